@@ -290,7 +290,8 @@ void CS488Window::launch (
 		int width,
 		int height,
 		const std::string& title,
-		float fps
+		float fps,
+		bool visible
 ) {
 	char * slash = strrchr( argv[0], '/' );
 	if( slash == nullptr ) {
@@ -301,7 +302,7 @@ void CS488Window::launch (
 
 	if( m_instance == nullptr ) {
         m_instance = shared_ptr<CS488Window>(window);
-		m_instance->run( width, height, title, fps );
+		m_instance->run( width, height, title, fps, visible );
 	}
 }
 
@@ -320,7 +321,8 @@ void CS488Window::run (
 		int width,
 		int height,
 		const string &windowTitle,
-		float desiredFramesPerSecond
+		float desiredFramesPerSecond,
+		bool visible
 ) {
 	m_windowTitle = windowTitle;
     m_windowWidth = width;
@@ -336,7 +338,7 @@ void CS488Window::run (
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
     glfwWindowHint(GLFW_SAMPLES, 0);
     glfwWindowHint(GLFW_RED_BITS, 8);
     glfwWindowHint(GLFW_GREEN_BITS, 8);
@@ -22,7 +22,8 @@ public:
 			int width,
 			int height,
 			const std::string& title,
-			float fps = 60.0f
+			float fps = 60.0f,
+			bool visible = true
 	);
 
 protected:
@@ -69,7 +70,8 @@ private:
 			int width,
 			int height,
 			const std::string & windowTitle,
-			float desiredFramesPerSecond = 60.0f
+			float desiredFramesPerSecond = 60.0f,
+			bool visible = true
 	);
 
 	//-- Callback functions to be registered with GLFW:
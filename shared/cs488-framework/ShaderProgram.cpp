@@ -5,16 +5,33 @@
 #include <glm/gtc/type_ptr.hpp>
 using glm::value_ptr;
 
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 using namespace std;
 
+//------------------------------------------------------------------------------------
+string ShaderProgram::binaryCacheDirectory;
+int ShaderProgram::linkedPrograms = 0;
+int ShaderProgram::cachedPrograms = 0;
+
+// From GL_KHR_parallel_shader_compile, which the GL headers predate.
+typedef void (*MaxShaderCompilerThreadsProc)(GLuint count);
+
 //------------------------------------------------------------------------------------
 ShaderProgram::Shader::Shader()
     : shaderObject(0),
-      filePath()
+      shaderType(0),
+      filePath(),
+      sourceCode()
 {
 
 }
@@ -23,7 +40,8 @@ ShaderProgram::Shader::Shader()
 ShaderProgram::ShaderProgram()
         : programObject(0),
           prevProgramObject(0),
-          activeProgram(0)
+          activeProgram(0),
+          linkPending(false)
 {
 
 }
@@ -38,69 +56,133 @@ void ShaderProgram::generateProgramObject() {
 void ShaderProgram::attachVertexShader (
 		const char * filePath
 ) {
-    vertexShader.shaderObject = createShader(GL_VERTEX_SHADER);
-    vertexShader.filePath = filePath;
-
-    extractSourceCodeAndCompile(vertexShader);
+    attachShader(vertexShader, GL_VERTEX_SHADER, filePath);
 }
 
 //------------------------------------------------------------------------------------
 void ShaderProgram::attachFragmentShader (
 		const char * filePath
 ) {
-    fragmentShader.shaderObject = createShader(GL_FRAGMENT_SHADER);
-    fragmentShader.filePath = filePath;
-
-    extractSourceCodeAndCompile(fragmentShader);
+    attachShader(fragmentShader, GL_FRAGMENT_SHADER, filePath);
 }
 
 //------------------------------------------------------------------------------------
 void ShaderProgram::attachGeometryShader (
 		const char * filePath
 ) {
-    geometryShader.shaderObject = createShader(GL_GEOMETRY_SHADER);
-    geometryShader.filePath = filePath;
-
-    extractSourceCodeAndCompile(geometryShader);
+    attachShader(geometryShader, GL_GEOMETRY_SHADER, filePath);
 }
 
 //------------------------------------------------------------------------------------
 void ShaderProgram::attachComputeShader (
 		const char * filePath
 ) {
-    computeShader.shaderObject = createShader(GL_COMPUTE_SHADER);
-    computeShader.filePath = filePath;
+    attachShader(computeShader, GL_COMPUTE_SHADER, filePath);
+}
+
+//------------------------------------------------------------------------------------
+/*
+ * Reads the shader source. Compilation is left to link(), which can skip it
+ * when the program is in the binary cache.
+ */
+void ShaderProgram::attachShader (
+		Shader & shader,
+		GLenum shaderType,
+		const char * filePath
+) {
+    shader.shaderType = shaderType;
+    shader.filePath = filePath;
 
-    extractSourceCodeAndCompile(computeShader);
+    extractSourceCode(shader.sourceCode, shader.filePath);
 }
 
 //------------------------------------------------------------------------------------
-void ShaderProgram::extractSourceCodeAndCompile (
-		const Shader & shader
+void ShaderProgram::setDefines (
+		const string & defines
 ) {
-    string shaderSourceCode;
-    extractSourceCode(shaderSourceCode, shader.filePath);
+    this->defines = defines;
+}
 
-    compileShader(shader.shaderObject, shaderSourceCode, shader.filePath);
+//------------------------------------------------------------------------------------
+/*
+ * Returns the source with the defines inserted right after #version, which has
+ * to come first.
+ */
+static string insertDefines (
+		const string & source,
+		const string & defines
+) {
+    if (defines.empty()) {
+        return source;
+    }
+
+    size_t version = source.find("#version");
+    size_t lineEnd = (version == string::npos) ? string::npos : source.find('\n', version);
+    if (lineEnd == string::npos) {
+        return defines + source;
+    }
+    return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+}
+
+//------------------------------------------------------------------------------------
+void ShaderProgram::compileShaders() {
+    Shader * shaders[] = { &vertexShader, &fragmentShader, &geometryShader, &computeShader };
+    for (Shader * shader : shaders) {
+        if (shader->filePath.empty()) {
+            continue;
+        }
+        if (shader->shaderObject == 0) {
+            shader->shaderObject = createShader(shader->shaderType);
+        }
+        compileShader(shader->shaderObject, insertDefines(shader->sourceCode, defines));
+    }
 }
 
 //------------------------------------------------------------------------------------
 void ShaderProgram::recompileShaders() {
-    extractSourceCodeAndCompile(vertexShader);
-    extractSourceCodeAndCompile(fragmentShader);
-    extractSourceCodeAndCompile(geometryShader);
-    extractSourceCodeAndCompile(computeShader);
+    Shader * shaders[] = { &vertexShader, &fragmentShader, &geometryShader, &computeShader };
+    for (Shader * shader : shaders) {
+        if (!shader->filePath.empty()) {
+            extractSourceCode(shader->sourceCode, shader->filePath);
+        }
+    }
+
+    compileShaders();
 }
 
 //------------------------------------------------------------------------------------
 /*
 * Extracts source code from file located at 'filePath' and places contents into
-* 'shaderSource'.
+* 'shaderSource', with every #include "file" line replaced by the contents of
+* that file.
 */
 void ShaderProgram::extractSourceCode (
 		string & shaderSource,
 		const string & filePath
 ) {
+    set<string> includeStack;
+
+    shaderSource.clear();
+    expandIncludes(shaderSource, filePath, includeStack);
+}
+
+//------------------------------------------------------------------------------------
+/*
+* Appends the contents of the file located at 'filePath' to 'shaderSource'.
+* Included files are looked up relative to the file that includes them, and may
+* include other files in turn.
+*/
+void ShaderProgram::expandIncludes (
+		string & shaderSource,
+		const string & filePath,
+		set<string> & includeStack
+) {
+    if (includeStack.count(filePath) > 0) {
+        stringstream strStream;
+        strStream << "Error -- Recursive include of file: " << filePath << endl;
+        throw ShaderException(strStream.str());
+    }
+
     ifstream file;
 
     file.open(filePath.c_str());
@@ -110,22 +192,51 @@ void ShaderProgram::extractSourceCode (
         throw ShaderException(strStream.str());
     }
 
-    stringstream strBuffer;
-    string str;
+    includeStack.insert(filePath);
 
-    while(file.good()) {
-        getline(file, str, '\r');
-        strBuffer << str;
+    string directory;
+    size_t slash = filePath.find_last_of('/');
+    if (slash != string::npos) {
+        directory = filePath.substr(0, slash + 1);
     }
-    file.close();
 
-    strBuffer << '\0';  // Append null terminator.
+    const string directive = "#include \"";
+    string line;
+
+    while(getline(file, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+
+        if (line.compare(0, directive.size(), directive) == 0) {
+            size_t end = line.find('"', directive.size());
+            if (end == string::npos) {
+                stringstream strStream;
+                strStream << "Error -- Malformed #include in file: " << filePath << endl;
+                throw ShaderException(strStream.str());
+            }
+
+            string includeName = line.substr(directive.size(), end - directive.size());
+            expandIncludes(shaderSource, directory + includeName, includeStack);
+        } else {
+            shaderSource += line;
+            shaderSource += '\n';
+        }
+    }
+    file.close();
 
-    shaderSource = strBuffer.str();
+    includeStack.erase(filePath);
 }
 
 //------------------------------------------------------------------------------------
 void ShaderProgram::attachShaders() {
+    // When relinking, the shaders are still attached and were just recompiled.
+    GLint attachedCount = 0;
+    glGetProgramiv(programObject, GL_ATTACHED_SHADERS, &attachedCount);
+    if (attachedCount > 0) {
+        return;
+    }
+
     if(vertexShader.shaderObject != 0) {
         glAttachShader(programObject, vertexShader.shaderObject);
     }
@@ -149,12 +260,238 @@ void ShaderProgram::attachShaders() {
 * Note: This method must be called once before calling ShaderProgram::enable().
 */
 void ShaderProgram::link() {
+    linkedPrograms++;
+    linkPending = false;
+
+    string cachePath = binaryCachePath();
+    if (!cachePath.empty() && loadProgramBinary(cachePath)) {
+        cachedPrograms++;
+        CHECK_GL_ERRORS;
+        return;
+    }
+
+    compileShaders();
     attachShaders();
+    prepareLink();
+
+    if (!cachePath.empty()) {
+        glProgramParameteri(programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
 
     glLinkProgram(programObject);
+    linkPending = true;
+    pendingCachePath = cachePath;
+
+    CHECK_GL_ERRORS;
+}
+
+//------------------------------------------------------------------------------------
+/*
+ * Checks the shaders and the program submitted by link(), waiting for the driver
+ * if it is still compiling them, and saves the program to the binary cache.
+ */
+void ShaderProgram::finishLink() const {
+    if (!linkPending) {
+        return;
+    }
+    linkPending = false;
+
+    const Shader * shaders[] = { &vertexShader, &fragmentShader, &geometryShader, &computeShader };
+    for (const Shader * shader : shaders) {
+        if (shader->shaderObject != 0) {
+            checkCompilationStatus(shader->shaderObject, shader->filePath);
+        }
+    }
     checkLinkStatus();
 
+    if (!pendingCachePath.empty()) {
+        saveProgramBinary(pendingCachePath);
+    }
+
+    CHECK_GL_ERRORS;
+}
+
+//------------------------------------------------------------------------------------
+void ShaderProgram::prepareLink() {
+
+}
+
+//------------------------------------------------------------------------------------
+void ShaderProgram::setBinaryCacheDirectory (
+		const string & directory
+) {
+    binaryCacheDirectory = directory;
+    if (!binaryCacheDirectory.empty() &&
+        binaryCacheDirectory[binaryCacheDirectory.size() - 1] != '/') {
+        binaryCacheDirectory += '/';
+    }
+}
+
+//------------------------------------------------------------------------------------
+bool ShaderProgram::enableParallelCompile() {
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+
+    const char * procName = NULL;
+    for (GLint i = 0; i < extensionCount; i++) {
+        string extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (extension == "GL_KHR_parallel_shader_compile") {
+            procName = "glMaxShaderCompilerThreadsKHR";
+            break;
+        } else if (extension == "GL_ARB_parallel_shader_compile") {
+            procName = "glMaxShaderCompilerThreadsARB";
+        }
+    }
+
+    MaxShaderCompilerThreadsProc maxShaderCompilerThreads = procName ?
+        (MaxShaderCompilerThreadsProc)gl3wGetProcAddress(procName) : NULL;
+    if (!maxShaderCompilerThreads) {
+        return false;
+    }
+
+    // As many threads as the driver wants.
+    maxShaderCompilerThreads(0xFFFFFFFF);
+
     CHECK_GL_ERRORS;
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+int ShaderProgram::linkedProgramCount() {
+    return linkedPrograms;
+}
+
+//------------------------------------------------------------------------------------
+int ShaderProgram::cachedProgramCount() {
+    return cachedPrograms;
+}
+
+//------------------------------------------------------------------------------------
+// 64-bit FNV-1a, with the length mixed in so that consecutive strings can't
+// run into each other.
+static void hashString (
+		uint64_t & hash,
+		const string & str
+) {
+    for (unsigned char c : str) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= str.size();
+    hash *= 1099511628211ULL;
+}
+
+//------------------------------------------------------------------------------------
+static string glString (
+		GLenum name
+) {
+    const GLubyte * str = glGetString(name);
+    return str ? string((const char *)str) : string();
+}
+
+//------------------------------------------------------------------------------------
+/*
+ * Returns the file the linked program is cached in, or an empty string when the
+ * cache is disabled or the driver can't save program binaries.
+ */
+string ShaderProgram::binaryCachePath() {
+    if (binaryCacheDirectory.empty() || !glProgramBinary || !glGetProgramBinary) {
+        return string();
+    }
+
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    if (formatCount == 0) {
+        return string();
+    }
+
+    // A binary is only valid for the driver that produced it.
+    uint64_t hash = 14695981039346656037ULL;
+    hashString(hash, glString(GL_VENDOR));
+    hashString(hash, glString(GL_RENDERER));
+    hashString(hash, glString(GL_VERSION));
+    hashString(hash, glString(GL_SHADING_LANGUAGE_VERSION));
+
+    const Shader * shaders[] = { &vertexShader, &fragmentShader, &geometryShader, &computeShader };
+    for (const Shader * shader : shaders) {
+        hashString(hash, shader->sourceCode);
+    }
+    hashString(hash, linkOptions);
+    hashString(hash, defines);
+
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "%016llx.bin", (unsigned long long)hash);
+
+    return binaryCacheDirectory + fileName;
+}
+
+//------------------------------------------------------------------------------------
+/*
+ * Restores the linked program from the cache. Returns false if the program
+ * still needs to be compiled.
+ */
+bool ShaderProgram::loadProgramBinary (
+		const string & cachePath
+) {
+    ifstream file(cachePath.c_str(), ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    GLenum format;
+    file.read((char *)&format, sizeof(format));
+    vector<char> binary((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (binary.empty()) {
+        return false;
+    }
+
+    glProgramBinary(programObject, format, binary.data(), (GLsizei)binary.size());
+
+    // The driver may reject the binary, e.g. if it was updated without changing
+    // its version string. Just compile the program then.
+    GLint linkSuccess;
+    glGetProgramiv(programObject, GL_LINK_STATUS, &linkSuccess);
+    if (linkSuccess == GL_FALSE) {
+        while (glGetError() != GL_NO_ERROR) { }
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+/*
+ * Saves the linked program to the cache. Failing to do so isn't an error, the
+ * program will be compiled again on the next start.
+ */
+void ShaderProgram::saveProgramBinary (
+		const string & cachePath
+) const {
+    GLint length = 0;
+    glGetProgramiv(programObject, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(programObject, length, NULL, &format, binary.data());
+
+    mkdir(binaryCacheDirectory.c_str(), 0755);
+
+    // Write to a temporary file first so that an interrupted write never
+    // leaves a truncated binary behind.
+    string tempPath = cachePath + ".tmp";
+    ofstream file(tempPath.c_str(), ios::binary);
+    file.write((const char *)&format, sizeof(format));
+    file.write(binary.data(), binary.size());
+    file.close();
+
+    if (file.good()) {
+        rename(tempPath.c_str(), cachePath.c_str());
+    } else {
+        remove(tempPath.c_str());
+    }
 }
 
 //------------------------------------------------------------------------------------
@@ -166,6 +503,8 @@ ShaderProgram::~ShaderProgram() {
 void ShaderProgram::deleteShaders() {
     glDeleteShader(vertexShader.shaderObject);
     glDeleteShader(fragmentShader.shaderObject);
+    glDeleteShader(geometryShader.shaderObject);
+    glDeleteShader(computeShader.shaderObject);
     glDeleteProgram(programObject);
 }
 
@@ -182,14 +521,13 @@ GLuint ShaderProgram::createShader (
 //------------------------------------------------------------------------------------
 void ShaderProgram::compileShader (
 		GLuint shaderObject,
-		const string & shaderSourceCode,
-        const string & filePath
+		const string & shaderSourceCode
 ) {
     const char * sourceCodeStr = shaderSourceCode.c_str();
     glShaderSource(shaderObject, 1, (const GLchar **)&sourceCodeStr, NULL);
 
+    // The status is checked in finishLink, not to wait for the driver here.
     glCompileShader(shaderObject);
-    checkCompilationStatus(shaderObject, filePath);
 
     CHECK_GL_ERRORS;
 }
@@ -198,7 +536,7 @@ void ShaderProgram::compileShader (
 void ShaderProgram::checkCompilationStatus (
 		GLuint shaderObject,
         const string & filePath
-) {
+) const {
     GLint compileSuccess;
 
     glGetShaderiv(shaderObject, GL_COMPILE_STATUS, &compileSuccess);
@@ -222,6 +560,7 @@ void ShaderProgram::checkCompilationStatus (
 
 //------------------------------------------------------------------------------------
 void ShaderProgram::enable() const {
+    finishLink();
     glUseProgram(programObject);
     CHECK_GL_ERRORS;
 }
@@ -233,7 +572,7 @@ void ShaderProgram::disable() const {
 }
 
 //------------------------------------------------------------------------------------
-void ShaderProgram::checkLinkStatus() {
+void ShaderProgram::checkLinkStatus() const {
     GLint linkSuccess;
 
     glGetProgramiv(programObject, GL_LINK_STATUS, &linkSuccess);
@@ -258,6 +597,7 @@ void ShaderProgram::checkLinkStatus() {
  * Returns the GL shader program object name.
  */
 GLuint ShaderProgram::getProgramObject() const {
+    finishLink();
     return programObject;
 }
 
@@ -268,6 +608,7 @@ GLuint ShaderProgram::getProgramObject() const {
 GLint ShaderProgram::getUniformLocation (
 		const char * uniformName
 ) const {
+    finishLink();
     GLint result = glGetUniformLocation(programObject, (const GLchar *)uniformName);
 
     if (result == -1) {
@@ -286,6 +627,7 @@ GLint ShaderProgram::getUniformLocation (
 GLint ShaderProgram::getAttribLocation (
 		const char * attributeName
 ) const {
+    finishLink();
     GLint result = glGetAttribLocation(programObject, (const GLchar *)attributeName);
 
     if (result == -1) {
@@ -6,6 +6,7 @@
 
 #include "OpenGLImport.hpp"
 
+#include <set>
 #include <string>
 
 
@@ -25,25 +26,55 @@ public:
 
     void attachComputeShader(const char * filePath);
 
+    // Submits the program to the driver without waiting for it to compile,
+    // which it can do in the background with GL_KHR_parallel_shader_compile.
+    // Compile and link errors are thrown, and the binary cache written, by
+    // finishLink, at the latest on the first use of the program (enable or
+    // any of the getters below).
     virtual void link();
 
+    // Waits for the program submitted by link() to be ready.
+    void finishLink() const;
+
     void enable() const;
 
     void disable() const;
 
     void recompileShaders();
 
+    // Lines inserted after the #version line of every shader, e.g.
+    // "#define OCTAVES 8\n". Used by the next link(), which may be called
+    // again to relink the program with other defines.
+    void setDefines(const std::string & defines);
+
     GLuint getProgramObject() const;
 
     GLint getUniformLocation(const char * uniformName) const;
 
     GLint getAttribLocation(const char * attributeName) const;
 
+    // Linked programs are saved to and restored from this directory with
+    // glProgramBinary, keyed by a hash of the preprocessed sources and of the
+    // driver strings. Caching is off while the directory is empty.
+    static void setBinaryCacheDirectory(const std::string & directory);
+
+    // Number of programs linked so far, and how many of them were loaded
+    // from the binary cache without compiling.
+    static int linkedProgramCount();
+    static int cachedProgramCount();
+
+    // Lets the driver compile programs on its own threads, if it supports
+    // GL_KHR_parallel_shader_compile (or the ARB version). Returns whether it
+    // does. Call once the context is current, before linking anything.
+    static bool enableParallelCompile();
+
 
 protected:
     struct Shader {
         GLuint shaderObject;
+        GLenum shaderType;
         std::string filePath;
+        std::string sourceCode;
 
         Shader();
     };
@@ -57,20 +88,48 @@ protected:
     GLuint prevProgramObject;
     GLuint activeProgram;
 
+    // Anything other than the shader sources that changes the linked program
+    // (e.g. transform feedback varyings), so that it is part of the cache key.
+    std::string linkOptions;
+
+    std::string defines;
+
+    // Set by link() until finishLink, with where to save the binary.
+    mutable bool linkPending;
+    mutable std::string pendingCachePath;
+
+    // Called after the shaders are attached, right before glLinkProgram.
+    virtual void prepareLink();
+
+    void attachShader(Shader & shader, GLenum shaderType, const char * filePath);
+
     void extractSourceCode(std::string & shaderSource, const std::string & filePath);
 
-    void extractSourceCodeAndCompile(const Shader &shader);
+    void expandIncludes(std::string & shaderSource, const std::string & filePath,
+                        std::set<std::string> & includeStack);
+
+    void compileShaders();
 
     GLuint createShader(GLenum shaderType);
 
-    void compileShader(GLuint shaderObject, const std::string & shader, const std::string & filePath);
+    void compileShader(GLuint shaderObject, const std::string & shader);
 
-    void checkCompilationStatus(GLuint shaderObject, const std::string & filePath);
+    void checkCompilationStatus(GLuint shaderObject, const std::string & filePath) const;
 
     void attachShaders();
 
-    void checkLinkStatus();
+    void checkLinkStatus() const;
 
     void deleteShaders();
+
+    std::string binaryCachePath();
+
+    bool loadProgramBinary(const std::string & cachePath);
+
+    void saveProgramBinary(const std::string & cachePath) const;
+
+    static std::string binaryCacheDirectory;
+    static int linkedPrograms;
+    static int cachedPrograms;
 };
 
@@ -10,12 +10,13 @@ in vertexData
 out vec4 fragColor;
 
 layout(binding = 0) uniform sampler3D density_map;
-layout(binding = 1) uniform sampler2D x_texture;
-layout(binding = 2) uniform sampler2D y_texture;
-layout(binding = 3) uniform sampler2D z_texture;
-layout(binding = 4) uniform sampler2D x_normal_map;
-layout(binding = 5) uniform sampler2D y_normal_map;
-layout(binding = 6) uniform sampler2D z_normal_map;
+layout(binding = 1) uniform sampler2DArray diffuse_textures;
+layout(binding = 2) uniform sampler2DArray normal_maps;
+
+// Layers of the textures for the x, y and z directions, -1 while the layer is
+// still loading.
+uniform ivec3 diffuse_layers;
+uniform ivec3 normal_layers;
 
 uniform bool triplanar_colors;
 uniform bool show_ambient_occlusion;
@@ -78,10 +79,23 @@ vec3 calculateLight(vec3 normal)
     return ambient + diffuse + specular;
 }
 
-vec3 normalMapValue(sampler2D map, vec2 pos)
+vec3 diffuseColor(vec2 uv, int layer)
+{
+    if (layer < 0) {
+        return vec3(0.5);
+    }
+    return texture(diffuse_textures, vec3(uv, layer)).rgb;
+}
+
+vec3 normalMapValue(vec2 uv, int layer)
 {
-    vec3 input = texture(map, pos).rgb;
-    return normalize(input - vec3(0.5));
+    if (layer < 0) {
+        return vec3(0.0, 0.0, 1.0);
+    }
+    // Compressed normal maps (BC5) only store x and y, so z is always
+    // reconstructed.
+    vec2 xy = texture(normal_maps, vec3(uv, layer)).rg * 2.0 - 1.0;
+    return normalize(vec3(xy, sqrt(max(0.0, 1.0 - dot(xy, xy)))));
 }
 
 void main() {
@@ -119,7 +133,7 @@ void main() {
                 tangent = normalize(cross(bitangent, normal));
                 mat3 TBN = mat3(tangent, bitangent, normal);
 
-                light1 = calculateLight(TBN * normalMapValue(x_normal_map, x_uv).xyz);
+                light1 = calculateLight(TBN * normalMapValue(x_uv, normal_layers.x).xyz);
             }
             {
                 vec3 tangent = vec3(1.0, 0.0, 0.0);
@@ -127,7 +141,7 @@ void main() {
                 tangent = normalize(cross(normal, bitangent));
                 mat3 TBN = mat3(tangent, bitangent, normal);
 
-                light2 = calculateLight(TBN * normalMapValue(y_normal_map, y_uv).xyz);
+                light2 = calculateLight(TBN * normalMapValue(y_uv, normal_layers.y).xyz);
             }
             {
                 vec3 tangent = vec3(1.0, 0.0, 0.0);
@@ -135,7 +149,7 @@ void main() {
                 tangent = normalize(cross(bitangent, normal));
                 mat3 TBN = mat3(tangent, bitangent, normal);
 
-                light3 = calculateLight(TBN * normalMapValue(z_normal_map, z_uv).xyz);
+                light3 = calculateLight(TBN * normalMapValue(z_uv, normal_layers.z).xyz);
             }
         } else {
             mat3 transform = mat3(1.0);
@@ -147,9 +161,9 @@ void main() {
         float vertex_distance = length(eye_position - vertex_in.position);
         float fog_falloff = clamp(fog_params.x * vertex_distance / fog_params.y - fog_params.z, 0.0, 1.0);
 
-        vec3 color_x = texture(x_texture, x_uv).xyz * light1;
-        vec3 color_y = texture(y_texture, y_uv).xyz * light2;
-        vec3 color_z = texture(z_texture, z_uv).xyz * light3;
+        vec3 color_x = diffuseColor(x_uv, diffuse_layers.x) * light1;
+        vec3 color_y = diffuseColor(y_uv, diffuse_layers.y) * light2;
+        vec3 color_z = diffuseColor(z_uv, diffuse_layers.z) * light3;
         vec3 base_color = (color_x * blend_weights.x +
                            color_y * blend_weights.y +
                            color_z * blend_weights.z);
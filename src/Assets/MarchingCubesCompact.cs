@@ -0,0 +1,112 @@
+#version 430
+
+// First pass of TerrainGeneratorCompute, one invocation per voxel and one row
+// of work groups per block of the batch. Finds the triangles of each voxel
+// and writes them, packed the same way as VoxelEdgesShader.gs, next to each
+// other with no gap for empty voxels.
+//
+// NOTE: if you update this, update it on the CPU side too
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) writeonly buffer Triangles {
+    uint z6_y6_x6_edge1_edge2_edge3[];
+};
+
+// Room for the triangles of every voxel of the block, per block.
+uniform uint max_triangles;
+
+struct DrawArraysIndirectCommand {
+    uint vertex_count;
+    uint instance_count;
+    uint first_vertex;
+    uint base_instance;
+};
+
+// Per block, counts start at 0.
+layout(std430, binding = 1) buffer DrawCommands {
+    DrawArraysIndirectCommand draw_commands[];
+};
+
+// The work groups of the second pass, num_groups_x starts at 0 and
+// num_groups_y is the number of blocks.
+layout(std430, binding = 2) buffer DispatchCommand {
+    uint num_groups_x;
+    uint num_groups_y;
+    uint num_groups_z;
+};
+
+#include "marching_cubes_common.h"
+
+#define GROUP_SIZE 64
+#define UNPACK_GROUP_SIZE 64
+
+shared uint triangle_sums[GROUP_SIZE];
+shared uint group_first;
+
+void main() {
+    uint local_index = gl_LocalInvocationIndex;
+    uint voxel = gl_GlobalInvocationID.x;
+    batch_slot = int(gl_WorkGroupID.y);
+
+    // Same order as the grid points of the Medium generator, x first.
+    ivec3 icoords = ivec3(voxel % block_size,
+                          (voxel / block_size) % block_size,
+                          voxel / (block_size * block_size));
+    vec3 coords = vec3(icoords);
+
+    int case_index = 0;
+    uint numpolys = 0;
+    if (voxel < block_size * block_size * block_size) {
+        vec2 offset = vec2(0, 1);
+
+        vec4 density0123;
+        vec4 density4567;
+
+        density0123.x = density(coords + offset.xxx);
+        density0123.y = density(coords + offset.xyx);
+        density0123.z = density(coords + offset.yyx);
+        density0123.w = density(coords + offset.yxx);
+        density4567.x = density(coords + offset.xxy);
+        density4567.y = density(coords + offset.xyy);
+        density4567.z = density(coords + offset.yyy);
+        density4567.w = density(coords + offset.yxy);
+
+        vec4 divider = vec4(0, 0, 0, 0);
+        ivec4 ground0123 = ivec4(lessThan(divider, density0123));
+        ivec4 ground4567 = ivec4(lessThan(divider, density4567));
+
+        case_index = (ground0123.x << 0) | (ground0123.y << 1) | (ground0123.z << 2) | (ground0123.w << 3) |
+                     (ground4567.x << 4) | (ground4567.y << 5) | (ground4567.z << 6) | (ground4567.w << 7);
+        numpolys = case_to_numpolys[case_index];
+    }
+
+    // Inclusive prefix sum of the triangle counts across the work group.
+    triangle_sums[local_index] = numpolys;
+    barrier();
+    for (uint offset = 1; offset < GROUP_SIZE; offset <<= 1) {
+        uint previous = local_index >= offset ? triangle_sums[local_index - offset] : 0;
+        barrier();
+        triangle_sums[local_index] += previous;
+        barrier();
+    }
+
+    // The last invocation holds the total, it reserves room for the whole
+    // work group and grows the second pass to cover it.
+    if (local_index == GROUP_SIZE - 1) {
+        uint total = triangle_sums[local_index];
+        group_first = atomicAdd(draw_commands[batch_slot].vertex_count, total * 3) / 3;
+        atomicMax(num_groups_x, (group_first + total + UNPACK_GROUP_SIZE - 1) / UNPACK_GROUP_SIZE);
+    }
+    barrier();
+
+    uint first = batch_slot * max_triangles + group_first + triangle_sums[local_index] - numpolys;
+    for (int i = 0; i < numpolys; i++) {
+        ivec3 edge_index = edge_connect_list[case_index][i];
+
+        // [6 bits: z] [6 bits: y] [6 bits: x]
+        // [4 bits: edge1] [4 bits: edge2] [4 bits: edge3]
+        z6_y6_x6_edge1_edge2_edge3[first + i] =
+                (edge_index.x << 0) | (edge_index.y << 4) | (edge_index.z << 8)
+              | (icoords.x << 12)   | (icoords.y << 18)   | (icoords.z << 24);
+    }
+}
@@ -0,0 +1,121 @@
+#version 430
+
+// Second pass of TerrainGeneratorCompute, one invocation per triangle found
+// by MarchingCubesCompact.cs and one row of work groups per block of the
+// batch. Same as TriangleUnpackShader.gs but writes the vertices straight
+// into the vertex buffer of the block.
+//
+// NOTE: if you update this, update it on the CPU side too
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer Triangles {
+    uint z6_y6_x6_edge1_edge2_edge3[];
+};
+
+uniform uint max_triangles;
+
+struct DrawArraysIndirectCommand {
+    uint vertex_count;
+    uint instance_count;
+    uint first_vertex;
+    uint base_instance;
+};
+
+layout(std430, binding = 1) readonly buffer DrawCommands {
+    DrawArraysIndirectCommand draw_commands[];
+};
+
+// first 3 components are the world coordinate
+// 4th is the texture coordinate, should be 1, 2 or 4
+layout(std430, binding = 3) readonly buffer BatchBlocks {
+    ivec4 batch_blocks[];
+};
+
+// The vertex buffers of the blocks, either 3 uints (packVertex) or 7 floats
+// (position, normal, ambient occlusion) per vertex, see Block::init. Plain
+// arrays since a vec3 or uvec3 array would be padded to 16 bytes per element.
+#ifdef PACKED_VERTICES
+layout(std430, binding = 4) writeonly buffer Vertices {
+    uint vertices[];
+} block_vertices[BATCH_SIZE];
+#else
+layout(std430, binding = 4) writeonly buffer Vertices {
+    float vertices[];
+} block_vertices[BATCH_SIZE];
+#endif
+
+ivec4 block_index;
+
+uniform bool short_range_ambient;
+uniform bool long_range_ambient;
+uniform float period;
+uniform vec2 warp_params;
+
+#include "noise.h"
+#include "marching_cubes_common.h"
+#include "terrain_vertex_common.h"
+
+void createVertex(uint index, vec3 vertex)
+{
+    float ambient_occlusion = ambientOcclusion(
+        vertex,
+        vertex * block_index.w + block_index.xyz * block_size,
+        block_index.w,
+        short_range_ambient, long_range_ambient);
+
+    // Map vertices to range [0, 1]
+    vec3 position = vertex / block_size;
+    vec3 normal = normalAtVertex(vertex);
+
+#ifdef PACKED_VERTICES
+    uvec3 packed_vertex = packVertex(position, normal, ambient_occlusion);
+    block_vertices[batch_slot].vertices[index * 3 + 0] = packed_vertex.x;
+    block_vertices[batch_slot].vertices[index * 3 + 1] = packed_vertex.y;
+    block_vertices[batch_slot].vertices[index * 3 + 2] = packed_vertex.z;
+#else
+    block_vertices[batch_slot].vertices[index * 7 + 0] = position.x;
+    block_vertices[batch_slot].vertices[index * 7 + 1] = position.y;
+    block_vertices[batch_slot].vertices[index * 7 + 2] = position.z;
+    block_vertices[batch_slot].vertices[index * 7 + 3] = normal.x;
+    block_vertices[batch_slot].vertices[index * 7 + 4] = normal.y;
+    block_vertices[batch_slot].vertices[index * 7 + 5] = normal.z;
+    block_vertices[batch_slot].vertices[index * 7 + 6] = ambient_occlusion;
+#endif
+}
+
+void main() {
+    uint triangle = gl_GlobalInvocationID.x;
+    batch_slot = int(gl_WorkGroupID.y);
+    block_index = batch_blocks[batch_slot];
+
+    // The work groups cover the block with the most triangles.
+    if (triangle >= draw_commands[batch_slot].vertex_count / 3) {
+        return;
+    }
+
+    uint packed_triangle = z6_y6_x6_edge1_edge2_edge3[batch_slot * max_triangles + triangle];
+    ivec3 edge_index = ivec3((packed_triangle >> 0) & 0xF,
+                             (packed_triangle >> 4) & 0xF,
+                             (packed_triangle >> 8) & 0xF);
+    ivec3 coords = ivec3((packed_triangle >> 12) & 0x3F,
+                         (packed_triangle >> 18) & 0x3F,
+                         (packed_triangle >> 24) & 0x3F);
+
+    // See TriangleUnpackShader.gs, the vertex is where the density is
+    // interpolated to zero along each edge.
+    vec3 d1 = vec3(density(coords + edge_start[edge_index.x]),
+                   density(coords + edge_start[edge_index.y]),
+                   density(coords + edge_start[edge_index.z]));
+    vec3 d2 = vec3(density(coords + edge_end[edge_index.x]),
+                   density(coords + edge_end[edge_index.y]),
+                   density(coords + edge_end[edge_index.z]));
+    vec3 t = d1 / (d1 - d2);
+
+    vec3 v1 = edge_start[edge_index.x] + edge_dir[edge_index.x] * t.x;
+    vec3 v2 = edge_start[edge_index.y] + edge_dir[edge_index.y] * t.y;
+    vec3 v3 = edge_start[edge_index.z] + edge_dir[edge_index.z] * t.z;
+
+    createVertex(triangle * 3 + 0, v1 + coords);
+    createVertex(triangle * 3 + 1, v2 + coords);
+    createVertex(triangle * 3 + 2, v3 + coords);
+}
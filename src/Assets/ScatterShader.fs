@@ -0,0 +1,20 @@
+#version 430
+
+uniform vec3 color;
+uniform vec3 eye_position;
+uniform vec3 fog_params;
+
+in vec3 world_position;
+
+out vec4 fragColor;
+
+void main() {
+    // Flat shaded, the boxes have no normals.
+    vec3 normal = normalize(cross(dFdx(world_position), dFdy(world_position)));
+    vec3 light = normalize(vec3(0.3, 1.0, 0.2));
+    vec3 lit = color * (0.45 + 0.55 * abs(dot(normal, light)));
+
+    float vertex_distance = length(eye_position - world_position);
+    float fog_falloff = clamp(fog_params.x * vertex_distance / fog_params.y - fog_params.z, 0.0, 1.0);
+    fragColor = vec4(mix(lit, vec3(0.5, 0.5, 0.5), fog_falloff), 1.0);
+}
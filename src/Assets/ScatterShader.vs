@@ -0,0 +1,30 @@
+#version 430
+
+uniform mat4 P;
+uniform mat4 V;
+uniform mat4 M;
+
+// Size of the box of the species at scale 1, and how much of its height is in
+// the ground.
+uniform vec3 extent;
+uniform float sink;
+
+// The unit cube, corner at the origin.
+in vec3 position;
+// Where it stands in blocks, and its scale.
+in vec4 instance;
+
+out vec3 world_position;
+
+void main() {
+    // Rotated about y by an angle hashed from where it stands.
+    float angle = fract(sin(dot(instance.xz, vec2(12.9898, 78.233))) * 43758.5453) * 6.2831853;
+    float c = cos(angle);
+    float s = sin(angle);
+
+    vec3 local = (position - vec3(0.5, sink, 0.5)) * extent * instance.w;
+    local.xz = vec2(c * local.x - s * local.z, s * local.x + c * local.z);
+
+    world_position = vec3(M * vec4(instance.xyz + local, 1.0));
+    gl_Position = P * V * vec4(world_position, 1.0);
+}
@@ -0,0 +1,96 @@
+#version 430
+
+// Steps every agent of the swarm alone, as Boids::stepAlone does on the CPU:
+// away from the ground ahead of it and back home. The constants, OCTAVES
+// included, come from Boids::shaderDefines.
+//
+// Reads one pair of buffers and writes the other, see Swarm::updateOnGpu. They
+// are tightly packed vec3s, as the instance attributes read them.
+layout(std430, binding = 0) readonly buffer Positions {
+    float positions[];
+};
+layout(std430, binding = 1) readonly buffer Velocities {
+    float velocities[];
+};
+layout(std430, binding = 2) writeonly buffer NextPositions {
+    float next_positions[];
+};
+layout(std430, binding = 3) writeonly buffer NextVelocities {
+    float next_velocities[];
+};
+
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+uniform int agent_count;
+uniform float time_elapsed;
+uniform vec2 home;
+uniform float home_radius;
+
+uniform float period;
+uniform vec2 warp_params;
+
+#include "noise.h"
+
+// In the same coordinates as SurfaceQuery, point in blocks.
+float density(vec3 point)
+{
+    return terrainDensity(point * BLOCK_SIZE, BLOCK_SIZE + 1, period);
+}
+
+vec3 avoidGround(vec3 position, vec3 velocity)
+{
+    vec3 ahead = position + velocity * (AVOID_LOOKAHEAD / max(length(velocity), MIN_SPEED));
+    float here = density(ahead);
+    if (here < -AVOID_MARGIN) {
+        return vec3(0.0);
+    }
+
+    // Up the density is into the ground, the harder the deeper.
+    vec3 gradient = vec3(density(ahead + vec3(AVOID_GRADIENT_STEP, 0.0, 0.0)),
+                         density(ahead + vec3(0.0, AVOID_GRADIENT_STEP, 0.0)),
+                         density(ahead + vec3(0.0, 0.0, AVOID_GRADIENT_STEP))) - here;
+    vec3 away = length(gradient) > 0.0 ? -normalize(gradient) : vec3(0.0, 1.0, 0.0);
+    float depth = (here + AVOID_MARGIN) / AVOID_MARGIN;
+    return away * AVOID_WEIGHT * min(depth, 4.0);
+}
+
+vec3 homeSteering(vec3 position)
+{
+    vec3 steering = vec3(0.0);
+    vec2 from_home = position.xz - home;
+    if (length(from_home) > home_radius) {
+        vec2 back = -normalize(from_home);
+        steering += HOME_WEIGHT * vec3(back.x, 0.0, back.y);
+    }
+    if (position.y > CEILING) {
+        steering.y -= HOME_WEIGHT;
+    }
+    return steering;
+}
+
+void main()
+{
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= agent_count) {
+        return;
+    }
+
+    vec3 position = vec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+    vec3 velocity = vec3(velocities[3 * i], velocities[3 * i + 1], velocities[3 * i + 2]);
+
+    float dt = min(time_elapsed, MAX_TIME_STEP);
+    vec3 steering = avoidGround(position, velocity) + homeSteering(position);
+    velocity += steering * dt;
+    float speed = length(velocity);
+    if (speed > 0.0) {
+        velocity *= clamp(speed, MIN_SPEED, MAX_SPEED) / speed;
+    }
+    position += velocity * dt;
+
+    next_positions[3 * i] = position.x;
+    next_positions[3 * i + 1] = position.y;
+    next_positions[3 * i + 2] = position.z;
+    next_velocities[3 * i] = velocity.x;
+    next_velocities[3 * i + 1] = velocity.y;
+    next_velocities[3 * i + 2] = velocity.z;
+}
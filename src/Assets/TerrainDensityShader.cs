@@ -1,14 +1,20 @@
 #version 430
 
+#ifdef BATCH_SIZE
+// The blocks of a batch, stacked along z in the texture, see
+// TerrainGeneratorCompute.
+layout(std430, binding = 3) readonly buffer BatchBlocks {
+    ivec4 batch_blocks[];
+};
+#else
 // first 3 components are the world coordinate
 // 4th is the texture coordinate, should be 1, 2 or 4
 uniform ivec4 block_index;
+#endif
 
 // Extra space on both sides that will be sampled by ambient occlusion.
 uniform int block_padding;
 
-uniform int octaves;
-uniform float octaves_decay;
 uniform float period;
 uniform vec2 warp_params;
 
@@ -20,18 +26,44 @@ uniform vec2 warp_params;
 layout(local_size_x = 16, local_size_y = 16, local_size_z = 4) in;
 
 // One float per texture location.
+#ifdef BATCH_SIZE
+layout(r32f, binding = 3) uniform image3D density_map;
+#else
 layout(r32f, binding = 0) uniform image3D density_map;
+#endif
 
 #include "noise.h"
+#include "terrain_edits.h"
 
 void main() {
     ivec3 img_coords = ivec3(gl_GlobalInvocationID.xyz);
     ivec3 space_coords = img_coords - ivec3(block_padding);
-    ivec3 block_dimensions = ivec3(gl_NumWorkGroups * gl_WorkGroupSize) - 2 * block_padding;
+    int padded_dimension = int(gl_NumWorkGroups.x * gl_WorkGroupSize.x);
+    ivec3 block_dimensions = ivec3(padded_dimension - 2 * block_padding);
 
-    float density = terrainDensity(
-            vec3(space_coords * block_index.w) + block_index.xyz * (block_dimensions - 1),
-            block_dimensions.y, period, octaves, octaves_decay);
+#ifdef BATCH_SIZE
+    int slot = img_coords.z / padded_dimension;
+    ivec4 block_index = batch_blocks[slot];
+    space_coords.z -= slot * padded_dimension;
+#else
+    int slot = 0;
+#endif
+    vec3 coords = vec3(space_coords * block_index.w) + block_index.xyz * (block_dimensions - 1);
+
+#ifdef GRADIENT_CACHE
+    // Coordinates of the first and last invocations of the work group.
+    ivec3 group_low = ivec3(gl_WorkGroupID * gl_WorkGroupSize) - img_coords + space_coords;
+    ivec3 group_high = group_low + ivec3(gl_WorkGroupSize) - 1;
+    vec3 offset = block_index.xyz * (block_dimensions - 1);
+
+    float density = cachedTerrainDensity(
+            vec3(space_coords * block_index.w) + offset,
+            block_dimensions.y, period,
+            vec3(group_low * block_index.w) + offset, vec3(group_high * block_index.w) + offset);
+#else
+    float density = terrainDensity(coords, block_dimensions.y, period);
+#endif
+    density = applyEdits(slot, coords, block_dimensions.y, period, density);
 
     // Erosion, we want the lower-detail blocks the be slightly shaved off so that
     // we can render the higher-detail blocks with transparency on top of them with
@@ -10,13 +10,12 @@ uniform ivec4 block_index;
 uniform bool short_range_ambient;
 uniform bool long_range_ambient;
 uniform float period;
-uniform int octaves;
-uniform float octaves_decay;
 uniform vec2 warp_params;
 
 out vec3 position;
 out vec3 normal;
 out float ambient_occlusion;
+out uvec3 packed_vertex;
 
 #include "noise.h"
 #include "marching_cubes_common.h"
@@ -34,6 +33,7 @@ void createVertex(vec3 vertex)
     position = vertex / block_size;
 
     normal = normalAtVertex(vertex);
+    packed_vertex = packVertex(position, normal, ambient_occlusion);
     EmitVertex();
 }
 
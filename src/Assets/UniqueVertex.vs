@@ -7,13 +7,12 @@ uniform ivec4 block_index;
 uniform bool short_range_ambient;
 uniform bool long_range_ambient;
 uniform float period;
-uniform int octaves;
-uniform float octaves_decay;
 uniform vec2 warp_params;
 
 out vec3 position;
 out vec3 normal;
 out float ambient_occlusion;
+out uvec3 packed_vertex;
 
 out vertexData
 {
@@ -55,4 +54,5 @@ void main() {
     position = vertex_position / block_size;
 
     normal = normalAtVertex(vertex_position);
+    packed_vertex = packVertex(position, normal, ambient_occlusion);
 }
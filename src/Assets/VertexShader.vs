@@ -9,6 +9,11 @@ uniform bool water_clip;
 uniform bool water_reflection_clip;
 uniform float clip_height;
 
+// Set when the block vertices were written with packVertex. The attribute
+// pointers already unpack the position and ambient occlusion, but normal
+// then holds the octahedral encoding in its xy components.
+uniform bool packed_vertices;
+
 in vec3 position;
 in vec3 normal;
 in float ambient_occlusion;
@@ -20,6 +25,17 @@ out vertexData
     float ambient_occlusion;
 } vertex_out;
 
+// Inverse of octahedralEncode in terrain_vertex_common.h
+vec3 octahedralDecode(vec2 encoded)
+{
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
+
 void main() {
     vec4 world_position = M * vec4(position, 1.0);
     vertex_out.position = vec3(world_position);
@@ -33,7 +49,11 @@ void main() {
 
     // Don't normalize yet, we need to do it after fragment shader
     // interpolation anyway.
-    vertex_out.normal = NormalMatrix * normal;
+    if (packed_vertices) {
+        vertex_out.normal = NormalMatrix * octahedralDecode(normal.xy);
+    } else {
+        vertex_out.normal = NormalMatrix * normal;
+    }
 
     gl_Position = P * V * world_position;
 }
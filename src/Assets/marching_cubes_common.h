@@ -1,4 +1,11 @@
+#ifdef BATCH_SIZE
+// The blocks of a batch are stacked along z, density() samples the one in
+// batch_slot. See TerrainGeneratorCompute.
+layout(binding = 3) uniform sampler3D density_map;
+int batch_slot = 0;
+#else
 layout(binding = 0) uniform sampler3D density_map;
+#endif
 
 // Extra space on both sides that will be sampled by ambient occlusion.
 uniform int block_padding;
@@ -314,5 +321,11 @@ float density(vec3 coord)
     // from a texture that's block_resolution x block_resolution.
     // The reason is that if resolution = 2, then we want (0, 1) / 1 = (0, 1)
     int texture_size = block_size + 2 * block_padding;
+#ifdef BATCH_SIZE
+    coord.z += batch_slot * texture_size;
+    return texture(density_map, (coord + vec3(block_padding)) /
+                                vec3(texture_size, texture_size, texture_size * BATCH_SIZE)).x;
+#else
     return texture(density_map, (coord + vec3(block_padding)) / texture_size).x;
+#endif
 }
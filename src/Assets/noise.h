@@ -15,8 +15,29 @@ unsigned int hash(ivec3 lowerCorner) {
     return x;
 }
 
+#ifdef GRADIENT_CACHE
+// Compute shaders only. The gradients of the lattice points that the work
+// group needs for the noise being evaluated, see cacheGradients. Alternates
+// between two halves so that filling one doesn't wait for the invocations
+// still reading the other.
+#define GRADIENT_CACHE_SIZE 2048
+shared uint cached_gradients[2][GRADIENT_CACHE_SIZE];
+int gradient_cache_half = 0;
+bool gradient_cache_valid = false;
+ivec3 gradient_cache_min;
+ivec3 gradient_cache_size;
+#endif
+
 vec3 gradientAtCoordinate(ivec3 gridCoords)
 {
+#ifdef GRADIENT_CACHE
+    ivec3 local = gridCoords - gradient_cache_min;
+    if (gradient_cache_valid && all(greaterThanEqual(local, ivec3(0))) &&
+        all(lessThan(local, gradient_cache_size))) {
+        return perlinVectors[cached_gradients[gradient_cache_half][
+            (local.z * gradient_cache_size.y + local.y) * gradient_cache_size.x + local.x]];
+    }
+#endif
     return perlinVectors[hash(gridCoords) % 12];
 }
 
@@ -66,24 +87,49 @@ float perlinNoise(vec3 coords, float frequency)
     return xInterp;
 }
 
-// coords should be in the range [coords, block_size] not [0, 1]
-float terrainDensity(vec3 coords, float block_size, float period, int octaves, float octaves_decay)
+#ifdef GRADIENT_CACHE
+// Hashes the lattice points that perlinNoise(coords, frequency) needs for
+// coords in [low, high], the same for the whole work group, into
+// cached_gradients, each once, if there are few enough. At low frequencies
+// that is a handful of points instead of eight per invocation. Points outside
+// of the cache are hashed as usual. Must be called by every invocation of the
+// work group.
+void cacheGradients(vec3 low, vec3 high, float frequency)
 {
-    float max_blocks_y = 2.0;
-
-    float noise = 0.0;
-    float frequency = 1.0 / period;
+    gradient_cache_half = 1 - gradient_cache_half;
+    gradient_cache_min = ivec3(floor(low * frequency));
+    gradient_cache_size = ivec3(floor(high * frequency)) - gradient_cache_min + 2;
+
+    int count = gradient_cache_size.x * gradient_cache_size.y * gradient_cache_size.z;
+    gradient_cache_valid = count <= GRADIENT_CACHE_SIZE;
+    if (gradient_cache_valid) {
+        int group_size = int(gl_WorkGroupSize.x * gl_WorkGroupSize.y * gl_WorkGroupSize.z);
+        for (int i = int(gl_LocalInvocationIndex); i < count; i += group_size) {
+            ivec3 local = ivec3(i % gradient_cache_size.x,
+                                (i / gradient_cache_size.x) % gradient_cache_size.y,
+                                i / (gradient_cache_size.x * gradient_cache_size.y));
+            cached_gradients[gradient_cache_half][i] = hash(gradient_cache_min + local) % 12;
+        }
+    }
+    barrier();
+}
+#endif
 
+// Displaces the coordinates so that the terrain gets overhangs and arches.
+vec3 warpCoords(vec3 coords)
+{
     vec3 warped_coords = coords;
     warped_coords += perlinNoise(coords, warp_params.x) * warp_params.y;
     warped_coords += perlinNoise(coords, warp_params.x * 1.9) * (warp_params.y / 2);
+    return warped_coords;
+}
 
-    /* Alternative pattern
-    for (int i = 1; i <= octaves; i++) {
-        noise += abs(perlinNoise(warped_coords, frequency) / pow(i, octaves_decay));
-        frequency *= 1.95;
-    }
+// Turns the sum of the octaves into the density at these coordinates.
+float shapeDensity(vec3 coords, float block_size, float noise)
+{
+    float max_blocks_y = 2.0;
 
+    /* Alternative pattern, with noise += abs(...) for every octave.
     // Air is negative, ground is positive.
     // Generate a gradient from [max to min]
     float min = -1.5;
@@ -93,11 +139,6 @@ float terrainDensity(vec3 coords, float block_size, float period, int octaves, f
     float density = height_gradient + noise * 2.0;
     */
 
-    for (int i = 1; i <= octaves; i++) {
-        noise += perlinNoise(warped_coords, frequency) / pow(i, octaves_decay);
-        frequency *= 1.95;
-    }
-
     // Air is negative, ground is positive.
     // Generate a gradient from [max to min]
     float min = -1.2;
@@ -120,3 +161,80 @@ float terrainDensity(vec3 coords, float block_size, float period, int octaves, f
 
     return density;
 }
+
+// coords should be in the range [coords, block_size] not [0, 1]
+float terrainDensity(vec3 coords, float block_size, float period, int octaves, float octaves_decay)
+{
+    vec3 warped_coords = warpCoords(coords);
+
+    float noise = 0.0;
+    float frequency = 1.0 / period;
+    for (int i = 1; i <= octaves; i++) {
+        noise += perlinNoise(warped_coords, frequency) / pow(i, octaves_decay);
+        frequency *= 1.95;
+    }
+
+    return shapeDensity(coords, block_size, noise);
+}
+
+// Programs that generate blocks are built with OCTAVES defined to the octave
+// count (see TerrainGenerator::specializeShaders), and get the weight of each
+// octave, 1 / pow(i + 1, octaves_decay), from the CPU. The octave loops below
+// then have a constant trip count and unroll without any pow.
+#ifdef OCTAVES
+uniform float octave_weights[OCTAVES];
+
+// Long-range ambient occlusion only needs the low frequencies.
+#if OCTAVES < 3
+#define AMBIENT_OCTAVES OCTAVES
+#else
+#define AMBIENT_OCTAVES 3
+#endif
+
+#define TERRAIN_DENSITY_KERNEL(name, octave_count) \
+float name(vec3 coords, float block_size, float period) \
+{ \
+    vec3 warped_coords = warpCoords(coords); \
+    float noise = 0.0; \
+    float frequency = 1.0 / period; \
+    for (int i = 0; i < octave_count; i++) { \
+        noise += perlinNoise(warped_coords, frequency) * octave_weights[i]; \
+        frequency *= 1.95; \
+    } \
+    return shapeDensity(coords, block_size, noise); \
+}
+
+TERRAIN_DENSITY_KERNEL(terrainDensity, OCTAVES)
+TERRAIN_DENSITY_KERNEL(ambientDensity, AMBIENT_OCTAVES)
+
+#ifdef GRADIENT_CACHE
+// Same as terrainDensity, caching the gradients of each noise for the work
+// group, whose coords are within [low, high]. Must be called by every
+// invocation of the work group.
+float cachedTerrainDensity(vec3 coords, float block_size, float period, vec3 low, vec3 high)
+{
+    vec3 warped_coords = coords;
+    cacheGradients(low, high, warp_params.x);
+    warped_coords += perlinNoise(coords, warp_params.x) * warp_params.y;
+    cacheGradients(low, high, warp_params.x * 1.9);
+    warped_coords += perlinNoise(coords, warp_params.x * 1.9) * (warp_params.y / 2);
+
+    // The noise is within [-1, 1] (see PERLIN_AMPLITUDE in terrain_density.cpp)
+    // so the warp moves coordinates by at most this much.
+    vec3 warp = vec3(warp_params.y * 1.5);
+    low -= warp;
+    high += warp;
+
+    float noise = 0.0;
+    float frequency = 1.0 / period;
+    for (int i = 0; i < OCTAVES; i++) {
+        cacheGradients(low, high, frequency);
+        noise += perlinNoise(warped_coords, frequency) * octave_weights[i];
+        frequency *= 1.95;
+    }
+    gradient_cache_valid = false;
+
+    return shapeDensity(coords, block_size, noise);
+}
+#endif
+#endif
@@ -0,0 +1,108 @@
+// The terrain edits touching the blocks being generated, see TerrainEdits and
+// TerrainGenerator::uploadEdits. The brushes of the block in each slot (only
+// the first without BATCH_SIZE) are edit_brushes[x, x + y) for its range. Under
+// them, the ground is displaced by the layer of heights, if any.
+// Needs noise.h with OCTAVES, and the EDIT_ and EROSION_ defines of
+// densityDefines.
+#define ADD_SPHERE 0
+#define SUBTRACT_SPHERE 1
+#define FLATTEN 2
+#define SMOOTH 3
+
+struct Brush {
+    vec4 center_radius;
+    vec4 params;        // type, strength
+};
+
+layout(std430, binding = 0) readonly buffer TerrainEdits {
+    ivec2 edit_ranges[EDIT_SLOTS];
+    Brush edit_brushes[];
+};
+
+layout(std430, binding = 5) readonly buffer TerrainDisplacement {
+    vec4 displacement_area;     // origin x and z, cell size, resolution (0 without)
+    float displacement[];
+};
+
+#if OCTAVES < EDIT_SMOOTH_OCTAVES
+TERRAIN_DENSITY_KERNEL(smoothDensity, OCTAVES)
+#else
+TERRAIN_DENSITY_KERNEL(smoothDensity, EDIT_SMOOTH_OCTAVES)
+#endif
+
+float falloff(float t)
+{
+    float s = 1.0 - t * t;
+    return s * s;
+}
+
+// Same as TerrainEdits::applyBrush.
+float applyBrush(Brush brush, vec3 coords, float block_size, float period, float density)
+{
+    vec3 center = brush.center_radius.xyz;
+    float radius = brush.center_radius.w;
+    int type = int(brush.params.x);
+    float strength = brush.params.y;
+
+    float distance = length(coords - center);
+    if (type == ADD_SPHERE) {
+        if (distance < radius + EDIT_BAND) {
+            density = max(density, (radius - distance) * EDIT_SLOPE);
+        }
+    } else if (type == SUBTRACT_SPHERE) {
+        if (distance < radius + EDIT_BAND) {
+            density = min(density, (distance - radius) * EDIT_SLOPE);
+        }
+    } else if (distance < radius) {
+        float weight = strength * falloff(distance / radius);
+        if (type == FLATTEN) {
+            density = mix(density, (center.y - coords.y) * EDIT_SLOPE, weight);
+        } else {
+            density = mix(density, smoothDensity(coords, block_size, period), weight);
+        }
+    }
+    return density;
+}
+
+// Same as keepInBand in terrain_edits.cpp.
+float keepInBand(vec3 coords, float block_size, float unedited, float density)
+{
+    float height = coords.y / block_size;
+    if (height < 0.1) {
+        density = max(density, min(unedited, (0.1 - height) * 10.0));
+    }
+    if (height > 1.9) {
+        density = min(density, max(unedited, (1.9 - height) * 10.0));
+    }
+    return density;
+}
+
+// Same as TerrainEdits::displace.
+float displace(vec3 coords, float density)
+{
+    int resolution = int(displacement_area.w);
+    vec2 cell = (coords.xz - displacement_area.xy) / displacement_area.z;
+    if (resolution == 0 || any(lessThan(cell, vec2(0.0))) ||
+        any(greaterThanEqual(cell, vec2(float(resolution - 1))))) {
+        return density;
+    }
+
+    ivec2 corner = ivec2(cell);
+    vec2 t = cell - vec2(corner);
+    int i = corner.y * resolution + corner.x;
+    float height = mix(mix(displacement[i], displacement[i + 1], t.x),
+                       mix(displacement[i + resolution], displacement[i + resolution + 1], t.x),
+                       t.y);
+    return density + height * EROSION_SLOPE;
+}
+
+float applyEdits(int slot, vec3 coords, float block_size, float period, float density)
+{
+    density = displace(coords, density);
+    float unedited = density;
+    ivec2 range = edit_ranges[slot];
+    for (int i = range.x; i < range.x + range.y; i++) {
+        density = applyBrush(edit_brushes[i], coords, block_size, period, density);
+    }
+    return keepInBand(coords, block_size, unedited, density);
+}
@@ -46,6 +46,29 @@ vec3 normalAtVertex(vec3 vertex)
     return -normalize(gradient);
 }
 
+// Map a unit vector onto the octahedron |x| + |y| + |z| = 1, then unfold the
+// lower half onto the square [-1, 1]^2.
+vec2 octahedralEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 encoded = n.xy;
+    if (n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        encoded = (1.0 - abs(n.yx)) * signs;
+    }
+    return encoded;
+}
+
+// 12 byte vertex, see Block::init for the matching attribute layout.
+// [unorm16 x, unorm16 y] [unorm16 z, unorm16 ambient_occlusion] [snorm16 x 2 normal]
+// Positions are already mapped to [0, 1] so they fit unorm16.
+uvec3 packVertex(vec3 position, vec3 normal, float ambient_occlusion)
+{
+    return uvec3(packUnorm2x16(position.xy),
+                 packUnorm2x16(vec2(position.z, ambient_occlusion)),
+                 packSnorm2x16(octahedralEncode(normal)));
+}
+
 // Returns the visibility.
 float ambientOcclusion(vec3 vertex, vec3 world_position, int block_124,
                        bool short_range_ambient, bool long_range_ambient)
@@ -72,8 +95,7 @@ float ambientOcclusion(vec3 vertex, vec3 world_position, int block_124,
         if (long_range_ambient && ray.y > 0) {
             for (int j = 0; j < 5; j++) {
                 float distance = pow((j + 3) / 5.0, 1.8) * 20;
-                float d = terrainDensity(world_position + distance * ray, block_size, period,
-                                         min(3, octaves), octaves_decay);
+                float d = ambientDensity(world_position + distance * ray, block_size, period);
                 ray_visibility *= (1.0 - clamp(d * ambient_occlusion_param.w, 0.0, 1.0) * ambient_occlusion_param.z);
             }
         }
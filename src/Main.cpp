@@ -1,7 +1,32 @@
 #include "navigator.hpp"
 
+#include <stdio.h>
+#include <string.h>
+
+#include "constants.hpp"
+
 int main( int argc, char **argv )
 {
+    // procedural488 --replay <camera path> [--erosion] [--swarm] runs the replay
+    // benchmark in a hidden window, then the benchmarks asked for, prints the
+    // results and exits.
+    if (argc >= 3 && strcmp(argv[1], "--replay") == 0) {
+        int benchmarks = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--erosion") == 0) {
+                benchmarks |= ErosionBenchmark;
+            } else if (strcmp(argv[i], "--swarm") == 0) {
+                benchmarks |= SwarmBenchmark;
+            } else {
+                fprintf(stderr, "Unknown replay option %s\n", argv[i]);
+                return 1;
+            }
+        }
+        CS488Window::launch( argc, argv, new Navigator(argv[2], benchmarks), REPLAY_WIDTH,
+                             REPLAY_HEIGHT, "GPU Procedural Terrain 488", 60.0f, false );
+        return 0;
+    }
+
     //CS488Window::launch( argc, argv, new Navigator(), 1024, 768, "GPU Procedural Terrain 488" );
     CS488Window::launch( argc, argv, new Navigator(), 2048, 1536, "GPU Procedural Terrain 488" );
     return 0;
@@ -0,0 +1,269 @@
+#include "bc_encoder.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glm/glm.hpp>
+
+using namespace glm;
+using namespace std;
+
+// Power iterations used to find the principal axis of a block's colors.
+#define BC1_AXIS_ITERATIONS 8
+
+// Read the 4x4 block at (block_x, block_y), repeating the last row and column
+// if it goes past the edge of the image.
+static void readBlock(const unsigned char* rgb, int width, int height,
+                      int block_x, int block_y, vec3 pixels[16])
+{
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int image_x = std::min(block_x * 4 + x, width - 1);
+            int image_y = std::min(block_y * 4 + y, height - 1);
+            const unsigned char* pixel = &rgb[(image_y * width + image_x) * 3];
+            pixels[y * 4 + x] = vec3(pixel[0], pixel[1], pixel[2]);
+        }
+    }
+}
+
+static uint16_t packColor565(vec3 color)
+{
+    ivec3 quantized = ivec3(clamp(color, vec3(0.0f), vec3(255.0f)) *
+                            vec3(31.0f, 63.0f, 31.0f) / 255.0f + 0.5f);
+    return (uint16_t)((quantized.r << 11) | (quantized.g << 5) | quantized.b);
+}
+
+static vec3 unpackColor565(uint16_t packed)
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    return vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+static float distanceSquared(vec3 a, vec3 b)
+{
+    vec3 d = a - b;
+    return dot(d, d);
+}
+
+// Pick the nearest of the four colors between the endpoints for every pixel.
+// Returns the total squared error.
+static float bc1Indices(const vec3 pixels[16], uint16_t color0, uint16_t color1, int indices[16])
+{
+    vec3 palette[4];
+    palette[0] = unpackColor565(color0);
+    palette[1] = unpackColor565(color1);
+    palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+    palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+    float error = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float best_distance = distanceSquared(pixels[i], palette[0]);
+        indices[i] = 0;
+        for (int j = 1; j < 4; j++) {
+            float distance = distanceSquared(pixels[i], palette[j]);
+            if (distance < best_distance) {
+                best_distance = distance;
+                indices[i] = j;
+            }
+        }
+        error += best_distance;
+    }
+    return error;
+}
+
+// Least squares fit of the endpoints for the given indices.
+static bool refineEndpoints(const vec3 pixels[16], const int indices[16],
+                            vec3& endpoint0, vec3& endpoint1)
+{
+    // Weight of endpoint0 for each index.
+    static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    vec3 ax(0.0f), bx(0.0f);
+    for (int i = 0; i < 16; i++) {
+        float a = weights[indices[i]];
+        float b = 1.0f - a;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        ax += a * pixels[i];
+        bx += b * pixels[i];
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (fabs(determinant) < 1e-6f) {
+        return false;
+    }
+
+    endpoint0 = (ax * bb - bx * ab) / determinant;
+    endpoint1 = (bx * aa - ax * ab) / determinant;
+    return true;
+}
+
+static void encodeBc1Block(const vec3 pixels[16], unsigned char* out)
+{
+    vec3 mean(0.0f);
+    for (int i = 0; i < 16; i++) {
+        mean += pixels[i];
+    }
+    mean /= 16.0f;
+
+    mat3 covariance(0.0f);
+    for (int i = 0; i < 16; i++) {
+        vec3 d = pixels[i] - mean;
+        covariance += outerProduct(d, d);
+    }
+
+    vec3 axis(1.0f, 1.0f, 1.0f);
+    for (int i = 0; i < BC1_AXIS_ITERATIONS; i++) {
+        axis = covariance * axis;
+        float length = glm::length(axis);
+        if (length < 1e-6f) {
+            break;
+        }
+        axis /= length;
+    }
+
+    float min_projection = 0.0f;
+    float max_projection = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float projection = dot(pixels[i] - mean, axis);
+        min_projection = std::min(min_projection, projection);
+        max_projection = std::max(max_projection, projection);
+    }
+
+    vec3 endpoint0 = mean + axis * max_projection;
+    vec3 endpoint1 = mean + axis * min_projection;
+
+    uint16_t color0 = packColor565(endpoint0);
+    uint16_t color1 = packColor565(endpoint1);
+    int indices[16];
+    float error = bc1Indices(pixels, color0, color1, indices);
+
+    if (refineEndpoints(pixels, indices, endpoint0, endpoint1)) {
+        uint16_t refined0 = packColor565(endpoint0);
+        uint16_t refined1 = packColor565(endpoint1);
+        int refined_indices[16];
+        float refined_error = bc1Indices(pixels, refined0, refined1, refined_indices);
+        if (refined_error < error) {
+            color0 = refined0;
+            color1 = refined1;
+            memcpy(indices, refined_indices, sizeof(indices));
+        }
+    }
+
+    // color0 > color1 selects the four color mode. Equal endpoints use the
+    // three color mode, but then every index is 0 anyway.
+    if (color0 < color1) {
+        std::swap(color0, color1);
+        for (int i = 0; i < 16; i++) {
+            indices[i] ^= 1;
+        }
+    } else if (color0 == color1) {
+        memset(indices, 0, sizeof(indices));
+    }
+
+    uint32_t packed_indices = 0;
+    for (int i = 0; i < 16; i++) {
+        packed_indices |= (uint32_t)indices[i] << (2 * i);
+    }
+
+    out[0] = color0 & 0xff;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xff;
+    out[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = (packed_indices >> (8 * i)) & 0xff;
+    }
+}
+
+// One channel of a BC5 block (a BC4 block), using the mode with eight
+// interpolated values between the minimum and maximum.
+static void encodeBc4Block(const float values[16], unsigned char* out)
+{
+    float min_value = values[0];
+    float max_value = values[0];
+    for (int i = 1; i < 16; i++) {
+        min_value = std::min(min_value, values[i]);
+        max_value = std::max(max_value, values[i]);
+    }
+
+    int endpoint0 = (int)(max_value + 0.5f);
+    int endpoint1 = (int)(min_value + 0.5f);
+
+    float palette[8];
+    palette[0] = endpoint0;
+    palette[1] = endpoint1;
+    for (int i = 1; i < 7; i++) {
+        palette[i + 1] = ((7 - i) * endpoint0 + i * endpoint1) / 7.0f;
+    }
+
+    uint64_t packed_indices = 0;
+    if (endpoint0 > endpoint1) {
+        for (int i = 0; i < 16; i++) {
+            int best_index = 0;
+            float best_distance = fabs(values[i] - palette[0]);
+            for (int j = 1; j < 8; j++) {
+                float distance = fabs(values[i] - palette[j]);
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best_index = j;
+                }
+            }
+            packed_indices |= (uint64_t)best_index << (3 * i);
+        }
+    }
+
+    out[0] = endpoint0;
+    out[1] = endpoint1;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (packed_indices >> (8 * i)) & 0xff;
+    }
+}
+
+vector<unsigned char> compressBc1(const unsigned char* rgb, int width, int height)
+{
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    vector<unsigned char> compressed(blocks_x * blocks_y * 8);
+
+    vec3 pixels[16];
+    for (int block_y = 0; block_y < blocks_y; block_y++) {
+        for (int block_x = 0; block_x < blocks_x; block_x++) {
+            readBlock(rgb, width, height, block_x, block_y, pixels);
+            encodeBc1Block(pixels, &compressed[(block_y * blocks_x + block_x) * 8]);
+        }
+    }
+
+    return compressed;
+}
+
+vector<unsigned char> compressBc5(const unsigned char* rgb, int width, int height)
+{
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    vector<unsigned char> compressed(blocks_x * blocks_y * 16);
+
+    vec3 pixels[16];
+    float red[16];
+    float green[16];
+    for (int block_y = 0; block_y < blocks_y; block_y++) {
+        for (int block_x = 0; block_x < blocks_x; block_x++) {
+            readBlock(rgb, width, height, block_x, block_y, pixels);
+            for (int i = 0; i < 16; i++) {
+                red[i] = pixels[i].r;
+                green[i] = pixels[i].g;
+            }
+
+            unsigned char* out = &compressed[(block_y * blocks_x + block_x) * 16];
+            encodeBc4Block(red, out);
+            encodeBc4Block(green, out + 8);
+        }
+    }
+
+    return compressed;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+
+// CPU encoders for block compressed texture formats, so that textures can be
+// compressed offline without a GPU. See texture_converter.
+//
+// Images are tightly packed rows of 8-bit RGB pixels. Sizes don't need to be
+// multiples of 4, edge blocks repeat the last row and column.
+
+// BC1 (DXT1) without alpha, 8 bytes per 4x4 block.
+std::vector<unsigned char> compressBc1(const unsigned char* rgb, int width, int height);
+
+// BC5 (RGTC2), 16 bytes per 4x4 block. Only the red and green channels are
+// kept, e.g. the x and y of a normal map.
+std::vector<unsigned char> compressBc5(const unsigned char* rgb, int width, int height);
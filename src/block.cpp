@@ -2,7 +2,7 @@
 
 #include "cs488-framework/GlErrorCheck.hpp"
 
-#include "timer.hpp"
+#include "trace.hpp"
 
 using namespace glm;
 using namespace std;
@@ -10,9 +10,19 @@ using namespace std;
 Block::Block(ivec3 index, int size, bool alpha_blend)
 : index(index)
 , size(size)
+, out_vao(0)
+, out_vbo(0)
+, feedback_object(0)
 {
+    if (PACKED_VERTICES) {
+        vertex_format = PackedVertex;
+        vertex_unit_size = sizeof(uvec3);
+    } else {
+        vertex_format = UnpackedVertex;
+        vertex_unit_size = sizeof(vec3) * 2 + sizeof(float);
+    }
+
     // TODO: reevaluate amount of space needed, maybe dynamically
-    vertex_unit_size = sizeof(vec3) * 2 + sizeof(float);
     vertex_data_size = BLOCK_SIZE * BLOCK_SIZE *
                        BLOCK_SIZE * vertex_unit_size * 15;
 
@@ -21,7 +31,10 @@ Block::Block(ivec3 index, int size, bool alpha_blend)
 
 Block::~Block()
 {
-    // TODO
+    // Zero names (block never initialized) are silently ignored.
+    glDeleteTransformFeedbacks(1, &feedback_object);
+    glDeleteBuffers(1, &out_vbo);
+    glDeleteVertexArrays(1, &out_vao);
 }
 
 void Block::init(GLint pos_attrib, GLint normal_attrib, GLint ambient_occlusion_attrib)
@@ -36,14 +49,27 @@ void Block::init(GLint pos_attrib, GLint normal_attrib, GLint ambient_occlusion_
 
         // Setup location of attributes
         glEnableVertexAttribArray(pos_attrib);
-        glVertexAttribPointer(pos_attrib, 3, GL_FLOAT, GL_FALSE,
-                vertex_unit_size, 0);
         glEnableVertexAttribArray(normal_attrib);
-        glVertexAttribPointer(normal_attrib, 3, GL_FLOAT, GL_FALSE,
-                vertex_unit_size, (void*)(sizeof(vec3)));
         glEnableVertexAttribArray(ambient_occlusion_attrib);
-        glVertexAttribPointer(ambient_occlusion_attrib, 1, GL_FLOAT, GL_FALSE,
-                vertex_unit_size, (void*)(sizeof(vec3) * 2));
+
+        if (vertex_format == PackedVertex) {
+            // [x16 y16] [z16 ambient_occlusion16] [octahedral normal 2 x 16]
+            // The normalized integer types let the vertex fetch do the unpacking,
+            // only the octahedral normal needs decoding in the vertex shader.
+            glVertexAttribPointer(pos_attrib, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+                    vertex_unit_size, 0);
+            glVertexAttribPointer(ambient_occlusion_attrib, 1, GL_UNSIGNED_SHORT, GL_TRUE,
+                    vertex_unit_size, (void*)(sizeof(GLushort) * 3));
+            glVertexAttribPointer(normal_attrib, 2, GL_SHORT, GL_TRUE,
+                    vertex_unit_size, (void*)(sizeof(GLushort) * 4));
+        } else {
+            glVertexAttribPointer(pos_attrib, 3, GL_FLOAT, GL_FALSE,
+                    vertex_unit_size, 0);
+            glVertexAttribPointer(normal_attrib, 3, GL_FLOAT, GL_FALSE,
+                    vertex_unit_size, (void*)(sizeof(vec3)));
+            glVertexAttribPointer(ambient_occlusion_attrib, 1, GL_FLOAT, GL_FALSE,
+                    vertex_unit_size, (void*)(sizeof(vec3) * 2));
+        }
     }
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
@@ -73,6 +99,7 @@ void Block::draw()
 void Block::resetBlock(bool alpha_blend)
 {
     generated = false;
+    scattered = false;
     if (alpha_blend) {
         // Go from transparent to opaque.
         transparency = 0.0;
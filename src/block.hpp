@@ -3,9 +3,17 @@
 #include "cs488-framework/ShaderProgram.hpp"
 
 #include <glm/glm.hpp>
+#include <vector>
 
 #include "constants.hpp"
 
+enum VertexFormat {
+    // vec3 position, vec3 normal, float ambient occlusion.
+    UnpackedVertex = 0,
+    // uvec3 written by packVertex in terrain_vertex_common.h.
+    PackedVertex = 1,
+};
+
 class Block {
 public:
     Block(glm::ivec3 index, int size, bool alpha_blend = true);
@@ -20,10 +28,17 @@ public:
     // instead of ->reset.
     void resetBlock(bool alpha_blend = true);
 
-    void finish() { generated = true; }
+    // Generating the block again drops what was scattered on it.
+    void finish() { generated = true; scattered = false; }
     bool isReady() { return generated; }
+    bool isScattered() { return scattered; }
     float getAlpha() { return transparency; }
 
+    VertexFormat vertexFormat() { return vertex_format; }
+
+    // GPU memory held by the buffers of this block, see ResidentSet.
+    virtual size_t bufferBytes() { return vertex_data_size; }
+
     glm::ivec3 index;
 
     int size;
@@ -35,11 +50,19 @@ public:
     // Careful, these cannot be reused for multiple buffers!
     GLuint feedback_object;
 
+    // Trees and rocks on its ground, (x, y, z) in blocks and a scale, per
+    // species. Filled by Scatter::place once the block is generated, only for
+    // blocks of size 1.
+    std::vector<glm::vec4> instances[SCATTER_SPECIES];
+    void setScattered(bool scattered) { this->scattered = scattered; }
+
 protected:
+    VertexFormat vertex_format;
     size_t vertex_unit_size;
     size_t vertex_data_size;
 
 private:
     bool generated;
+    bool scattered;
     float transparency;
 };
@@ -4,12 +4,22 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
+#include <algorithm>
+#include <thread>
 #include <unordered_set>
 
 #include "cs488-framework/GlErrorCheck.hpp"
 
+#include "hydraulic_erosion.hpp"
+
 #include "indexed_block.hpp"
-#include "timer.hpp"
+#include "indirect_block.hpp"
+#include "terrain_generator_compute.hpp"
+#include "terrain_generator_cpu.hpp"
+#include "terrain_generator_fast.hpp"
+#include "terrain_generator_medium.hpp"
+#include "terrain_generator_slow.hpp"
+#include "trace.hpp"
 
 using namespace glm;
 using namespace std;
@@ -18,6 +28,8 @@ static ivec4_set eight_blocks;
 
 BlockManager::BlockManager()
 : lod(VIEW_RANGE)
+, prefetch_lod(VIEW_RANGE)
+, has_prediction(false)
 {
     triplanar_colors = false;
     use_ambient = true;
@@ -26,7 +38,12 @@ BlockManager::BlockManager()
     show_ambient = false;
     use_water = true;
     use_stencil = true;
+    use_scatter = true;
+    use_cluster_culling = true;
+    use_occlusion_culling = true;
+    use_prefetch = true;
     water_height = -0.3f;
+    scattered_water_height = water_height;
     small_blocks = true;
     medium_blocks = true;
     large_blocks = true;
@@ -38,10 +55,19 @@ BlockManager::BlockManager()
     light_specular = vec3(0.2);
 
     reused_block_count = 0;
+    occluded_blocks = 0;
+    generated_block_count = 0;
+    visible_holes = 0;
+    prefetch_hits = 0;
+    cancelled_prefetches = 0;
+    last_edit_blocks = 0;
+    last_edit_milliseconds = 0.0f;
+    last_edit_frames = 0;
+    last_erosion_milliseconds = 0.0f;
 
-    terrain_generator = &terrain_generator_medium;
     block_display_type = All;
     generator_selection = Medium;
+    active_generator = Medium;
 
     eight_blocks.insert(ivec4(0, 0, 0, 1));
     eight_blocks.insert(ivec4(1, 0, 0, 1));
@@ -53,13 +79,243 @@ BlockManager::BlockManager()
     eight_blocks.insert(ivec4(1, 1, 1, 1));
 }
 
-void BlockManager::init(string dir)
+static const char* generatorName(TerrainGeneratorSelection selection)
+{
+    switch (selection) {
+        case Slow:
+            return "Slow";
+        case Medium:
+            return "Medium";
+        case Fast:
+            return "Fast";
+        case Cpu:
+            return "CPU";
+        case Compute:
+            return "Compute";
+    }
+    return "";
+}
+
+static unique_ptr<TerrainGenerator> newGenerator(TerrainGeneratorSelection selection)
 {
+    switch (selection) {
+        case Slow:
+            return unique_ptr<TerrainGenerator>(new TerrainGeneratorSlow());
+        case Fast:
+            return unique_ptr<TerrainGenerator>(new TerrainGeneratorFast());
+        case Cpu:
+            return unique_ptr<TerrainGenerator>(new TerrainGeneratorCpu());
+        case Compute:
+            return unique_ptr<TerrainGenerator>(new TerrainGeneratorCompute());
+        default:
+            return unique_ptr<TerrainGenerator>(new TerrainGeneratorMedium());
+    }
+}
+
+void BlockManager::init(string dir, StartupReport& report)
+{
+    asset_dir = dir;
+
+    report.step("Terrain renderer");
     terrain_renderer.init(dir);
-    terrain_generator_slow.init(dir);
-    terrain_generator_medium.init(dir);
-    terrain_generator_fast.init(dir);
+
+    report.step(string(generatorName(generator_selection)) + " generator");
+    terrain_generator = newGenerator(generator_selection);
+    terrain_generator->edits = &terrain_edits;
+    terrain_generator->init(dir);
+    active_generator = generator_selection;
+
+    report.step("Water");
     water.init(dir);
+
+    report.step("Scatter");
+    scatter.init(dir);
+
+    report.step("Surface query");
+    surface_query.reset(terrain_generator->densityFunction());
+}
+
+void BlockManager::finishInit(StartupReport& report)
+{
+    report.step("Terrain renderer, linked");
+    terrain_renderer.finishInit();
+
+    report.step(string(generatorName(active_generator)) + " generator, linked");
+    terrain_generator->finishInit();
+    report.addGpuBytes(terrain_generator->gpuBytes());
+
+    report.step("Water, linked");
+    water.finishInit();
+
+    report.step("Scatter, linked");
+    scatter.finishInit();
+}
+
+void BlockManager::applyBrush(const TerrainBrush& brush)
+{
+    TRACE_ZONE("Apply brush");
+
+    terrain_edits.add(brush);
+    vec3 low, high;
+    terrain_edits.brushBounds(terrain_edits.brushCount() - 1, low, high);
+    markEdited(low, high);
+}
+
+void BlockManager::erodeTerrain(vec2 center, int iterations)
+{
+    TRACE_ZONE("Erode terrain");
+
+    Timer timer;
+    timer.start();
+
+    // Erode the ground as it is without the previous erosion.
+    vec3 low, high;
+    if (terrain_edits.hasDisplacement()) {
+        terrain_edits.displacementBounds(low, high);
+        terrain_edits.clearDisplacement();
+        markEdited(low, high);
+    }
+
+    // The heights are at the corners of the cells, the layer interpolates
+    // between them.
+    const int n = EROSION_RESOLUTION;
+    const float cell_size = 1.0f / EROSION_CELLS_PER_BLOCK;
+    vec2 origin = floor(center * float(EROSION_CELLS_PER_BLOCK)) * cell_size -
+                  0.5f * (n - 1) * cell_size;
+    vector<vec2> columns(n * n);
+    for (int z = 0; z < n; z++) {
+        for (int x = 0; x < n; x++) {
+            columns[z * n + x] = origin + vec2(x, z) * cell_size;
+        }
+    }
+    vector<float> heights;
+    surface_query.surfaceHeights(columns, heights);
+    for (float& height : heights) {
+        height *= EROSION_CELLS_PER_BLOCK;
+    }
+
+    HydraulicErosion erosion(n, EROSION_SEED);
+    erosion.reset(heights);
+    erosion.run(iterations, std::min((int)thread::hardware_concurrency(), EROSION_THREADS));
+    erosion.displacement(heights);
+
+    // In density coordinates, fading out to the edges so that the ground
+    // around doesn't step up or down.
+    for (int z = 0; z < n; z++) {
+        for (int x = 0; x < n; x++) {
+            int edge = std::min(std::min(x, z), std::min(n - 1 - x, n - 1 - z));
+            float fade = smoothstep(0.0f, 1.0f, float(edge) / EROSION_FADE_CELLS);
+            heights[z * n + x] *= fade * cell_size * BLOCK_SIZE;
+        }
+    }
+    terrain_edits.setDisplacement(origin * float(BLOCK_SIZE), cell_size * BLOCK_SIZE, n, heights);
+    terrain_edits.displacementBounds(low, high);
+    markEdited(low, high);
+
+    timer.stop();
+    last_erosion_milliseconds = timer.elapsedSeconds() * 1000.0f;
+}
+
+void BlockManager::markEdited(vec3 low, vec3 high)
+{
+    // Blocks still waiting for the previous edit stay dirty, the timing
+    // starts over.
+    for (auto& kv : blocks) {
+        if (TerrainEdits::touches(low, high, kv.first)) {
+            dirty_blocks.insert(kv.first);
+        }
+    }
+    resident_set.dropMeshes(low, high);
+
+    surface_query.invalidate(low / float(BLOCK_SIZE), high / float(BLOCK_SIZE));
+    occlusion_culler.invalidate(low / float(BLOCK_SIZE), high / float(BLOCK_SIZE));
+
+    last_edit_blocks = dirty_blocks.size();
+    last_edit_frames = 0;
+    edit_timer.start();
+}
+
+void BlockManager::clearEdits()
+{
+    terrain_edits.clear();
+    regenerateAllBlocks(false);
+}
+
+void BlockManager::remeshDirtyBlocks()
+{
+    if (dirty_blocks.empty()) {
+        return;
+    }
+
+    TRACE_ZONE("Remesh edited blocks");
+
+    // Small blocks are the ones near the camera, remesh them first.
+    vector<ivec4> order(dirty_blocks.begin(), dirty_blocks.end());
+    std::sort(order.begin(), order.end(), [](const ivec4& a, const ivec4& b) {
+        return a.w < b.w;
+    });
+
+    vector<shared_ptr<Block>> batch;
+    for (ivec4 index : order) {
+        if ((int)batch.size() >= EDIT_BLOCKS_PER_FRAME) {
+            break;
+        }
+        dirty_blocks.erase(index);
+
+        // Evicted blocks are generated again with the brush, and blocks not
+        // generated yet will be.
+        auto block = blocks.find(index);
+        if (block != blocks.end() && block->second->isReady()) {
+            batch.push_back(block->second);
+        }
+    }
+
+    if (active_generator == Cpu) {
+        for (auto& block : batch) {
+            terrain_generator->generateTerrainBlock(*block);
+            resident_set.cacheMesh(ivec4(block->index, block->size),
+                                   static_cast<TerrainGeneratorCpu&>(*terrain_generator).lastMesh());
+        }
+    } else if (!batch.empty()) {
+        vector<Block*> blocks_to_generate;
+        for (auto& block : batch) {
+            blocks_to_generate.push_back(block.get());
+        }
+        terrain_generator->generateTerrainBlocks(blocks_to_generate);
+    }
+    for (auto& block : batch) {
+        block->finish();
+    }
+    generated_block_count += batch.size();
+
+    last_edit_frames++;
+    if (dirty_blocks.empty()) {
+        edit_timer.stop();
+        last_edit_milliseconds = edit_timer.elapsedSeconds() * 1000.0f;
+    }
+}
+
+void BlockManager::scatterNewBlocks()
+{
+    vector<Block*> batch;
+    for (auto& kv : blocks) {
+        Block& block = *kv.second;
+        if (block.size == 1 && block.isReady() && !block.isScattered()) {
+            batch.push_back(&block);
+        }
+    }
+    scatter.place(batch, terrain_generator->densityFunction(), water_height);
+}
+
+void BlockManager::scatterAboveWater()
+{
+    if (water_height == scattered_water_height) {
+        return;
+    }
+    scattered_water_height = water_height;
+    for (auto& kv : blocks) {
+        kv.second->setScattered(false);
+    }
 }
 
 void BlockManager::profileBlockGeneration()
@@ -71,17 +327,19 @@ void BlockManager::profileBlockGeneration()
     Timer timer;
     timer.start();
 
-    shared_ptr<Block> block;
-    if (generator_selection == Fast) {
-       block = shared_ptr<IndexedBlock>(new IndexedBlock(ivec3(0), 1));
-    } else {
-       block = shared_ptr<Block>(new Block(ivec3(0), 1));
+    // As many copies of the block as the generator takes at once.
+    int batch_size = terrain_generator->batchSize();
+    vector<shared_ptr<Block>> batch;
+    vector<Block*> batch_blocks;
+    for (int i = 0; i < batch_size; i++) {
+        batch.push_back(allocateBlock(ivec3(0), 1));
+        batch_blocks.push_back(batch.back().get());
     }
-    block->init(terrain_renderer.pos_attrib, terrain_renderer.normal_attrib,
-                terrain_renderer.ambient_occlusion_attrib);
 
-    for (int i = 0; i < 100; i++) {
-        terrain_generator->generateTerrainBlock(*block);
+    int block_count = 0;
+    while (block_count < 100) {
+        terrain_generator->generateTerrainBlocks(batch_blocks);
+        block_count += batch_size;
     }
 
     // Make sure OpenGL has executed everything, so that they are measured
@@ -90,23 +348,66 @@ void BlockManager::profileBlockGeneration()
 
     timer.stop();
 
-    printf("Generating 100 blocks took %f seconds\n", timer.elapsedSeconds());
+    printf("Generating %d blocks (%d at a time) took %f seconds\n",
+           block_count, batch_size, timer.elapsedSeconds());
 }
 
 int BlockManager::allocatedBlocks()
 {
-    return free_blocks.size() + blocks.size();
+    return resident_set.freeBlocks() + blocks.size();
+}
+
+void BlockManager::selectGenerator()
+{
+    if (terrain_generator && generator_selection == active_generator) {
+        return;
+    }
+
+    TRACE_ZONE("Select generator");
+
+    Timer timer;
+    timer.start();
+
+    // Free the old generator's memory before allocating the new one's.
+    unique_ptr<TerrainGenerator> generator = newGenerator(generator_selection);
+    bool switched = terrain_generator != nullptr;
+    if (switched) {
+        generator->copyParameters(*terrain_generator);
+        terrain_generator.reset();
+    }
+    generator->init(asset_dir);
+    generator->finishInit();
+    terrain_generator = std::move(generator);
+    active_generator = generator_selection;
+
+    timer.stop();
+    if (switched) {
+        printf("Switching to the %s generator took %.2f seconds (%.1f MB of GPU memory)\n",
+               generatorName(active_generator), timer.elapsedSeconds(),
+               terrain_generator->gpuBytes() / (1024.0 * 1024.0));
+    }
 }
 
 void BlockManager::regenerateAllBlocks(bool alpha_blend)
 {
+    // Called right after the selection changes in the UI, before the next
+    // update, so make sure the blocks generated below match the generator.
+    selectGenerator();
+
+    // Terrain parameters might have changed.
+    occlusion_culler.clearOccluders();
+    surface_query.reset(terrain_generator->densityFunction());
+
     for (auto& kv : blocks) {
         auto& block = kv.second;
         block->resetBlock(alpha_blend);
-        free_blocks.push(block);
+        resident_set.release(block);
     }
 
     blocks.clear();
+    prefetched_blocks.clear();
+    dirty_blocks.clear();
+    resident_set.clearMeshes();
 
     // We might want to regenerate this block continuously when we show
     // only few blocks, so generate themn ow.
@@ -128,156 +429,332 @@ void BlockManager::regenerateAllBlocks(bool alpha_blend)
     }
 }
 
-void BlockManager::generateBestBlock()
+bool BlockManager::blockIsOccluded(ivec3 index, int size, mat4 W)
 {
-    // Generate fully visible blocks first. This lets us have at least something,
-    // even if it's lower detail. If a block is not fully visible, this means it's
-    // transitioning, so there is at least a fully visible block under it.
-    //
-    // We'd like to generate them in order of distance to the camera.
-    // For now I'm being lazy and just generating small blocks first,
-    // then medium ones, then large ones, as a proxy.
-    for (auto& block : lod.blocks_of_size_4) {
-        if (blocks.count(ivec4(block.first, 4)) == 0 && block.second == 1.0) {
-            auto new_block = newBlock(block.first, 4);
-            terrain_generator->generateTerrainBlock(*new_block);
-            new_block->finish();
-            return;
-        }
+    if (!use_occlusion_culling) {
+        return false;
     }
-    for (auto& block : lod.blocks_of_size_2) {
-        if (blocks.count(ivec4(block.first, 2)) == 0 && block.second == 1.0) {
-            auto new_block = newBlock(block.first, 2);
-            terrain_generator->generateTerrainBlock(*new_block);
-            new_block->finish();
-            return;
-        }
+
+    mat4 block_transform = translate(vec3(index)) * W * scale(vec3(size));
+    if (!occlusion_culler.isOccluded(block_transform)) {
+        return false;
     }
-    for (auto& block : lod.blocks_of_size_1) {
-        if (blocks.count(ivec4(block.first, 1)) == 0 && block.second == 1.0) {
-            auto new_block = newBlock(block.first, 1);
-            terrain_generator->generateTerrainBlock(*new_block);
-            new_block->finish();
-            return;
-        }
+
+    // The reflection of a hidden block can still show up in the water.
+    if (use_water) {
+        mat4 W_reflect = glm::translate(vec3(0, water_height, 0)) *
+                         glm::scale(vec3(1.0f, -1.0f, 1.0f)) *
+                         glm::translate(vec3(0, -water_height, 0)) *
+                         block_transform;
+        return occlusion_culler.isOccluded(W_reflect);
     }
+    return true;
+}
 
-    // Generate non-fully visible blocks.
-    for (auto& block : lod.blocks_of_size_4) {
-        if (blocks.count(ivec4(block.first, 4)) == 0) {
-            auto new_block = newBlock(block.first, 4);
-            terrain_generator->generateTerrainBlock(*new_block);
-            new_block->finish();
-            return;
+bool BlockManager::generateFirstMissing(vector<pair<ivec3, float>>& lod_blocks, int size, mat4 W,
+                                        int filter)
+{
+    for (auto& block : lod_blocks) {
+        if (blocks.count(ivec4(block.first, size)) > 0) {
+            continue;
         }
-    }
-    for (auto& block : lod.blocks_of_size_2) {
-        if (blocks.count(ivec4(block.first, 2)) == 0) {
-            auto new_block = newBlock(block.first, 2);
-            terrain_generator->generateTerrainBlock(*new_block);
-            new_block->finish();
-            return;
+        if ((filter & FullyVisibleOnly) && block.second != 1.0) {
+            continue;
         }
-    }
-    for (auto& block : lod.blocks_of_size_1) {
-        if (blocks.count(ivec4(block.first, 1)) == 0) {
-            auto new_block = newBlock(block.first, 1);
-            terrain_generator->generateTerrainBlock(*new_block);
+        if ((filter & HolesOnly) && isCovered(block.first, size)) {
+            continue;
+        }
+        if ((filter & SkipOccluded) && blockIsOccluded(block.first, size, W)) {
+            continue;
+        }
+
+        TraceZone zone("Generate block");
+        zone.setDetail("%d, %d, %d, size %d", block.first.x, block.first.y, block.first.z, size);
+
+        ivec4 index = ivec4(block.first, size);
+        auto new_block = newBlock(block.first, size);
+        if (active_generator == Cpu) {
+            // The mesh might still be around if the block was evicted.
+            IndexedBlock& indexed_block = dynamic_cast<IndexedBlock&>(*new_block);
+            if (!resident_set.uploadCachedMesh(index, indexed_block)) {
+                terrain_generator->generateTerrainBlock(*new_block);
+                resident_set.cacheMesh(
+                    index, static_cast<TerrainGeneratorCpu&>(*terrain_generator).lastMesh());
+                generated_block_count++;
+            }
             new_block->finish();
-            return;
+        } else {
+            // Generated with the rest of the frame's blocks, see
+            // generatePendingBlocks.
+            pending_blocks.push_back(new_block);
         }
+        if (filter & Prefetch) {
+            prefetched_blocks[index] = 0.0f;
+        }
+        return true;
     }
+    return false;
 }
 
-void BlockManager::update(float time_elapsed, mat4 P, mat4 V, mat4 W, vec3 eye_position, bool generate_blocks)
+void BlockManager::generatePendingBlocks()
 {
-    switch (generator_selection) {
-        case Slow:
-            terrain_generator = &terrain_generator_slow;
-            break;
-        case Medium:
-            terrain_generator = &terrain_generator_medium;
-            break;
-        case Fast:
-            terrain_generator = &terrain_generator_fast;
-            break;
+    if (pending_blocks.empty()) {
+        return;
     }
 
+    TRACE_ZONE("Generate pending blocks");
+
+    vector<Block*> batch;
+    for (auto& block : pending_blocks) {
+        batch.push_back(block.get());
+    }
+    terrain_generator->generateTerrainBlocks(batch);
+
+    for (auto& block : pending_blocks) {
+        block->finish();
+    }
+    generated_block_count += pending_blocks.size();
+    pending_blocks.clear();
+}
+
+bool BlockManager::generateFirstMissing(Lod& source, mat4 W, int filter)
+{
+    // For now I'm being lazy and just generating large blocks first, then
+    // medium ones, then small ones, as a proxy for the order of distance to
+    // the camera.
+    return generateFirstMissing(source.blocks_of_size_4, 4, W, filter) ||
+           generateFirstMissing(source.blocks_of_size_2, 2, W, filter) ||
+           generateFirstMissing(source.blocks_of_size_1, 1, W, filter);
+}
+
+void BlockManager::generateBestBlock(mat4 W)
+{
+    // Fill the holes first, where no block at all is shown. Fully visible blocks
+    // come before those that are fading out, which means there is at least a
+    // fully visible block under them.
+    if (generateFirstMissing(lod, W, FullyVisibleOnly | SkipOccluded | HolesOnly) ||
+        generateFirstMissing(lod, W, SkipOccluded | HolesOnly)) {
+        return;
+    }
+
+    // Then the holes there will be where the camera is heading. Fast enough
+    // flight keeps the blocks below busy and would otherwise never get there.
+    if (has_prediction && generateFirstMissing(prefetch_lod, W, HolesOnly | Prefetch)) {
+        return;
+    }
+
+    // Then blocks with more detail than the larger blocks shown in their place.
+    if (generateFirstMissing(lod, W, FullyVisibleOnly | SkipOccluded) ||
+        generateFirstMissing(lod, W, SkipOccluded)) {
+        return;
+    }
+
+    if (has_prediction && generateFirstMissing(prefetch_lod, W, Prefetch)) {
+        return;
+    }
+
+    // Blocks hidden behind the terrain come last, we might still turn around.
+    generateFirstMissing(lod, W, 0);
+}
+
+void BlockManager::update(float time_elapsed, mat4 P, mat4 V, mat4 W, vec3 eye_position, bool generate_blocks)
+{
+    TRACE_ZONE("BlockManager::update");
+
+    selectGenerator();
+
     ivec4_map<float> existing_blocks_alpha;
     for (auto& kv : blocks) {
         existing_blocks_alpha[kv.first] = kv.second->getAlpha();
     }
     lod.generateForPosition(P, V, W, eye_position, &existing_blocks_alpha);
+    updatePrefetch(time_elapsed, P, V, W, eye_position, existing_blocks_alpha);
+
+    if (use_occlusion_culling) {
+        occlusion_culler.update(P, V, W, eye_position, terrain_generator->densityFunction());
+    }
 
     blocks_in_view = lod.blocks_of_size_1.size() + lod.blocks_of_size_2.size() + lod.blocks_of_size_4.size();
 
     // Count blocks that we don't already have.
     blocks_in_queue = 0;
+    visible_holes = 0;
 
     for (auto& block : lod.blocks_of_size_4) {
         if (blocks.count(ivec4(block.first, 4)) == 0) {
             blocks_in_queue++;
+            visible_holes += isHole(block.first, 4, W);
         }
     }
     for (auto& block : lod.blocks_of_size_2) {
         if (blocks.count(ivec4(block.first, 2)) == 0) {
             blocks_in_queue++;
+            visible_holes += isHole(block.first, 2, W);
         }
     }
     for (auto& block : lod.blocks_of_size_1) {
         if (blocks.count(ivec4(block.first, 1)) == 0) {
             blocks_in_queue++;
+            visible_holes += isHole(block.first, 1, W);
         }
     }
 
-    for (int i = 0; i < blocks_per_frame; i++) {
-        generateBestBlock();
+    // Blocks touched by brushes come before any new block.
+    remeshDirtyBlocks();
+
+    // Generators that work on batches get at least a full one per frame.
+    int batch_size = terrain_generator->batchSize();
+    int block_count = (blocks_per_frame + batch_size - 1) / batch_size * batch_size;
+    for (int i = 0; i < block_count; i++) {
+        generateBestBlock(W);
+    }
+    generatePendingBlocks();
+    if (use_scatter) {
+        scatterNewBlocks();
     }
 
-    vector<ivec4> to_be_removed;
     for (auto& kv : blocks) {
         auto& block = kv.second;
+        if (block->isReady()) {
+            block->update(time_elapsed);
+        }
+    }
+
+    // Blocks in view, or about to be, are the last to be evicted.
+    markUsed(lod);
+    if (has_prediction) {
+        markUsed(prefetch_lod);
+    }
+    resident_set.update(time_elapsed, eye_position, blocks);
+}
 
-        float distance = length(eye_position - vec3(block->index));
-        if (distance > VIEW_RANGE * 1.1) {
-            // Block is no longer visible, remove, but only if size 1 or 2.
-            if (block->size < 4) {
-                to_be_removed.push_back(kv.first);
-                block->resetBlock();
-                free_blocks.push(block);
-            } else if (distance > VIEW_RANGE * 2) {
-                // Should still remove large blocks at some point.
-                to_be_removed.push_back(kv.first);
-                block->resetBlock();
-                free_blocks.push(block);
+void BlockManager::markUsed(Lod& source)
+{
+    for (auto& block : source.blocks_of_size_4) {
+        resident_set.markUsed(ivec4(block.first, 4));
+    }
+    for (auto& block : source.blocks_of_size_2) {
+        resident_set.markUsed(ivec4(block.first, 2));
+    }
+    for (auto& block : source.blocks_of_size_1) {
+        resident_set.markUsed(ivec4(block.first, 1));
+    }
+}
+
+void BlockManager::updatePrefetch(float time_elapsed, mat4 P, mat4 V, mat4 W, vec3 eye_position,
+                                  ivec4_map<float>& existing_blocks_alpha)
+{
+    mat4 camera = inverse(V);
+    vec3 eye_direction = -vec3(camera[2]);
+    vec3 eye_up = vec3(camera[1]);
+    camera_predictor.addSample(time_elapsed, eye_position, eye_direction);
+
+    vec3 predicted_position, predicted_direction;
+    has_prediction = use_prefetch &&
+        camera_predictor.predict(PREFETCH_SECONDS, predicted_position, predicted_direction);
+    if (has_prediction) {
+        mat4 predicted_V = lookAt(predicted_position, predicted_position + predicted_direction,
+                                  eye_up);
+        prefetch_lod.generateForPosition(P, predicted_V, W, predicted_position,
+                                         &existing_blocks_alpha);
+    }
+
+    ivec4_set in_view, predicted;
+    for (int size : { 1, 2, 4 }) {
+        for (auto& block : size == 1 ? lod.blocks_of_size_1 :
+                           size == 2 ? lod.blocks_of_size_2 : lod.blocks_of_size_4) {
+            in_view.insert(ivec4(block.first, size));
+        }
+        if (has_prediction) {
+            for (auto& block : size == 1 ? prefetch_lod.blocks_of_size_1 :
+                               size == 2 ? prefetch_lod.blocks_of_size_2 :
+                                           prefetch_lod.blocks_of_size_4) {
+                predicted.insert(ivec4(block.first, size));
             }
         }
+    }
 
-        if (block->isReady()) {
-            block->update(time_elapsed);
+    // Prefetched blocks that came into view were worth it. The prediction was
+    // wrong for those that stay out of it, free them for other blocks.
+    for (auto it = prefetched_blocks.begin(); it != prefetched_blocks.end(); ) {
+        if (blocks.count(it->first) == 0) {
+            it = prefetched_blocks.erase(it);
+            continue;
+        }
+        if (in_view.count(it->first) > 0) {
+            prefetch_hits++;
+            it = prefetched_blocks.erase(it);
+            continue;
         }
+
+        it->second = predicted.count(it->first) > 0 ? 0.0f : it->second + time_elapsed;
+        if (it->second > PREFETCH_CANCEL_SECONDS) {
+            auto& block = blocks[it->first];
+            block->resetBlock();
+            resident_set.release(block);
+            blocks.erase(it->first);
+            cancelled_prefetches++;
+            it = prefetched_blocks.erase(it);
+            continue;
+        }
+        ++it;
     }
+}
 
-    for (auto& index : to_be_removed) {
-        blocks.erase(index);
+// Whether a larger block that contains this one exists, to be shown while it
+// is missing.
+bool BlockManager::isCovered(ivec3 index, int size)
+{
+    for (int parent_size = size * 2; parent_size <= 4; parent_size *= 2) {
+        ivec3 parent = ivec3(floor(vec3(index) / float(parent_size))) * parent_size;
+        if (blocks.count(ivec4(parent, parent_size)) > 0) {
+            return true;
+        }
     }
+    return false;
 }
 
-shared_ptr<Block> BlockManager::newBlock(ivec3 index, int size)
+// A missing block leaves a hole unless it is covered or hidden behind the terrain.
+bool BlockManager::isHole(ivec3 index, int size, mat4 W)
+{
+    return !isCovered(index, size) && !blockIsOccluded(index, size, W);
+}
+
+const type_info& BlockManager::blockType()
+{
+    switch (active_generator) {
+        case Fast:
+        case Cpu:
+            return typeid(IndexedBlock);
+        case Compute:
+            return typeid(IndirectBlock);
+        default:
+            return typeid(Block);
+    }
+}
+
+shared_ptr<Block> BlockManager::allocateBlock(ivec3 index, int size)
 {
     shared_ptr<Block> block;
-    if (free_blocks.empty()) {
-        if (generator_selection == Fast) {
-            block = shared_ptr<IndexedBlock>(new IndexedBlock(index, size));
-        } else {
-            block = shared_ptr<Block>(new Block(index, size));
-        }
-        block->init(terrain_renderer.pos_attrib, terrain_renderer.normal_attrib,
-                    terrain_renderer.ambient_occlusion_attrib);
+    if (blockType() == typeid(IndexedBlock)) {
+        block = shared_ptr<IndexedBlock>(new IndexedBlock(index, size));
+    } else if (blockType() == typeid(IndirectBlock)) {
+        block = shared_ptr<IndirectBlock>(new IndirectBlock(index, size));
+    } else {
+        block = shared_ptr<Block>(new Block(index, size));
+    }
+    block->init(terrain_renderer.pos_attrib, terrain_renderer.normal_attrib,
+                terrain_renderer.ambient_occlusion_attrib);
+    return block;
+}
+
+shared_ptr<Block> BlockManager::newBlock(ivec3 index, int size)
+{
+    shared_ptr<Block> block = resident_set.reuse(blockType());
+    if (block == nullptr) {
+        block = allocateBlock(index, size);
     } else {
         reused_block_count++;
-        block = free_blocks.front();
-        free_blocks.pop();
 
         block->index = index;
         block->size = size;
@@ -302,7 +779,7 @@ void BlockManager::renderBlock(mat4 P, mat4 V, mat4 W, Block& block, float fadeA
     if (use_water) {
         glUniform1i(terrain_renderer.water_clip_uni, true);
         glUniform1i(terrain_renderer.water_reflection_clip_uni, false);
-        block.draw();
+        drawBlock(block, block_transform);
 
         mat4 W_reflect = glm::translate(vec3(0, water_height, 0)) *
                          glm::scale(vec3(1.0f, -1.0f, 1.0f)) *
@@ -318,7 +795,7 @@ void BlockManager::renderBlock(mat4 P, mat4 V, mat4 W, Block& block, float fadeA
         glUniform1i(terrain_renderer.water_clip_uni, false);
         glUniform1i(terrain_renderer.water_reflection_clip_uni, true);
         glUniformMatrix4fv( terrain_renderer.M_uni, 1, GL_FALSE, value_ptr(W_reflect));
-        block.draw();
+        drawBlock(block, W_reflect);
 
         if (use_stencil && block_display_type != All) {
             glDisable(GL_STENCIL_TEST);
@@ -326,7 +803,7 @@ void BlockManager::renderBlock(mat4 P, mat4 V, mat4 W, Block& block, float fadeA
     } else {
         glUniform1i(terrain_renderer.water_clip_uni, false);
         glUniform1i(terrain_renderer.water_reflection_clip_uni, false);
-        block.draw();
+        drawBlock(block, block_transform);
     }
 
     glBindVertexArray(0);
@@ -334,15 +811,32 @@ void BlockManager::renderBlock(mat4 P, mat4 V, mat4 W, Block& block, float fadeA
     CHECK_GL_ERRORS;
 }
 
+void BlockManager::drawBlock(Block& block, mat4 M)
+{
+    // Only blocks generated on the CPU have clusters.
+    IndexedBlock* indexed_block = dynamic_cast<IndexedBlock*>(&block);
+    if (use_cluster_culling && indexed_block != NULL && !indexed_block->clusters.empty()) {
+        cluster_culler.cull(*indexed_block, M);
+        indexed_block->draw(cluster_culler.counts, cluster_culler.offsets);
+    } else {
+        block.draw();
+    }
+}
+
 void BlockManager::processBlockOfSize(mat4 P, mat4 V, mat4 W,
                                       ivec2_map<float>& water_squares,
                                       ivec3 position, int size, float alpha)
 {
     ivec4 index = vec4(position, size);
     if (blocks.count(index) > 0 && blocks[index]->isReady()) {
-        // Don't draw blocks under water.
-        if (!use_water || (W * vec4(position, 1.0)).y + size >= water_height) {
+        // Don't draw blocks under water or hidden behind the terrain.
+        if (blockIsOccluded(position, size, W)) {
+            occluded_blocks++;
+        } else if (!use_water || (W * vec4(position, 1.0)).y + size >= water_height) {
             renderBlock(P, V, W, *blocks[index], alpha);
+            if (size == 1 && blocks[index]->isScattered()) {
+                scattered_blocks.push_back(blocks[index].get());
+            }
         }
 
         // Indicate grid units that need water corresponding to this block.
@@ -395,6 +889,8 @@ void BlockManager::renderStencil(mat4 P, mat4 V, mat4 W) {
 
 void BlockManager::renderBlocks(mat4 P, mat4 V, mat4 W, vec3 eye_position)
 {
+    TRACE_ZONE("BlockManager::renderBlocks");
+
     // We need to make sure not to draw water multiple times on the same grid
     // cell, because the overlapping will cause visual artifacts.
     // Keep track of the highest alpha at that cell.
@@ -408,6 +904,10 @@ void BlockManager::renderBlocks(mat4 P, mat4 V, mat4 W, vec3 eye_position)
     }
     glClear(GL_STENCIL_BUFFER_BIT);     // Clear stencil buffer (0 by default)
 
+    cluster_culler.setView(P, V);
+    occluded_blocks = 0;
+    scattered_blocks.clear();
+
     terrain_renderer.renderer_shader.enable();
         glUniformMatrix4fv(terrain_renderer.P_uni, 1, GL_FALSE, value_ptr(P));
         glUniformMatrix4fv(terrain_renderer.V_uni, 1, GL_FALSE, value_ptr(V));
@@ -419,6 +919,7 @@ void BlockManager::renderBlocks(mat4 P, mat4 V, mat4 W, vec3 eye_position)
         glUniform1i(terrain_renderer.debug_flag_uni, debug_flag);
 
         glUniform1f(terrain_renderer.clip_height_uni, water_height);
+        glUniform1i(terrain_renderer.packed_vertices_uni, PACKED_VERTICES);
 
         glUniform3f(terrain_renderer.eye_position_uni, eye_position.x, eye_position.y, eye_position.z);
 
@@ -468,6 +969,12 @@ void BlockManager::renderBlocks(mat4 P, mat4 V, mat4 W, vec3 eye_position)
         // Draw the cubes
         // Highlight the active square.
     terrain_renderer.renderer_shader.disable();
+
+    // The instances of all the blocks, one draw per species.
+    if (use_scatter) {
+        scatter.draw(P, V, W, eye_position, scattered_blocks);
+    }
+
     if (use_water) {
         water.start();
 
@@ -1,16 +1,22 @@
 #pragma once
 
-#include <queue>
 #include <memory>
 #include <vector>
 
 #include "block.hpp"
+#include "camera_predictor.hpp"
+#include "cluster_culler.hpp"
 #include "lod.hpp"
-
-#include "terrain_generator_slow.hpp"
-#include "terrain_generator_medium.hpp"
-#include "terrain_generator_fast.hpp"
+#include "occlusion_culler.hpp"
+#include "resident_set.hpp"
+#include "scatter.hpp"
+#include "startup_report.hpp"
+#include "surface_query.hpp"
+
+#include "terrain_edits.hpp"
+#include "terrain_generator.hpp"
 #include "terrain_renderer.hpp"
+#include "trace.hpp"
 
 #include "vec_hash.hpp"
 #include "swarm.hpp"
@@ -20,6 +26,8 @@ enum TerrainGeneratorSelection {
     Slow = 0,
     Medium = 1,
     Fast = 2,
+    Cpu = 3,
+    Compute = 4,
 };
 
 enum BlockDisplayType {
@@ -32,7 +40,10 @@ class BlockManager {
 public:
     BlockManager();
 
-    void init(std::string dir);
+    // Only the selected generator is created, see selectGenerator. init
+    // submits the shaders, finishInit waits for them to be linked.
+    void init(std::string dir, StartupReport& report);
+    void finishInit(StartupReport& report);
     void update(float time_elapsed, glm::mat4 P, glm::mat4 V, glm::mat4 W,
                 glm::vec3 eye_position, bool generate_blocks);
     void regenerateAllBlocks(bool alpha_blend = true);
@@ -40,9 +51,42 @@ public:
 
     void profileBlockGeneration();
 
+    // Adds the brush to terrain_edits. Only the blocks it touches, at every
+    // level of detail, are remeshed, starting with the next update and up to
+    // EDIT_BLOCKS_PER_FRAME per frame. Blocks generated later include it.
+    void applyBrush(const TerrainBrush& brush);
+    // Erodes the ground of EROSION_RESOLUTION^2 cells around center (x and z,
+    // in blocks) for that many iterations, see HydraulicErosion, and adds how
+    // much it moved to terrain_edits instead of what the previous erosion did.
+    // The blocks it changed are remeshed as for a brush.
+    void erodeTerrain(glm::vec2 center, int iterations);
+    void clearEdits();
+    // Scatters the trees and rocks again if the water moved since, they keep
+    // out of it.
+    void scatterAboveWater();
+
     int blocksInQueue() { return blocks_in_queue; }
     int blocksInView() { return blocks_in_view; }
     int reusedBlockCount() { return reused_block_count; }
+    int clustersTested() { return cluster_culler.clusters_tested; }
+    int clustersDrawn() { return cluster_culler.clusters_drawn; }
+    int occludedBlocks() { return occluded_blocks; }
+    int generatedBlockCount() { return generated_block_count; }
+    int visibleHoles() { return visible_holes; }
+    int prefetchHits() { return prefetch_hits; }
+    int cancelledPrefetches() { return cancelled_prefetches; }
+    // Blocks touched by brushes or erosion and not remeshed yet.
+    int dirtyBlocks() { return dirty_blocks.size(); }
+    // For the last edit, how many blocks it touched, and how long and how
+    // many frames it took until they were all remeshed. Generation on the GPU
+    // isn't waited for.
+    int lastEditBlocks() { return last_edit_blocks; }
+    float lastEditMilliseconds() { return last_edit_milliseconds; }
+    int lastEditFrames() { return last_edit_frames; }
+    // Including finding the heights of the ground.
+    float lastErosionMilliseconds() { return last_erosion_milliseconds; }
+    float scatterMillisecondsPerBlock() { return scatter.lastMillisecondsPerBlock(); }
+    int scatteredInstances() { return scatter.drawnInstances(); }
     int allocatedBlocks();
 
     ivec4_map<std::shared_ptr<Block>> blocks;
@@ -54,6 +98,10 @@ public:
     bool debug_flag;
     bool use_water;
     bool use_stencil;
+    bool use_scatter;
+    bool use_cluster_culling;
+    bool use_occlusion_culling;
+    bool use_prefetch;
     bool small_blocks;
     bool medium_blocks;
     bool large_blocks;
@@ -69,26 +117,94 @@ public:
     TerrainGeneratorSelection generator_selection;
 
     TerrainRenderer terrain_renderer;
-    TerrainGenerator* terrain_generator;
+    // The generator of generator_selection, null before init.
+    std::unique_ptr<TerrainGenerator> terrain_generator;
+    ResidentSet resident_set;
+    SurfaceQuery surface_query;
+    TerrainEdits terrain_edits;
 private:
     void renderBlock(glm::mat4 P, glm::mat4 V, glm::mat4 W, Block& block, float fadeAlpha);
+    void drawBlock(Block& block, glm::mat4 M);
     void renderStencil(glm::mat4 P, glm::mat4 V, glm::mat4 W);
     void processBlockOfSize(glm::mat4 P, glm::mat4 V, glm::mat4 W,
                             ivec2_map<float>& water_squares,
                             glm::ivec3 position, int size, float alpha);
+    // Replaces the generator if the selection changed. The old one is deleted
+    // with its shaders, buffers and textures before the new one is created.
+    void selectGenerator();
     std::shared_ptr<Block> newBlock(glm::ivec3 index, int size);
-    void generateBestBlock();
+    std::shared_ptr<Block> allocateBlock(glm::ivec3 index, int size);
+    // The kind of block the generator writes to.
+    const std::type_info& blockType();
+    bool blockIsOccluded(glm::ivec3 index, int size, glm::mat4 W);
+    // Filters for generateFirstMissing, combined with |.
+    enum GenerateFilter {
+        FullyVisibleOnly = 1 << 0,
+        SkipOccluded = 1 << 1,
+        HolesOnly = 1 << 2,
+        Prefetch = 1 << 3,     // Not a filter, remembers the block as prefetched.
+    };
+    bool generateFirstMissing(std::vector<std::pair<glm::ivec3, float>>& lod_blocks, int size,
+                              glm::mat4 W, int filter);
+    bool generateFirstMissing(Lod& source, glm::mat4 W, int filter);
+    void generateBestBlock(glm::mat4 W);
+    // Blocks picked by generateBestBlock are generated together, once all
+    // of this frame's are known.
+    void generatePendingBlocks();
+    void updatePrefetch(float time_elapsed, glm::mat4 P, glm::mat4 V, glm::mat4 W,
+                        glm::vec3 eye_position, ivec4_map<float>& existing_blocks_alpha);
+    bool isCovered(glm::ivec3 index, int size);
+    bool isHole(glm::ivec3 index, int size, glm::mat4 W);
+    void markUsed(Lod& source);
+    // The density changed within [low, high], in density coordinates.
+    void markEdited(glm::vec3 low, glm::vec3 high);
+    void remeshDirtyBlocks();
+    // Scatters trees and rocks on the blocks of size 1 generated since the
+    // last call, all together.
+    void scatterNewBlocks();
 
     // Keep track of this for debugging.
     int blocks_in_view;
     int blocks_in_queue;
     int reused_block_count;
+    int occluded_blocks;
+    int generated_block_count;
+    int visible_holes;
+    int prefetch_hits;
+    int cancelled_prefetches;
 
     Lod lod;
-    Water water;
-    TerrainGeneratorSlow terrain_generator_slow;
-    TerrainGeneratorMedium terrain_generator_medium;
-    TerrainGeneratorFast terrain_generator_fast;
 
-    std::queue<std::shared_ptr<Block>> free_blocks;
+    std::vector<std::shared_ptr<Block>> pending_blocks;
+
+    // Blocks touched by brushes or erosion since they were generated.
+    ivec4_set dirty_blocks;
+    Timer edit_timer;
+    int last_edit_blocks;
+    float last_edit_milliseconds;
+    int last_edit_frames;
+    float last_erosion_milliseconds;
+
+    // Blocks in view of the camera as predicted PREFETCH_SECONDS from now.
+    // Generated once nothing in view is missing.
+    CameraPredictor camera_predictor;
+    Lod prefetch_lod;
+    bool has_prediction;
+
+    // Prefetched blocks that haven't come into view yet, with how long they
+    // haven't been predicted to.
+    ivec4_map<float> prefetched_blocks;
+    ClusterCuller cluster_culler;
+    OcclusionCuller occlusion_culler;
+    Water water;
+    Scatter scatter;
+    // Blocks of size 1 drawn this frame, their instances are drawn after them.
+    std::vector<Block*> scattered_blocks;
+    float scattered_water_height;
+
+    // Where generators find their shaders.
+    std::string asset_dir;
+    // The kind of terrain_generator, generator_selection may already have
+    // changed.
+    TerrainGeneratorSelection active_generator;
 };
@@ -0,0 +1,443 @@
+#include "boids.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <sstream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "constants.hpp"
+#include "parallel_for.hpp"
+#include "trace.hpp"
+
+using namespace glm;
+using namespace std;
+
+// How the agents steer, distances in blocks and times in seconds. Neighbours
+// closer than SEPARATION_RADIUS push the agent away, harder the closer they are.
+#define SEPARATION_RADIUS 0.04f
+#define SEPARATION_WEIGHT 0.02f
+#define ALIGNMENT_WEIGHT 1.0f
+#define COHESION_WEIGHT 1.5f
+#define MIN_SPEED 0.15f
+#define MAX_SPEED 0.5f
+// Longer steps are cut, so a slow frame doesn't throw the agents into the
+// ground.
+#define MAX_TIME_STEP 0.05f
+// Twice the neighbourhood, so that it is within 2^3 cells.
+#define CELL_SIZE (2.0f * SWARM_NEIGHBOUR_RADIUS)
+
+// The ground is sampled LOOKAHEAD blocks ahead of the agent, and avoided where
+// the density there is above -AVOID_MARGIN.
+#define AVOID_LOOKAHEAD 0.2f
+#define AVOID_MARGIN 0.15f
+#define AVOID_WEIGHT 2.0f
+#define AVOID_GRADIENT_STEP 0.02f
+
+// Agents turn back past their home radius and above CEILING blocks, the
+// terrain is at most 2 blocks high.
+#define HOME_WEIGHT 0.5f
+#define CEILING 2.5f
+
+// The neighbours of an agent, see gatherNeighbours.
+struct Neighbourhood {
+    float count;
+    vec3 velocity;
+    vec3 offset;
+    vec3 separation;
+};
+
+// The agents within SWARM_NEIGHBOUR_RADIUS of position, other than itself,
+// among count candidates, a multiple of 4.
+static Neighbourhood gatherNeighbours(const float* x, const float* y, const float* z,
+                                      const float* vx, const float* vy, const float* vz,
+                                      int count, vec3 position)
+{
+    const float radius2 = SWARM_NEIGHBOUR_RADIUS * SWARM_NEIGHBOUR_RADIUS;
+    const float separation2 = SEPARATION_RADIUS * SEPARATION_RADIUS;
+
+    Neighbourhood neighbourhood = { 0.0f, vec3(0.0f), vec3(0.0f), vec3(0.0f) };
+#if defined(__SSE2__)
+    __m128 px = _mm_set1_ps(position.x);
+    __m128 py = _mm_set1_ps(position.y);
+    __m128 pz = _mm_set1_ps(position.z);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 neighbours = zero;
+    __m128 velocity[3] = { zero, zero, zero };
+    __m128 offset[3] = { zero, zero, zero };
+    __m128 separation[3] = { zero, zero, zero };
+    for (int i = 0; i < count; i += 4) {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), px);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), py);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), pz);
+        __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                               _mm_mul_ps(dz, dz));
+
+        // The agent itself is at a distance of 0.
+        __m128 other = _mm_cmpgt_ps(d2, zero);
+        __m128 near = _mm_and_ps(_mm_cmplt_ps(d2, _mm_set1_ps(radius2)), other);
+        neighbours = _mm_add_ps(neighbours, _mm_and_ps(near, one));
+        velocity[0] = _mm_add_ps(velocity[0], _mm_and_ps(near, _mm_loadu_ps(vx + i)));
+        velocity[1] = _mm_add_ps(velocity[1], _mm_and_ps(near, _mm_loadu_ps(vy + i)));
+        velocity[2] = _mm_add_ps(velocity[2], _mm_and_ps(near, _mm_loadu_ps(vz + i)));
+        offset[0] = _mm_add_ps(offset[0], _mm_and_ps(near, dx));
+        offset[1] = _mm_add_ps(offset[1], _mm_and_ps(near, dy));
+        offset[2] = _mm_add_ps(offset[2], _mm_and_ps(near, dz));
+
+        __m128 close = _mm_and_ps(_mm_cmplt_ps(d2, _mm_set1_ps(separation2)), other);
+        __m128 push = _mm_and_ps(close, _mm_div_ps(one, _mm_max_ps(d2, _mm_set1_ps(1e-8f))));
+        separation[0] = _mm_sub_ps(separation[0], _mm_mul_ps(dx, push));
+        separation[1] = _mm_sub_ps(separation[1], _mm_mul_ps(dy, push));
+        separation[2] = _mm_sub_ps(separation[2], _mm_mul_ps(dz, push));
+    }
+
+    float lanes[4];
+    auto sum = [&](__m128 value) {
+        _mm_storeu_ps(lanes, value);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    };
+    neighbourhood.count = sum(neighbours);
+    for (int axis = 0; axis < 3; axis++) {
+        neighbourhood.velocity[axis] = sum(velocity[axis]);
+        neighbourhood.offset[axis] = sum(offset[axis]);
+        neighbourhood.separation[axis] = sum(separation[axis]);
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        vec3 d = vec3(x[i], y[i], z[i]) - position;
+        float d2 = dot(d, d);
+        if (d2 <= 0.0f || d2 >= radius2) {
+            continue;
+        }
+        neighbourhood.count += 1.0f;
+        neighbourhood.velocity += vec3(vx[i], vy[i], vz[i]);
+        neighbourhood.offset += d;
+        if (d2 < separation2) {
+            neighbourhood.separation -= d / std::max(d2, 1e-8f);
+        }
+    }
+#endif
+    return neighbourhood;
+}
+
+static ivec3 cellOf(vec3 position)
+{
+    return ivec3(floor(position / CELL_SIZE));
+}
+
+// The neighbours of an agent are in the 2^3 cells from this one, those with a
+// corner nearest to it.
+static ivec3 firstNeighbourCell(vec3 position)
+{
+    return ivec3(floor(position / CELL_SIZE - 0.5f));
+}
+
+Boids::Boids()
+: home(0.0f)
+, home_radius(1.0f)
+, step_count(0)
+, last_step_milliseconds(0.0f)
+{
+}
+
+void Boids::reset(const vector<vec3>& positions, const vector<vec3>& velocities)
+{
+    int count = positions.size();
+    for (vector<float>* values : { &position_x, &position_y, &position_z, &velocity_x,
+                                   &velocity_y, &velocity_z, &avoid_x, &avoid_y, &avoid_z,
+                                   &next_position_x, &next_position_y, &next_position_z,
+                                   &next_velocity_x, &next_velocity_y, &next_velocity_z,
+                                   &next_avoid_x, &next_avoid_y, &next_avoid_z }) {
+        values->assign(count, 0.0f);
+    }
+    id.resize(count);
+    next_id.resize(count);
+    cell_hashes.resize(count);
+
+    for (int i = 0; i < count; i++) {
+        position_x[i] = positions[i].x;
+        position_y[i] = positions[i].y;
+        position_z[i] = positions[i].z;
+        velocity_x[i] = velocities[i].x;
+        velocity_y[i] = velocities[i].y;
+        velocity_z[i] = velocities[i].z;
+        id[i] = i;
+    }
+
+    // At least twice as many hashes as agents, so few cells share one.
+    int table_size = 1024;
+    while (table_size < 2 * count) {
+        table_size *= 2;
+    }
+    cell_start.resize(table_size + 1);
+    step_count = 0;
+}
+
+void Boids::positions(vector<vec3>& positions) const
+{
+    positions.resize(size());
+    for (int i = 0; i < size(); i++) {
+        positions[id[i]] = vec3(position_x[i], position_y[i], position_z[i]);
+    }
+}
+
+void Boids::velocities(vector<vec3>& velocities) const
+{
+    velocities.resize(size());
+    for (int i = 0; i < size(); i++) {
+        velocities[id[i]] = vec3(velocity_x[i], velocity_y[i], velocity_z[i]);
+    }
+}
+
+uint32_t Boids::cellHash(ivec3 cell) const
+{
+    uint32_t h = (uint32_t(cell.x) * 73856093u) ^ (uint32_t(cell.y) * 19349663u) ^
+                 (uint32_t(cell.z) * 83492791u);
+    return h & uint32_t(cell_start.size() - 2);
+}
+
+void Boids::copyCandidates(const ivec2* ranges, int range_count, Candidates& candidates) const
+{
+    int count = 0;
+    for (int r = 0; r < range_count; r++) {
+        count += ranges[r].y - ranges[r].x;
+    }
+    // Padded to a multiple of 4 with agents too far away to count.
+    int padded = (count + 3) & ~3;
+    if ((int)candidates.x.size() < padded) {
+        for (vector<float>* values : { &candidates.x, &candidates.y, &candidates.z,
+                                       &candidates.velocity_x, &candidates.velocity_y,
+                                       &candidates.velocity_z }) {
+            values->resize(padded);
+        }
+    }
+
+    int j = 0;
+    for (int r = 0; r < range_count; r++) {
+        for (int i = ranges[r].x; i < ranges[r].y; i++, j++) {
+            candidates.x[j] = position_x[i];
+            candidates.y[j] = position_y[i];
+            candidates.z[j] = position_z[i];
+            candidates.velocity_x[j] = velocity_x[i];
+            candidates.velocity_y[j] = velocity_y[i];
+            candidates.velocity_z[j] = velocity_z[i];
+        }
+    }
+    for (; j < padded; j++) {
+        candidates.x[j] = candidates.y[j] = candidates.z[j] = 1e18f;
+        candidates.velocity_x[j] = candidates.velocity_y[j] = candidates.velocity_z[j] = 0.0f;
+    }
+    candidates.count = padded;
+}
+
+void Boids::step(float time_elapsed, const TerrainDensity& terrain_density)
+{
+    TRACE_ZONE("Boids::step");
+
+    Timer timer;
+    timer.start();
+
+    time_elapsed = std::min(time_elapsed, MAX_TIME_STEP);
+    sortByCell();
+
+    parallelFor(size(), SWARM_AGENTS_PER_THREAD, SWARM_THREADS, [&](int begin, int end) {
+        steer(begin, end, time_elapsed, terrain_density);
+    });
+    std::swap(position_x, next_position_x);
+    std::swap(position_y, next_position_y);
+    std::swap(position_z, next_position_z);
+    std::swap(velocity_x, next_velocity_x);
+    std::swap(velocity_y, next_velocity_y);
+    std::swap(velocity_z, next_velocity_z);
+    std::swap(avoid_x, next_avoid_x);
+    std::swap(avoid_y, next_avoid_y);
+    std::swap(avoid_z, next_avoid_z);
+    step_count++;
+
+    timer.stop();
+    last_step_milliseconds = timer.elapsedSeconds() * 1000.0f;
+}
+
+void Boids::sortByCell()
+{
+    TRACE_ZONE("Boids::sortByCell");
+
+    // Counting sort, agents of a hash stay in the same order.
+    std::fill(cell_start.begin(), cell_start.end(), 0);
+    for (int i = 0; i < size(); i++) {
+        cell_hashes[i] = cellHash(cellOf(vec3(position_x[i], position_y[i], position_z[i])));
+        cell_start[cell_hashes[i] + 1]++;
+    }
+    for (size_t h = 1; h < cell_start.size(); h++) {
+        cell_start[h] += cell_start[h - 1];
+    }
+
+    vector<int> next_slot(cell_start.begin(), cell_start.end() - 1);
+    for (int i = 0; i < size(); i++) {
+        int slot = next_slot[cell_hashes[i]]++;
+        next_position_x[slot] = position_x[i];
+        next_position_y[slot] = position_y[i];
+        next_position_z[slot] = position_z[i];
+        next_velocity_x[slot] = velocity_x[i];
+        next_velocity_y[slot] = velocity_y[i];
+        next_velocity_z[slot] = velocity_z[i];
+        next_avoid_x[slot] = avoid_x[i];
+        next_avoid_y[slot] = avoid_y[i];
+        next_avoid_z[slot] = avoid_z[i];
+        next_id[slot] = id[i];
+    }
+    std::swap(position_x, next_position_x);
+    std::swap(position_y, next_position_y);
+    std::swap(position_z, next_position_z);
+    std::swap(velocity_x, next_velocity_x);
+    std::swap(velocity_y, next_velocity_y);
+    std::swap(velocity_z, next_velocity_z);
+    std::swap(avoid_x, next_avoid_x);
+    std::swap(avoid_y, next_avoid_y);
+    std::swap(avoid_z, next_avoid_z);
+    std::swap(id, next_id);
+}
+
+void Boids::steer(int begin, int end, float time_elapsed, const TerrainDensity& terrain_density)
+{
+    // The agents in the cells around the last agent, copied next to each other.
+    // The agents of a cell are next to each other, cells that share a hash
+    // share their range of the arrays, which is only copied once.
+    Candidates candidates;
+    ivec2 ranges[8];
+    ivec3 last_cell;
+    for (int i = begin; i < end; i++) {
+        vec3 position(position_x[i], position_y[i], position_z[i]);
+        vec3 velocity(velocity_x[i], velocity_y[i], velocity_z[i]);
+
+        ivec3 cell = firstNeighbourCell(position);
+        if (i == begin || cell != last_cell) {
+            int range_count = 0;
+            for (int z = 0; z <= 1; z++) {
+                for (int y = 0; y <= 1; y++) {
+                    for (int x = 0; x <= 1; x++) {
+                        uint32_t h = cellHash(cell + ivec3(x, y, z));
+                        ivec2 range(cell_start[h], cell_start[h + 1]);
+                        if (range.x < range.y &&
+                            std::find(ranges, ranges + range_count, range) == ranges + range_count) {
+                            ranges[range_count++] = range;
+                        }
+                    }
+                }
+            }
+            copyCandidates(ranges, range_count, candidates);
+            last_cell = cell;
+        }
+
+        Neighbourhood neighbourhood =
+            gatherNeighbours(candidates.x.data(), candidates.y.data(), candidates.z.data(),
+                             candidates.velocity_x.data(), candidates.velocity_y.data(),
+                             candidates.velocity_z.data(), candidates.count, position);
+
+        vec3 steering = SEPARATION_WEIGHT * neighbourhood.separation;
+        if (neighbourhood.count > 0.0f) {
+            steering += ALIGNMENT_WEIGHT * (neighbourhood.velocity / neighbourhood.count - velocity);
+            steering += COHESION_WEIGHT * neighbourhood.offset / neighbourhood.count;
+        }
+
+        // Agents look at the ground in turns.
+        vec3 avoid(avoid_x[i], avoid_y[i], avoid_z[i]);
+        if ((id[i] + step_count) % SWARM_AVOID_INTERVAL == 0) {
+            avoid = avoidGround(position, velocity, terrain_density);
+        }
+        steering += avoid;
+
+        steering += homeSteering(position, home, home_radius);
+        move(steering, time_elapsed, position, velocity);
+
+        next_position_x[i] = position.x;
+        next_position_y[i] = position.y;
+        next_position_z[i] = position.z;
+        next_velocity_x[i] = velocity.x;
+        next_velocity_y[i] = velocity.y;
+        next_velocity_z[i] = velocity.z;
+        next_avoid_x[i] = avoid.x;
+        next_avoid_y[i] = avoid.y;
+        next_avoid_z[i] = avoid.z;
+    }
+}
+
+vec3 Boids::avoidGround(vec3 position, vec3 velocity, const TerrainDensity& terrain_density)
+{
+    // The density ahead and a step past it along each axis, in the same
+    // coordinates as SurfaceQuery.
+    vec3 ahead = position + velocity * (AVOID_LOOKAHEAD / std::max(length(velocity), MIN_SPEED));
+    vec3 coords[4] = { ahead, ahead + vec3(AVOID_GRADIENT_STEP, 0.0f, 0.0f),
+                       ahead + vec3(0.0f, AVOID_GRADIENT_STEP, 0.0f),
+                       ahead + vec3(0.0f, 0.0f, AVOID_GRADIENT_STEP) };
+    for (vec3& point : coords) {
+        point *= float(BLOCK_SIZE);
+    }
+    float densities[4];
+    terrain_density.terrainDensity4(coords, BLOCK_RESOLUTION, SWARM_AVOID_OCTAVES, densities);
+
+    if (densities[0] < -AVOID_MARGIN) {
+        return vec3(0.0f);
+    }
+
+    // Up the density is into the ground, the harder the deeper.
+    vec3 gradient = vec3(densities[1], densities[2], densities[3]) - densities[0];
+    vec3 away = length(gradient) > 0.0f ? -normalize(gradient) : vec3(0.0f, 1.0f, 0.0f);
+    float depth = (densities[0] + AVOID_MARGIN) / AVOID_MARGIN;
+    return away * AVOID_WEIGHT * std::min(depth, 4.0f);
+}
+
+vec3 Boids::homeSteering(vec3 position, vec2 home, float home_radius)
+{
+    vec3 steering(0.0f);
+    vec2 from_home = vec2(position.x, position.z) - home;
+    if (length(from_home) > home_radius) {
+        vec2 back = -normalize(from_home);
+        steering += HOME_WEIGHT * vec3(back.x, 0.0f, back.y);
+    }
+    if (position.y > CEILING) {
+        steering.y -= HOME_WEIGHT;
+    }
+    return steering;
+}
+
+void Boids::move(vec3 steering, float time_elapsed, vec3& position, vec3& velocity)
+{
+    velocity += steering * time_elapsed;
+    float speed = length(velocity);
+    if (speed > 0.0f) {
+        velocity *= clamp(speed, MIN_SPEED, MAX_SPEED) / speed;
+    }
+    position += velocity * time_elapsed;
+}
+
+void Boids::stepAlone(float time_elapsed, const TerrainDensity& terrain_density, vec2 home,
+                      float home_radius, vec3& position, vec3& velocity)
+{
+    time_elapsed = std::min(time_elapsed, MAX_TIME_STEP);
+    vec3 steering = avoidGround(position, velocity, terrain_density) +
+                    homeSteering(position, home, home_radius);
+    move(steering, time_elapsed, position, velocity);
+}
+
+string Boids::shaderDefines()
+{
+    // At full precision, so the GPU matches stepAlone.
+    ostringstream defines;
+    defines.precision(9);
+    defines << "#define MIN_SPEED " << MIN_SPEED << "\n"
+            << "#define MAX_SPEED " << MAX_SPEED << "\n"
+            << "#define MAX_TIME_STEP " << MAX_TIME_STEP << "\n"
+            << "#define AVOID_LOOKAHEAD " << AVOID_LOOKAHEAD << "\n"
+            << "#define AVOID_MARGIN " << AVOID_MARGIN << "\n"
+            << "#define AVOID_WEIGHT " << AVOID_WEIGHT << "\n"
+            << "#define AVOID_GRADIENT_STEP " << AVOID_GRADIENT_STEP << "\n"
+            << "#define HOME_WEIGHT " << HOME_WEIGHT << "\n"
+            << "#define CEILING " << CEILING << "\n"
+            << "#define OCTAVES " << SWARM_AVOID_OCTAVES << "\n"
+            << "#define BLOCK_SIZE " << BLOCK_SIZE << "\n";
+    return defines.str();
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "terrain_density.hpp"
+
+// Flocking on the CPU (Reynolds' boids): each agent steers away from the
+// neighbours too close to it (separation), towards their mean velocity
+// (alignment) and their center (cohesion), away from the ground ahead of it
+// and back towards its home when it strays.
+//
+// Agents are kept as a structure of arrays, sorted at each step by the cell of
+// a uniform grid (cells twice as large as the neighbourhood) they are in, with
+// the cells hashed into a table of ranges of the arrays: the neighbours of an
+// agent are in the ranges of the 2^3 cells around the corner nearest to it,
+// copied next to each other once per corner and read four at a time with
+// SSE2. The ground is found by sampling the density function with
+// SWARM_AVOID_OCTAVES octaves ahead of the agent and around it for its
+// gradient, with TerrainDensity::terrainDensity4, each agent every
+// SWARM_AVOID_INTERVAL steps. Steps are split across up to SWARM_THREADS
+// threads, each agent only reads the previous step.
+//
+// Positions and velocities are in blocks and blocks per second, as block
+// indices.
+class Boids {
+public:
+    Boids();
+
+    void reset(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& velocities);
+    void step(float time_elapsed, const TerrainDensity& terrain_density);
+
+    int size() const { return position_x.size(); }
+    // In the order they were given to reset.
+    void positions(std::vector<glm::vec3>& positions) const;
+    void velocities(std::vector<glm::vec3>& velocities) const;
+
+    // Agents further than home_radius from home, along x and z, turn back.
+    glm::vec2 home;
+    float home_radius;
+
+    // Of the last step.
+    float lastStepMilliseconds() const { return last_step_milliseconds; }
+
+    // Steps one agent that doesn't see the others, only steering away from the
+    // ground ahead of it and back home, as the GPU swarm does (see
+    // SwarmUpdate.cs).
+    static void stepAlone(float time_elapsed, const TerrainDensity& terrain_density,
+                          glm::vec2 home, float home_radius, glm::vec3& position,
+                          glm::vec3& velocity);
+    // The constants of stepAlone, as #defines for the GPU.
+    static std::string shaderDefines();
+
+private:
+    // The agents around a cell, copied out of the arrays, see copyCandidates.
+    struct Candidates {
+        int count;
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> velocity_x;
+        std::vector<float> velocity_y;
+        std::vector<float> velocity_z;
+    };
+
+    // Sorts the agents by the hash of their cell and finds the range of each.
+    void sortByCell();
+    // Steers and moves the agents [begin, end), from the current arrays into
+    // the next ones.
+    void steer(int begin, int end, float time_elapsed, const TerrainDensity& terrain_density);
+    // Copies the agents of the ranges [ranges[i].x, ranges[i].y) of the arrays
+    // next to each other, so they are read four at a time whatever the size of
+    // the ranges.
+    void copyCandidates(const glm::ivec2* ranges, int range_count, Candidates& candidates) const;
+    static glm::vec3 avoidGround(glm::vec3 position, glm::vec3 velocity,
+                                 const TerrainDensity& terrain_density);
+    static glm::vec3 homeSteering(glm::vec3 position, glm::vec2 home, float home_radius);
+    // Applies the steering for time_elapsed, keeping the speed within bounds.
+    static void move(glm::vec3 steering, float time_elapsed, glm::vec3& position,
+                     glm::vec3& velocity);
+
+    uint32_t cellHash(glm::ivec3 cell) const;
+
+    // One per agent, sorted by cell.
+    std::vector<float> position_x;
+    std::vector<float> position_y;
+    std::vector<float> position_z;
+    std::vector<float> velocity_x;
+    std::vector<float> velocity_y;
+    std::vector<float> velocity_z;
+    // Steering away from the ground, kept between the steps it is updated.
+    std::vector<float> avoid_x;
+    std::vector<float> avoid_y;
+    std::vector<float> avoid_z;
+    // Index of the agent given to reset.
+    std::vector<int> id;
+
+    // The same arrays, written by a step (or the sort) then swapped in.
+    std::vector<float> next_position_x;
+    std::vector<float> next_position_y;
+    std::vector<float> next_position_z;
+    std::vector<float> next_velocity_x;
+    std::vector<float> next_velocity_y;
+    std::vector<float> next_velocity_z;
+    std::vector<float> next_avoid_x;
+    std::vector<float> next_avoid_y;
+    std::vector<float> next_avoid_z;
+    std::vector<int> next_id;
+
+    // The agents of hash h are [cell_start[h], cell_start[h + 1]).
+    std::vector<uint32_t> cell_hashes;
+    std::vector<int> cell_start;
+
+    int step_count;
+    float last_step_milliseconds;
+};
@@ -0,0 +1,111 @@
+#include "camera_path.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "constants.hpp"
+
+using namespace glm;
+using namespace std;
+
+void CameraPath::record(float time, vec3 eye_position, vec3 eye_direction, vec3 eye_up)
+{
+    CameraKeyframe keyframe;
+    keyframe.time = time;
+    keyframe.eye_position = eye_position;
+    keyframe.eye_direction = eye_direction;
+    keyframe.eye_up = eye_up;
+    keyframe.cut = !keyframes.empty() &&
+        distance(eye_position, keyframes.back().eye_position) > CAMERA_PATH_CUT_DISTANCE;
+    keyframes.push_back(keyframe);
+}
+
+CameraKeyframe CameraPath::sample(float time) const
+{
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+        [](float time, const CameraKeyframe& keyframe) { return time < keyframe.time; });
+    if (next == keyframes.begin()) {
+        return keyframes.front();
+    }
+    if (next == keyframes.end()) {
+        return keyframes.back();
+    }
+
+    const CameraKeyframe& previous = *(next - 1);
+    if (next->cut) {
+        return previous;
+    }
+
+    float t = (time - previous.time) / (next->time - previous.time);
+    CameraKeyframe keyframe;
+    keyframe.time = time;
+    keyframe.eye_position = mix(previous.eye_position, next->eye_position, t);
+    keyframe.eye_direction = normalize(mix(previous.eye_direction, next->eye_direction, t));
+    keyframe.eye_up = normalize(mix(previous.eye_up, next->eye_up, t));
+    keyframe.cut = false;
+    return keyframe;
+}
+
+float CameraPath::startTime() const
+{
+    return keyframes.empty() ? 0.0f : keyframes.front().time;
+}
+
+float CameraPath::endTime() const
+{
+    return keyframes.empty() ? 0.0f : keyframes.back().time;
+}
+
+bool CameraPath::load(const string& path)
+{
+    ifstream file(path.c_str());
+    if (!file) {
+        return false;
+    }
+
+    keyframes.clear();
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        istringstream stream(line);
+        CameraKeyframe keyframe;
+        int cut;
+        stream >> keyframe.time
+               >> keyframe.eye_position.x >> keyframe.eye_position.y >> keyframe.eye_position.z
+               >> keyframe.eye_direction.x >> keyframe.eye_direction.y >> keyframe.eye_direction.z
+               >> keyframe.eye_up.x >> keyframe.eye_up.y >> keyframe.eye_up.z
+               >> cut;
+        if (!stream || (!keyframes.empty() && keyframe.time < keyframes.back().time)) {
+            keyframes.clear();
+            return false;
+        }
+        keyframe.cut = cut != 0;
+        keyframes.push_back(keyframe);
+    }
+
+    return !keyframes.empty();
+}
+
+bool CameraPath::save(const string& path) const
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    fprintf(file, "# time, eye position, eye direction, eye up, cut\n");
+    for (const CameraKeyframe& keyframe : keyframes) {
+        fprintf(file, "%.4f  %.5f %.5f %.5f  %.5f %.5f %.5f  %.5f %.5f %.5f  %d\n", keyframe.time,
+                keyframe.eye_position.x, keyframe.eye_position.y, keyframe.eye_position.z,
+                keyframe.eye_direction.x, keyframe.eye_direction.y, keyframe.eye_direction.z,
+                keyframe.eye_up.x, keyframe.eye_up.y, keyframe.eye_up.z, keyframe.cut ? 1 : 0);
+    }
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Camera position recorded at a given time, in seconds from the start of the path.
+// A cut means the camera jumped there (a teleport) instead of moving from the
+// previous keyframe, so nothing is interpolated between the two.
+struct CameraKeyframe {
+    float time;
+    glm::vec3 eye_position;
+    glm::vec3 eye_direction;
+    glm::vec3 eye_up;
+    bool cut;
+};
+
+// A camera path recorded in first-person mode and replayed by the benchmark,
+// see Navigator::runReplay. Saved as text, one keyframe per line:
+//
+//     time  eye_position (3)  eye_direction (3)  eye_up (3)  cut (0 or 1)
+//
+// Lines starting with # are comments.
+class CameraPath {
+public:
+    // Keyframes further than CAMERA_PATH_CUT_DISTANCE from the previous one
+    // are cuts.
+    void record(float time, glm::vec3 eye_position, glm::vec3 eye_direction, glm::vec3 eye_up);
+
+    // The camera at any time between the first and last keyframe.
+    CameraKeyframe sample(float time) const;
+
+    float startTime() const;
+    float endTime() const;
+
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    std::vector<CameraKeyframe> keyframes;
+};
@@ -0,0 +1,70 @@
+#include "camera_predictor.hpp"
+
+#include <algorithm>
+
+#include <glm/gtx/rotate_vector.hpp>
+
+#include "constants.hpp"
+
+using namespace glm;
+using namespace std;
+
+CameraPredictor::CameraPredictor()
+: time(0.0f)
+{
+}
+
+void CameraPredictor::addSample(float time_elapsed, vec3 position, vec3 direction)
+{
+    time += time_elapsed;
+
+    // The camera was moved somewhere else (reset or teleported), its previous
+    // motion says nothing about where it goes next.
+    if (!samples.empty() && distance(position, samples.back().position) > PREFETCH_RESET_DISTANCE) {
+        samples.clear();
+    }
+
+    Sample sample;
+    sample.time = time;
+    sample.position = position;
+    sample.direction = normalize(direction);
+    samples.push_back(sample);
+    if (samples.size() > PREFETCH_HISTORY) {
+        samples.pop_front();
+    }
+}
+
+bool CameraPredictor::predict(float seconds, vec3& position, vec3& direction)
+{
+    if (samples.size() < 2) {
+        return false;
+    }
+
+    // Average motion over the history, it smooths out uneven frame times.
+    const Sample& oldest = samples.front();
+    const Sample& newest = samples.back();
+    float duration = newest.time - oldest.time;
+    if (duration <= 0.0f) {
+        return false;
+    }
+
+    vec3 displacement = (newest.position - oldest.position) * (seconds / duration);
+    vec3 axis = cross(oldest.direction, newest.direction);
+    float angle = acos(clamp(dot(oldest.direction, newest.direction), -1.0f, 1.0f));
+    if (length(displacement) < 1e-3f && angle < 1e-3f) {
+        return false;
+    }
+
+    if (length(displacement) > PREFETCH_MAX_DISTANCE) {
+        displacement = normalize(displacement) * PREFETCH_MAX_DISTANCE;
+    }
+    position = newest.position + displacement;
+
+    direction = newest.direction;
+    if (length(axis) > 1e-6f) {
+        float turn = std::min(angle * seconds / duration, PI / 2.0f);
+        direction = rotate(newest.direction, turn, normalize(axis));
+    }
+
+    return true;
+}
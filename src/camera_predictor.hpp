@@ -0,0 +1,29 @@
+#pragma once
+
+#include <deque>
+
+#include <glm/glm.hpp>
+
+// Extrapolates where the camera is going from its last few positions and
+// directions, so that blocks can be generated before they come into view.
+class CameraPredictor {
+public:
+    CameraPredictor();
+
+    void addSample(float time_elapsed, glm::vec3 position, glm::vec3 direction);
+
+    // Where the camera will be in the given number of seconds if it keeps
+    // moving and turning the same way, at most PREFETCH_MAX_DISTANCE away.
+    // Returns false if the camera isn't moving.
+    bool predict(float seconds, glm::vec3& position, glm::vec3& direction);
+
+private:
+    struct Sample {
+        float time;
+        glm::vec3 position;
+        glm::vec3 direction;
+    };
+
+    std::deque<Sample> samples;
+    float time;
+};
@@ -0,0 +1,83 @@
+#include "cluster_culler.hpp"
+
+#include <algorithm>
+
+#include "indexed_block.hpp"
+
+using namespace glm;
+using namespace std;
+
+ClusterCuller::ClusterCuller()
+: clusters_tested(0)
+, clusters_drawn(0)
+{
+}
+
+void ClusterCuller::setView(mat4 P, mat4 V)
+{
+    // Planes of the frustum in world space, from the rows of P * V
+    // (Gribb and Hartmann). Normals point inside.
+    mat4 PV = transpose(P * V);
+    frustum_planes[0] = PV[3] + PV[0];
+    frustum_planes[1] = PV[3] - PV[0];
+    frustum_planes[2] = PV[3] + PV[1];
+    frustum_planes[3] = PV[3] - PV[1];
+    frustum_planes[4] = PV[3] + PV[2];
+    frustum_planes[5] = PV[3] - PV[2];
+    for (vec4& plane : frustum_planes) {
+        plane /= length(vec3(plane));
+    }
+
+    eye_position = vec3(inverse(V)[3]);
+
+    clusters_tested = 0;
+    clusters_drawn = 0;
+}
+
+bool ClusterCuller::isVisible(const MeshCluster& cluster, mat4& M, float scale)
+{
+    vec3 center = vec3(M * vec4(cluster.center, 1.0f));
+    float radius = cluster.radius * scale;
+
+    for (vec4& plane : frustum_planes) {
+        if (dot(vec3(plane), center) + plane.w < -radius) {
+            return false;
+        }
+    }
+
+    // Every triangle faces away if the direction from the eye to any point
+    // of the sphere is within 90 degrees minus the cone angle of the axis.
+    vec3 axis = normalize(mat3(M) * cluster.cone_axis);
+    vec3 to_center = center - eye_position;
+    if (dot(to_center, axis) >= cluster.cone_cutoff * length(to_center) + radius) {
+        return false;
+    }
+
+    return true;
+}
+
+void ClusterCuller::cull(const IndexedBlock& block, mat4 M)
+{
+    counts.clear();
+    offsets.clear();
+
+    size_t index_unit_size = (block.index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    float scale = std::max(length(vec3(M[0])), std::max(length(vec3(M[1])), length(vec3(M[2]))));
+
+    GLuint next_index = 0;
+    for (const MeshCluster& cluster : block.clusters) {
+        clusters_tested++;
+        if (!isVisible(cluster, M, scale)) {
+            continue;
+        }
+        clusters_drawn++;
+
+        if (!counts.empty() && cluster.first_index == next_index) {
+            counts.back() += cluster.index_count;
+        } else {
+            counts.push_back(cluster.index_count);
+            offsets.push_back((const GLvoid*)(cluster.first_index * index_unit_size));
+        }
+        next_index = cluster.first_index + cluster.index_count;
+    }
+}
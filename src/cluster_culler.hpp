@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cs488-framework/OpenGLImport.hpp"
+
+#include "mesh_cluster.hpp"
+
+class IndexedBlock;
+
+// Per-cluster frustum and back face culling for blocks that have clusters.
+// Lod only culls whole blocks, so blocks near the edge of the view or far away
+// would otherwise submit many triangles that end up off screen or facing away.
+class ClusterCuller {
+public:
+    ClusterCuller();
+
+    // Call once per frame before culling.
+    void setView(glm::mat4 P, glm::mat4 V);
+
+    // Build the draw list of the clusters of block that can be visible when
+    // drawn with model transform M. Adjacent visible clusters are merged into
+    // a single draw.
+    void cull(const IndexedBlock& block, glm::mat4 M);
+
+    // Draw list for glMultiDrawElements.
+    std::vector<GLsizei> counts;
+    std::vector<const GLvoid*> offsets;
+
+    // Statistics since the last setView.
+    int clusters_tested;
+    int clusters_drawn;
+
+private:
+    bool isVisible(const MeshCluster& cluster, glm::mat4& M, float scale);
+
+    glm::vec4 frustum_planes[6];
+    glm::vec3 eye_position;
+};
@@ -8,7 +8,181 @@
 
 #define VIEW_RANGE 16
 
+// Largest octave count of the density function, which is specialized for
+// each count up to it (see TerrainDensity and OCTAVES in noise.h).
+#define MAX_OCTAVES 10
+
 #define FOG_MULTIPLIER 1.1
 #define FOG_BIAS 0.2
 
 #define ONE_BLOCK_PROFILE false
+
+// Store block vertices as 12 bytes (16-bit unorm position and ambient occlusion,
+// octahedral 16-bit normal) instead of 28 bytes of floats.
+#define PACKED_VERTICES true
+
+// The density compute shaders hash the lattice gradients each work group
+// needs once per noise, into shared memory, see cacheGradients in noise.h.
+// Meant for GPUs, software rasterizers run slower with it.
+#define DENSITY_GRADIENT_CACHE false
+
+// TerrainDensity::terrainDensityRow evaluates rows in chunks of up to
+// DENSITY_ROW_CHUNK points and hashes the lattice gradients of a noise into a
+// tile when there are at most GRADIENT_TILE_RATIO per point.
+#define DENSITY_ROW_CHUNK 64
+#define GRADIENT_TILE_RATIO 2
+#define GRADIENT_TILE_POINTS (DENSITY_ROW_CHUNK * GRADIENT_TILE_RATIO)
+
+// The compute generator generates up to GENERATOR_BATCH_SIZE blocks with one
+// dispatch per pass, see TerrainGeneratorCompute. The vertex buffer of each
+// takes a shader storage binding, there may be as few as 8 in total.
+#define GENERATOR_BATCH_SIZE 4
+
+// Terrain edits, see TerrainEdits. Brushes are indexed in cells of
+// EDIT_CELL_SIZE blocks. Spheres reach EDIT_BAND density coordinates past
+// their radius, where their density changes by EDIT_SLOPE per coordinate.
+// Smoothing blends towards the density with EDIT_SMOOTH_OCTAVES octaves. At
+// most EDIT_BLOCKS_PER_FRAME blocks touched by brushes are remeshed per frame.
+#define EDIT_CELL_SIZE 1
+#define EDIT_BAND 8.0f
+#define EDIT_SLOPE (1.0f / BLOCK_SIZE)
+#define EDIT_SMOOTH_OCTAVES 2
+#define EDIT_BLOCKS_PER_FRAME 32
+
+// Hydraulic erosion, see HydraulicErosion. The ground under EROSION_RESOLUTION^2
+// cells, EROSION_CELLS_PER_BLOCK per block, around the camera is eroded for
+// EROSION_ITERATIONS by default, in tiles of EROSION_TILE_SIZE^2 cells on up to
+// EROSION_THREADS threads, with rain hashed from EROSION_SEED. How
+// much it moved fades out over EROSION_FADE_CELLS to the edges, and moves the
+// density by EROSION_SLOPE per density coordinate, as the height gradient of
+// the density function does.
+#define EROSION_RESOLUTION 256
+#define EROSION_CELLS_PER_BLOCK 32
+#define EROSION_ITERATIONS 200
+#define EROSION_TILE_SIZE 64
+#define EROSION_THREADS 16
+#define EROSION_FADE_CELLS 16
+#define EROSION_SLOPE (0.85f / BLOCK_SIZE)
+#define EROSION_SEED 488
+
+// Swarm, see Boids. SWARM_SIZE agents by default, which see the others within
+// SWARM_NEIGHBOUR_RADIUS blocks and sample the ground ahead of them with
+// SWARM_AVOID_OCTAVES octaves every SWARM_AVOID_INTERVAL steps. Steps are split
+// across up to SWARM_THREADS threads, each moving at least
+// SWARM_AGENTS_PER_THREAD agents. On the GPU, there can be up to
+// SWARM_GPU_MAX_SIZE agents.
+#define SWARM_SIZE 16384
+#define SWARM_MAX_SIZE 131072
+#define SWARM_GPU_MAX_SIZE (1 << 22)
+#define SWARM_NEIGHBOUR_RADIUS 0.1f
+#define SWARM_AVOID_OCTAVES 3
+#define SWARM_AVOID_INTERVAL 4
+#define SWARM_THREADS 16
+#define SWARM_AGENTS_PER_THREAD 2048
+
+// Trees and rocks scattered on the ground of the blocks of size 1, see Scatter.
+// Candidates come from a tileable Poisson disk pattern with points at least
+// SCATTER_SPACING blocks apart. The ground under them is sampled
+// SCATTER_HEIGHT_STEPS times per block and the step into it bisected
+// SCATTER_REFINE_ITERATIONS times. Its normal and occlusion are sampled with
+// SCATTER_OCTAVES octaves, the occlusion SCATTER_OCCLUSION_RADIUS blocks
+// around them. Split across up to SCATTER_THREADS threads, each placing at
+// least SCATTER_POINTS_PER_THREAD candidates.
+#define SCATTER_SPECIES 2
+#define SCATTER_SPACING 0.1f
+#define SCATTER_HEIGHT_STEPS 16
+#define SCATTER_REFINE_ITERATIONS 6
+#define SCATTER_OCTAVES 4
+#define SCATTER_OCCLUSION_RADIUS 0.08f
+#define SCATTER_THREADS 4
+#define SCATTER_POINTS_PER_THREAD 64
+
+// FIFO size assumed when reordering triangles for the post-transform vertex
+// cache. Smaller than most hardware so it doesn't overestimate.
+#define VERTEX_CACHE_SIZE 16
+
+// CPU-generated meshes are split into clusters of at most this many triangles,
+// taken from bricks of CLUSTER_BRICK_SIZE^3 cells, so they can be culled
+// individually.
+#define CLUSTER_TRIANGLES 128
+#define CLUSTER_BRICK_SIZE 8
+
+// Software occlusion culling, see OcclusionCuller. Occluders are built for the
+// block columns within OCCLUDER_RANGE of the camera, each a heightfield with
+// OCCLUDER_RESOLUTION^2 quads.
+#define OCCLUSION_BUFFER_WIDTH 256
+#define OCCLUSION_BUFFER_HEIGHT 128
+#define OCCLUDER_RANGE 4
+#define OCCLUDER_RESOLUTION 8
+#define OCCLUDERS_PER_FRAME 2
+
+// The terrain textures are layers of texture arrays, so they all have the same
+// size. Images of another size are resized when loaded (or converted).
+#define TEXTURE_LAYER_SIZE 1024
+#define TEXTURE_UPLOADS_PER_FRAME 2
+
+// Every thread keeps its last TRACE_BUFFER_EVENTS trace zones, see trace.hpp.
+// Pressing T writes the ones from the last TRACE_DUMP_SECONDS seconds.
+#define TRACE_BUFFER_EVENTS (1 << 15)
+#define TRACE_DUMP_SECONDS 10
+
+// Camera path replay benchmark, see Navigator::runReplay. Recorded keyframes
+// further apart than CAMERA_PATH_CUT_DISTANCE are teleports.
+#define REPLAY_TIME_STEP (1.0f / 60.0f)
+#define REPLAY_WIDTH 1024
+#define REPLAY_HEIGHT 768
+#define CAMERA_PATH_CUT_DISTANCE 1.0f
+// After the replay, REPLAY_QUERIES_PER_SECOND surface queries and
+// REPLAY_RAYS_PER_SECOND rays from the camera per second of the path are
+// timed, within REPLAY_QUERY_RANGE blocks of the camera.
+#define REPLAY_QUERIES_PER_SECOND 4096
+#define REPLAY_RAYS_PER_SECOND 1024
+#define REPLAY_QUERY_RANGE 4.0f
+// Then EROSION_BENCHMARK_ITERATIONS of erosion on EROSION_BENCHMARK_RESOLUTION^2
+// cells around the start of the path are timed, on more and more threads.
+#define EROSION_BENCHMARK_RESOLUTION 1024
+#define EROSION_BENCHMARK_ITERATIONS 50
+// And SWARM_BENCHMARK_STEPS steps of a swarm of SWARM_BENCHMARK_SIZE agents,
+// then of SWARM_GPU_BENCHMARK_SIZE agents on the GPU.
+#define SWARM_BENCHMARK_SIZE 100000
+#define SWARM_GPU_BENCHMARK_SIZE (1 << 20)
+#define SWARM_BENCHMARK_STEPS 60
+
+// Blocks are prefetched where the camera is predicted to be PREFETCH_SECONDS
+// from now, extrapolated from its last PREFETCH_HISTORY frames and at most
+// PREFETCH_MAX_DISTANCE blocks away. Prefetched blocks that stay out of view
+// and out of the prediction for PREFETCH_CANCEL_SECONDS are freed.
+#define PREFETCH_HISTORY 8
+#define PREFETCH_SECONDS 0.75f
+#define PREFETCH_MAX_DISTANCE 4.0f
+#define PREFETCH_CANCEL_SECONDS 1.0f
+#define PREFETCH_RESET_DISTANCE 1.0f
+
+// Block memory budgets in megabytes, see ResidentSet. Over budget, blocks and
+// cached meshes are evicted down to RESIDENT_LOW_WATER of it, least recently
+// in view first. A second out of view counts as RESIDENT_BLOCKS_PER_SECOND
+// blocks of distance from the camera.
+#define RESIDENT_GPU_BUDGET 1536
+#define RESIDENT_CPU_BUDGET 256
+#define RESIDENT_LOW_WATER 0.9f
+#define RESIDENT_BLOCKS_PER_SECOND 1.0f
+
+// Surface queries, see SurfaceQuery. Each block column has a tile of
+// SURFACE_TILE_RESOLUTION^2 cells bounding the ground, found by sampling it
+// SURFACE_HEIGHT_STEPS times per block. At most SURFACE_MAX_TILES are kept.
+// Batches are split across SURFACE_QUERY_THREADS threads, each answering at
+// least SURFACE_QUERIES_PER_THREAD queries.
+#define SURFACE_TILE_RESOLUTION 8
+#define SURFACE_HEIGHT_STEPS 16
+#define SURFACE_MAX_TILES 1024
+#define SURFACE_QUERY_THREADS 4
+#define SURFACE_QUERIES_PER_THREAD 256
+
+// Ray casts, see SurfaceQuery. Steps are first bounded with RAY_BOUND_OCTAVES
+// octaves, near the ground they are at least RAY_MIN_STEP blocks and the step
+// into the ground is bisected RAY_REFINE_ITERATIONS times. Threads trace at
+// least RAYS_PER_THREAD rays.
+#define RAY_BOUND_OCTAVES 3
+#define RAY_MIN_STEP (1.0f / 32)
+#define RAY_REFINE_ITERATIONS 8
+#define RAYS_PER_THREAD 16
@@ -22,7 +22,10 @@ void DensitySlicer::init(string dir)
     density_shader.attachVertexShader((dir + "DensitySliceShader.vs").c_str());
     density_shader.attachFragmentShader((dir + "DensitySliceShader.fs").c_str());
     density_shader.link();
+}
 
+void DensitySlicer::finishInit()
+{
     P_uni = density_shader.getUniformLocation("P");
     V_uni = density_shader.getUniformLocation("V");
     M_uni = density_shader.getUniformLocation("M");
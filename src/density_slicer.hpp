@@ -12,6 +12,7 @@ public:
     DensitySlicer();
 
     void init(std::string dir);
+    void finishInit();
     void draw(glm::mat4 P, glm::mat4 V, glm::mat4 M, float size,
               float period, int octaves, float octaves_decay,
               float warp_frequency, float warp_strength);
@@ -2,6 +2,19 @@
 
 #include "cs488-framework/GlErrorCheck.hpp"
 
+Geometry::Geometry()
+: geometry_vao(0)
+, geometry_vbo(0)
+, buffer_bytes(0)
+{
+}
+
+Geometry::~Geometry()
+{
+    glDeleteBuffers(1, &geometry_vbo);
+    glDeleteVertexArrays(1, &geometry_vao);
+}
+
 void Geometry::initFromVertices(ShaderProgram& shaderProgram, float* vertices, int vertex_count)
 {
     // Create the vertex array to record buffer assignments.
@@ -12,6 +25,7 @@ void Geometry::initFromVertices(ShaderProgram& shaderProgram, float* vertices, i
     glGenBuffers(1, &geometry_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, geometry_vbo);
     glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(float), vertices, GL_STATIC_DRAW);
+    buffer_bytes = vertex_count * sizeof(float);
 
     // Specify the means of extracting the position values properly.
     GLint posAttrib = shaderProgram.getAttribLocation("position");
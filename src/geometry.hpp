@@ -8,12 +8,18 @@
 class Geometry
 {
 public:
+    Geometry();
+    virtual ~Geometry();
+
     GLuint getVertices() { return geometry_vao; }
+    // Size of the buffers, once initialized.
+    size_t bufferBytes() const { return buffer_bytes; }
 
 protected:
     // Fields related to grid geometry.
     GLuint geometry_vao; // Vertex Array Object
     GLuint geometry_vbo; // Vertex Buffer Object
+    size_t buffer_bytes;
 
     void initFromVertices(ShaderProgram& shader_program, float* vertices, int vertex_count);
 };
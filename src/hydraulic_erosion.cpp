@@ -0,0 +1,342 @@
+#include "hydraulic_erosion.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "constants.hpp"
+#include "trace.hpp"
+
+using namespace glm;
+using namespace std;
+
+// Parameters of the simulation, in cells and units of time. Water moves at
+// most a cell per step, so that the halo has everything a step reads.
+#define TIME_STEP 0.05f
+#define GRAVITY 9.81f
+#define RAIN_RATE 0.2f
+#define SEDIMENT_CAPACITY 0.01f
+#define DISSOLVE_RATE 0.2f
+#define DEPOSIT_RATE 0.2f
+#define EVAPORATION_RATE 0.3f
+// Flat ground still carries a little sediment.
+#define MIN_TILT 0.05f
+// Water shallower than this carries less sediment, it would flow too fast.
+#define FULL_DEPTH 0.05f
+
+#define STRIDE (EROSION_TILE_SIZE + 2)
+
+// Index of the cell (x, z) of a tile, from -1 to EROSION_TILE_SIZE with the
+// halo.
+static inline int at(int x, int z)
+{
+    return (z + 1) * STRIDE + x + 1;
+}
+
+// Blocks the threads that reach it until all of them have.
+class Barrier {
+public:
+    explicit Barrier(int count)
+    : count(count)
+    , waiting(0)
+    , generation(0)
+    {
+    }
+
+    void wait()
+    {
+        unique_lock<mutex> lock(m);
+        int arrived_in = generation;
+        if (++waiting == count) {
+            waiting = 0;
+            generation++;
+            all_arrived.notify_all();
+        } else {
+            all_arrived.wait(lock, [&] { return generation != arrived_in; });
+        }
+    }
+
+private:
+    mutex m;
+    condition_variable all_arrived;
+    int count;
+    int waiting;
+    int generation;
+};
+
+HydraulicErosion::HydraulicErosion(int resolution, uint32_t seed)
+: cells(resolution)
+, tiles_per_side(resolution / EROSION_TILE_SIZE)
+, seed(seed)
+, iterations_run(0)
+{
+    assert(resolution > 0 && resolution % EROSION_TILE_SIZE == 0);
+
+    tiles.resize(tiles_per_side * tiles_per_side);
+    for (int z = 0; z < tiles_per_side; z++) {
+        for (int x = 0; x < tiles_per_side; x++) {
+            Tile& tile = tiles[z * tiles_per_side + x];
+            tile.origin = ivec2(x, z) * EROSION_TILE_SIZE;
+            for (vector<float> Tile::*field : { &Tile::terrain, &Tile::water, &Tile::sediment,
+                                                &Tile::flux_left, &Tile::flux_right,
+                                                &Tile::flux_back, &Tile::flux_front,
+                                                &Tile::velocity_x, &Tile::velocity_z,
+                                                &Tile::next_terrain, &Tile::next_sediment }) {
+                (tile.*field).resize(STRIDE * STRIDE);
+            }
+        }
+    }
+}
+
+void HydraulicErosion::reset(const vector<float>& heights)
+{
+    assert((int)heights.size() == cells * cells);
+
+    initial_heights = heights;
+    iterations_run = 0;
+    for (Tile& tile : tiles) {
+        for (int z = 0; z < EROSION_TILE_SIZE; z++) {
+            for (int x = 0; x < EROSION_TILE_SIZE; x++) {
+                ivec2 cell = tile.origin + ivec2(x, z);
+                tile.terrain[at(x, z)] = heights[cell.y * cells + cell.x];
+            }
+        }
+        for (vector<float> Tile::*field : { &Tile::water, &Tile::sediment, &Tile::flux_left,
+                                            &Tile::flux_right, &Tile::flux_back,
+                                            &Tile::flux_front, &Tile::velocity_x,
+                                            &Tile::velocity_z }) {
+            std::fill((tile.*field).begin(), (tile.*field).end(), 0.0f);
+        }
+    }
+    for (Tile& tile : tiles) {
+        pullHalo(tile, &Tile::terrain, false);
+    }
+}
+
+void HydraulicErosion::run(int iterations, int thread_count)
+{
+    TRACE_ZONE("HydraulicErosion::run");
+
+    thread_count = std::max(1, std::min(thread_count, (int)tiles.size()));
+    Barrier barrier(thread_count);
+
+    // Each thread takes every thread_count-th tile. Tiles only read each other
+    // while pulling their halo, between barriers.
+    auto work = [&](int first_tile) {
+        auto eachTile = [&](const function<void(Tile&)>& step) {
+            for (size_t i = first_tile; i < tiles.size(); i += thread_count) {
+                step(tiles[i]);
+            }
+        };
+
+        for (int i = 0; i < iterations; i++) {
+            int iteration = iterations_run + i;
+            eachTile([&](Tile& tile) { updateFlux(tile, iteration); });
+            barrier.wait();
+            eachTile([&](Tile& tile) {
+                pullHalo(tile, &Tile::flux_left, true);
+                pullHalo(tile, &Tile::flux_right, true);
+                pullHalo(tile, &Tile::flux_back, true);
+                pullHalo(tile, &Tile::flux_front, true);
+            });
+            barrier.wait();
+
+            eachTile([&](Tile& tile) { updateWater(tile); });
+            barrier.wait();
+            eachTile([&](Tile& tile) {
+                pullHalo(tile, &Tile::terrain, false);
+                pullHalo(tile, &Tile::sediment, false);
+            });
+            barrier.wait();
+
+            eachTile([&](Tile& tile) { transportSediment(tile); });
+            barrier.wait();
+            eachTile([&](Tile& tile) { pullHalo(tile, &Tile::water, false); });
+            barrier.wait();
+        }
+    };
+
+    vector<thread> threads;
+    for (int i = 1; i < thread_count; i++) {
+        threads.push_back(thread([&, i] {
+            traceThreadName("Erosion " + to_string(i));
+            work(i);
+        }));
+    }
+    work(0);
+    for (thread& worker : threads) {
+        worker.join();
+    }
+
+    iterations_run += iterations;
+}
+
+void HydraulicErosion::displacement(vector<float>& heights) const
+{
+    heights.resize(cells * cells);
+    for (const Tile& tile : tiles) {
+        for (int z = 0; z < EROSION_TILE_SIZE; z++) {
+            for (int x = 0; x < EROSION_TILE_SIZE; x++) {
+                int cell = (tile.origin.y + z) * cells + tile.origin.x + x;
+                heights[cell] = tile.terrain[at(x, z)] - initial_heights[cell];
+            }
+        }
+    }
+}
+
+float HydraulicErosion::rain(ivec2 cell, int iteration) const
+{
+    // Wang hash of the seed, the cell and the iteration.
+    uint32_t h = seed ^ (uint32_t(cell.x) * 73856093u) ^ (uint32_t(cell.y) * 19349663u) ^
+                 (uint32_t(iteration) * 83492791u);
+    h = (h ^ 61u) ^ (h >> 16);
+    h *= 9u;
+    h = h ^ (h >> 4);
+    h *= 0x27d4eb2du;
+    h = h ^ (h >> 15);
+    return float(h >> 8) / float(1 << 24) * RAIN_RATE * TIME_STEP;
+}
+
+void HydraulicErosion::updateFlux(Tile& tile, int iteration)
+{
+    // It rains on the halo too, as it does on the tiles it comes from.
+    for (int z = -1; z <= EROSION_TILE_SIZE; z++) {
+        for (int x = -1; x <= EROSION_TILE_SIZE; x++) {
+            ivec2 cell = clamp(tile.origin + ivec2(x, z), ivec2(0), ivec2(cells - 1));
+            tile.water[at(x, z)] += rain(cell, iteration);
+        }
+    }
+
+    const float pipe = TIME_STEP * GRAVITY;
+    for (int z = 0; z < EROSION_TILE_SIZE; z++) {
+        for (int x = 0; x < EROSION_TILE_SIZE; x++) {
+            int i = at(x, z);
+            float level = tile.terrain[i] + tile.water[i];
+            auto outflow = [&](float flux, int neighbour) {
+                float drop = level - tile.terrain[neighbour] - tile.water[neighbour];
+                return std::max(0.0f, flux + pipe * drop);
+            };
+
+            // Nothing flows out of the cells.
+            ivec2 cell = tile.origin + ivec2(x, z);
+            float left = cell.x > 0 ? outflow(tile.flux_left[i], at(x - 1, z)) : 0.0f;
+            float right = cell.x < cells - 1 ? outflow(tile.flux_right[i], at(x + 1, z)) : 0.0f;
+            float back = cell.y > 0 ? outflow(tile.flux_back[i], at(x, z - 1)) : 0.0f;
+            float front = cell.y < cells - 1 ? outflow(tile.flux_front[i], at(x, z + 1)) : 0.0f;
+
+            // No more water flows out than there is.
+            float total = (left + right + back + front) * TIME_STEP;
+            float scale = total > tile.water[i] ? tile.water[i] / total : 1.0f;
+            tile.flux_left[i] = left * scale;
+            tile.flux_right[i] = right * scale;
+            tile.flux_back[i] = back * scale;
+            tile.flux_front[i] = front * scale;
+        }
+    }
+}
+
+void HydraulicErosion::updateWater(Tile& tile)
+{
+    const float max_speed = 1.0f / TIME_STEP;
+    for (int z = 0; z < EROSION_TILE_SIZE; z++) {
+        for (int x = 0; x < EROSION_TILE_SIZE; x++) {
+            int i = at(x, z);
+            int left = at(x - 1, z);
+            int right = at(x + 1, z);
+            int back = at(x, z - 1);
+            int front = at(x, z + 1);
+
+            float inflow = tile.flux_right[left] + tile.flux_left[right] +
+                           tile.flux_front[back] + tile.flux_back[front];
+            float outflow = tile.flux_left[i] + tile.flux_right[i] + tile.flux_back[i] +
+                            tile.flux_front[i];
+            float depth = tile.water[i];
+            float next_depth = std::max(0.0f, depth + (inflow - outflow) * TIME_STEP);
+            tile.water[i] = next_depth;
+
+            // The water going through the cell, over its mean depth.
+            float mean_depth = 0.5f * (depth + next_depth);
+            vec2 velocity(0.0f);
+            if (mean_depth > 0.0f) {
+                velocity.x = 0.5f * (tile.flux_right[left] - tile.flux_left[i] +
+                                     tile.flux_right[i] - tile.flux_left[right]) / mean_depth;
+                velocity.y = 0.5f * (tile.flux_front[back] - tile.flux_back[i] +
+                                     tile.flux_front[i] - tile.flux_back[front]) / mean_depth;
+                velocity = clamp(velocity, vec2(-max_speed), vec2(max_speed));
+            }
+            tile.velocity_x[i] = velocity.x;
+            tile.velocity_z[i] = velocity.y;
+
+            // Fast water on steep ground carries more.
+            vec2 slope = 0.5f * vec2(tile.terrain[right] - tile.terrain[left],
+                                     tile.terrain[front] - tile.terrain[back]);
+            float slope2 = dot(slope, slope);
+            float tilt = sqrt(slope2 / (1.0f + slope2));
+            float capacity = SEDIMENT_CAPACITY * std::max(tilt, MIN_TILT) * length(velocity) *
+                             std::min(1.0f, next_depth / FULL_DEPTH);
+
+            float sediment = tile.sediment[i];
+            float change = sediment < capacity ? DISSOLVE_RATE * (capacity - sediment)
+                                               : -DEPOSIT_RATE * (sediment - capacity);
+            tile.next_terrain[i] = tile.terrain[i] - change;
+            tile.next_sediment[i] = sediment + change;
+        }
+    }
+
+    // Only this tile reads them until its halo is pulled.
+    std::swap(tile.terrain, tile.next_terrain);
+    std::swap(tile.sediment, tile.next_sediment);
+}
+
+void HydraulicErosion::transportSediment(Tile& tile)
+{
+    const float evaporation = 1.0f - EVAPORATION_RATE * TIME_STEP;
+    for (int z = 0; z < EROSION_TILE_SIZE; z++) {
+        for (int x = 0; x < EROSION_TILE_SIZE; x++) {
+            int i = at(x, z);
+
+            // The sediment comes from where the water was, at most a cell away.
+            vec2 from = vec2(x, z) - vec2(tile.velocity_x[i], tile.velocity_z[i]) * TIME_STEP;
+            from = clamp(from, vec2(-1.0f), vec2(float(EROSION_TILE_SIZE)));
+            ivec2 corner = min(ivec2(floor(from)), ivec2(EROSION_TILE_SIZE - 1));
+            vec2 t = from - vec2(corner);
+            const float* s = &tile.sediment[at(corner.x, corner.y)];
+            tile.next_sediment[i] = mix(mix(s[0], s[1], t.x), mix(s[STRIDE], s[STRIDE + 1], t.x),
+                                        t.y);
+
+            tile.water[i] *= evaporation;
+        }
+    }
+    std::swap(tile.sediment, tile.next_sediment);
+}
+
+void HydraulicErosion::pullHalo(Tile& tile, vector<float> Tile::*field, bool zero_outside)
+{
+    vector<float>& values = tile.*field;
+    auto pull = [&](int x, int z) {
+        ivec2 cell = tile.origin + ivec2(x, z);
+        if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, ivec2(cells)))) {
+            if (zero_outside) {
+                values[at(x, z)] = 0.0f;
+                return;
+            }
+            cell = clamp(cell, ivec2(0), ivec2(cells - 1));
+        }
+        const Tile& from = tiles[(cell.y / EROSION_TILE_SIZE) * tiles_per_side +
+                                 cell.x / EROSION_TILE_SIZE];
+        ivec2 local = cell - from.origin;
+        values[at(x, z)] = (from.*field)[at(local.x, local.y)];
+    };
+
+    for (int x = -1; x <= EROSION_TILE_SIZE; x++) {
+        pull(x, -1);
+        pull(x, EROSION_TILE_SIZE);
+    }
+    for (int z = 0; z < EROSION_TILE_SIZE; z++) {
+        pull(-1, z);
+        pull(EROSION_TILE_SIZE, z);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Erodes a heightfield with the shallow water model of Mei et al., "Fast
+// Hydraulic Erosion Simulation and Visualization on GPU": rain falls on every
+// cell, flows to the neighbours through virtual pipes, dissolves ground where
+// it is fast and steep enough to carry more sediment than it does, deposits it
+// where it slows down, carries it along and evaporates.
+//
+// Heights are in cells, the cell is the unit of every length. The cells are
+// split into tiles of EROSION_TILE_SIZE^2 cells, each with a halo of one cell
+// copied from its neighbours between the steps of an iteration, so threads
+// work on their own tiles. Every step of a cell only reads what the previous
+// steps wrote and the rain is hashed from the seed, the cell and the
+// iteration, so the result is the same whatever the number of threads.
+class HydraulicErosion {
+public:
+    // resolution must be a multiple of EROSION_TILE_SIZE.
+    HydraulicErosion(int resolution, uint32_t seed);
+
+    // Starts over from these heights, resolution^2 of them, row-major in x.
+    void reset(const std::vector<float>& heights);
+
+    // Runs that many iterations on up to thread_count threads.
+    void run(int iterations, int thread_count);
+
+    // How much the ground went up (or down, negative) since reset, per cell.
+    void displacement(std::vector<float>& heights) const;
+
+    int resolution() const { return cells; }
+    int iterationsRun() const { return iterations_run; }
+
+private:
+    struct Tile {
+        // Of its first cell.
+        glm::ivec2 origin;
+
+        // (EROSION_TILE_SIZE + 2)^2 each, row-major in x: the cells of the
+        // tile surrounded by its halo.
+        std::vector<float> terrain;
+        std::vector<float> water;
+        std::vector<float> sediment;
+        // Water flowing out to the cells at -x, +x, -z and +z, per unit of time.
+        std::vector<float> flux_left;
+        std::vector<float> flux_right;
+        std::vector<float> flux_back;
+        std::vector<float> flux_front;
+        std::vector<float> velocity_x;
+        std::vector<float> velocity_z;
+
+        // Written by a step that still reads the current values.
+        std::vector<float> next_terrain;
+        std::vector<float> next_sediment;
+    };
+
+    // The steps of an iteration, over the tiles of one thread.
+    void updateFlux(Tile& tile, int iteration);
+    void updateWater(Tile& tile);
+    void transportSediment(Tile& tile);
+
+    // Copies the halo of a field of the tile from the tiles around it. Outside
+    // of the cells, the halo repeats the edge, or is zero for the flux.
+    void pullHalo(Tile& tile, std::vector<float> Tile::*field, bool zero_outside);
+
+    float rain(glm::ivec2 cell, int iteration) const;
+
+    int cells;
+    int tiles_per_side;
+    uint32_t seed;
+    int iterations_run;
+
+    std::vector<Tile> tiles;
+    std::vector<float> initial_heights;
+};
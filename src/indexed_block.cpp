@@ -1,24 +1,43 @@
 #include "indexed_block.hpp"
 
+#include <assert.h>
+
 #include "cs488-framework/GlErrorCheck.hpp"
 
-#include "timer.hpp"
+#include "trace.hpp"
 
 using namespace glm;
 using namespace std;
 
+BlockMesh::BlockMesh()
+: vertex_count(0)
+, index_count(0)
+, index_type(GL_UNSIGNED_INT)
+{
+}
+
+size_t BlockMesh::bytes() const
+{
+    return vertices.size() + indices.size() + clusters.size() * sizeof(MeshCluster);
+}
+
 IndexedBlock::IndexedBlock(ivec3 index, int size, bool alpha_blend)
 : Block(index, size, alpha_blend)
+, index_buffer(0)
+, index_feedback(0)
+, index_count(0)
+, index_type(GL_UNSIGNED_INT)
+, index_data_size(0)
 {
     // TODO: reevaluate amount of space needed, maybe dynamically
-    vertex_unit_size = sizeof(vec3) * 2 + sizeof(float);
     vertex_data_size = BLOCK_SIZE * BLOCK_SIZE *
                        BLOCK_SIZE * vertex_unit_size * 3;
 }
 
 IndexedBlock::~IndexedBlock()
 {
-    // TODO
+    glDeleteTransformFeedbacks(1, &index_feedback);
+    glDeleteBuffers(1, &index_buffer);
 }
 
 void IndexedBlock::init(GLint pos_attrib, GLint normal_attrib, GLint ambient_occlusion_attrib)
@@ -27,7 +46,7 @@ void IndexedBlock::init(GLint pos_attrib, GLint normal_attrib, GLint ambient_occ
 
     // TODO: reevaluate amount of space needed, maybe dynamically
     size_t index_unit_size = sizeof(ivec3);
-    size_t index_data_size = BLOCK_SIZE * BLOCK_SIZE *
+    index_data_size = BLOCK_SIZE * BLOCK_SIZE *
                              BLOCK_SIZE * index_unit_size * 15;
 
     glGenBuffers(1, &index_buffer);
@@ -55,5 +74,44 @@ void IndexedBlock::draw()
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
 
     // Should double check the sign/unsigned thing...
-    glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, index_count, index_type, 0);
+}
+
+void IndexedBlock::draw(const vector<GLsizei>& counts, const vector<const GLvoid*>& offsets)
+{
+    if (counts.empty()) {
+        return;
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glMultiDrawElements(GL_TRIANGLES, counts.data(), index_type, offsets.data(), counts.size());
+}
+
+void IndexedBlock::uploadMesh(const void* vertices, int vertex_count,
+                              const void* indices, int count, GLenum type,
+                              const vector<MeshCluster>& mesh_clusters)
+{
+    size_t index_unit_size = (type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    assert(vertex_count * vertex_unit_size <= vertex_data_size);
+    assert(count * index_unit_size <= index_data_size);
+
+    // The buffers are allocated for the worst case in init, so only
+    // overwrite the part in use.
+    glBindBuffer(GL_ARRAY_BUFFER, out_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_count * vertex_unit_size, vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, index_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * index_unit_size, indices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    index_count = count;
+    index_type = type;
+    clusters = mesh_clusters;
+
+    CHECK_GL_ERRORS;
+}
+
+void IndexedBlock::uploadMesh(const BlockMesh& mesh)
+{
+    uploadMesh(mesh.vertices.data(), mesh.vertex_count,
+               mesh.indices.data(), mesh.index_count, mesh.index_type, mesh.clusters);
 }
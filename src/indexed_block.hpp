@@ -1,6 +1,24 @@
 #pragma once
 
+#include <vector>
+
 #include "block.hpp"
+#include "mesh_cluster.hpp"
+
+// A mesh built on the CPU in the vertex format of the blocks, as uploaded by
+// IndexedBlock::uploadMesh. Kept by ResidentSet after the block is evicted.
+struct BlockMesh {
+    BlockMesh();
+
+    size_t bytes() const;
+
+    std::vector<char> vertices;
+    std::vector<char> indices;
+    int vertex_count;
+    int index_count;
+    GLenum index_type;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+    std::vector<MeshCluster> clusters;
+};
 
 class IndexedBlock : public Block {
 public:
@@ -11,9 +29,26 @@ public:
 
     void draw();
 
+    size_t bufferBytes() { return vertex_data_size + index_data_size; }
+
+    // Draw only some ranges of the index buffer, see ClusterCuller.
+    void draw(const std::vector<GLsizei>& counts, const std::vector<const GLvoid*>& offsets);
+
+    // Replace the mesh with one built on the CPU. Indices are GL_UNSIGNED_SHORT
+    // or GL_UNSIGNED_INT, vertices must be in this block's vertex format.
+    void uploadMesh(const void* vertices, int vertex_count,
+                    const void* indices, int count, GLenum type,
+                    const std::vector<MeshCluster>& mesh_clusters);
+    void uploadMesh(const BlockMesh& mesh);
+
     GLuint index_buffer;
     GLuint index_feedback;
 
     int index_count;
+    GLenum index_type;
+
+    // Empty unless the mesh was built on the CPU.
+    std::vector<MeshCluster> clusters;
 private:
+    size_t index_data_size;
 };
@@ -2,6 +2,16 @@
 
 #include "cs488-framework/GlErrorCheck.hpp"
 
+IndexedGeometry::IndexedGeometry()
+: indices_buffer(0)
+{
+}
+
+IndexedGeometry::~IndexedGeometry()
+{
+    glDeleteBuffers(1, &indices_buffer);
+}
+
 void IndexedGeometry::initFromVertices(
         ShaderProgram& shader_program,
         float* vertices, int vertex_count)
@@ -14,6 +24,7 @@ void IndexedGeometry::initFromVertices(
     glGenBuffers(1, &geometry_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, geometry_vbo);
     glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(float), vertices, GL_STATIC_DRAW);
+    buffer_bytes = vertex_count * sizeof(float);
 
     // Specify the means of extracting the position values properly.
     GLint posAttrib = shader_program.getAttribLocation("position");
@@ -26,6 +37,7 @@ void IndexedGeometry::initFromVertices(
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_buffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
         &indices[0], GL_STATIC_DRAW);
+    buffer_bytes += indices.size() * sizeof(unsigned int);
 
     // Cleanup
     glBindVertexArray(0);
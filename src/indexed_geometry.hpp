@@ -7,6 +7,9 @@
 class IndexedGeometry : public Geometry
 {
 public:
+    IndexedGeometry();
+    virtual ~IndexedGeometry();
+
     GLuint getIndices() { return indices_buffer; }
     int indexCount() { return indices.size(); }
 
@@ -0,0 +1,39 @@
+#include "indirect_block.hpp"
+
+#include "cs488-framework/GlErrorCheck.hpp"
+
+using namespace glm;
+using namespace std;
+
+IndirectBlock::IndirectBlock(ivec3 index, int size, bool alpha_blend)
+: Block(index, size, alpha_blend)
+, draw_buffer(0)
+{
+}
+
+IndirectBlock::~IndirectBlock()
+{
+    glDeleteBuffers(1, &draw_buffer);
+}
+
+void IndirectBlock::init(GLint pos_attrib, GLint normal_attrib, GLint ambient_occlusion_attrib)
+{
+    Block::init(pos_attrib, normal_attrib, ambient_occlusion_attrib);
+
+    // Nothing to draw until the block is generated.
+    DrawArraysIndirectCommand command = { 0, 1, 0, 0 };
+
+    glGenBuffers(1, &draw_buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), &command, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    CHECK_GL_ERRORS;
+}
+
+void IndirectBlock::draw()
+{
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw_buffer);
+    glDrawArraysIndirect(GL_TRIANGLES, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
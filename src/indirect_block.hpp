@@ -0,0 +1,29 @@
+#pragma once
+
+#include "block.hpp"
+
+// Matches the layout glDrawArraysIndirect reads.
+struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first;
+    GLuint base_instance;
+};
+
+// A block whose vertex count is written by the GPU into an indirect draw
+// buffer rather than recorded by transform feedback, see
+// TerrainGeneratorCompute.
+class IndirectBlock : public Block {
+public:
+    IndirectBlock(glm::ivec3 index, int size, bool alpha_blend = true);
+    virtual ~IndirectBlock();
+
+    void init(GLint pos_attrib, GLint normal_attrib, GLint ambient_occlusion_attrib);
+
+    void draw();
+
+    size_t bufferBytes() { return vertex_data_size + sizeof(DrawArraysIndirectCommand); }
+
+    // One DrawArraysIndirectCommand.
+    GLuint draw_buffer;
+};
@@ -3,6 +3,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
+#include "trace.hpp"
+
 using namespace glm;
 using namespace std;
 
@@ -99,6 +101,8 @@ bool Lod::blockIsInView(mat4& P, mat4& V, mat4& W, ivec3 block, int size)
 
 void Lod::generateForPosition(mat4 P, mat4 V, mat4 W, vec3 current_pos, ivec4_map<float>* existing_blocks_alpha)
 {
+    TRACE_ZONE("Lod::generateForPosition");
+
     blocks_of_size_1.clear();
     blocks_of_size_2.clear();
     blocks_of_size_4.clear();
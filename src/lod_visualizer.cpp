@@ -20,7 +20,10 @@ void LodVisualizer::init(string dir)
     lod_shader.attachVertexShader((dir + "ColorShader.vs").c_str());
     lod_shader.attachFragmentShader((dir + "ColorShader.fs").c_str());
     lod_shader.link();
+}
 
+void LodVisualizer::finishInit()
+{
     P_uni = lod_shader.getUniformLocation("P");
     V_uni = lod_shader.getUniformLocation("V");
     M_uni = lod_shader.getUniformLocation("M");
@@ -14,6 +14,7 @@ public:
     LodVisualizer();
 
     void init(std::string dir);
+    void finishInit();
     void draw(glm::mat4 P, glm::mat4 V, glm::mat4 W, glm::vec3 current_pos);
 
 private:
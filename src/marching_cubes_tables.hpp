@@ -0,0 +1,22 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// The marching cubes algorithm consists of 256 cases of triangle configurations
+// (each corner can be on or off). Same layout as Assets/marching_cubes_common.h,
+// the corner bits of a case index are
+// 0: (0, 0, 0)  1: (0, 1, 0)  2: (1, 1, 0)  3: (1, 0, 0)
+// 4: (0, 0, 1)  5: (0, 1, 1)  6: (1, 1, 1)  7: (1, 0, 1)
+
+// Lookup table for many polygons for each of the 256 cases.
+extern const int case_to_numpolys[256];
+
+extern const glm::ivec3 edge_start[12];
+extern const glm::ivec3 edge_dir[12];
+
+// Axis (0 = x, 1 = y, 2 = z) along which the edge lies.
+extern const int edge_axis[12];
+
+// Each case can have up to 5 triangles, each defined by the index of the
+// 3 edges in which its vertices are located.
+extern const int edge_connect_list[256][5][3];
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "cs488-framework/OpenGLImport.hpp"
+
+// A run of up to CLUSTER_TRIANGLES nearby triangles in a block's index buffer,
+// with bounds to cull them separately from the rest of the block. Everything
+// is in block space, where the block spans [0, 1].
+struct MeshCluster {
+    GLuint first_index;
+    GLuint index_count;
+
+    // Bounding sphere.
+    glm::vec3 center;
+    float radius;
+
+    // All triangle normals are within the cone around cone_axis, cone_cutoff
+    // is the sine of its half angle. Set to 1 when the cone is too wide to
+    // ever be entirely back facing.
+    glm::vec3 cone_axis;
+    float cone_cutoff;
+};
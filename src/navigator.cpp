@@ -2,7 +2,10 @@
 #include "cs488-framework/GlErrorCheck.hpp"
 
 #include <iostream>
+#include <random>
 #include <stdlib.h>
+#include <time.h>
+#include <thread>
 
 #include <imgui/imgui.h>
 #include <glm/glm.hpp>
@@ -10,17 +13,18 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
-#include "timer.hpp"
-
-// From ImGui demo
-#define IM_ARRAYSIZE(_ARR)  ((int)(sizeof(_ARR)/sizeof(*_ARR)))
+#include "hydraulic_erosion.hpp"
+#include "replay_stats.hpp"
+#include "trace.hpp"
 
 using namespace glm;
 using namespace std;
 
 //----------------------------------------------------------------------------------------
 // Constructor
-Navigator::Navigator()
+Navigator::Navigator(string replay_path, int replay_benchmarks)
+: replay_path(replay_path)
+, replay_benchmarks(replay_benchmarks)
 {
     rotation = 0.0f;
     rotation_vertical = 0.0f;
@@ -35,11 +39,18 @@ Navigator::Navigator()
     show_lod = false;
     show_slicer = false;
     show_terrain = true;
+    show_swarm = false;
     generate_blocks = true;
 
-    selected_texture_top = -1;
-    selected_texture_front = -1;
-    selected_texture_side = -1;
+    brush_type = AddSphere;
+    brush_radius = 0.2f;
+    brush_strength = 0.5f;
+    erosion_iterations = EROSION_ITERATIONS;
+    swarm_size = SWARM_SIZE;
+    swarm_on_gpu = false;
+
+    recording = false;
+    recording_time = 0.0f;
 }
 
 //----------------------------------------------------------------------------------------
@@ -61,23 +72,49 @@ void Navigator::init()
     glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &result);
     printf("Max 3D texture size: %d\n", result);
 
-    // Call the script that will include shader code into other shaders.
-    system((m_exec_dir + "/Assets/include.py").c_str());
+    traceThreadName("Main");
 
-    // Build the shaders
-    Timer shader_init_timer;
-    shader_init_timer.start();
+    // Linked shaders are kept across runs, so that only the first start after
+    // changing a shader (or the driver) needs to compile it.
+    ShaderProgram::setBinaryCacheDirectory(m_exec_dir + "/Assets/cache/");
+    ShaderProgram::enableParallelCompile();
+
+    // Build the shaders. All of them are submitted first and the driver
+    // compiles them while the CPU loads the audio, then each component waits
+    // for its own to be linked.
+    StartupReport startup_report;
     {
-        string dir = m_exec_dir + "/Assets/out/";
-        block_manager.init(dir);
+        string dir = m_exec_dir + "/Assets/";
+        block_manager.init(dir, startup_report);
+
+        startup_report.step("Density slicer");
         density_slicer.init(dir);
+
+        startup_report.step("LOD visualizer");
         lod.init(dir);
 
+        startup_report.step("Swarm");
+        // Its agents are only placed once it is shown, see guiLogic.
         swarm.init(dir);
-        swarm.initializeAttributes(*block_manager.terrain_generator);
+
+        // Replays run silently.
+        if (replay_path.empty()) {
+            startup_report.step("Audio");
+            background_music = unique_ptr<Sound>(new Sound("Audio/Jungle_Village.wav"));
+        }
+
+        block_manager.finishInit(startup_report);
+
+        startup_report.step("Density slicer, linked");
+        density_slicer.finishInit();
+
+        startup_report.step("LOD visualizer, linked");
+        lod.finishInit();
+
+        startup_report.step("Swarm, linked");
+        swarm.finishInit();
     }
-    shader_init_timer.stop();
-    printf("Compiling shaders took %.2f seconds\n", shader_init_timer.elapsedSeconds());
+    startup_report.print();
 
     resetView();
 
@@ -85,7 +122,11 @@ void Navigator::init()
     // since it depends on the GLFW window being set up correctly).
     makeView();
 
-    background_music = unique_ptr<Sound>(new Sound("Audio/Jungle_Village.wav"));
+    if (!replay_path.empty()) {
+        runReplay();
+        glfwSetWindowShouldClose(m_window, GL_TRUE);
+        return;
+    }
 }
 
 void Navigator::resetView()
@@ -101,6 +142,16 @@ void Navigator::resetView()
     eye_up = cross(eye_right, eye_direction);
 }
 
+void Navigator::dumpTrace()
+{
+    string path = m_exec_dir + "/trace-" + to_string(time(nullptr)) + ".json";
+    if (writeTrace(path, TRACE_DUMP_SECONDS)) {
+        printf("Wrote the last %d seconds of trace to %s\n", TRACE_DUMP_SECONDS, path.c_str());
+    } else {
+        cerr << "Could not write trace to " << path << endl;
+    }
+}
+
 void Navigator::makeView()
 {
     proj = glm::perspective(
@@ -116,11 +167,14 @@ void Navigator::makeView()
  */
 void Navigator::appLogic()
 {
+    TRACE_ZONE("Navigator::appLogic");
+
     // Animations should not be dependent on FPS.
     float time_elapsed = ImGui::GetIO().DeltaTime;
 
     // First person camera controls.
     if (first_person_mode) {
+        vec3 previous_eye_position = eye_position;
         vec3 eye_right = cross(eye_direction, eye_up);
         float factor = 0.02f * camera_speed;
 
@@ -149,9 +203,34 @@ void Navigator::appLogic()
             eye_position -= eye_up * factor;
         }
 
+        // Don't go into the ground, but let the camera out if it started
+        // there. The world is offset by half a block from block indices, see
+        // updateTerrain.
+        if (eye_position != previous_eye_position) {
+            SurfaceQuery& surface_query = block_manager.surface_query;
+            if (surface_query.isSolid(eye_position + vec3(0.5f)) &&
+                !surface_query.isSolid(previous_eye_position + vec3(0.5f))) {
+                eye_position = previous_eye_position;
+            }
+        }
+
         makeView();
     }
 
+    if (recording) {
+        recording_time += time_elapsed;
+        recorded_path.record(recording_time, eye_position, eye_direction, eye_up);
+    }
+
+    updateTerrain(time_elapsed);
+
+    if (show_swarm) {
+        swarm.update(time_elapsed, *block_manager.terrain_generator);
+    }
+}
+
+void Navigator::updateTerrain(float time_elapsed)
+{
     // Create a global transformation for the model.
     float offset = -0.5f;
     W = glm::translate(mat4(), vec3(offset, offset, offset));
@@ -160,6 +239,279 @@ void Navigator::appLogic()
     block_manager.update(time_elapsed, proj, view, W, eye_position, generate_blocks);
 }
 
+void Navigator::toggleRecording()
+{
+    if (recording) {
+        recording = false;
+        string path = m_exec_dir + "/camera-path-" + to_string(time(nullptr)) + ".txt";
+        if (recorded_path.save(path)) {
+            printf("Saved camera path to %s, replay it with --replay\n", path.c_str());
+        } else {
+            cerr << "Could not save camera path to " << path << endl;
+        }
+    } else if (first_person_mode) {
+        recording = true;
+        recording_time = 0.0f;
+        recorded_path.keyframes.clear();
+    } else {
+        printf("Camera paths are recorded in first person mode\n");
+    }
+}
+
+void Navigator::applyBrush()
+{
+    // Block indices are offset by half a block from the world, see
+    // updateTerrain.
+    RayHit hit = block_manager.surface_query.castRay(eye_position + vec3(0.5f), eye_direction,
+                                                     far_plane);
+    if (!hit.hit) {
+        printf("The brush needs the camera to look at the ground\n");
+        return;
+    }
+
+    TerrainBrush brush;
+    brush.type = brush_type;
+    brush.center = hit.position;
+    brush.radius = brush_radius;
+    brush.strength = brush_strength;
+    block_manager.applyBrush(brush);
+}
+
+/*
+ * Replay the camera path at replay_path one frame per REPLAY_TIME_STEP,
+ * whatever the time the frames take, and print the frame times, the block
+ * generation rate and how long it took to get all blocks in view after each
+ * teleport. Textures are loaded first so that every run does the same work.
+ * The peak memory is the replay's, the replay_benchmarks run after it.
+ */
+void Navigator::runReplay()
+{
+    CameraPath camera_path;
+    if (!camera_path.load(replay_path)) {
+        cerr << "Could not load camera path " << replay_path << endl;
+        return;
+    }
+
+    block_manager.terrain_renderer.finishLoadingTextures();
+
+    ReplayStats stats;
+    int frame_count = (int)ceil((camera_path.endTime() - camera_path.startTime()) /
+                                REPLAY_TIME_STEP) + 1;
+    size_t next_keyframe = 0;
+    for (int frame = 0; frame < frame_count; frame++) {
+        float time = camera_path.startTime() + frame * REPLAY_TIME_STEP;
+
+        // The start of the path counts as a teleport too.
+        bool teleported = frame == 0;
+        for (; next_keyframe < camera_path.keyframes.size() &&
+               camera_path.keyframes[next_keyframe].time <= time; next_keyframe++) {
+            teleported = teleported || camera_path.keyframes[next_keyframe].cut;
+        }
+        if (teleported) {
+            stats.teleport();
+        }
+
+        CameraKeyframe camera = camera_path.sample(time);
+        eye_position = camera.eye_position;
+        eye_direction = camera.eye_direction;
+        eye_up = camera.eye_up;
+        makeView();
+
+        int generated_blocks = block_manager.generatedBlockCount();
+
+        uint64_t start = traceClock();
+        {
+            TRACE_ZONE("Replay frame");
+
+            updateTerrain(REPLAY_TIME_STEP);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            draw();
+
+            // Include the time the GPU takes.
+            glFinish();
+        }
+        stats.addFrame((traceClock() - start) / 1e9,
+                       block_manager.generatedBlockCount() - generated_blocks,
+                       block_manager.blocksInQueue(), block_manager.visibleHoles());
+    }
+
+    stats.finishReplay();
+
+    benchmarkSurfaceQueries(camera_path, stats);
+    stats.print();
+
+    // Much longer than the replay, and they take memory of their own.
+    if (replay_benchmarks & ErosionBenchmark) {
+        benchmarkErosion(camera_path, stats);
+    }
+    if (replay_benchmarks & SwarmBenchmark) {
+        benchmarkSwarm(camera_path, stats);
+    }
+    stats.printBenchmarks();
+}
+
+/*
+ * Time batches of surface queries around the camera path, as gameplay code
+ * would make them: once with no tiles, so they are built too, and once more
+ * with the tiles.
+ */
+void Navigator::benchmarkSurfaceQueries(const CameraPath& camera_path, ReplayStats& stats)
+{
+    // The same queries every run.
+    mt19937 generator(488);
+    uniform_real_distribution<float> offset(-REPLAY_QUERY_RANGE, REPLAY_QUERY_RANGE);
+    // The terrain is at most 2 blocks high.
+    uniform_real_distribution<float> height(0.0f, 2.0f);
+
+    uniform_real_distribution<float> axis(-1.0f, 1.0f);
+
+    vector<vec2> columns;
+    vector<vec3> points;
+    vector<vec3> ray_origins;
+    vector<vec3> ray_directions;
+    for (float time = camera_path.startTime(); time <= camera_path.endTime(); time += 1.0f) {
+        // The world is offset by half a block from block indices, see updateTerrain.
+        vec3 eye = camera_path.sample(time).eye_position + vec3(0.5f);
+        for (int i = 0; i < REPLAY_QUERIES_PER_SECOND; i++) {
+            vec2 column = vec2(eye.x, eye.z) + vec2(offset(generator), offset(generator));
+            columns.push_back(column);
+            points.push_back(vec3(column.x, height(generator), column.y));
+        }
+        for (int i = 0; i < REPLAY_RAYS_PER_SECOND; i++) {
+            vec3 direction;
+            do {
+                direction = vec3(axis(generator), axis(generator), axis(generator));
+            } while (length(direction) > 1.0f || length(direction) < 0.01f);
+            ray_origins.push_back(eye);
+            ray_directions.push_back(normalize(direction));
+        }
+    }
+
+    SurfaceQuery& surface_query = block_manager.surface_query;
+    surface_query.reset(block_manager.terrain_generator->densityFunction());
+
+    vector<float> heights;
+    vector<char> solid;
+    Timer timer;
+
+    timer.start();
+    surface_query.surfaceHeights(columns, heights);
+    timer.stop();
+    stats.addQueries("surface height, building tiles", columns.size(), timer.elapsedSeconds());
+
+    timer.start();
+    surface_query.surfaceHeights(columns, heights);
+    timer.stop();
+    stats.addQueries("surface height", columns.size(), timer.elapsedSeconds());
+
+    timer.start();
+    surface_query.isSolid(points, solid);
+    timer.stop();
+    stats.addQueries("is solid", points.size(), timer.elapsedSeconds());
+
+    // Build the tiles first, to only time the rays.
+    vector<RayHit> hits;
+    surface_query.castRays(ray_origins, ray_directions, REPLAY_QUERY_RANGE, hits);
+
+    surface_query.use_ray_packets = false;
+    timer.start();
+    surface_query.castRays(ray_origins, ray_directions, REPLAY_QUERY_RANGE, hits);
+    timer.stop();
+    stats.addQueries("ray cast, one at a time", ray_origins.size(), timer.elapsedSeconds());
+
+    surface_query.use_ray_packets = true;
+    timer.start();
+    surface_query.castRays(ray_origins, ray_directions, REPLAY_QUERY_RANGE, hits);
+    timer.stop();
+    stats.addQueries("ray cast, four at a time", ray_origins.size(), timer.elapsedSeconds());
+}
+
+/*
+ * Time erosion of the ground around the start of the camera path on one
+ * thread, then on twice as many until all the cores are used, and check that
+ * they all erode it the same.
+ */
+void Navigator::benchmarkErosion(const CameraPath& camera_path, ReplayStats& stats)
+{
+    const int n = EROSION_BENCHMARK_RESOLUTION;
+    vec3 eye = camera_path.sample(camera_path.startTime()).eye_position + vec3(0.5f);
+    vec2 origin = vec2(eye.x, eye.z) - 0.5f * n / EROSION_CELLS_PER_BLOCK;
+    vector<vec2> columns(n * n);
+    for (int z = 0; z < n; z++) {
+        for (int x = 0; x < n; x++) {
+            columns[z * n + x] = origin + vec2(x, z) / float(EROSION_CELLS_PER_BLOCK);
+        }
+    }
+    vector<float> heights;
+    block_manager.surface_query.surfaceHeights(columns, heights);
+    for (float& height : heights) {
+        height *= EROSION_CELLS_PER_BLOCK;
+    }
+
+    HydraulicErosion erosion(n, EROSION_SEED);
+    vector<float> one_thread;
+    vector<float> displacement;
+    int max_threads = std::max(1, std::min((int)thread::hardware_concurrency(), EROSION_THREADS));
+    for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+        erosion.reset(heights);
+        Timer timer;
+        timer.start();
+        erosion.run(EROSION_BENCHMARK_ITERATIONS, threads);
+        timer.stop();
+
+        erosion.displacement(displacement);
+        if (threads == 1) {
+            one_thread = displacement;
+        }
+        stats.addErosion(n, threads, EROSION_BENCHMARK_ITERATIONS, timer.elapsedSeconds(),
+                         displacement == one_thread);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
+/*
+ * Time steps of a swarm of SWARM_BENCHMARK_SIZE agents around the start of the
+ * camera path, then of SWARM_GPU_BENCHMARK_SIZE agents on the GPU, after
+ * checking that its steps match the CPU.
+ */
+void Navigator::benchmarkSwarm(const CameraPath& camera_path, ReplayStats& stats)
+{
+    vec3 eye = camera_path.sample(camera_path.startTime()).eye_position + vec3(0.5f);
+    Boids boids;
+    Swarm::placeAgents(block_manager.surface_query, vec2(eye.x, eye.z), SWARM_BENCHMARK_SIZE,
+                       boids);
+
+    const TerrainDensity& terrain_density = block_manager.surface_query.densityFunction();
+    Timer timer;
+    timer.start();
+    for (int i = 0; i < SWARM_BENCHMARK_STEPS; i++) {
+        boids.step(REPLAY_TIME_STEP, terrain_density);
+    }
+    timer.stop();
+    stats.addSwarm(false, boids.size(), SWARM_BENCHMARK_STEPS, timer.elapsedSeconds(), 0.0f);
+
+    // Its own swarm, the one shown is left as it is. Its buffers are freed
+    // when it goes.
+    Swarm gpu_swarm;
+    gpu_swarm.init(m_exec_dir + "/Assets/");
+    gpu_swarm.finishInit();
+
+    TerrainGenerator& terrain_generator = *block_manager.terrain_generator;
+    gpu_swarm.initializeAttributes(block_manager.surface_query, SWARM_GPU_BENCHMARK_SIZE, true);
+    float max_error = gpu_swarm.compareGpuStep(REPLAY_TIME_STEP, terrain_generator);
+    timer.start();
+    for (int i = 0; i < SWARM_BENCHMARK_STEPS; i++) {
+        gpu_swarm.update(REPLAY_TIME_STEP, terrain_generator);
+    }
+    // Include the time the GPU takes.
+    glFinish();
+    timer.stop();
+    stats.addSwarm(true, gpu_swarm.size(), SWARM_BENCHMARK_STEPS, timer.elapsedSeconds(),
+                   max_error);
+}
+
 //----------------------------------------------------------------------------------------
 /*
  * Called once per frame, after appLogic(), but before the draw() method.
@@ -183,45 +535,25 @@ void Navigator::guiLogic()
     if (ImGui::Begin("Debug Window", &showDebugWindow, ImVec2(100, 100), opacity, windowFlags)) {
 
         ImGui::SliderFloat("Water Height", &block_manager.water_height, -0.5f, 1.5f);
+        // Once the slider is released, every block is scattered again.
+        if (!ImGui::IsItemActive()) {
+            block_manager.scatterAboveWater();
+        }
         ImGui::Checkbox("Use Water", &block_manager.use_water);
         ImGui::Checkbox("Use Stencil", &block_manager.use_stencil);
-
-        const char* items[] = {
-            "Ancient Flooring",
-            "Boards",
-            "CherryBark",
-            "Chimeny",
-            "CliffRock",
-            "CliffRock2",
-            "Dirt",
-            "Grass",
-            "Grass2",
-            "GrassDry",
-            "GrassPurpleFlowers",
-            "GrassSparse",
-            "Gravel",
-            "GroundCover",
-            "Hay",
-            "LeafyGround",
-            "Mud",
-            "OakBark",
-            "PackedDirt",
-            "PineBarkYoung",
-            "PineNeedles",
-            "Roof1",
-            "Siding1",
-            "Siding2",
-            "Stone1",
-        };
-
-        if (ImGui::Combo("Top texture", &selected_texture_top, items, IM_ARRAYSIZE(items))) {
-            block_manager.terrain_renderer.changeTopTexture(items[selected_texture_top]);
-        }
-        if (ImGui::Combo("Front texture", &selected_texture_front, items, IM_ARRAYSIZE(items))) {
-            block_manager.terrain_renderer.changeFrontTexture(items[selected_texture_front]);
-        }
-        if (ImGui::Combo("Side texture", &selected_texture_side, items, IM_ARRAYSIZE(items))) {
-            block_manager.terrain_renderer.changeSideTexture(items[selected_texture_side]);
+        ImGui::Checkbox("Trees and Rocks", &block_manager.use_scatter);
+
+        TerrainRenderer& renderer = block_manager.terrain_renderer;
+        // ImGui wants a non-const array.
+        vector<const char*> texture_names = renderer.textureNames();
+        ImGui::Combo("Top texture", &renderer.top_texture,
+                     texture_names.data(), texture_names.size());
+        ImGui::Combo("Front texture", &renderer.front_texture,
+                     texture_names.data(), texture_names.size());
+        ImGui::Combo("Side texture", &renderer.side_texture,
+                     texture_names.data(), texture_names.size());
+        if (renderer.texturesLoading() > 0) {
+            ImGui::Text("Loading textures: %d", renderer.texturesLoading());
         }
 
         if (ImGui::RadioButton("One Block", (int*)&block_manager.block_display_type, 0)) {
@@ -291,7 +623,7 @@ void Navigator::guiLogic()
             if (ImGui::SliderFloat("Period", &block_manager.terrain_generator->period, 10.0f, 100.0f)) {
                 block_manager.regenerateAllBlocks(false);
             }
-            if (ImGui::SliderInt("Octaves", &block_manager.terrain_generator->octaves, 1, 10)) {
+            if (ImGui::SliderInt("Octaves", &block_manager.terrain_generator->octaves, 1, MAX_OCTAVES)) {
                 block_manager.regenerateAllBlocks(false);
             }
             if (ImGui::SliderFloat("Octaves Decay", &block_manager.terrain_generator->octaves_decay, 1.0f, 4.0f)) {
@@ -306,6 +638,8 @@ void Navigator::guiLogic()
 
             ImGui::Checkbox("Generate Blocks", &generate_blocks);
             ImGui::SliderInt("Blocks per Frame", &block_manager.blocks_per_frame, 1, 8);
+            ImGui::SliderInt("Block Memory (MB)", &block_manager.resident_set.gpu_budget, 256, 8192);
+            ImGui::SliderInt("Mesh Cache (MB)", &block_manager.resident_set.cpu_budget, 0, 2048);
 
             if (ImGui::RadioButton("Slow Generator", (int*)&block_manager.generator_selection, 0)) {
                 block_manager.regenerateAllBlocks();
@@ -316,6 +650,59 @@ void Navigator::guiLogic()
             if (ImGui::RadioButton("Fast Generator (do not use)", (int*)&block_manager.generator_selection, 2)) {
                 block_manager.regenerateAllBlocks();
             }
+            if (ImGui::RadioButton("CPU Generator (indexed)", (int*)&block_manager.generator_selection, 3)) {
+                block_manager.regenerateAllBlocks();
+            }
+            if (ImGui::RadioButton("Compute Generator", (int*)&block_manager.generator_selection, 4)) {
+                block_manager.regenerateAllBlocks();
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Terrain Editing (B)", "", true, true)) {
+            ImGui::RadioButton("Add Sphere", (int*)&brush_type, AddSphere);
+            ImGui::RadioButton("Subtract Sphere", (int*)&brush_type, SubtractSphere);
+            ImGui::RadioButton("Flatten", (int*)&brush_type, Flatten);
+            ImGui::RadioButton("Smooth", (int*)&brush_type, Smooth);
+            ImGui::SliderFloat("Brush Radius", &brush_radius, 0.05f, 1.0f);
+            ImGui::SliderFloat("Brush Strength", &brush_strength, 0.0f, 1.0f);
+            ImGui::SliderInt("Erosion Iterations", &erosion_iterations, 10, 1000);
+            if (ImGui::Button("Erode Around Camera")) {
+                // The world is offset by half a block from block indices.
+                vec3 eye = eye_position + vec3(0.5f);
+                block_manager.erodeTerrain(vec2(eye.x, eye.z), erosion_iterations);
+            }
+            if (ImGui::Button("Clear Edits")) {
+                block_manager.clearEdits();
+            }
+            ImGui::Text("Brushes: %d", block_manager.terrain_edits.brushCount());
+            ImGui::Text("Last erosion: %.1f ms", block_manager.lastErosionMilliseconds());
+            ImGui::Text("Last edit: %d blocks remeshed in %.1f ms, %d frames",
+                        block_manager.lastEditBlocks(), block_manager.lastEditMilliseconds(),
+                        block_manager.lastEditFrames());
+        }
+
+        if (ImGui::CollapsingHeader("Swarm", "", true, true)) {
+            ImGui::Checkbox("Show Swarm", &show_swarm);
+            ImGui::Checkbox("Swarm on GPU", &swarm_on_gpu);
+            ImGui::SliderInt("Swarm Size", &swarm_size, 1024,
+                             swarm_on_gpu ? SWARM_GPU_MAX_SIZE : SWARM_MAX_SIZE);
+            // Placing the swarm takes a while: only when it is shown, and once the
+            // slider is released.
+            if (show_swarm && !ImGui::IsItemActive() &&
+                (swarm_size != swarm.size() || swarm_on_gpu != swarm.onGpu())) {
+                swarm_size = std::min(swarm_size,
+                                      swarm_on_gpu ? SWARM_GPU_MAX_SIZE : SWARM_MAX_SIZE);
+                swarm.initializeAttributes(block_manager.surface_query, swarm_size, swarm_on_gpu);
+            }
+            if (swarm.onGpu()) {
+                if (ImGui::Button("Compare GPU Step")) {
+                    float max_error = swarm.compareGpuStep(ImGui::GetIO().DeltaTime,
+                                                           *block_manager.terrain_generator);
+                    printf("GPU swarm step: %g blocks from the CPU\n", max_error);
+                }
+            } else {
+                ImGui::Text("Swarm step: %.1f ms", swarm.lastStepMilliseconds());
+            }
         }
 
         if (ImGui::CollapsingHeader("Debug Options", "", true, true)) {
@@ -326,6 +713,9 @@ void Navigator::guiLogic()
             ImGui::Checkbox("Small Blocks", &block_manager.small_blocks);
             ImGui::Checkbox("Medium Blocks", &block_manager.medium_blocks);
             ImGui::Checkbox("Large Blocks", &block_manager.large_blocks);
+            ImGui::Checkbox("Cluster Culling", &block_manager.use_cluster_culling);
+            ImGui::Checkbox("Occlusion Culling", &block_manager.use_occlusion_culling);
+            ImGui::Checkbox("Prefetch Blocks", &block_manager.use_prefetch);
             ImGui::Checkbox("Wireframe", &wireframe);
             ImGui::Checkbox("Triplanar Colors", &block_manager.triplanar_colors);
             ImGui::Checkbox("Show Ambient Occlusion", &block_manager.show_ambient);
@@ -355,6 +745,24 @@ void Navigator::guiLogic()
         ImGui::Text("Blocks in view: %d", block_manager.blocksInView());
         ImGui::Text("Allocated blocks: %d", block_manager.allocatedBlocks());
         ImGui::Text("Reused blocks: %d", block_manager.reusedBlockCount());
+        ImGui::Text("Block memory: %d MB live, %d MB free, %d MB cached",
+                    (int)(block_manager.resident_set.liveBytes() >> 20),
+                    (int)(block_manager.resident_set.freeBytes() >> 20),
+                    (int)(block_manager.resident_set.cachedBytes() >> 20));
+        ImGui::Text("Evicted blocks: %d, cached meshes used: %d",
+                    block_manager.resident_set.evictedBlocks(),
+                    block_manager.resident_set.cachedMeshHits());
+        ImGui::Text("Clusters drawn: %d / %d", block_manager.clustersDrawn(),
+                    block_manager.clustersTested());
+        ImGui::Text("Occluded blocks: %d", block_manager.occludedBlocks());
+        ImGui::Text("Holes in view: %d", block_manager.visibleHoles());
+        ImGui::Text("Trees and rocks: %d, %.2f ms per block", block_manager.scatteredInstances(),
+                    block_manager.scatterMillisecondsPerBlock());
+        ImGui::Text("Prefetched blocks used: %d, cancelled: %d",
+                    block_manager.prefetchHits(), block_manager.cancelledPrefetches());
+        if (recording) {
+            ImGui::Text("Recording camera path: %.1f seconds (R to stop)", recording_time);
+        }
     }
     ImGui::End();
 
@@ -369,6 +777,8 @@ void Navigator::guiLogic()
  */
 void Navigator::draw()
 {
+    TRACE_ZONE("Navigator::draw");
+
     if (wireframe) {
         glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
     }
@@ -392,7 +802,9 @@ void Navigator::draw()
         lod.draw(proj, view, W, eye_position);
     }
 
-    // swarm.draw(proj, view, W, eye_position, *block_manager.terrain_generator);
+    if (show_swarm) {
+        swarm.draw(proj, view, W, eye_position);
+    }
 
     // Restore defaults
     glBindVertexArray( 0 );
@@ -552,6 +964,21 @@ bool Navigator::keyInputEvent(int key, int action, int mods) {
 
             eventHandled = true;
         }
+        if (key == GLFW_KEY_T) {
+            dumpTrace();
+
+            eventHandled = true;
+        }
+        if (key == GLFW_KEY_R) {
+            toggleRecording();
+
+            eventHandled = true;
+        }
+        if (key == GLFW_KEY_B) {
+            applyBrush();
+
+            eventHandled = true;
+        }
 
         pressed_keys.insert(key);
     }
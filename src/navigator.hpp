@@ -12,12 +12,22 @@
 #include "sound.hpp"
 
 #include "block_manager.hpp"
+#include "camera_path.hpp"
 #include "density_slicer.hpp"
 #include "lod_visualizer.hpp"
+#include "replay_stats.hpp"
+
+// Benchmarks run after a replay, combined with |, see runReplay.
+enum ReplayBenchmark {
+    ErosionBenchmark = 1 << 0,
+    SwarmBenchmark = 1 << 1,
+};
 
 class Navigator : public CS488Window {
 public:
-    Navigator();
+    // With a replay_path, replay that camera path as a benchmark instead, then
+    // run the replay_benchmarks, see runReplay.
+    Navigator(std::string replay_path = "", int replay_benchmarks = 0);
     virtual ~Navigator();
 
 protected:
@@ -37,6 +47,15 @@ protected:
 private:
     void resetView();
     void makeView();
+    void updateTerrain(float time_elapsed);
+    void dumpTrace();
+    void toggleRecording();
+    // Applies the brush where the camera looks at the ground.
+    void applyBrush();
+    void runReplay();
+    void benchmarkSurfaceQueries(const CameraPath& camera_path, ReplayStats& stats);
+    void benchmarkErosion(const CameraPath& camera_path, ReplayStats& stats);
+    void benchmarkSwarm(const CameraPath& camera_path, ReplayStats& stats);
 
     // Fields related to the shader and uniforms.
     ShaderProgram m_shader;
@@ -63,6 +82,7 @@ private:
     bool show_lod;
     bool show_slicer;
     bool show_terrain;
+    bool show_swarm;
     bool generate_blocks;
 
     float rotation;
@@ -77,9 +97,24 @@ private:
     double previous_mouse_x;
     double previous_mouse_y;
 
+    // Terrain editing, with B.
+    BrushType brush_type;
+    float brush_radius;
+    float brush_strength;
+    int erosion_iterations;
+
+    // The swarm is placed when it is first shown, and again when these change
+    // while it is.
+    int swarm_size;
+    bool swarm_on_gpu;
+
+    // Camera path recording, for the replay benchmark.
+    bool recording;
+    float recording_time;
+    CameraPath recorded_path;
+    std::string replay_path;
+    int replay_benchmarks;
+
     // Misc
     std::unique_ptr<Sound> background_music;
-    int selected_texture_top;
-    int selected_texture_front;
-    int selected_texture_side;
 };
@@ -0,0 +1,377 @@
+#include "occlusion_culler.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "trace.hpp"
+
+using namespace glm;
+using namespace std;
+
+// Vertical resolution of the occluder heightfield, in samples per block.
+#define OCCLUDER_HEIGHT_STEPS 16
+
+// The terrain is at most 2 blocks high, see terrainDensity in noise.h.
+#define OCCLUDER_MAX_HEIGHT 2
+
+OcclusionCuller::OcclusionCuller()
+: occluders_rasterized(0)
+{
+    static_assert(OCCLUSION_BUFFER_WIDTH % 4 == 0, "Rows are rasterized 4 pixels at a time");
+
+    ivec2 size = ivec2(OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+    while (size.x >= 1 && size.y >= 1) {
+        hi_z.push_back(vector<float>(size.x * size.y, 1.0f));
+        hi_z_sizes.push_back(size);
+        size /= 2;
+    }
+}
+
+void OcclusionCuller::clearOccluders()
+{
+    occluders.clear();
+}
+
+void OcclusionCuller::invalidate(vec3 low, vec3 high)
+{
+    ivec2 first = ivec2(floor(vec2(low.x, low.z)));
+    ivec2 last = ivec2(floor(vec2(high.x, high.z)));
+    for (int x = first.x; x <= last.x; x++) {
+        for (int z = first.y; z <= last.y; z++) {
+            occluders.erase(ivec2(x, z));
+        }
+    }
+}
+
+void OcclusionCuller::update(mat4 P, mat4 V, mat4 W, vec3 eye_position,
+                             const TerrainDensity& terrain_density)
+{
+    TRACE_ZONE("OcclusionCuller::update");
+
+    PV = P * V;
+    mat4 PVW = PV * W;
+
+    vec3 eye_block = vec3(inverse(W) * vec4(eye_position, 1.0f));
+    ivec2 eye_column = ivec2(floor(eye_block.x), floor(eye_block.z));
+
+    // Forget about occluders we've moved away from.
+    for (auto it = occluders.begin(); it != occluders.end();) {
+        if (length(vec2(it->first - eye_column)) > 2 * OCCLUDER_RANGE) {
+            it = occluders.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Nearest occluders first, they hide the most.
+    vector<pair<float, ivec2>> columns;
+    for (int x = -OCCLUDER_RANGE; x <= OCCLUDER_RANGE; x++) {
+        for (int z = -OCCLUDER_RANGE; z <= OCCLUDER_RANGE; z++) {
+            float distance = length(vec2(x, z));
+            if (distance <= OCCLUDER_RANGE) {
+                columns.push_back(make_pair(distance, eye_column + ivec2(x, z)));
+            }
+        }
+    }
+    sort(columns.begin(), columns.end(),
+         [](const pair<float, ivec2>& a, const pair<float, ivec2>& b) {
+             return a.first < b.first;
+         });
+
+    std::fill(hi_z[0].begin(), hi_z[0].end(), 1.0f);
+    occluders_rasterized = 0;
+
+    int built = 0;
+    for (auto& column : columns) {
+        if (occluders.count(column.second) == 0) {
+            if (built >= OCCLUDERS_PER_FRAME) {
+                continue;
+            }
+            buildOccluder(column.second, terrain_density);
+            built++;
+        }
+        rasterizeOccluder(occluders[column.second], PVW);
+        occluders_rasterized++;
+    }
+
+    buildPyramid();
+}
+
+void OcclusionCuller::buildOccluder(ivec2 column, const TerrainDensity& terrain_density)
+{
+    const int n = OCCLUDER_RESOLUTION;
+    const float step = 1.0f / OCCLUDER_HEIGHT_STEPS;
+
+    // Height of the ground at each sample, below any cave.
+    vector<float> heights((n + 1) * (n + 1));
+    for (int i = 0; i <= n; i++) {
+        for (int j = 0; j <= n; j++) {
+            vec2 q = vec2(column) + vec2(i, j) / float(n);
+            int k = 0;
+            while (k < OCCLUDER_MAX_HEIGHT * OCCLUDER_HEIGHT_STEPS) {
+                // Same coordinates as the density texture of a block of size 1.
+                vec3 coords = vec3(q.x, (k + 1) * step, q.y) * float(BLOCK_SIZE);
+                if (terrain_density.terrainDensity(coords, BLOCK_RESOLUTION) <= 0.0f) {
+                    break;
+                }
+                k++;
+            }
+            heights[i * (n + 1) + j] = k * step;
+        }
+    }
+
+    // Ground can dip between samples, keep the occluder under the lowest
+    // neighbouring sample so it stays inside the terrain.
+    vector<float> safe_heights(heights.size());
+    for (int i = 0; i <= n; i++) {
+        for (int j = 0; j <= n; j++) {
+            float height = heights[i * (n + 1) + j];
+            for (int di = -1; di <= 1; di++) {
+                for (int dj = -1; dj <= 1; dj++) {
+                    int ni = clamp(i + di, 0, n);
+                    int nj = clamp(j + dj, 0, n);
+                    height = std::min(height, heights[ni * (n + 1) + nj]);
+                }
+            }
+            safe_heights[i * (n + 1) + j] = std::max(0.0f, height - step);
+        }
+    }
+
+    vector<vec3>& vertices = occluders[column];
+    vertices.clear();
+    auto corner = [&](int i, int j) {
+        return vec3(column.x + float(i) / n, safe_heights[i * (n + 1) + j],
+                    column.y + float(j) / n);
+    };
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            vertices.push_back(corner(i, j));
+            vertices.push_back(corner(i + 1, j));
+            vertices.push_back(corner(i + 1, j + 1));
+            vertices.push_back(corner(i, j));
+            vertices.push_back(corner(i + 1, j + 1));
+            vertices.push_back(corner(i, j + 1));
+        }
+    }
+}
+
+void OcclusionCuller::rasterizeOccluder(const vector<vec3>& vertices, mat4& PVW)
+{
+    for (size_t i = 0; i + 2 < vertices.size(); i += 3) {
+        rasterizeClipped(PVW * vec4(vertices[i], 1.0f),
+                         PVW * vec4(vertices[i + 1], 1.0f),
+                         PVW * vec4(vertices[i + 2], 1.0f));
+    }
+}
+
+void OcclusionCuller::rasterizeClipped(vec4 v0, vec4 v1, vec4 v2)
+{
+    // Clip against the near plane, z = -w in clip space.
+    vec4 in[3] = { v0, v1, v2 };
+    float distances[3] = { v0.z + v0.w, v1.z + v1.w, v2.z + v2.w };
+
+    if (distances[0] >= 0 && distances[1] >= 0 && distances[2] >= 0) {
+        rasterizeTriangle(v0, v1, v2);
+        return;
+    }
+
+    vec4 out[4];
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3;
+        if (distances[i] >= 0) {
+            out[count++] = in[i];
+        }
+        if ((distances[i] >= 0) != (distances[j] >= 0)) {
+            float t = distances[i] / (distances[i] - distances[j]);
+            out[count++] = mix(in[i], in[j], t);
+        }
+    }
+
+    for (int i = 2; i < count; i++) {
+        rasterizeTriangle(out[0], out[i - 1], out[i]);
+    }
+}
+
+void OcclusionCuller::rasterizeTriangle(vec4 v0, vec4 v1, vec4 v2)
+{
+    const float width = OCCLUSION_BUFFER_WIDTH;
+    const float height = OCCLUSION_BUFFER_HEIGHT;
+
+    // Screen space, depth in [0, 1].
+    vec3 s[3];
+    vec4 clip[3] = { v0, v1, v2 };
+    for (int i = 0; i < 3; i++) {
+        vec3 ndc = vec3(clip[i]) / clip[i].w;
+        s[i] = vec3((ndc.x * 0.5f + 0.5f) * width,
+                    (ndc.y * 0.5f + 0.5f) * height,
+                    ndc.z * 0.5f + 0.5f);
+    }
+
+    float area = (s[1].x - s[0].x) * (s[2].y - s[0].y) -
+                 (s[1].y - s[0].y) * (s[2].x - s[0].x);
+    if (fabs(area) < 1e-6f) {
+        return;
+    }
+    // Occluders are seen from both sides, make the winding counter-clockwise.
+    if (area < 0) {
+        std::swap(s[1], s[2]);
+        area = -area;
+    }
+
+    // Clamp before converting, vertices close to the near plane can be far
+    // outside of the screen.
+    float min_x = std::min(s[0].x, std::min(s[1].x, s[2].x));
+    float max_x = std::max(s[0].x, std::max(s[1].x, s[2].x));
+    float min_y = std::min(s[0].y, std::min(s[1].y, s[2].y));
+    float max_y = std::max(s[0].y, std::max(s[1].y, s[2].y));
+    if (max_x < 0.0f || max_y < 0.0f || min_x >= width || min_y >= height) {
+        return;
+    }
+    int x_min = (int)std::max(0.0f, floor(min_x));
+    int x_max = (int)std::min(width - 1.0f, ceil(max_x));
+    int y_min = (int)std::max(0.0f, floor(min_y));
+    int y_max = (int)std::min(height - 1.0f, ceil(max_y));
+    if (x_min > x_max || y_min > y_max) {
+        return;
+    }
+
+    // Edge functions e = a * x + b * y + c, positive inside. Edge i is
+    // opposite to vertex i, so e_i / area is the barycentric weight of vertex i.
+    float a[3], b[3], c[3];
+    for (int i = 0; i < 3; i++) {
+        vec3 p = s[(i + 1) % 3];
+        vec3 q = s[(i + 2) % 3];
+        a[i] = p.y - q.y;
+        b[i] = q.x - p.x;
+        c[i] = p.x * q.y - p.y * q.x;
+    }
+    float inv_area = 1.0f / area;
+    float z[3] = { s[0].z * inv_area, s[1].z * inv_area, s[2].z * inv_area };
+
+    vector<float>& depth = hi_z[0];
+    x_min &= ~3;
+
+#if defined(__SSE2__)
+    __m128 a0 = _mm_set1_ps(a[0]), a1 = _mm_set1_ps(a[1]), a2 = _mm_set1_ps(a[2]);
+    __m128 z0 = _mm_set1_ps(z[0]), z1 = _mm_set1_ps(z[1]), z2 = _mm_set1_ps(z[2]);
+    __m128 zero = _mm_setzero_ps();
+    __m128 pixel_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+
+    for (int y = y_min; y <= y_max; y++) {
+        float py = y + 0.5f;
+        __m128 row0 = _mm_set1_ps(b[0] * py + c[0]);
+        __m128 row1 = _mm_set1_ps(b[1] * py + c[1]);
+        __m128 row2 = _mm_set1_ps(b[2] * py + c[2]);
+        float* row = &depth[y * OCCLUSION_BUFFER_WIDTH];
+
+        for (int x = x_min; x <= x_max; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), pixel_offsets);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero),
+                            _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+
+            __m128 pixel_z = _mm_add_ps(_mm_mul_ps(e0, z0),
+                             _mm_add_ps(_mm_mul_ps(e1, z1), _mm_mul_ps(e2, z2)));
+            __m128 old_z = _mm_loadu_ps(row + x);
+            __m128 new_z = _mm_min_ps(old_z, pixel_z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_z),
+                                             _mm_andnot_ps(inside, old_z)));
+        }
+    }
+#else
+    for (int y = y_min; y <= y_max; y++) {
+        float py = y + 0.5f;
+        float* row = &depth[y * OCCLUSION_BUFFER_WIDTH];
+        for (int x = x_min; x <= x_max; x++) {
+            float px = x + 0.5f;
+            float e0 = a[0] * px + b[0] * py + c[0];
+            float e1 = a[1] * px + b[1] * py + c[1];
+            float e2 = a[2] * px + b[2] * py + c[2];
+            if (e0 >= 0 && e1 >= 0 && e2 >= 0) {
+                row[x] = std::min(row[x], e0 * z[0] + e1 * z[1] + e2 * z[2]);
+            }
+        }
+    }
+#endif
+}
+
+void OcclusionCuller::buildPyramid()
+{
+    for (size_t level = 1; level < hi_z.size(); level++) {
+        const vector<float>& below = hi_z[level - 1];
+        vector<float>& current = hi_z[level];
+        int below_width = hi_z_sizes[level - 1].x;
+        ivec2 size = hi_z_sizes[level];
+
+        for (int y = 0; y < size.y; y++) {
+            const float* row0 = &below[(2 * y) * below_width];
+            const float* row1 = &below[(2 * y + 1) * below_width];
+            for (int x = 0; x < size.x; x++) {
+                current[y * size.x + x] = std::max(std::max(row0[2 * x], row0[2 * x + 1]),
+                                                   std::max(row1[2 * x], row1[2 * x + 1]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::isOccluded(mat4 M)
+{
+    mat4 PVM = PV * M;
+
+    vec3 ndc_min = vec3(1.0f);
+    vec3 ndc_max = vec3(-1.0f);
+    for (int i = 0; i < 8; i++) {
+        vec4 corner = PVM * vec4(i & 1, (i >> 1) & 1, (i >> 2) & 1, 1.0f);
+        // Crosses the near plane, the box is right in front of us.
+        if (corner.z < -corner.w) {
+            return false;
+        }
+        vec3 ndc = vec3(corner) / corner.w;
+        ndc_min = min(ndc_min, ndc);
+        ndc_max = max(ndc_max, ndc);
+    }
+
+    if (ndc_max.x < -1.0f || ndc_min.x > 1.0f || ndc_max.y < -1.0f || ndc_min.y > 1.0f) {
+        // Off screen, that's for frustum culling to decide.
+        return false;
+    }
+
+    float nearest_depth = ndc_min.z * 0.5f + 0.5f;
+    vec2 screen_min = (clamp(vec2(ndc_min), -1.0f, 1.0f) * 0.5f + 0.5f) *
+                      vec2(OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+    vec2 screen_max = (clamp(vec2(ndc_max), -1.0f, 1.0f) * 0.5f + 0.5f) *
+                      vec2(OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+    int x0 = std::min((int)screen_min.x, OCCLUSION_BUFFER_WIDTH - 1);
+    int x1 = std::min((int)screen_max.x, OCCLUSION_BUFFER_WIDTH - 1);
+    int y0 = std::min((int)screen_min.y, OCCLUSION_BUFFER_HEIGHT - 1);
+    int y1 = std::min((int)screen_max.y, OCCLUSION_BUFFER_HEIGHT - 1);
+
+    // Use the finest level where the box covers at most 8x8 texels. Coarser
+    // levels are cheaper to test but mix in too much of the sky around the box.
+    size_t level = 0;
+    while (level + 1 < hi_z.size() &&
+           ((x1 >> level) - (x0 >> level) > 7 || (y1 >> level) - (y0 >> level) > 7)) {
+        level++;
+    }
+
+    const vector<float>& depth = hi_z[level];
+    int level_width = hi_z_sizes[level].x;
+    for (int y = y0 >> level; y <= (y1 >> level); y++) {
+        for (int x = x0 >> level; x <= (x1 >> level); x++) {
+            if (nearest_depth <= depth[y * level_width + x]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+#include "terrain_density.hpp"
+#include "vec_hash.hpp"
+
+// Software occlusion culling of whole blocks.
+//
+// Every frame, coarse occluders of the terrain nearest to the camera are
+// rasterized on the CPU into a small depth buffer, from which we build a
+// hierarchical (max) depth pyramid. A block whose bounding box is behind the
+// occluders everywhere it covers on screen doesn't need to be drawn, or
+// generated soon.
+//
+// Occluders are built from the density function rather than from the block
+// meshes, which live on the GPU. For each column of blocks, a heightfield is
+// placed at or below the ground so that it never hides something that would
+// actually be visible.
+class OcclusionCuller {
+public:
+    OcclusionCuller();
+
+    // Rasterize occluders for this frame. W is the global transform, in which
+    // block (x, y, z) spans [x, x + 1] etc. Builds at most
+    // OCCLUDERS_PER_FRAME new occluders, nearest first.
+    void update(glm::mat4 P, glm::mat4 V, glm::mat4 W, glm::vec3 eye_position,
+                const TerrainDensity& terrain_density);
+
+    // Whether the unit cube transformed by M (e.g. a block transform) is
+    // entirely hidden. Conservative, returns false when unsure.
+    bool isOccluded(glm::mat4 M);
+
+    // Occluders depend on the terrain parameters.
+    void clearOccluders();
+    // The density changed within [low, high] (in blocks), drops the occluders
+    // of those columns.
+    void invalidate(glm::vec3 low, glm::vec3 high);
+
+    // Depth buffer, for debugging. Depth is in [0, 1], 1 is the far plane.
+    const std::vector<float>& depthBuffer() { return hi_z[0]; }
+
+    int occluderCount() { return occluders_rasterized; }
+
+private:
+    void buildOccluder(glm::ivec2 column, const TerrainDensity& terrain_density);
+    void rasterizeOccluder(const std::vector<glm::vec3>& vertices, glm::mat4& PVW);
+    void rasterizeTriangle(glm::vec4 v0, glm::vec4 v1, glm::vec4 v2);
+    void rasterizeClipped(glm::vec4 v0, glm::vec4 v1, glm::vec4 v2);
+    void buildPyramid();
+
+    glm::mat4 PV;
+
+    // Heightfield triangles, in the same units as block indices.
+    ivec2_map<std::vector<glm::vec3>> occluders;
+    int occluders_rasterized;
+
+    // Level 0 is the depth buffer, each next level has half the size and
+    // keeps the farthest depth of the 2x2 texels under it.
+    std::vector<std::vector<float>> hi_z;
+    std::vector<glm::ivec2> hi_z_sizes;
+};
@@ -0,0 +1,29 @@
+#include "parallel_for.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+void parallelFor(int count, int min_per_thread, int max_threads,
+                 const function<void(int, int)>& work)
+{
+    int thread_count = std::min((int)thread::hardware_concurrency(), max_threads);
+    thread_count = std::max(1, std::min(thread_count, count / min_per_thread));
+    if (thread_count == 1) {
+        work(0, count);
+        return;
+    }
+
+    int slice = (count + thread_count - 1) / thread_count;
+    vector<thread> threads;
+    for (int begin = slice; begin < count; begin += slice) {
+        threads.push_back(thread(work, begin, std::min(count, begin + slice)));
+    }
+    work(0, slice);
+
+    for (thread& worker : threads) {
+        worker.join();
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <functional>
+
+// Runs work(begin, end) on slices of [0, count) on up to max_threads threads
+// (this one included), with at least min_per_thread items each. Threads are
+// started for each call, the work is expected to be large enough for that not
+// to matter.
+void parallelFor(int count, int min_per_thread, int max_threads,
+                 const std::function<void(int, int)>& work);
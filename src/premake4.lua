@@ -66,6 +66,21 @@ solution "CS488-Projects"
         includedirs (includeDirList)
         files { "*.cpp" }
 
+    -- Offline tool, see tools/texture_converter.cpp.
+    project "texture_converter"
+        kind "ConsoleApp"
+        language "C++"
+        location "build"
+        objdir "build/texture_converter"
+        targetdir "."
+        buildoptions (buildOptions)
+        libdirs (libDirectories)
+        links (linkLibs)
+        linkoptions (linkOptionList)
+        includedirs (includeDirList)
+        includedirs { "." }
+        files { "tools/texture_converter.cpp", "bc_encoder.cpp", "texture_container.cpp", "trace.cpp" }
+
     configuration "Debug"
         defines { "DEBUG" }
         flags { "Symbols" }
@@ -0,0 +1,156 @@
+#include "replay_stats.hpp"
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+
+using namespace std;
+
+ReplayStats::ReplayStats()
+: blocks_generated(0)
+, hole_frames(0)
+, peak_memory(0.0)
+{
+}
+
+void ReplayStats::teleport()
+{
+    Teleport teleport;
+    teleport.frame = frame_times.size();
+    teleport.frames_to_full_detail = -1;
+    teleport.seconds_to_full_detail = 0.0;
+    teleports.push_back(teleport);
+}
+
+void ReplayStats::addFrame(double seconds, int new_blocks, int blocks_in_queue,
+                           int visible_holes)
+{
+    frame_times.push_back(seconds);
+    blocks_generated += new_blocks;
+    if (visible_holes > 0) {
+        hole_frames++;
+    }
+
+    if (!teleports.empty() && teleports.back().frames_to_full_detail < 0) {
+        Teleport& teleport = teleports.back();
+        teleport.seconds_to_full_detail += seconds;
+        if (blocks_in_queue == 0) {
+            teleport.frames_to_full_detail = frame_times.size() - teleport.frame;
+        }
+    }
+}
+
+void ReplayStats::addQueries(const string& kind, int count, double seconds)
+{
+    QueryBatch batch;
+    batch.kind = kind;
+    batch.count = count;
+    batch.seconds = seconds;
+    query_batches.push_back(batch);
+}
+
+void ReplayStats::addErosion(int resolution, int threads, int iterations, double seconds,
+                             bool deterministic)
+{
+    ErosionRun run;
+    run.resolution = resolution;
+    run.threads = threads;
+    run.iterations = iterations;
+    run.seconds = seconds;
+    run.deterministic = deterministic;
+    erosion_runs.push_back(run);
+}
+
+void ReplayStats::addSwarm(bool on_gpu, int agents, int steps, double seconds,
+                           float max_error)
+{
+    SwarmRun run;
+    run.on_gpu = on_gpu;
+    run.agents = agents;
+    run.steps = steps;
+    run.seconds = seconds;
+    run.max_error = max_error;
+    swarm_runs.push_back(run);
+}
+
+void ReplayStats::finishReplay()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    // In bytes on OS X, kilobytes on Linux.
+    peak_memory = usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    peak_memory = usage.ru_maxrss / 1024.0;
+#endif
+}
+
+static double percentile(const vector<double>& sorted, double p)
+{
+    size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[i];
+}
+
+void ReplayStats::print()
+{
+    if (frame_times.empty()) {
+        return;
+    }
+
+    vector<double> sorted = frame_times;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (double time : frame_times) {
+        total += time;
+    }
+
+    printf("Replayed %d frames in %.2f seconds\n", (int)frame_times.size(), total);
+    printf("Frame time: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           percentile(sorted, 0.5) * 1000.0, percentile(sorted, 0.9) * 1000.0,
+           percentile(sorted, 0.99) * 1000.0, sorted.back() * 1000.0);
+    printf("Blocks generated: %d (%.1f per second)\n", blocks_generated, blocks_generated / total);
+    printf("Frames with holes: %d (%.1f%%)\n", hole_frames,
+           100.0 * hole_frames / frame_times.size());
+
+    for (const Teleport& teleport : teleports) {
+        if (teleport.frames_to_full_detail < 0) {
+            printf("Teleport at frame %d: full detail not reached\n",
+                   teleport.frame);
+        } else {
+            printf("Teleport at frame %d: full detail after %d frames, %.2f seconds\n",
+                   teleport.frame, teleport.frames_to_full_detail,
+                   teleport.seconds_to_full_detail);
+        }
+    }
+
+    for (const QueryBatch& batch : query_batches) {
+        printf("Surface queries, %s: %d in %.3f seconds (%.0f per second)\n",
+               batch.kind.c_str(), batch.count, batch.seconds, batch.count / batch.seconds);
+    }
+
+    printf("Peak memory: %.1f MB\n", peak_memory);
+}
+
+void ReplayStats::printBenchmarks()
+{
+    for (const ErosionRun& run : erosion_runs) {
+        // Compared to the first run, on one thread.
+        double speedup = erosion_runs[0].seconds / run.seconds;
+        printf("Erosion, %d^2 cells on %d threads: %d iterations in %.3f seconds "
+               "(%.1f per second, %.2fx one thread)%s\n",
+               run.resolution, run.threads, run.iterations, run.seconds,
+               run.iterations / run.seconds, speedup,
+               run.deterministic ? "" : ", NOT the same heights as one thread");
+    }
+
+    for (const SwarmRun& run : swarm_runs) {
+        printf("Swarm on the %s, %d agents: %d steps in %.3f seconds (%.2f ms per step)",
+               run.on_gpu ? "GPU" : "CPU", run.agents, run.steps, run.seconds,
+               run.seconds * 1000.0 / run.steps);
+        if (run.on_gpu) {
+            printf(", %g blocks from the CPU after a step", run.max_error);
+        }
+        printf("\n");
+    }
+}
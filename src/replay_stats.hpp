@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Measurements taken while replaying a camera path, see Navigator::runReplay.
+class ReplayStats {
+public:
+    ReplayStats();
+
+    // The camera jumped before this frame (the start of the path counts too).
+    // Measures how long it takes until no block in view is missing.
+    void teleport();
+
+    // seconds is the time the whole frame took, including waiting for the GPU.
+    // visible_holes is the number of places in view with no block at all.
+    void addFrame(double seconds, int new_blocks, int blocks_in_queue, int visible_holes);
+
+    // A batch of count surface queries took seconds, see SurfaceQuery.
+    void addQueries(const std::string& kind, int count, double seconds);
+
+    // iterations of erosion on resolution^2 cells took seconds on that many
+    // threads, see HydraulicErosion. deterministic if the heights were the
+    // same as with one thread.
+    void addErosion(int resolution, int threads, int iterations, double seconds,
+                    bool deterministic);
+
+    // steps of a swarm of that many agents took seconds, see Swarm. On the
+    // GPU, max_error is how far its agents ended up from the CPU's after one
+    // step.
+    void addSwarm(bool on_gpu, int agents, int steps, double seconds, float max_error);
+
+    // The path is done, keeps the peak memory so far as the replay's, before
+    // the benchmarks that follow it allocate their own.
+    void finishReplay();
+
+    // The replay and the surface queries.
+    void print();
+    // The erosion and swarm benchmarks, if any ran.
+    void printBenchmarks();
+
+private:
+    struct Teleport {
+        int frame;
+        int frames_to_full_detail;     // -1 until reached.
+        double seconds_to_full_detail;
+    };
+
+    struct QueryBatch {
+        std::string kind;
+        int count;
+        double seconds;
+    };
+
+    struct ErosionRun {
+        int resolution;
+        int threads;
+        int iterations;
+        double seconds;
+        bool deterministic;
+    };
+
+    struct SwarmRun {
+        bool on_gpu;
+        int agents;
+        int steps;
+        double seconds;
+        float max_error;
+    };
+
+    std::vector<double> frame_times;
+    std::vector<Teleport> teleports;
+    std::vector<QueryBatch> query_batches;
+    std::vector<ErosionRun> erosion_runs;
+    std::vector<SwarmRun> swarm_runs;
+    int blocks_generated;
+    int hole_frames;
+    double peak_memory;     // In MB, see finishReplay.
+};
@@ -0,0 +1,199 @@
+#include "resident_set.hpp"
+
+#include <algorithm>
+
+#include "constants.hpp"
+#include "terrain_edits.hpp"
+#include "trace.hpp"
+
+using namespace glm;
+using namespace std;
+
+static size_t megabytes(int count)
+{
+    return (size_t)count * 1024 * 1024;
+}
+
+ResidentSet::ResidentSet()
+: gpu_budget(RESIDENT_GPU_BUDGET)
+, cpu_budget(RESIDENT_CPU_BUDGET)
+, time(0.0f)
+, live_bytes(0)
+, free_bytes(0)
+, cached_bytes(0)
+, evicted_blocks(0)
+, cached_mesh_hits(0)
+{
+}
+
+void ResidentSet::markUsed(ivec4 index)
+{
+    last_used[index] = time;
+}
+
+// Higher is evicted first.
+float ResidentSet::score(ivec4 index, vec3 eye_position, float used)
+{
+    // Distance to the nearest point of the block, so that large blocks
+    // around the camera are kept as long as the small ones next to them.
+    vec3 low = vec3(index);
+    vec3 high = low + vec3(index.w);
+    float distance = length(max(max(low - eye_position, eye_position - high), vec3(0.0f)));
+    return distance + (time - used) * RESIDENT_BLOCKS_PER_SECOND;
+}
+
+static bool higherScore(const pair<float, ivec4>& a, const pair<float, ivec4>& b)
+{
+    return a.first > b.first;
+}
+
+void ResidentSet::update(float time_elapsed, vec3 eye_position,
+                         ivec4_map<shared_ptr<Block>>& blocks)
+{
+    TRACE_ZONE("ResidentSet::update");
+
+    live_bytes = 0;
+    for (auto& kv : blocks) {
+        live_bytes += kv.second->bufferBytes();
+    }
+
+    for (auto it = last_used.begin(); it != last_used.end(); ) {
+        if (blocks.count(it->first) == 0 && meshes.count(it->first) == 0) {
+            it = last_used.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    size_t budget = megabytes(gpu_budget);
+    if (live_bytes + free_bytes > budget) {
+        vector<pair<float, ivec4>> candidates;
+        for (auto& kv : blocks) {
+            auto used = last_used.find(kv.first);
+            float used_time = used != last_used.end() ? used->second : 0.0f;
+            if (used_time < time) {
+                candidates.push_back(make_pair(score(kv.first, eye_position, used_time), kv.first));
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), higherScore);
+
+        size_t low_water = budget * RESIDENT_LOW_WATER;
+        for (auto& candidate : candidates) {
+            if (live_bytes <= low_water) {
+                break;
+            }
+            shared_ptr<Block> block = blocks[candidate.second];
+            blocks.erase(candidate.second);
+            live_bytes -= block->bufferBytes();
+            block->resetBlock();
+            release(block);
+            evicted_blocks++;
+        }
+
+        // Only keep as many free blocks as fit in the budget, they are
+        // reused before any new buffer gets allocated.
+        while (!free_blocks.empty() && live_bytes + free_bytes > budget) {
+            free_bytes -= free_blocks.front()->bufferBytes();
+            free_blocks.pop();
+        }
+    }
+
+    trimMeshes(eye_position);
+
+    time += time_elapsed;
+}
+
+void ResidentSet::trimMeshes(vec3 eye_position)
+{
+    size_t budget = megabytes(cpu_budget);
+    if (cached_bytes <= budget) {
+        return;
+    }
+
+    vector<pair<float, ivec4>> candidates;
+    for (auto& kv : meshes) {
+        float used_time = last_used[kv.first];
+        if (used_time < time) {
+            candidates.push_back(make_pair(score(kv.first, eye_position, used_time), kv.first));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), higherScore);
+
+    size_t low_water = budget * RESIDENT_LOW_WATER;
+    for (auto& candidate : candidates) {
+        if (cached_bytes <= low_water) {
+            break;
+        }
+        cached_bytes -= meshes[candidate.second].bytes();
+        meshes.erase(candidate.second);
+    }
+}
+
+shared_ptr<Block> ResidentSet::reuse(const type_info& kind)
+{
+    // The pool may still hold blocks of the other kind if the generator
+    // was switched, those can't be written to by the current generator.
+    while (!free_blocks.empty() &&
+           typeid(*free_blocks.front()) != kind) {
+        free_bytes -= free_blocks.front()->bufferBytes();
+        free_blocks.pop();
+    }
+
+    if (free_blocks.empty()) {
+        return nullptr;
+    }
+
+    shared_ptr<Block> block = free_blocks.front();
+    free_blocks.pop();
+    free_bytes -= block->bufferBytes();
+    return block;
+}
+
+void ResidentSet::release(shared_ptr<Block> block)
+{
+    free_bytes += block->bufferBytes();
+    free_blocks.push(block);
+}
+
+void ResidentSet::cacheMesh(ivec4 index, const BlockMesh& mesh)
+{
+    auto existing = meshes.find(index);
+    if (existing != meshes.end()) {
+        cached_bytes -= existing->second.bytes();
+    }
+
+    meshes[index] = mesh;
+    cached_bytes += mesh.bytes();
+    last_used[index] = time;
+}
+
+bool ResidentSet::uploadCachedMesh(ivec4 index, IndexedBlock& block)
+{
+    auto mesh = meshes.find(index);
+    if (mesh == meshes.end()) {
+        return false;
+    }
+
+    block.uploadMesh(mesh->second);
+    last_used[index] = time;
+    cached_mesh_hits++;
+    return true;
+}
+
+void ResidentSet::clearMeshes()
+{
+    meshes.clear();
+    cached_bytes = 0;
+}
+
+void ResidentSet::dropMeshes(vec3 low, vec3 high)
+{
+    for (auto it = meshes.begin(); it != meshes.end(); ) {
+        if (TerrainEdits::touches(low, high, it->first)) {
+            cached_bytes -= it->second.bytes();
+            it = meshes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <queue>
+#include <typeinfo>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "block.hpp"
+#include "indexed_block.hpp"
+#include "indirect_block.hpp"
+#include "vec_hash.hpp"
+
+// Keeps the memory used by blocks within a budget.
+//
+// GPU memory is the buffers of the blocks, live ones (generated or being
+// shown) and free ones kept in a pool to be reused by new blocks. Once they
+// take more than gpu_budget, live blocks are evicted to the pool until they
+// take RESIDENT_LOW_WATER of it and then the pool is trimmed to the budget,
+// so the blocks generated next reuse buffers instead of evicting again.
+//
+// CPU memory is the meshes built by the CPU generator, kept after upload so
+// that an evicted block coming back into view doesn't have to be meshed
+// again. They are evicted the same way within cpu_budget.
+//
+// Blocks used (in view or about to be) this frame are never evicted. Others
+// go first the longer they haven't been used and the farther they are, a
+// second out of view counts as RESIDENT_BLOCKS_PER_SECOND blocks of distance.
+class ResidentSet {
+public:
+    ResidentSet();
+
+    // The block is in view, or about to be, this frame.
+    void markUsed(glm::ivec4 index);
+
+    // Evicts blocks (to the pool) and cached meshes over budget, after the
+    // blocks used this frame were marked. Call once per frame.
+    void update(float time_elapsed, glm::vec3 eye_position,
+                ivec4_map<std::shared_ptr<Block>>& blocks);
+
+    // A free block of the right kind (Block, IndexedBlock or IndirectBlock),
+    // or null if there is none.
+    std::shared_ptr<Block> reuse(const std::type_info& kind);
+    // Put a block that was reset in the pool.
+    void release(std::shared_ptr<Block> block);
+
+    // Keep a copy of the mesh uploaded to a block, see uploadCachedMesh.
+    void cacheMesh(glm::ivec4 index, const BlockMesh& mesh);
+    // Uploads the cached mesh of that block, if there is one.
+    bool uploadCachedMesh(glm::ivec4 index, IndexedBlock& block);
+    // Cached meshes depend on the terrain parameters.
+    void clearMeshes();
+    // Drops the cached meshes of the blocks whose density changed within
+    // [low, high], in density coordinates.
+    void dropMeshes(glm::vec3 low, glm::vec3 high);
+
+    int freeBlocks() { return free_blocks.size(); }
+    size_t liveBytes() { return live_bytes; }
+    size_t freeBytes() { return free_bytes; }
+    size_t cachedBytes() { return cached_bytes; }
+    int evictedBlocks() { return evicted_blocks; }
+    int cachedMeshHits() { return cached_mesh_hits; }
+
+    // In megabytes, changed from the UI.
+    int gpu_budget;
+    int cpu_budget;
+
+private:
+    float score(glm::ivec4 index, glm::vec3 eye_position, float last_used);
+    void trimMeshes(glm::vec3 eye_position);
+
+    float time;
+
+    // When each block or mesh was last used.
+    ivec4_map<float> last_used;
+
+    std::queue<std::shared_ptr<Block>> free_blocks;
+    ivec4_map<BlockMesh> meshes;
+
+    size_t live_bytes;
+    size_t free_bytes;
+    size_t cached_bytes;
+    int evicted_blocks;
+    int cached_mesh_hits;
+};
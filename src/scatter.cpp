@@ -0,0 +1,416 @@
+#include "scatter.hpp"
+
+#include "cs488-framework/GlErrorCheck.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <random>
+
+#include "parallel_for.hpp"
+#include "trace.hpp"
+
+using namespace glm;
+using namespace std;
+
+// Darts thrown to build the pattern, most land too close to the others once it
+// fills up.
+#define PATTERN_DARTS 20000
+#define PATTERN_SEED 488
+
+// Distance between the samples of the density gradient, in blocks.
+#define GRADIENT_STEP 0.01f
+
+struct Scatter::Species {
+    // Of a point of the pattern.
+    float probability;
+    // Largest 1 - normal.y of the ground under it.
+    float max_slope;
+    // Height above the water, in blocks.
+    float min_height;
+    float max_height;
+    // Largest fraction of the points around it inside the ground.
+    float max_occlusion;
+    float min_scale;
+    float max_scale;
+    // Size of the box at scale 1 and how much of its height is in the ground.
+    vec3 extent;
+    float sink;
+    vec3 color;
+};
+
+static const Scatter::Species species[SCATTER_SPECIES] = {
+    // Trees, on gentle open slopes, not too high.
+    { 0.45f, 0.25f, 0.05f, 2.0f, 0.25f, 0.7f, 1.3f,
+      vec3(0.025f, 0.12f, 0.025f), 0.1f, vec3(0.16f, 0.32f, 0.12f) },
+    // Rocks, anywhere but cliffs, in crevices too.
+    { 0.2f, 0.6f, -0.05f, 100.0f, 1.0f, 0.5f, 1.5f,
+      vec3(0.05f, 0.03f, 0.04f), 0.4f, vec3(0.42f, 0.4f, 0.38f) },
+};
+
+// Wang hash, see unitFloat for [0, 1).
+static uint32_t wangHash(uint32_t h)
+{
+    h = (h ^ 61u) ^ (h >> 16);
+    h *= 9u;
+    h = h ^ (h >> 4);
+    h *= 0x27d4eb2du;
+    h = h ^ (h >> 15);
+    return h;
+}
+
+static float unitFloat(uint32_t h)
+{
+    return float(h >> 8) / float(1 << 24);
+}
+
+Scatter::Scatter()
+: cube(1.0f)
+, uploaded_placements(0)
+, placements(0)
+, drawn_instances(0)
+, last_milliseconds_per_block(0.0f)
+{
+    for (int s = 0; s < SCATTER_SPECIES; s++) {
+        instance_buffers[s] = 0;
+        instance_counts[s] = 0;
+    }
+    buildPattern();
+}
+
+void Scatter::buildPattern()
+{
+    // The same pattern every run.
+    mt19937 generator(PATTERN_SEED);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // Brute force, the pattern has about a hundred points.
+    float min_distance2 = SCATTER_SPACING * SCATTER_SPACING;
+    for (int dart = 0; dart < PATTERN_DARTS; dart++) {
+        vec2 point(unit(generator), unit(generator));
+        bool too_close = false;
+        for (vec2 other : pattern) {
+            vec2 offset = abs(point - other);
+            offset = min(offset, vec2(1.0f) - offset);
+            if (dot(offset, offset) < min_distance2) {
+                too_close = true;
+                break;
+            }
+        }
+        if (!too_close) {
+            pattern.push_back(point);
+        }
+    }
+}
+
+void Scatter::init(string dir)
+{
+    scatter_shader.generateProgramObject();
+    scatter_shader.attachVertexShader((dir + "ScatterShader.vs").c_str());
+    scatter_shader.attachFragmentShader((dir + "ScatterShader.fs").c_str());
+    scatter_shader.link();
+
+    glGenBuffers(SCATTER_SPECIES, instance_buffers);
+
+    CHECK_GL_ERRORS;
+}
+
+void Scatter::finishInit()
+{
+    cube.init(scatter_shader);
+
+    P_uni = scatter_shader.getUniformLocation("P");
+    V_uni = scatter_shader.getUniformLocation("V");
+    M_uni = scatter_shader.getUniformLocation("M");
+    extent_uni = scatter_shader.getUniformLocation("extent");
+    sink_uni = scatter_shader.getUniformLocation("sink");
+    color_uni = scatter_shader.getUniformLocation("color");
+    eye_position_uni = scatter_shader.getUniformLocation("eye_position");
+    fog_uni = scatter_shader.getUniformLocation("fog_params");
+
+    instance_attrib = scatter_shader.getAttribLocation("instance");
+
+    glBindVertexArray(cube.getVertices());
+    {
+        // Pointed at the buffer of each species when drawing.
+        glEnableVertexAttribArray(instance_attrib);
+        glVertexAttribDivisor(instance_attrib, 1); // 1 per object
+    }
+    glBindVertexArray(0);
+
+    CHECK_GL_ERRORS;
+}
+
+void Scatter::place(const vector<Block*>& blocks, const TerrainDensity& terrain_density,
+                    float water_height)
+{
+    if (blocks.empty()) {
+        return;
+    }
+
+    TraceZone zone("Scatter blocks");
+    zone.setDetail("%d blocks", (int)blocks.size());
+
+    Timer timer;
+    timer.start();
+
+    // Points of the pattern hashed into some species, before looking for the
+    // ground.
+    vector<vec2> columns;
+    vector<int> owners;
+    vector<uint32_t> hashes;
+    for (int b = 0; b < (int)blocks.size(); b++) {
+        ivec3 index = blocks[b]->index;
+        for (int i = 0; i < (int)pattern.size(); i++) {
+            uint32_t h = wangHash((uint32_t(index.x) * 73856093u) ^
+                                  (uint32_t(index.z) * 19349663u) ^ (uint32_t(i) * 83492791u));
+            if (speciesOf(unitFloat(h)) >= 0) {
+                columns.push_back(vec2(index.x, index.z) + pattern[i]);
+                owners.push_back(b);
+                hashes.push_back(h);
+            }
+        }
+    }
+
+    // The species each column ends up as (-1 for none) and its instance.
+    int count = columns.size();
+    vector<int> placed_species(count, -1);
+    vector<vec4> placed(count);
+    parallelFor((count + 3) / 4, SCATTER_POINTS_PER_THREAD / 4, SCATTER_THREADS,
+                [&](int begin, int end) {
+        for (int group = begin; group < end; group++) {
+            int first = group * 4;
+            vec3 tops[4];
+            for (int lane = 0; lane < 4; lane++) {
+                int c = std::min(first + lane, count - 1);
+                tops[lane] = vec3(columns[c].x, blocks[owners[c]]->index.y + 1.0f, columns[c].y);
+            }
+            float heights[4];
+            bool found[4];
+            findGround(terrain_density, tops, heights, found);
+
+            for (int lane = 0; lane < 4 && first + lane < count; lane++) {
+                if (!found[lane]) {
+                    continue;
+                }
+                int c = first + lane;
+                int s = speciesOf(unitFloat(hashes[c]));
+                vec3 point = vec3(columns[c].x, heights[lane], columns[c].y);
+                if (fits(terrain_density, species[s], point, water_height)) {
+                    float scale = mix(species[s].min_scale, species[s].max_scale,
+                                      unitFloat(wangHash(hashes[c])));
+                    placed_species[c] = s;
+                    placed[c] = vec4(point, scale);
+                }
+            }
+        }
+    });
+
+    for (Block* block : blocks) {
+        for (auto& instances : block->instances) {
+            instances.clear();
+        }
+        block->setScattered(true);
+    }
+    for (int c = 0; c < count; c++) {
+        if (placed_species[c] >= 0) {
+            blocks[owners[c]]->instances[placed_species[c]].push_back(placed[c]);
+        }
+    }
+    placements++;
+
+    timer.stop();
+    last_milliseconds_per_block = timer.elapsedSeconds() * 1000.0f / blocks.size();
+}
+
+int Scatter::speciesOf(float pick)
+{
+    for (int s = 0; s < SCATTER_SPECIES; s++) {
+        if (pick < species[s].probability) {
+            return s;
+        }
+        pick -= species[s].probability;
+    }
+    return -1;
+}
+
+// Density at four points in blocks, as SurfaceQuery samples it.
+static void density4(const TerrainDensity& terrain_density, const vec3* points, int octaves,
+                     float* densities)
+{
+    vec3 coords[4];
+    for (int lane = 0; lane < 4; lane++) {
+        coords[lane] = points[lane] * float(BLOCK_SIZE);
+    }
+    terrain_density.terrainDensity4(coords, BLOCK_RESOLUTION, octaves, densities);
+}
+
+void Scatter::findGround(const TerrainDensity& terrain_density, const vec3* tops,
+                         float* heights, bool* found)
+{
+    // Down from the top of the block to the first sample in the ground.
+    float step = 1.0f / SCATTER_HEIGHT_STEPS;
+    float above[4];
+    density4(terrain_density, tops, MAX_OCTAVES, above);
+    for (int lane = 0; lane < 4; lane++) {
+        found[lane] = false;
+        heights[lane] = tops[lane].y;
+    }
+    for (int i = 1; i <= SCATTER_HEIGHT_STEPS; i++) {
+        vec3 points[4];
+        for (int lane = 0; lane < 4; lane++) {
+            points[lane] = tops[lane] - vec3(0.0f, i * step, 0.0f);
+        }
+        float densities[4];
+        density4(terrain_density, points, MAX_OCTAVES, densities);
+        bool all_found = true;
+        for (int lane = 0; lane < 4; lane++) {
+            if (!found[lane]) {
+                if (above[lane] <= 0.0f && densities[lane] > 0.0f) {
+                    found[lane] = true;
+                } else {
+                    above[lane] = densities[lane];
+                    heights[lane] = points[lane].y;
+                }
+            }
+            all_found = all_found && found[lane];
+        }
+        if (all_found) {
+            break;
+        }
+    }
+
+    // heights is in the air, a step above the ground. Bisect between the two.
+    float low[4];
+    float high[4];
+    for (int lane = 0; lane < 4; lane++) {
+        high[lane] = heights[lane];
+        low[lane] = heights[lane] - step;
+    }
+    for (int i = 0; i < SCATTER_REFINE_ITERATIONS; i++) {
+        vec3 points[4];
+        for (int lane = 0; lane < 4; lane++) {
+            points[lane] = vec3(tops[lane].x, 0.5f * (low[lane] + high[lane]), tops[lane].z);
+        }
+        float densities[4];
+        density4(terrain_density, points, MAX_OCTAVES, densities);
+        for (int lane = 0; lane < 4; lane++) {
+            if (densities[lane] > 0.0f) {
+                low[lane] = points[lane].y;
+            } else {
+                high[lane] = points[lane].y;
+            }
+        }
+    }
+    for (int lane = 0; lane < 4; lane++) {
+        heights[lane] = 0.5f * (low[lane] + high[lane]);
+    }
+}
+
+bool Scatter::fits(const TerrainDensity& terrain_density, const Species& kind, vec3 point,
+                   float water_height)
+{
+    // The world is offset by half a block from block indices.
+    float height = point.y - 0.5f - water_height;
+    if (height < kind.min_height || height > kind.max_height) {
+        return false;
+    }
+
+    // Into the ground is up the density.
+    vec3 points[4] = {
+        point,
+        point + vec3(GRADIENT_STEP, 0.0f, 0.0f),
+        point + vec3(0.0f, GRADIENT_STEP, 0.0f),
+        point + vec3(0.0f, 0.0f, GRADIENT_STEP),
+    };
+    float densities[4];
+    density4(terrain_density, points, SCATTER_OCTAVES, densities);
+    vec3 gradient = vec3(densities[1], densities[2], densities[3]) - densities[0];
+    vec3 normal = length(gradient) > 0.0f ? -normalize(gradient) : vec3(0.0f, 1.0f, 0.0f);
+    if (1.0f - normal.y > kind.max_slope) {
+        return false;
+    }
+
+    float r = SCATTER_OCCLUSION_RADIUS;
+    vec3 around[4] = {
+        point + vec3(r, 0.5f * r, 0.0f),
+        point + vec3(-r, 0.5f * r, 0.0f),
+        point + vec3(0.0f, 0.5f * r, r),
+        point + vec3(0.0f, 0.5f * r, -r),
+    };
+    density4(terrain_density, around, SCATTER_OCTAVES, densities);
+    int inside = 0;
+    for (float density : densities) {
+        inside += density > 0.0f;
+    }
+    return inside <= kind.max_occlusion * 4.0f;
+}
+
+void Scatter::uploadInstances(const vector<Block*>& blocks)
+{
+    if (blocks == uploaded_blocks && placements == uploaded_placements) {
+        return;
+    }
+
+    TRACE_ZONE("Upload scattered instances");
+
+    vector<vec4> instances;
+    for (int s = 0; s < SCATTER_SPECIES; s++) {
+        instances.clear();
+        for (Block* block : blocks) {
+            instances.insert(instances.end(), block->instances[s].begin(),
+                             block->instances[s].end());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffers[s]);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(vec4), instances.data(),
+                     GL_DYNAMIC_DRAW);
+        instance_counts[s] = instances.size();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    uploaded_blocks = blocks;
+    uploaded_placements = placements;
+
+    CHECK_GL_ERRORS;
+}
+
+void Scatter::draw(mat4 P, mat4 V, mat4 M, vec3 eye_position, const vector<Block*>& blocks)
+{
+    uploadInstances(blocks);
+
+    drawn_instances = 0;
+    scatter_shader.enable();
+    {
+        glBindVertexArray(cube.getVertices());
+
+        glUniformMatrix4fv(P_uni, 1, GL_FALSE, value_ptr(P));
+        glUniformMatrix4fv(V_uni, 1, GL_FALSE, value_ptr(V));
+        glUniformMatrix4fv(M_uni, 1, GL_FALSE, value_ptr(M));
+        glUniform3f(eye_position_uni, eye_position.x, eye_position.y, eye_position.z);
+        glUniform3f(fog_uni, FOG_MULTIPLIER, VIEW_RANGE, FOG_BIAS);
+
+        for (int s = 0; s < SCATTER_SPECIES; s++) {
+            if (instance_counts[s] == 0) {
+                continue;
+            }
+
+            glBindBuffer(GL_ARRAY_BUFFER, instance_buffers[s]);
+            glVertexAttribPointer(instance_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(vec4), nullptr);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            const Species& kind = species[s];
+            glUniform3f(extent_uni, kind.extent.x, kind.extent.y, kind.extent.z);
+            glUniform1f(sink_uni, kind.sink);
+            glUniform3f(color_uni, kind.color.r, kind.color.g, kind.color.b);
+
+            glDrawElementsInstanced(GL_TRIANGLES, cube.indexCount(), GL_UNSIGNED_INT, 0,
+                                    instance_counts[s]);
+            drawn_instances += instance_counts[s];
+        }
+
+        glBindVertexArray(0);
+    }
+    scatter_shader.disable();
+
+    CHECK_GL_ERRORS;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "cs488-framework/ShaderProgram.hpp"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "constants.hpp"
+#include "cube.hpp"
+#include "terrain_density.hpp"
+
+// Trees and rocks scattered on the ground, drawn as instanced boxes.
+//
+// Each block column is covered by the same Poisson disk pattern, built once,
+// which tiles so its points stay SCATTER_SPACING apart across the edges. Each
+// point is hashed from its position into a species (or nothing), a scale and
+// a rotation, so they don't depend on the order blocks are generated in. Each
+// block looks for the highest ground under the point within its own height,
+// sampling the density SCATTER_HEIGHT_STEPS times down the column and
+// bisecting the step into the ground, four columns at a time with
+// TerrainDensity::terrainDensity4. Ground under an overhang counts. The point
+// is kept only if the ground there is flat enough, high enough above the water
+// and open enough for its species: the normal is the gradient of the density
+// function and the occlusion how many of four points around it, just above the
+// ground, are inside it.
+//
+// The instances of a block are kept with it (see Block::instances) until it is
+// generated again. Those of the blocks drawn are copied into one buffer per
+// species whenever the blocks change, and each species is a single instanced
+// draw.
+class Scatter
+{
+public:
+    Scatter();
+
+    // Submits the shader, finishInit does the rest once it is linked.
+    void init(std::string dir);
+    void finishInit();
+
+    // Scatters the instances of these blocks, all of size 1, water_height is
+    // in world coordinates.
+    void place(const std::vector<Block*>& blocks, const TerrainDensity& terrain_density,
+               float water_height);
+    // Draws the instances of these blocks, which must all be scattered.
+    void draw(glm::mat4 P, glm::mat4 V, glm::mat4 M, glm::vec3 eye_position,
+              const std::vector<Block*>& blocks);
+
+    // Of the last batch placed.
+    float lastMillisecondsPerBlock() const { return last_milliseconds_per_block; }
+    int patternSize() const { return pattern.size(); }
+    // Of the last draw.
+    int drawnInstances() const { return drawn_instances; }
+
+    // Where each species grows and how it looks, see scatter.cpp.
+    struct Species;
+
+private:
+    // The species a point of the pattern hashed to pick in [0, 1) is, -1 for
+    // none.
+    static int speciesOf(float pick);
+    // Where the density goes from air to ground going down four columns, from
+    // their tops to a block below. found is false for columns without ground
+    // there.
+    static void findGround(const TerrainDensity& terrain_density, const glm::vec3* tops,
+                           float* heights, bool* found);
+    // Whether the ground at point suits the species.
+    static bool fits(const TerrainDensity& terrain_density, const Species& kind,
+                     glm::vec3 point, float water_height);
+
+    // Dart throwing in the unit square, with distances wrapped around.
+    void buildPattern();
+    // Copies the instances of the blocks into the buffers, if they changed.
+    void uploadInstances(const std::vector<Block*>& blocks);
+
+    std::vector<glm::vec2> pattern;
+
+    ShaderProgram scatter_shader;
+    Cube cube;
+
+    GLuint instance_buffers[SCATTER_SPECIES];
+    int instance_counts[SCATTER_SPECIES];
+    // The blocks the buffers were filled from, and the placements up to then.
+    std::vector<Block*> uploaded_blocks;
+    int uploaded_placements;
+    int placements;
+    int drawn_instances;
+
+    float last_milliseconds_per_block;
+
+    GLint P_uni;    // Uniform location for Projection matrix.
+    GLint V_uni;    // Uniform location for View matrix.
+    GLint M_uni;    // Uniform location for Model matrix.
+    GLint extent_uni;
+    GLint sink_uni;
+    GLint color_uni;
+    GLint eye_position_uni;
+    GLint fog_uni;
+
+    GLint instance_attrib;
+};
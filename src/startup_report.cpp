@@ -0,0 +1,82 @@
+#include "startup_report.hpp"
+
+#include <stdio.h>
+
+#include "cs488-framework/ShaderProgram.hpp"
+
+using namespace std;
+
+StartupReport::StartupReport()
+: in_step(false)
+, linked_programs(0)
+, cached_programs(0)
+{
+}
+
+void StartupReport::step(const string& name)
+{
+    endStep();
+
+    Step step;
+    step.name = name;
+    step.seconds = 0.0;
+    step.linked_programs = 0;
+    step.cached_programs = 0;
+    step.gpu_bytes = 0;
+    steps.push_back(step);
+
+    in_step = true;
+    linked_programs = ShaderProgram::linkedProgramCount();
+    cached_programs = ShaderProgram::cachedProgramCount();
+    timer.start();
+}
+
+void StartupReport::addGpuBytes(size_t bytes)
+{
+    if (in_step) {
+        steps.back().gpu_bytes += bytes;
+    }
+}
+
+void StartupReport::endStep()
+{
+    if (!in_step) {
+        return;
+    }
+
+    timer.stop();
+    Step& step = steps.back();
+    step.seconds = timer.elapsedSeconds();
+    step.linked_programs = ShaderProgram::linkedProgramCount() - linked_programs;
+    step.cached_programs = ShaderProgram::cachedProgramCount() - cached_programs;
+    in_step = false;
+}
+
+void StartupReport::print()
+{
+    endStep();
+
+    double total_seconds = 0.0;
+    int total_programs = 0;
+    int total_cached = 0;
+    size_t total_bytes = 0;
+    for (auto& step : steps) {
+        total_seconds += step.seconds;
+        total_programs += step.linked_programs;
+        total_cached += step.cached_programs;
+        total_bytes += step.gpu_bytes;
+    }
+
+    printf("Startup took %.2f seconds (%d of %d programs from the binary cache, %.1f MB of GPU memory)\n",
+           total_seconds, total_cached, total_programs, total_bytes / (1024.0 * 1024.0));
+    for (auto& step : steps) {
+        printf("  %-24s %6.3f s", step.name.c_str(), step.seconds);
+        if (step.linked_programs > 0) {
+            printf(", %d programs (%d cached)", step.linked_programs, step.cached_programs);
+        }
+        if (step.gpu_bytes > 0) {
+            printf(", %.1f MB", step.gpu_bytes / (1024.0 * 1024.0));
+        }
+        printf("\n");
+    }
+}
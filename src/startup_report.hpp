@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+// Times the steps of startup and prints how long each took, how many shader
+// programs it linked and how much GPU memory it allocated, for the steps that
+// say so.
+class StartupReport {
+public:
+    StartupReport();
+
+    // Ends the current step, if any, and starts the next one.
+    void step(const std::string& name);
+    // Buffers and textures allocated by the current step, in bytes.
+    void addGpuBytes(size_t bytes);
+    // Ends the current step and prints them all.
+    void print();
+
+private:
+    struct Step {
+        std::string name;
+        double seconds;
+        int linked_programs;
+        int cached_programs;
+        size_t gpu_bytes;
+    };
+
+    void endStep();
+
+    std::vector<Step> steps;
+    bool in_step;
+    Timer timer;
+    int linked_programs;
+    int cached_programs;
+};
@@ -0,0 +1,560 @@
+#include "surface_query.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+
+#include "parallel_for.hpp"
+#include "trace.hpp"
+
+using namespace glm;
+using namespace std;
+
+// The terrain is at most 2 blocks high, see terrainDensity in noise.h.
+#define SURFACE_MAX_HEIGHT 2
+
+// Halvings of the last height step when looking for the surface.
+#define SURFACE_REFINE_ITERATIONS 6
+
+// Highest air_above of any tile, see buildTile.
+#define SURFACE_CEILING (SURFACE_MAX_HEIGHT + 2.0f / SURFACE_HEIGHT_STEPS)
+
+// How far past a cell boundary rays skip to, so they are in the next cell.
+#define RAY_SKIP_EPSILON 1e-4f
+
+static ivec2 columnOf(vec2 position)
+{
+    return ivec2(floor(position));
+}
+
+SurfaceQuery::SurfaceQuery()
+: use_ray_packets(true)
+, batch(0)
+, tiles_built(0)
+, query_count(0)
+, bounded_queries(0)
+, ray_count(0)
+, ray_samples(0)
+{
+}
+
+void SurfaceQuery::reset(const TerrainDensity& terrain_density)
+{
+    this->terrain_density.reset(new TerrainDensity(terrain_density));
+    tiles.clear();
+}
+
+void SurfaceQuery::invalidate(vec3 low, vec3 high)
+{
+    ivec2 first = columnOf(vec2(low.x, low.z));
+    ivec2 last = columnOf(vec2(high.x, high.z));
+    for (int x = first.x; x <= last.x; x++) {
+        for (int z = first.y; z <= last.y; z++) {
+            tiles.erase(ivec2(x, z));
+        }
+    }
+}
+
+float SurfaceQuery::density(vec3 point) const
+{
+    // Same coordinates as the density texture of a block of size 1.
+    return terrain_density->terrainDensity(point * float(BLOCK_SIZE), BLOCK_RESOLUTION);
+}
+
+void SurfaceQuery::buildTile(ivec2 column, Tile& tile)
+{
+    const int n = SURFACE_TILE_RESOLUTION;
+    const int max_step = SURFACE_MAX_HEIGHT * SURFACE_HEIGHT_STEPS;
+    const float step = 1.0f / SURFACE_HEIGHT_STEPS;
+
+    // At each sample, the first air going up from the bottom and the last
+    // ground going down from the top, in steps.
+    vector<int> first_air((n + 1) * (n + 1));
+    vector<int> last_ground((n + 1) * (n + 1));
+    for (int i = 0; i <= n; i++) {
+        for (int j = 0; j <= n; j++) {
+            vec2 q = vec2(column) + vec2(i, j) / float(n);
+            int top = max_step;
+            while (top > 0 && density(vec3(q.x, top * step, q.y)) <= 0.0f) {
+                top--;
+            }
+            int bottom = 0;
+            while (bottom <= top && density(vec3(q.x, bottom * step, q.y)) > 0.0f) {
+                bottom++;
+            }
+            first_air[i * (n + 1) + j] = bottom;
+            last_ground[i * (n + 1) + j] = top;
+        }
+    }
+
+    // The surface crosses between samples, so the ground is only certain a
+    // step under the first air and the air a step over the last ground. Keep
+    // another step of margin for the ground between samples.
+    tile.ground_below.resize(n * n);
+    tile.air_above.resize(n * n);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            int lowest_air = max_step;
+            int highest_ground = 0;
+            for (int di = 0; di <= 1; di++) {
+                for (int dj = 0; dj <= 1; dj++) {
+                    lowest_air = std::min(lowest_air, first_air[(i + di) * (n + 1) + j + dj]);
+                    highest_ground = std::max(highest_ground, last_ground[(i + di) * (n + 1) + j + dj]);
+                }
+            }
+            tile.ground_below[i * n + j] = (lowest_air - 2) * step;
+            tile.air_above[i * n + j] = (highest_ground + 2) * step;
+        }
+    }
+}
+
+void SurfaceQuery::prepareTiles(const vector<ivec2>& columns)
+{
+    batch++;
+
+    vector<pair<ivec2, Tile*>> missing;
+    for (ivec2 column : columns) {
+        auto inserted = tiles.emplace(column, Tile());
+        Tile& tile = inserted.first->second;
+        tile.last_batch = batch;
+        if (inserted.second) {
+            // References to the elements stay valid when the map grows.
+            missing.push_back(make_pair(column, &tile));
+        }
+    }
+
+    if (!missing.empty()) {
+        TRACE_ZONE("SurfaceQuery::buildTiles");
+        parallelFor(missing.size(), 1, SURFACE_QUERY_THREADS, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                buildTile(missing[i].first, *missing[i].second);
+            }
+        });
+        tiles_built += missing.size();
+    }
+
+    if (tiles.size() > SURFACE_MAX_TILES) {
+        vector<pair<int, ivec2>> unused;
+        for (auto& kv : tiles) {
+            if (kv.second.last_batch < batch) {
+                unused.push_back(make_pair(kv.second.last_batch, kv.first));
+            }
+        }
+        std::sort(unused.begin(), unused.end(),
+                  [](const pair<int, ivec2>& a, const pair<int, ivec2>& b) {
+                      return a.first < b.first;
+                  });
+        for (size_t i = 0; i < unused.size() && tiles.size() > SURFACE_MAX_TILES; i++) {
+            tiles.erase(unused[i].second);
+        }
+    }
+}
+
+void SurfaceQuery::cellBounds(vec2 position, float& ground_below, float& air_above) const
+{
+    const int n = SURFACE_TILE_RESOLUTION;
+
+    ivec2 column = columnOf(position);
+    auto found = tiles.find(column);
+    if (found == tiles.end()) {
+        ground_below = -INFINITY;
+        air_above = INFINITY;
+        return;
+    }
+    const Tile& tile = found->second;
+    ivec2 cell = clamp(ivec2((position - vec2(column)) * float(n)), ivec2(0), ivec2(n - 1));
+    ground_below = tile.ground_below[cell.x * n + cell.y];
+    air_above = tile.air_above[cell.x * n + cell.y];
+}
+
+float SurfaceQuery::findSurface(vec2 column) const
+{
+    const float step = 1.0f / SURFACE_HEIGHT_STEPS;
+
+    float ground_below, air_above;
+    cellBounds(column, ground_below, air_above);
+
+    // Walk down from the air to the first ground, then bisect that step.
+    for (float height = air_above - step; height > ground_below; height -= step) {
+        if (density(vec3(column.x, height, column.y)) > 0.0f) {
+            float ground = height;
+            float air = height + step;
+            for (int i = 0; i < SURFACE_REFINE_ITERATIONS; i++) {
+                float middle = (ground + air) * 0.5f;
+                if (density(vec3(column.x, middle, column.y)) > 0.0f) {
+                    ground = middle;
+                } else {
+                    air = middle;
+                }
+            }
+            return (ground + air) * 0.5f;
+        }
+    }
+    return ground_below;
+}
+
+void SurfaceQuery::surfaceHeights(const vector<vec2>& columns, vector<float>& heights)
+{
+    TRACE_ZONE("SurfaceQuery::surfaceHeights");
+
+    vector<ivec2> tile_columns(columns.size());
+    for (size_t i = 0; i < columns.size(); i++) {
+        tile_columns[i] = columnOf(columns[i]);
+    }
+    prepareTiles(tile_columns);
+
+    heights.resize(columns.size());
+    parallelFor(columns.size(), SURFACE_QUERIES_PER_THREAD, SURFACE_QUERY_THREADS,
+                [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            heights[i] = findSurface(columns[i]);
+        }
+    });
+    query_count += columns.size();
+}
+
+void SurfaceQuery::isSolid(const vector<vec3>& points, vector<char>& solid)
+{
+    TRACE_ZONE("SurfaceQuery::isSolid");
+
+    vector<ivec2> tile_columns(points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        tile_columns[i] = columnOf(vec2(points[i].x, points[i].z));
+    }
+    prepareTiles(tile_columns);
+
+    solid.resize(points.size());
+    atomic<long> bounded(0);
+    parallelFor(points.size(), SURFACE_QUERIES_PER_THREAD, SURFACE_QUERY_THREADS,
+                [&](int begin, int end) {
+        long slice_bounded = 0;
+        for (int i = begin; i < end; i++) {
+            vec3 point = points[i];
+            float ground_below, air_above;
+            cellBounds(vec2(point.x, point.z), ground_below, air_above);
+            if (point.y < ground_below) {
+                solid[i] = true;
+                slice_bounded++;
+            } else if (point.y > air_above) {
+                solid[i] = false;
+                slice_bounded++;
+            } else {
+                solid[i] = density(point) > 0.0f;
+            }
+        }
+        bounded += slice_bounded;
+    });
+    query_count += points.size();
+    bounded_queries += bounded;
+}
+
+float SurfaceQuery::surfaceHeight(vec2 column)
+{
+    vector<float> heights;
+    surfaceHeights(vector<vec2>(1, column), heights);
+    return heights[0];
+}
+
+bool SurfaceQuery::isSolid(vec3 point)
+{
+    vector<char> solid;
+    isSolid(vector<vec3>(1, point), solid);
+    return solid[0];
+}
+
+// A ray being cast. Everything on it before t is air.
+struct SurfaceQuery::RayMarch {
+    vec3 origin;
+    vec3 direction;
+    float start;
+    float end;
+    float t;
+
+    // Last distance sampled in the air and, while refining the hit, the first
+    // one in the ground.
+    float air;
+    float ground;
+    int refine_iterations;      // -1 until the ray reaches the ground.
+
+    // Whether the sample at t needs all the octaves, or the bound ones first.
+    bool full_sample;
+    bool done;
+    RayHit hit;
+};
+
+void SurfaceQuery::startRay(RayMarch& ray, vec3 origin, vec3 direction, float max_distance,
+                            vector<ivec2>& columns) const
+{
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.start = 0.0f;
+    ray.end = max_distance;
+    ray.refine_iterations = -1;
+    ray.full_sample = ray_bound_octaves >= terrain_density->octaves;
+    ray.done = false;
+    ray.hit.hit = false;
+    ray.hit.distance = max_distance;
+
+    // Only the part of the ray below the highest ground can hit it.
+    if (direction.y < 0.0f) {
+        ray.start = std::max(0.0f, (origin.y - SURFACE_CEILING) / -direction.y);
+    } else if (direction.y > 0.0f) {
+        ray.end = std::min(ray.end, (SURFACE_CEILING - origin.y) / direction.y);
+    } else if (origin.y > SURFACE_CEILING) {
+        ray.end = -1.0f;
+    }
+    ray.t = ray.start;
+    ray.air = ray.start;
+    if (ray.start > ray.end) {
+        ray.done = true;
+        return;
+    }
+
+    // The columns the ray crosses, in order.
+    vec2 position = vec2(origin.x, origin.z) + vec2(direction.x, direction.z) * ray.start;
+    vec2 planar_direction = vec2(direction.x, direction.z);
+    ivec2 column = columnOf(position);
+    ivec2 step = ivec2(sign(planar_direction));
+    vec2 next_boundary = vec2(column) + max(vec2(step), vec2(0.0f));
+    vec2 next = vec2(INFINITY);
+    vec2 delta = vec2(INFINITY);
+    for (int i = 0; i < 2; i++) {
+        if (step[i] != 0) {
+            next[i] = (next_boundary[i] - position[i]) / planar_direction[i];
+            delta[i] = 1.0f / fabs(planar_direction[i]);
+        }
+    }
+    float length = ray.end - ray.start;
+    columns.push_back(column);
+    while (std::min(next.x, next.y) <= length) {
+        int axis = next.x < next.y ? 0 : 1;
+        column[axis] += step[axis];
+        next[axis] += delta[axis];
+        columns.push_back(column);
+    }
+}
+
+void SurfaceQuery::finishRay(RayMarch& ray, bool hit, float distance) const
+{
+    ray.done = true;
+    ray.hit.hit = hit;
+    ray.hit.distance = distance;
+    ray.hit.position = ray.origin + ray.direction * distance;
+}
+
+bool SurfaceQuery::nextSample(RayMarch& ray, vec3& point, int& octaves) const
+{
+    if (ray.done) {
+        return false;
+    }
+
+    if (ray.refine_iterations >= 0) {
+        point = ray.origin + ray.direction * ((ray.air + ray.ground) * 0.5f);
+        octaves = terrain_density->octaves;
+        return true;
+    }
+
+    const float n = SURFACE_TILE_RESOLUTION;
+    while (ray.t <= ray.end) {
+        vec3 position = ray.origin + ray.direction * ray.t;
+        float ground_below, air_above;
+        cellBounds(vec2(position.x, position.z), ground_below, air_above);
+
+        if (position.y > air_above) {
+            // Air down to the ground of this cell, skip to the next cell or
+            // to that ground, whichever comes first.
+            vec2 cell = floor(vec2(position.x, position.z) * n) / n;
+            float skip = INFINITY;
+            if (ray.direction.x > 0.0f) {
+                skip = std::min(skip, (cell.x + 1.0f / n - position.x) / ray.direction.x);
+            } else if (ray.direction.x < 0.0f) {
+                skip = std::min(skip, (cell.x - position.x) / ray.direction.x);
+            }
+            if (ray.direction.z > 0.0f) {
+                skip = std::min(skip, (cell.y + 1.0f / n - position.z) / ray.direction.z);
+            } else if (ray.direction.z < 0.0f) {
+                skip = std::min(skip, (cell.y - position.z) / ray.direction.z);
+            }
+            if (ray.direction.y < 0.0f) {
+                skip = std::min(skip, (position.y - air_above) / -ray.direction.y);
+            }
+            ray.air = ray.t;
+            ray.t += skip + RAY_SKIP_EPSILON;
+            continue;
+        }
+
+        if (position.y < ground_below) {
+            // Everything before was air, so the ground starts right here.
+            finishRay(ray, true, ray.t);
+            return false;
+        }
+
+        point = position;
+        octaves = ray.full_sample ? terrain_density->octaves : ray_bound_octaves;
+        return true;
+    }
+
+    finishRay(ray, false, ray.end);
+    return false;
+}
+
+void SurfaceQuery::takeSample(RayMarch& ray, float density) const
+{
+    if (ray.refine_iterations >= 0) {
+        float middle = (ray.air + ray.ground) * 0.5f;
+        if (density > 0.0f) {
+            ray.ground = middle;
+        } else {
+            ray.air = middle;
+        }
+        if (++ray.refine_iterations == RAY_REFINE_ITERATIONS) {
+            finishRay(ray, true, (ray.air + ray.ground) * 0.5f);
+        }
+        return;
+    }
+
+    if (!ray.full_sample) {
+        // The other octaves can't make it ground this far.
+        float clearance = -(density + ray_remainder) / ray_bound_lipschitz / BLOCK_SIZE;
+        if (clearance >= RAY_MIN_STEP) {
+            ray.air = ray.t;
+            ray.t += clearance;
+        } else {
+            ray.full_sample = true;
+        }
+        return;
+    }
+
+    ray.full_sample = ray_bound_octaves >= terrain_density->octaves;
+    if (density > 0.0f) {
+        if (ray.t == ray.start) {
+            finishRay(ray, true, ray.t);
+        } else {
+            ray.ground = ray.t;
+            ray.refine_iterations = 0;
+        }
+        return;
+    }
+
+    ray.air = ray.t;
+    ray.t += std::max(-density / ray_lipschitz / BLOCK_SIZE, RAY_MIN_STEP);
+}
+
+// Both return the number of samples taken.
+long SurfaceQuery::traceRays(vector<RayMarch>& rays, int begin, int end) const
+{
+    long samples = 0;
+    for (int i = begin; i < end; i++) {
+        vec3 point;
+        int octaves;
+        while (nextSample(rays[i], point, octaves)) {
+            takeSample(rays[i], terrain_density->terrainDensity(point * float(BLOCK_SIZE),
+                                                                BLOCK_RESOLUTION, octaves));
+            samples++;
+        }
+    }
+    return samples;
+}
+
+long SurfaceQuery::traceRayPackets(vector<RayMarch>& rays, int begin, int end) const
+{
+    // Each lane traces a ray until it is done, then takes the next one.
+    int lanes[4];
+    int next_ray = begin;
+    for (int lane = 0; lane < 4; lane++) {
+        lanes[lane] = next_ray < end ? next_ray++ : -1;
+    }
+
+    long samples = 0;
+    while (true) {
+        vec3 points[4];
+        int octaves[4];
+        bool active = false;
+        for (int lane = 0; lane < 4; lane++) {
+            while (lanes[lane] >= 0 && !nextSample(rays[lanes[lane]], points[lane], octaves[lane])) {
+                lanes[lane] = next_ray < end ? next_ray++ : -1;
+            }
+            active = active || lanes[lane] >= 0;
+        }
+        if (!active) {
+            break;
+        }
+
+        // Lanes either need the bound octaves or all of them, evaluate each
+        // group at once. Idle lanes repeat a point of the group.
+        for (int group = 0; group < 4; group++) {
+            if (lanes[group] < 0) {
+                continue;
+            }
+            int group_octaves = octaves[group];
+            bool earlier_group = false;
+            for (int lane = 0; lane < group; lane++) {
+                earlier_group = earlier_group || (lanes[lane] >= 0 && octaves[lane] == group_octaves);
+            }
+            if (earlier_group) {
+                continue;
+            }
+
+            vec3 coords[4];
+            for (int lane = 0; lane < 4; lane++) {
+                bool in_group = lanes[lane] >= 0 && octaves[lane] == group_octaves;
+                coords[lane] = (in_group ? points[lane] : points[group]) * float(BLOCK_SIZE);
+            }
+            float densities[4];
+            terrain_density->terrainDensity4(coords, BLOCK_RESOLUTION, group_octaves, densities);
+            for (int lane = 0; lane < 4; lane++) {
+                if (lanes[lane] >= 0 && octaves[lane] == group_octaves) {
+                    takeSample(rays[lanes[lane]], densities[lane]);
+                    samples++;
+                }
+            }
+        }
+    }
+    return samples;
+}
+
+void SurfaceQuery::castRays(const vector<vec3>& origins, const vector<vec3>& directions,
+                            float max_distance, vector<RayHit>& hits)
+{
+    TRACE_ZONE("SurfaceQuery::castRays");
+
+    ray_bound_octaves = std::min(RAY_BOUND_OCTAVES, terrain_density->octaves);
+    ray_bound_lipschitz = terrain_density->lipschitzBound(BLOCK_RESOLUTION, ray_bound_octaves);
+    ray_remainder = terrain_density->octaveRemainder(ray_bound_octaves);
+    ray_lipschitz = terrain_density->lipschitzBound(BLOCK_RESOLUTION, terrain_density->octaves);
+
+    vector<RayMarch> rays(origins.size());
+    vector<ivec2> columns;
+    for (size_t i = 0; i < rays.size(); i++) {
+        startRay(rays[i], origins[i], directions[i], max_distance, columns);
+    }
+    prepareTiles(columns);
+
+    atomic<long> samples(0);
+    parallelFor(rays.size(), RAYS_PER_THREAD, SURFACE_QUERY_THREADS, [&](int begin, int end) {
+        samples += use_ray_packets ? traceRayPackets(rays, begin, end) : traceRays(rays, begin, end);
+    });
+
+    hits.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); i++) {
+        hits[i] = rays[i].hit;
+    }
+    ray_count += rays.size();
+    ray_samples += samples;
+}
+
+RayHit SurfaceQuery::castRay(vec3 origin, vec3 direction, float max_distance)
+{
+    vector<RayHit> hits;
+    castRays(vector<vec3>(1, origin), vector<vec3>(1, direction), max_distance, hits);
+    return hits[0];
+}
+
+bool SurfaceQuery::lineOfSight(vec3 from, vec3 to)
+{
+    float distance = length(to - from);
+    if (distance == 0.0f) {
+        return true;
+    }
+    return !castRay(from, (to - from) / distance, distance).hit;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+#include "terrain_density.hpp"
+#include "vec_hash.hpp"
+
+// Where a ray cast by SurfaceQuery entered the ground, distance is along the
+// ray in blocks.
+struct RayHit {
+    bool hit;
+    float distance;
+    glm::vec3 position;
+};
+
+// Answers "how high is the ground here", "is this point inside the ground" and
+// "where does this ray hit the ground" on the CPU, for gameplay code (camera
+// collision, placing objects, the swarm, picking) that can't wait for the
+// blocks, which live on the GPU anyway.
+//
+// Queries are in the same units as block indices, block (x, y, z) spans
+// [x, x + 1] etc., and are answered against the density function. To avoid
+// evaluating it for most of them, each block column is covered by a tile of
+// SURFACE_TILE_RESOLUTION^2 cells that keeps, for each cell, a height below
+// which everything is ground and a height above which everything is air. Only
+// points between the two (caves, overhangs, the ground itself) sample the
+// density function. The bounds come from samples SURFACE_HEIGHT_STEPS per
+// block apart with a step of margin, features thinner than that can be missed.
+//
+// Rays skip the cells they pass above, and in the others are sphere traced:
+// the density can't change faster than lipschitzBound, so a point where it is
+// -d is at least d / lipschitzBound away from the ground. Steps are bounded
+// with RAY_BOUND_OCTAVES octaves first, cheaper and smoother, then with all of
+// them, at least RAY_MIN_STEP, and the first step into the ground is bisected.
+// Rays are traced four at a time, evaluating the density of their next samples
+// together with TerrainDensity::terrainDensity4.
+//
+// Batches first build the tiles they need and then answer their queries, both
+// split across up to SURFACE_QUERY_THREADS threads.
+class SurfaceQuery {
+public:
+    SurfaceQuery();
+
+    // Answer queries for that density function, drops the tiles.
+    void reset(const TerrainDensity& terrain_density);
+    // The density changed within [low, high] (in blocks), drops the tiles of
+    // those columns.
+    void invalidate(glm::vec3 low, glm::vec3 high);
+    // The density function queries are answered for, for callers that sample
+    // it themselves.
+    const TerrainDensity& densityFunction() const { return *terrain_density; }
+
+    // Height of the top of the ground (below the air above any overhang) at
+    // each (x, z).
+    void surfaceHeights(const std::vector<glm::vec2>& columns, std::vector<float>& heights);
+    // Whether each point is inside the ground.
+    void isSolid(const std::vector<glm::vec3>& points, std::vector<char>& solid);
+
+    // Where each ray, from its origin along its (normalized) direction, first
+    // enters the ground within max_distance blocks.
+    void castRays(const std::vector<glm::vec3>& origins, const std::vector<glm::vec3>& directions,
+                  float max_distance, std::vector<RayHit>& hits);
+
+    float surfaceHeight(glm::vec2 column);
+    bool isSolid(glm::vec3 point);
+    RayHit castRay(glm::vec3 origin, glm::vec3 direction, float max_distance);
+    // Whether there is no ground between from and to.
+    bool lineOfSight(glm::vec3 from, glm::vec3 to);
+
+    // Trace four rays at a time rather than one, the benchmark compares both.
+    bool use_ray_packets;
+
+    int tileCount() { return tiles.size(); }
+    int tilesBuilt() { return tiles_built; }
+    long queryCount() { return query_count; }
+    // Point queries answered by the tiles alone.
+    long boundedQueries() { return bounded_queries; }
+    long rayCount() { return ray_count; }
+    // Points where rays evaluated the density function.
+    long raySamples() { return ray_samples; }
+
+private:
+    struct Tile {
+        // Per cell, row-major in x.
+        std::vector<float> ground_below;
+        std::vector<float> air_above;
+        int last_batch;
+    };
+
+    // Builds the tiles covering these columns that are missing, and forgets
+    // the least recently used ones over SURFACE_MAX_TILES.
+    void prepareTiles(const std::vector<glm::ivec2>& columns);
+    void buildTile(glm::ivec2 column, Tile& tile);
+
+    // Bounds of the ground in the cell containing (x, z). Rays may graze a
+    // column their batch didn't prepare, without a tile nothing is bounded.
+    void cellBounds(glm::vec2 column, float& ground_below, float& air_above) const;
+
+    float density(glm::vec3 point) const;
+    float findSurface(glm::vec2 column) const;
+
+    struct RayMarch;
+    void startRay(RayMarch& ray, glm::vec3 origin, glm::vec3 direction, float max_distance,
+                  std::vector<glm::ivec2>& columns) const;
+    // The next point (in blocks) where the ray needs the density with that
+    // many octaves, false once the ray is done.
+    bool nextSample(RayMarch& ray, glm::vec3& point, int& octaves) const;
+    void takeSample(RayMarch& ray, float density) const;
+    void finishRay(RayMarch& ray, bool hit, float distance) const;
+    long traceRays(std::vector<RayMarch>& rays, int begin, int end) const;
+    long traceRayPackets(std::vector<RayMarch>& rays, int begin, int end) const;
+
+    std::unique_ptr<TerrainDensity> terrain_density;
+
+    ivec2_map<Tile> tiles;
+    int batch;
+
+    // Bounds of the density function for the rays, see castRays.
+    int ray_bound_octaves;
+    float ray_bound_lipschitz;
+    float ray_remainder;
+    float ray_lipschitz;
+
+    int tiles_built;
+    long query_count;
+    long bounded_queries;
+    long ray_count;
+    long ray_samples;
+};
@@ -5,57 +5,97 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <cassert>
+#include <random>
+
+#include "constants.hpp"
+#include "parallel_for.hpp"
+#include "trace.hpp"
+
 using namespace glm;
 using namespace std;
 
-#define SWARM_SIZE 1024
+// The swarm starts within SWARM_SPREAD blocks of its home, between
+// SWARM_MIN_HEIGHT and SWARM_MAX_HEIGHT blocks above the ground, and stays
+// around it.
+#define SWARM_SPREAD 6.0f
+#define SWARM_MIN_HEIGHT 0.1f
+#define SWARM_MAX_HEIGHT 0.4f
+#define SWARM_START_SPEED 0.3f
+
+// Agents per invocation of SwarmUpdate.cs.
+#define SWARM_LOCAL_SIZE 256
 
 Swarm::Swarm()
-: cube(0.12)
+: agent_count(0)
+, on_gpu(false)
+, home(0.0f)
+, current_buffers(0)
+, colors_buffer(0)
+, cube(0.02)
 {
+    for (int i = 0; i < 2; i++) {
+        positions_buffers[i] = 0;
+        velocities_buffers[i] = 0;
+    }
 }
 
-void Swarm::init(string dir)
+Swarm::~Swarm()
 {
-    initialization_shader.generateProgramObject();
-    initialization_shader.attachComputeShader((dir + "SwarmInitialization.cs").c_str());
-    initialization_shader.link();
+    // Zero names (swarm never initialized) are silently ignored.
+    glDeleteBuffers(2, positions_buffers);
+    glDeleteBuffers(2, velocities_buffers);
+    glDeleteBuffers(1, &colors_buffer);
+}
 
+void Swarm::init(string dir)
+{
     update_shader.generateProgramObject();
     update_shader.attachVertexShader((dir + "ColorShaderAttrib.vs").c_str());
     update_shader.attachFragmentShader((dir + "ColorShader.fs").c_str());
     update_shader.link();
 
-    cube.init(update_shader);
+    step_shader.generateProgramObject();
+    step_shader.attachComputeShader((dir + "SwarmUpdate.cs").c_str());
+    step_shader.setDefines(Boids::shaderDefines());
+    step_shader.link();
 
-    block_size_uni = initialization_shader.getUniformLocation("block_size");
-    period_uni = initialization_shader.getUniformLocation("period");
-    warp_params_uni = initialization_shader.getUniformLocation("warp_params");
+    // Allocated for the agents when they are placed.
+    glGenBuffers(2, positions_buffers);
+    glGenBuffers(2, velocities_buffers);
+    glGenBuffers(1, &colors_buffer);
+
+    CHECK_GL_ERRORS;
+}
+
+void Swarm::finishInit()
+{
+    cube.init(update_shader);
 
     P_uni = update_shader.getUniformLocation("P");
     V_uni = update_shader.getUniformLocation("V");
     M_uni = update_shader.getUniformLocation("M");
+    eye_position_uni = update_shader.getUniformLocation("eye_position");
+    fog_uni = update_shader.getUniformLocation("fog_params");
+
+    agent_count_uni = step_shader.getUniformLocation("agent_count");
+    time_elapsed_uni = step_shader.getUniformLocation("time_elapsed");
+    home_uni = step_shader.getUniformLocation("home");
+    home_radius_uni = step_shader.getUniformLocation("home_radius");
+    period_uni = step_shader.getUniformLocation("period");
+    warp_params_uni = step_shader.getUniformLocation("warp_params");
+    octave_weights_uni = step_shader.getUniformLocation("octave_weights");
 
     pos_attrib = update_shader.getAttribLocation("instance_pos");
     color_attrib = update_shader.getAttribLocation("color");
 
-    glGenBuffers(1, &positions_buffer);
-    glGenBuffers(1, &velocities_buffer);
-    glGenBuffers(1, &colors_buffer);
-
-    glBindBuffer(GL_ARRAY_BUFFER, velocities_buffer);
-    glBufferData(GL_ARRAY_BUFFER, SWARM_SIZE * sizeof(vec3), NULL, GL_STREAM_DRAW);
-
     glBindVertexArray(cube.getVertices());
     {
-        glBindBuffer(GL_ARRAY_BUFFER, positions_buffer);
-        glBufferData(GL_ARRAY_BUFFER, SWARM_SIZE * sizeof(vec3), NULL, GL_DYNAMIC_DRAW);
+        // The positions are pointed at the current buffer when drawing.
         glEnableVertexAttribArray(pos_attrib);
-        glVertexAttribPointer(pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
         glVertexAttribDivisor(pos_attrib, 1); // 1 per object
 
         glBindBuffer(GL_ARRAY_BUFFER, colors_buffer);
-        glBufferData(GL_ARRAY_BUFFER, SWARM_SIZE * sizeof(vec3), NULL, GL_DYNAMIC_DRAW);
         glEnableVertexAttribArray(color_attrib);
         glVertexAttribPointer(color_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
         glVertexAttribDivisor(color_attrib, 1); // 1 per object
@@ -65,17 +105,87 @@ void Swarm::init(string dir)
     CHECK_GL_ERRORS;
 }
 
-void Swarm::draw(mat4 P, mat4 V, mat4 M, vec3 eye_position, TerrainGenerator& terrain_generator)
+void Swarm::update(float time_elapsed, const TerrainGenerator& terrain_generator)
+{
+    TRACE_ZONE("Swarm::update");
+
+    if (on_gpu) {
+        updateOnGpu(time_elapsed, terrain_generator);
+        return;
+    }
+
+    boids.step(time_elapsed, terrain_generator.densityFunction());
+    boids.positions(positions);
+
+    glBindBuffer(GL_ARRAY_BUFFER, positions_buffers[current_buffers]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, positions.size() * sizeof(vec3), positions.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    CHECK_GL_ERRORS;
+}
+
+void Swarm::updateOnGpu(float time_elapsed, const TerrainGenerator& terrain_generator)
+{
+    // The shader always sums SWARM_AVOID_OCTAVES octaves, the ones past those
+    // of the generator weigh nothing.
+    float octave_weights[SWARM_AVOID_OCTAVES] = { 0.0f };
+    TerrainDensity terrain_density = terrain_generator.densityFunction();
+    std::copy(terrain_density.octaveWeights(),
+              terrain_density.octaveWeights() + std::min(SWARM_AVOID_OCTAVES,
+                                                         terrain_density.octaves),
+              octave_weights);
+
+    step_shader.enable();
+    {
+        glUniform1i(agent_count_uni, agent_count);
+        glUniform1f(time_elapsed_uni, time_elapsed);
+        glUniform2f(home_uni, home.x, home.y);
+        glUniform1f(home_radius_uni, SWARM_SPREAD);
+        glUniform1f(period_uni, terrain_generator.period);
+        glUniform2f(warp_params_uni, terrain_generator.warp_frequency,
+                    terrain_generator.warp_strength);
+        glUniform1fv(octave_weights_uni, SWARM_AVOID_OCTAVES, octave_weights);
+
+        int next_buffers = 1 - current_buffers;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, positions_buffers[current_buffers]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, velocities_buffers[current_buffers]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, positions_buffers[next_buffers]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, velocities_buffers[next_buffers]);
+
+        glDispatchCompute((agent_count + SWARM_LOCAL_SIZE - 1) / SWARM_LOCAL_SIZE, 1, 1);
+
+        // The positions are drawn as instance attributes and read by the next
+        // step.
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT |
+                        GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        for (int i = 0; i < 4; i++) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+        }
+        current_buffers = next_buffers;
+    }
+    step_shader.disable();
+
+    CHECK_GL_ERRORS;
+}
+
+void Swarm::draw(mat4 P, mat4 V, mat4 M, vec3 eye_position)
 {
     update_shader.enable();
     {
         glBindVertexArray(cube.getVertices());
 
+        glBindBuffer(GL_ARRAY_BUFFER, positions_buffers[current_buffers]);
+        glVertexAttribPointer(pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
         glUniformMatrix4fv(P_uni, 1, GL_FALSE, value_ptr(P));
         glUniformMatrix4fv(V_uni, 1, GL_FALSE, value_ptr(V));
         glUniformMatrix4fv(M_uni, 1, GL_FALSE, value_ptr(M));
+        glUniform3f(eye_position_uni, eye_position.x, eye_position.y, eye_position.z);
+        glUniform3f(fog_uni, FOG_MULTIPLIER, VIEW_RANGE, FOG_BIAS);
 
-        glDrawElementsInstanced(GL_TRIANGLES, cube.indexCount(), GL_UNSIGNED_INT, 0, SWARM_SIZE);
+        glDrawElementsInstanced(GL_TRIANGLES, cube.indexCount(), GL_UNSIGNED_INT, 0, agent_count);
 
         glBindVertexArray(0);
     }
@@ -84,20 +194,132 @@ void Swarm::draw(mat4 P, mat4 V, mat4 M, vec3 eye_position, TerrainGenerator& te
     CHECK_GL_ERRORS;
 }
 
-void Swarm::initializeAttributes(TerrainGenerator& terrain_generator)
+float Swarm::compareGpuStep(float time_elapsed, const TerrainGenerator& terrain_generator)
 {
-    initialization_shader.enable();
-    {
-        glUniform1i(block_size_uni, BLOCK_SIZE);
-        glUniform2f(warp_params_uni, terrain_generator.warp_frequency, terrain_generator.warp_strength);
-        glUniform1f(period_uni, terrain_generator.period);
+    assert(on_gpu);
+
+    vector<vec3> velocities;
+    readBack(positions, velocities);
 
-        glDispatchCompute(1, 1, 1);
+    // Without the edits, as on the GPU.
+    TerrainDensity terrain_density(terrain_generator.period, terrain_generator.octaves,
+                                   terrain_generator.octaves_decay,
+                                   vec2(terrain_generator.warp_frequency,
+                                        terrain_generator.warp_strength));
+    vec2 home = this->home;
+    parallelFor(agent_count, SWARM_AGENTS_PER_THREAD, SWARM_THREADS, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            Boids::stepAlone(time_elapsed, terrain_density, home, SWARM_SPREAD, positions[i],
+                             velocities[i]);
+        }
+    });
 
-        // Block until kernel/shader finishes execution.
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    updateOnGpu(time_elapsed, terrain_generator);
+    vector<vec3> gpu_positions;
+    vector<vec3> gpu_velocities;
+    readBack(gpu_positions, gpu_velocities);
+
+    float max_distance = 0.0f;
+    for (int i = 0; i < agent_count; i++) {
+        max_distance = std::max(max_distance, distance(positions[i], gpu_positions[i]));
     }
-    initialization_shader.disable();
+    return max_distance;
+}
+
+void Swarm::readBack(vector<vec3>& positions, vector<vec3>& velocities)
+{
+    positions.resize(agent_count);
+    velocities.resize(agent_count);
+    glBindBuffer(GL_ARRAY_BUFFER, positions_buffers[current_buffers]);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, agent_count * sizeof(vec3), positions.data());
+    glBindBuffer(GL_ARRAY_BUFFER, velocities_buffers[current_buffers]);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, agent_count * sizeof(vec3), velocities.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     CHECK_GL_ERRORS;
 }
+
+void Swarm::initializeAttributes(SurfaceQuery& surface_query, int size, bool on_gpu)
+{
+    TRACE_ZONE("Swarm::initializeAttributes");
+
+    size = std::min(size, on_gpu ? SWARM_GPU_MAX_SIZE : SWARM_MAX_SIZE);
+    this->on_gpu = on_gpu;
+    agent_count = size;
+    current_buffers = 0;
+
+    // The GPU keeps the agents, the CPU only needs them to start.
+    vector<vec3> velocities;
+    if (on_gpu) {
+        placeAgents(surface_query, home, size, positions, velocities);
+        boids.reset(vector<vec3>(), vector<vec3>());
+    } else {
+        placeAgents(surface_query, home, size, boids);
+        boids.positions(positions);
+        boids.velocities(velocities);
+    }
+
+    // Dark birds, some darker than others.
+    mt19937 generator(488);
+    uniform_real_distribution<float> shade(0.1f, 0.3f);
+    vector<vec3> colors(size);
+    for (vec3& color : colors) {
+        color = vec3(shade(generator));
+    }
+
+    size_t bytes = size * sizeof(vec3);
+    GLenum usage = on_gpu ? GL_DYNAMIC_COPY : GL_STREAM_DRAW;
+    for (int i = 0; i < 2; i++) {
+        // On the CPU, only the first positions are used.
+        size_t used_bytes = on_gpu ? bytes : 0;
+        glBindBuffer(GL_ARRAY_BUFFER, positions_buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, i == 0 ? bytes : used_bytes, positions.data(), usage);
+        glBindBuffer(GL_ARRAY_BUFFER, velocities_buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, used_bytes, velocities.data(), usage);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, colors_buffer);
+    glBufferData(GL_ARRAY_BUFFER, bytes, colors.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    CHECK_GL_ERRORS;
+}
+
+void Swarm::placeAgents(SurfaceQuery& surface_query, vec2 home, int size, Boids& boids)
+{
+    vector<vec3> positions;
+    vector<vec3> velocities;
+    placeAgents(surface_query, home, size, positions, velocities);
+
+    boids.home = home;
+    boids.home_radius = SWARM_SPREAD;
+    boids.reset(positions, velocities);
+}
+
+void Swarm::placeAgents(SurfaceQuery& surface_query, vec2 home, int size,
+                        vector<vec3>& positions, vector<vec3>& velocities)
+{
+    // The same swarm every run.
+    mt19937 generator(488);
+    uniform_real_distribution<float> spread(-SWARM_SPREAD, SWARM_SPREAD);
+    uniform_real_distribution<float> height(SWARM_MIN_HEIGHT, SWARM_MAX_HEIGHT);
+    uniform_real_distribution<float> axis(-1.0f, 1.0f);
+
+    vector<vec2> columns(size);
+    for (vec2& column : columns) {
+        column = home + vec2(spread(generator), spread(generator));
+    }
+    vector<float> ground_heights;
+    surface_query.surfaceHeights(columns, ground_heights);
+
+    positions.resize(size);
+    velocities.resize(size);
+    for (int i = 0; i < size; i++) {
+        positions[i] = vec3(columns[i].x, ground_heights[i] + height(generator), columns[i].y);
+        // Mostly level.
+        vec3 direction;
+        do {
+            direction = vec3(axis(generator), 0.2f * axis(generator), axis(generator));
+        } while (length(direction) < 0.01f);
+        velocities[i] = normalize(direction) * SWARM_START_SPEED;
+    }
+}
@@ -5,34 +5,86 @@
 #include <glm/glm.hpp>
 #include <vector>
 
+#include "boids.hpp"
 #include "cube.hpp"
+#include "surface_query.hpp"
+#include "terrain_density.hpp"
 #include "terrain_generator.hpp"
 
+// A swarm of birds, drawn as instanced cubes. On the CPU the agents flock, see
+// Boids. On the GPU they only avoid the ground and stay around home, but there
+// can be millions of them: a compute shader steps them from one pair of
+// buffers into the other, and the positions it writes are drawn as they are,
+// without going through the CPU.
 class Swarm
 {
 public:
     Swarm();
+    ~Swarm();
 
+    // Submits the shaders and allocates the buffers, finishInit does the rest
+    // once the shaders are linked.
     void init(std::string dir);
-    void initializeAttributes(TerrainGenerator& terrain_generator);
-    void draw(glm::mat4 P, glm::mat4 V, glm::mat4 M, glm::vec3 eye_position,
-              TerrainGenerator& terrain_generator);
+    void finishInit();
+    // Places size agents in the air above the ground, at most SWARM_MAX_SIZE on
+    // the CPU and SWARM_GPU_MAX_SIZE on the GPU.
+    void initializeAttributes(SurfaceQuery& surface_query, int size, bool on_gpu);
+    // Moves the agents for the density function of the generator. The GPU
+    // ignores the terrain edits.
+    void update(float time_elapsed, const TerrainGenerator& terrain_generator);
+    void draw(glm::mat4 P, glm::mat4 V, glm::mat4 M, glm::vec3 eye_position);
+
+    int size() const { return agent_count; }
+    bool onGpu() const { return on_gpu; }
+    // Of the last step on the CPU.
+    float lastStepMilliseconds() const { return boids.lastStepMilliseconds(); }
+
+    // Reads the agents back from the GPU, steps them there and with
+    // Boids::stepAlone on the CPU, and returns the largest distance between
+    // where they end up. Only for a swarm on the GPU.
+    float compareGpuStep(float time_elapsed, const TerrainGenerator& terrain_generator);
+
+    // Places size agents within SWARM_SPREAD blocks of home, flying in random
+    // directions, the same ones every time.
+    static void placeAgents(SurfaceQuery& surface_query, glm::vec2 home, int size, Boids& boids);
 
 private:
-    ShaderProgram initialization_shader;
+    static void placeAgents(SurfaceQuery& surface_query, glm::vec2 home, int size,
+                            std::vector<glm::vec3>& positions,
+                            std::vector<glm::vec3>& velocities);
+
+    void updateOnGpu(float time_elapsed, const TerrainGenerator& terrain_generator);
+    void readBack(std::vector<glm::vec3>& positions, std::vector<glm::vec3>& velocities);
+
     ShaderProgram update_shader;
+    ShaderProgram step_shader;
 
-    GLuint positions_buffer;
-    GLuint velocities_buffer;
-    GLuint colors_buffer;
+    Boids boids;
+    std::vector<glm::vec3> positions;
+    int agent_count;
+    bool on_gpu;
+    glm::vec2 home;
 
-    GLint block_size_uni;
-    GLint period_uni;
-    GLint warp_params_uni;
+    // Steps on the GPU read the current buffers and write the others. On the
+    // CPU, only the current positions are used.
+    GLuint positions_buffers[2];
+    GLuint velocities_buffers[2];
+    int current_buffers;
+    GLuint colors_buffer;
 
     GLint P_uni;    // Uniform location for Projection matrix.
     GLint V_uni;    // Uniform location for View matrix.
     GLint M_uni;    // Uniform location for Model matrix.
+    GLint eye_position_uni;
+    GLint fog_uni;
+
+    GLint agent_count_uni;
+    GLint time_elapsed_uni;
+    GLint home_uni;
+    GLint home_radius_uni;
+    GLint period_uni;
+    GLint warp_params_uni;
+    GLint octave_weights_uni;
 
     GLint pos_attrib;
     GLint color_attrib;
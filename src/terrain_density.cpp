@@ -0,0 +1,599 @@
+#include "terrain_density.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace glm;
+using namespace std;
+
+// Bounds of perlinNoise at a frequency of 1, the largest gradient and value
+// found by sampling millions of points (3.28 and 0.99), rounded up.
+#define PERLIN_LIPSCHITZ 3.5f
+#define PERLIN_AMPLITUDE 1.0f
+
+// Represent the twelve vectors of the edges of a cube.
+static const vec3 perlin_vectors[12] = {
+    vec3(1,1,0),vec3(-1,1,0),vec3(1,-1,0),vec3(-1,-1,0),
+    vec3(1,0,1),vec3(-1,0,1),vec3(1,0,-1),vec3(-1,0,-1),
+    vec3(0,1,1),vec3(0,-1,1),vec3(0,1,-1),vec3(0,-1,-1)
+};
+
+// Same as hash in noise.h. Unsigned arithmetic so that overflow wraps around
+// like it does on the GPU.
+static uint32_t latticeHash(ivec3 lower_corner)
+{
+    uint32_t x = uint32_t(lower_corner.x) * 256 * 256 +
+                 uint32_t(lower_corner.y) * 256 +
+                 uint32_t(lower_corner.z);
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = ((x >> 16) ^ x);
+    return x;
+}
+
+static float influenceAtCoordinate(ivec3 lower_corner, ivec3 offset, vec3 inner_coords)
+{
+    return dot(perlin_vectors[latticeHash(lower_corner + offset) % 12], inner_coords - vec3(offset));
+}
+
+static float ease(float t)
+{
+    float t3 = t * t * t;
+    float t4 = t3 * t;
+    float t5 = t4 * t;
+    return 6 * t5 - 15 * t4 + 10 * t3;
+}
+
+TerrainDensity::TerrainDensity(float period, int octaves, float octaves_decay, vec2 warp_params,
+                               const TerrainEdits* edits)
+: octaves(clamp(octaves, 0, MAX_OCTAVES))
+, period(period)
+, warp_params(warp_params)
+, edits(edits)
+{
+    for (int i = 0; i < MAX_OCTAVES; i++) {
+        octave_weights[i] = 1.0f / pow(float(i + 1), octaves_decay);
+    }
+}
+
+float TerrainDensity::perlinNoise(vec3 coords, float frequency)
+{
+    vec3 scaled_coords = coords * frequency;
+    vec3 lower = floor(scaled_coords);
+    vec3 inner_coords = scaled_coords - lower;
+    ivec3 lower_corner = ivec3(lower);
+
+    float x_interpolant = ease(inner_coords.x);
+    float y_interpolant = ease(inner_coords.y);
+    float z_interpolant = ease(inner_coords.z);
+
+    vec4 face1 = vec4(influenceAtCoordinate(lower_corner, ivec3(0, 0, 0), inner_coords),
+                      influenceAtCoordinate(lower_corner, ivec3(0, 1, 0), inner_coords),
+                      influenceAtCoordinate(lower_corner, ivec3(1, 0, 0), inner_coords),
+                      influenceAtCoordinate(lower_corner, ivec3(1, 1, 0), inner_coords));
+    vec4 face2 = vec4(influenceAtCoordinate(lower_corner, ivec3(0, 0, 1), inner_coords),
+                      influenceAtCoordinate(lower_corner, ivec3(0, 1, 1), inner_coords),
+                      influenceAtCoordinate(lower_corner, ivec3(1, 0, 1), inner_coords),
+                      influenceAtCoordinate(lower_corner, ivec3(1, 1, 1), inner_coords));
+    vec4 z_interp = mix(face1, face2, z_interpolant);
+    vec2 y_interp = mix(vec2(z_interp.x, z_interp.z), vec2(z_interp.y, z_interp.w), y_interpolant);
+    return mix(y_interp.x, y_interp.y, x_interpolant);
+}
+
+// Adds octaves I to Octaves - 1 to the noise. Recursing on I unrolls the loop,
+// in the same order as the GPU so that the sums round the same way.
+template <int I, int Octaves>
+struct OctaveSum {
+    static float add(float noise, vec3 coords, float frequency, const float* weights)
+    {
+        noise += TerrainDensity::perlinNoise(coords, frequency) * weights[I];
+        return OctaveSum<I + 1, Octaves>::add(noise, coords, frequency * 1.95f, weights);
+    }
+};
+
+template <int Octaves>
+struct OctaveSum<Octaves, Octaves> {
+    static float add(float noise, vec3 /*coords*/, float /*frequency*/, const float* /*weights*/)
+    {
+        return noise;
+    }
+};
+
+template <int Octaves>
+float TerrainDensity::kernel(vec3 coords, float block_size) const
+{
+    float max_blocks_y = 2.0f;
+
+    vec3 warped_coords = coords;
+    warped_coords += perlinNoise(coords, warp_params.x) * warp_params.y;
+    warped_coords += perlinNoise(coords, warp_params.x * 1.9f) * (warp_params.y / 2);
+
+    float noise = OctaveSum<0, Octaves>::add(0.0f, warped_coords, 1.0f / period, octave_weights);
+
+    // Air is negative, ground is positive.
+    float min = -1.2f;
+    float max = 0.5f;
+    float height_gradient = max - (max - min) * (coords.y / max_blocks_y) / block_size;
+
+    float density = height_gradient + noise * 1.5f;
+
+    if (coords.y / block_size < 0.1f) {
+        density += (0.1f - coords.y / block_size) * 10;
+    }
+    if (coords.y / block_size > max_blocks_y - 0.1f) {
+        density -= (coords.y / block_size - (max_blocks_y - 0.1f)) * 10;
+    }
+
+    return density;
+}
+
+#if defined(__SSE2__)
+
+// Four points, one per lane.
+struct Coords4 {
+    __m128 x;
+    __m128 y;
+    __m128 z;
+};
+
+// _mm_mullo_epi32 needs SSE4.1.
+static __m128i multiply4(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// Same as latticeHash, then % 12.
+static __m128i gradientIndex4(__m128i x, __m128i y, __m128i z)
+{
+    const __m128i multiplier = _mm_set1_epi32(0x45d9f3b);
+    __m128i h = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(x, 16), _mm_slli_epi32(y, 8)), z);
+    h = multiply4(_mm_xor_si128(_mm_srli_epi32(h, 16), h), multiplier);
+    h = multiply4(_mm_xor_si128(_mm_srli_epi32(h, 16), h), multiplier);
+    h = _mm_xor_si128(_mm_srli_epi32(h, 16), h);
+
+    // h / 12 is (h * 0xaaaaaaab) >> 35, on the even and odd lanes separately.
+    const __m128i reciprocal = _mm_set1_epi32(0xaaaaaaab);
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(h, reciprocal), 35);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(h, 32), reciprocal), 35);
+    __m128i quotient = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+    return _mm_sub_epi32(h, _mm_add_epi32(_mm_slli_epi32(quotient, 3), _mm_slli_epi32(quotient, 2)));
+}
+
+// Same as influenceAtCoordinate, from the index of the gradient at the corner.
+// Of the twelve perlin_vectors, the first eight have x = +-1 and the others
+// y = +-1, the first four y = +-1 and the others z = +-1, so the dot product
+// is the sum of two coordinates, the first negated on odd indices and the
+// second on indices with bit 1 set.
+static __m128 influence4(__m128i index, int dx, int dy, int dz, const __m128* inner_coords)
+{
+    __m128 x = _mm_sub_ps(inner_coords[0], _mm_set1_ps(dx));
+    __m128 y = _mm_sub_ps(inner_coords[1], _mm_set1_ps(dy));
+    __m128 z = _mm_sub_ps(inner_coords[2], _mm_set1_ps(dz));
+
+    __m128 first_is_x = _mm_castsi128_ps(_mm_cmplt_epi32(index, _mm_set1_epi32(8)));
+    __m128 second_is_y = _mm_castsi128_ps(_mm_cmplt_epi32(index, _mm_set1_epi32(4)));
+    __m128 first = _mm_or_ps(_mm_and_ps(first_is_x, x), _mm_andnot_ps(first_is_x, y));
+    __m128 second = _mm_or_ps(_mm_and_ps(second_is_y, y), _mm_andnot_ps(second_is_y, z));
+
+    __m128i sign = _mm_set1_epi32(0x80000000);
+    __m128i negate_first = _mm_slli_epi32(index, 31);
+    __m128i negate_second = _mm_and_si128(_mm_slli_epi32(index, 30), sign);
+    first = _mm_xor_ps(first, _mm_castsi128_ps(negate_first));
+    second = _mm_xor_ps(second, _mm_castsi128_ps(negate_second));
+    return _mm_add_ps(first, second);
+}
+
+static __m128 ease4(__m128 t)
+{
+    __m128 t3 = _mm_mul_ps(_mm_mul_ps(t, t), t);
+    __m128 t4 = _mm_mul_ps(t3, t);
+    __m128 t5 = _mm_mul_ps(t4, t);
+    return _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(6), t5), _mm_mul_ps(_mm_set1_ps(15), t4)),
+                      _mm_mul_ps(_mm_set1_ps(10), t3));
+}
+
+// mix(a, b, t)
+static __m128 mix4(__m128 a, __m128 b, __m128 t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+// The lattice cell of each point, and the coordinates within it.
+static void latticeCell4(const Coords4& coords, float frequency,
+                         __m128i* lower_corner, __m128* inner_coords)
+{
+    __m128 scaled[3] = {
+        _mm_mul_ps(coords.x, _mm_set1_ps(frequency)),
+        _mm_mul_ps(coords.y, _mm_set1_ps(frequency)),
+        _mm_mul_ps(coords.z, _mm_set1_ps(frequency)),
+    };
+
+    for (int i = 0; i < 3; i++) {
+        // floor, truncating then going one down where that rounded up.
+        __m128i truncated = _mm_cvttps_epi32(scaled[i]);
+        __m128 lower = _mm_cvtepi32_ps(truncated);
+        __m128 rounded_up = _mm_cmpgt_ps(lower, scaled[i]);
+        lower = _mm_sub_ps(lower, _mm_and_ps(rounded_up, _mm_set1_ps(1.0f)));
+        lower_corner[i] = _mm_add_epi32(truncated, _mm_castps_si128(rounded_up));
+        inner_coords[i] = _mm_sub_ps(scaled[i], lower);
+    }
+}
+
+// The rest of perlinNoise4, given the gradient index at each corner of the
+// cells, corners[(dx * 2 + dy) * 2 + dz].
+static __m128 interpolate4(const __m128i* corners, const __m128* inner_coords)
+{
+    __m128 x_interpolant = ease4(inner_coords[0]);
+    __m128 y_interpolant = ease4(inner_coords[1]);
+    __m128 z_interpolant = ease4(inner_coords[2]);
+
+    __m128 z_interp_x = mix4(influence4(corners[0], 0, 0, 0, inner_coords),
+                             influence4(corners[1], 0, 0, 1, inner_coords), z_interpolant);
+    __m128 z_interp_y = mix4(influence4(corners[2], 0, 1, 0, inner_coords),
+                             influence4(corners[3], 0, 1, 1, inner_coords), z_interpolant);
+    __m128 z_interp_z = mix4(influence4(corners[4], 1, 0, 0, inner_coords),
+                             influence4(corners[5], 1, 0, 1, inner_coords), z_interpolant);
+    __m128 z_interp_w = mix4(influence4(corners[6], 1, 1, 0, inner_coords),
+                             influence4(corners[7], 1, 1, 1, inner_coords), z_interpolant);
+    __m128 y_interp_x = mix4(z_interp_x, z_interp_y, y_interpolant);
+    __m128 y_interp_y = mix4(z_interp_z, z_interp_w, y_interpolant);
+    return mix4(y_interp_x, y_interp_y, x_interpolant);
+}
+
+// Same as TerrainDensity::perlinNoise, in the same order of operations so the
+// results are the same.
+static __m128 perlinNoise4(const Coords4& coords, float frequency)
+{
+    __m128i lower_corner[3];
+    __m128 inner_coords[3];
+    latticeCell4(coords, frequency, lower_corner, inner_coords);
+
+    __m128i corners[8];
+    for (int i = 0; i < 8; i++) {
+        corners[i] = gradientIndex4(_mm_add_epi32(lower_corner[0], _mm_set1_epi32(i >> 2)),
+                                    _mm_add_epi32(lower_corner[1], _mm_set1_epi32((i >> 1) & 1)),
+                                    _mm_add_epi32(lower_corner[2], _mm_set1_epi32(i & 1)));
+    }
+    return interpolate4(corners, inner_coords);
+}
+
+// The gradient indices of a box of lattice points, for one noise of
+// TerrainDensity::terrainDensityRow.
+struct GradientTile {
+    ivec3 low;
+    ivec3 size;
+    uint8_t indices[GRADIENT_TILE_POINTS];
+};
+
+// Hashes the lattice points that perlinNoise(coords, frequency) needs for
+// coords within [low, high] into the tile, unless there are more than
+// max_points of them.
+static bool buildGradientTile(vec3 low, vec3 high, float frequency, int max_points,
+                              GradientTile& tile)
+{
+    // Multiplying by a positive frequency and flooring preserve the order,
+    // so every point's cell is in there.
+    tile.low = ivec3(floor(low * frequency));
+    tile.size = ivec3(floor(high * frequency)) - tile.low + 2;
+    if (tile.size.x * tile.size.y * tile.size.z > std::min(max_points, GRADIENT_TILE_POINTS)) {
+        return false;
+    }
+
+    uint8_t* index = tile.indices;
+    for (int z = 0; z < tile.size.z; z++) {
+        for (int y = 0; y < tile.size.y; y++) {
+            for (int x = 0; x < tile.size.x; x += 4) {
+                __m128i indices = gradientIndex4(
+                    _mm_add_epi32(_mm_set1_epi32(tile.low.x + x), _mm_setr_epi32(0, 1, 2, 3)),
+                    _mm_set1_epi32(tile.low.y + y), _mm_set1_epi32(tile.low.z + z));
+                int lanes[4];
+                _mm_storeu_si128((__m128i*)lanes, indices);
+                for (int i = 0; i < std::min(4, tile.size.x - x); i++) {
+                    *index++ = lanes[i];
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// perlinNoise4 with the gradients looked up in the tile.
+static __m128 perlinNoise4(const Coords4& coords, float frequency, const GradientTile& tile)
+{
+    __m128i lower_corner[3];
+    __m128 inner_coords[3];
+    latticeCell4(coords, frequency, lower_corner, inner_coords);
+
+    __m128i corners[8];
+    int stride_y = tile.size.x;
+    int stride_z = tile.size.x * tile.size.y;
+    if (tile.size == ivec3(2)) {
+        // All the points are in the same cell, at the lowest frequencies.
+        for (int i = 0; i < 8; i++) {
+            corners[i] = _mm_set1_epi32(tile.indices[(i >> 2) + ((i >> 1) & 1) * stride_y +
+                                                     (i & 1) * stride_z]);
+        }
+        return interpolate4(corners, inner_coords);
+    }
+
+    int lower[3][4];
+    for (int i = 0; i < 3; i++) {
+        _mm_storeu_si128((__m128i*)lower[i], lower_corner[i]);
+    }
+    int offsets[4];
+    for (int lane = 0; lane < 4; lane++) {
+        offsets[lane] = (lower[0][lane] - tile.low.x) +
+                        (lower[1][lane] - tile.low.y) * stride_y +
+                        (lower[2][lane] - tile.low.z) * stride_z;
+    }
+    if (offsets[0] == offsets[1] && offsets[0] == offsets[2] && offsets[0] == offsets[3]) {
+        // The four points are in the same cell, common at low frequencies.
+        for (int i = 0; i < 8; i++) {
+            int corner = (i >> 2) + ((i >> 1) & 1) * stride_y + (i & 1) * stride_z;
+            corners[i] = _mm_set1_epi32(tile.indices[offsets[0] + corner]);
+        }
+        return interpolate4(corners, inner_coords);
+    }
+    for (int i = 0; i < 8; i++) {
+        int corner = (i >> 2) + ((i >> 1) & 1) * stride_y + (i & 1) * stride_z;
+        corners[i] = _mm_setr_epi32(tile.indices[offsets[0] + corner],
+                                    tile.indices[offsets[1] + corner],
+                                    tile.indices[offsets[2] + corner],
+                                    tile.indices[offsets[3] + corner]);
+    }
+    return interpolate4(corners, inner_coords);
+}
+
+template <int I, int Octaves>
+struct OctaveSum4 {
+    static __m128 add(__m128 noise, const Coords4& coords, float frequency, const float* weights)
+    {
+        noise = _mm_add_ps(noise, _mm_mul_ps(perlinNoise4(coords, frequency), _mm_set1_ps(weights[I])));
+        return OctaveSum4<I + 1, Octaves>::add(noise, coords, frequency * 1.95f, weights);
+    }
+};
+
+template <int Octaves>
+struct OctaveSum4<Octaves, Octaves> {
+    static __m128 add(__m128 noise, const Coords4& /*coords*/, float /*frequency*/,
+                      const float* /*weights*/)
+    {
+        return noise;
+    }
+};
+
+// The end of kernel, four points at a time.
+static __m128 shapeDensity4(const Coords4& points, float block_size, __m128 noise)
+{
+    float max_blocks_y = 2.0f;
+
+    float min = -1.2f;
+    float max = 0.5f;
+    __m128 height = _mm_div_ps(points.y, _mm_set1_ps(block_size));
+    __m128 height_gradient = _mm_sub_ps(_mm_set1_ps(max),
+        _mm_div_ps(_mm_mul_ps(_mm_set1_ps(max - min),
+                              _mm_div_ps(points.y, _mm_set1_ps(max_blocks_y))),
+                   _mm_set1_ps(block_size)));
+
+    __m128 density = _mm_add_ps(height_gradient, _mm_mul_ps(noise, _mm_set1_ps(1.5f)));
+
+    __m128 bottom = _mm_cmplt_ps(height, _mm_set1_ps(0.1f));
+    density = _mm_add_ps(density, _mm_and_ps(bottom,
+        _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(0.1f), height), _mm_set1_ps(10))));
+    __m128 top = _mm_cmpgt_ps(height, _mm_set1_ps(max_blocks_y - 0.1f));
+    density = _mm_sub_ps(density, _mm_and_ps(top,
+        _mm_mul_ps(_mm_sub_ps(height, _mm_set1_ps(max_blocks_y - 0.1f)), _mm_set1_ps(10))));
+
+    return density;
+}
+
+// Same as kernel, four points at a time.
+template <int Octaves>
+void TerrainDensity::kernel4(const vec3* coords, float block_size, float* densities) const
+{
+    Coords4 points;
+    points.x = _mm_setr_ps(coords[0].x, coords[1].x, coords[2].x, coords[3].x);
+    points.y = _mm_setr_ps(coords[0].y, coords[1].y, coords[2].y, coords[3].y);
+    points.z = _mm_setr_ps(coords[0].z, coords[1].z, coords[2].z, coords[3].z);
+
+    Coords4 warped = points;
+    __m128 warp = _mm_mul_ps(perlinNoise4(points, warp_params.x), _mm_set1_ps(warp_params.y));
+    warped.x = _mm_add_ps(warped.x, warp);
+    warped.y = _mm_add_ps(warped.y, warp);
+    warped.z = _mm_add_ps(warped.z, warp);
+    warp = _mm_mul_ps(perlinNoise4(points, warp_params.x * 1.9f), _mm_set1_ps(warp_params.y / 2));
+    warped.x = _mm_add_ps(warped.x, warp);
+    warped.y = _mm_add_ps(warped.y, warp);
+    warped.z = _mm_add_ps(warped.z, warp);
+
+    __m128 noise = OctaveSum4<0, Octaves>::add(_mm_setzero_ps(), warped, 1.0f / period,
+                                               octave_weights);
+
+    _mm_storeu_ps(densities, shapeDensity4(points, block_size, noise));
+}
+
+// Bounds of the first count points, at least one.
+static void bounds4(const Coords4* points, int count, vec3& low, vec3& high)
+{
+    __m128 low4[3] = { points[0].x, points[0].y, points[0].z };
+    __m128 high4[3] = { points[0].x, points[0].y, points[0].z };
+    for (int i = 1; i < (count + 3) / 4; i++) {
+        const __m128 coords[3] = { points[i].x, points[i].y, points[i].z };
+        for (int j = 0; j < 3; j++) {
+            low4[j] = _mm_min_ps(low4[j], coords[j]);
+            high4[j] = _mm_max_ps(high4[j], coords[j]);
+        }
+    }
+    for (int j = 0; j < 3; j++) {
+        float lows[4], highs[4];
+        _mm_storeu_ps(lows, low4[j]);
+        _mm_storeu_ps(highs, high4[j]);
+        low[j] = std::min(std::min(lows[0], lows[1]), std::min(lows[2], lows[3]));
+        high[j] = std::max(std::max(highs[0], highs[1]), std::max(highs[2], highs[3]));
+    }
+}
+
+// Adds weight times the noise at each point to noises, through a tile when
+// the points need fewer lattice points than there are of them.
+static void addNoise(const Coords4* points, int count, float frequency, float weight,
+                     __m128* noises)
+{
+    vec3 low, high;
+    bounds4(points, count, low, high);
+
+    GradientTile tile;
+    bool tiled = buildGradientTile(low, high, frequency, count * GRADIENT_TILE_RATIO, tile);
+    for (int i = 0; i < (count + 3) / 4; i++) {
+        __m128 noise = tiled ? perlinNoise4(points[i], frequency, tile)
+                             : perlinNoise4(points[i], frequency);
+        noises[i] = _mm_mul_ps(noise, _mm_set1_ps(weight));
+    }
+}
+
+void TerrainDensity::densityRow(vec3 start, float step, int count, float block_size,
+                                float* densities) const
+{
+    if (count <= 0) {
+        return;
+    }
+
+    // Lanes past count repeat the last point, so they don't widen the tiles.
+    Coords4 points[DENSITY_ROW_CHUNK / 4];
+    int groups = (count + 3) / 4;
+    for (int i = 0; i < groups; i++) {
+        float x[4];
+        for (int lane = 0; lane < 4; lane++) {
+            x[lane] = start.x + float(std::min(i * 4 + lane, count - 1)) * step;
+        }
+        points[i].x = _mm_loadu_ps(x);
+        points[i].y = _mm_set1_ps(start.y);
+        points[i].z = _mm_set1_ps(start.z);
+    }
+
+    Coords4 warped[DENSITY_ROW_CHUNK / 4];
+    __m128 noises[DENSITY_ROW_CHUNK / 4];
+    __m128 warps[DENSITY_ROW_CHUNK / 4];
+    addNoise(points, count, warp_params.x, warp_params.y, warps);
+    addNoise(points, count, warp_params.x * 1.9f, warp_params.y / 2, noises);
+    for (int i = 0; i < groups; i++) {
+        warped[i].x = _mm_add_ps(_mm_add_ps(points[i].x, warps[i]), noises[i]);
+        warped[i].y = _mm_add_ps(_mm_add_ps(points[i].y, warps[i]), noises[i]);
+        warped[i].z = _mm_add_ps(_mm_add_ps(points[i].z, warps[i]), noises[i]);
+    }
+
+    __m128 sums[DENSITY_ROW_CHUNK / 4];
+    for (int i = 0; i < groups; i++) {
+        sums[i] = _mm_setzero_ps();
+    }
+    float frequency = 1.0f / period;
+    for (int octave = 0; octave < octaves; octave++) {
+        addNoise(warped, count, frequency, octave_weights[octave], noises);
+        for (int i = 0; i < groups; i++) {
+            sums[i] = _mm_add_ps(sums[i], noises[i]);
+        }
+        frequency *= 1.95f;
+    }
+
+    for (int i = 0; i < groups; i++) {
+        float results[4];
+        _mm_storeu_ps(results, shapeDensity4(points[i], block_size, sums[i]));
+        std::copy(results, results + std::min(4, count - i * 4), densities + i * 4);
+    }
+}
+
+#else
+
+template <int Octaves>
+void TerrainDensity::kernel4(const vec3* coords, float block_size, float* densities) const
+{
+    for (int i = 0; i < 4; i++) {
+        densities[i] = kernel<Octaves>(coords[i], block_size);
+    }
+}
+
+void TerrainDensity::densityRow(vec3 start, float step, int count, float block_size,
+                                float* densities) const
+{
+    for (int i = 0; i < count; i++) {
+        densities[i] = terrainDensity(start + vec3(float(i) * step, 0.0f, 0.0f), block_size);
+    }
+}
+
+#endif
+
+void TerrainDensity::terrainDensityRow(vec3 start, float step, int count, float block_size,
+                                       float* densities) const
+{
+    if (count <= 0) {
+        return;
+    }
+
+    for (int first = 0; first < count; first += DENSITY_ROW_CHUNK) {
+        densityRow(start + vec3(float(first) * step, 0.0f, 0.0f), step,
+                   std::min(DENSITY_ROW_CHUNK, count - first), block_size, densities + first);
+    }
+
+    if (edits && !edits->empty()) {
+        // The brushes along the row are looked up once.
+        vector<int> nearby;
+        edits->brushesIn(start, start + vec3(float(count - 1) * step, 0.0f, 0.0f), nearby);
+        bool edited = !nearby.empty() || edits->hasDisplacement();
+        for (int i = 0; i < count && edited; i++) {
+            vec3 coords = start + vec3(float(i) * step, 0.0f, 0.0f);
+            densities[i] = edits->apply(*this, nearby, coords, block_size, densities[i]);
+        }
+    }
+}
+
+float TerrainDensity::lipschitzBound(float block_size, int max_octaves) const
+{
+    // The warp adds the same two noises to every coordinate, each stretches
+    // distances by at most sqrt(3) times its gradient.
+    float warp_stretch = 1.0f + sqrt(3.0f) * PERLIN_LIPSCHITZ * warp_params.x * warp_params.y *
+                                (1.0f + 1.9f / 2);
+
+    float noise = 0.0f;
+    float frequency = 1.0f / period;
+    for (int i = 0; i < std::min(max_octaves, octaves); i++) {
+        noise += octave_weights[i] * PERLIN_LIPSCHITZ * frequency;
+        frequency *= 1.95f;
+    }
+
+    // The height gradient, and the floor and ceiling terms.
+    float shape = (1.7f / 2.0f + 10.0f) / block_size;
+
+    float bound = noise * 1.5f * warp_stretch + shape;
+    return edits ? bound + edits->lipschitzBound() : bound;
+}
+
+float TerrainDensity::octaveRemainder(int max_octaves) const
+{
+    float remainder = 0.0f;
+    for (int i = std::max(max_octaves, 0); i < octaves; i++) {
+        remainder += octave_weights[i] * PERLIN_AMPLITUDE;
+    }
+    return remainder * 1.5f;
+}
+
+static_assert(MAX_OCTAVES == 10, "Update the kernel table");
+const TerrainDensity::Kernel TerrainDensity::kernels[MAX_OCTAVES + 1] = {
+    &TerrainDensity::kernel<0>, &TerrainDensity::kernel<1>, &TerrainDensity::kernel<2>,
+    &TerrainDensity::kernel<3>, &TerrainDensity::kernel<4>, &TerrainDensity::kernel<5>,
+    &TerrainDensity::kernel<6>, &TerrainDensity::kernel<7>, &TerrainDensity::kernel<8>,
+    &TerrainDensity::kernel<9>, &TerrainDensity::kernel<10>,
+};
+
+const TerrainDensity::Kernel4 TerrainDensity::kernels4[MAX_OCTAVES + 1] = {
+    &TerrainDensity::kernel4<0>, &TerrainDensity::kernel4<1>, &TerrainDensity::kernel4<2>,
+    &TerrainDensity::kernel4<3>, &TerrainDensity::kernel4<4>, &TerrainDensity::kernel4<5>,
+    &TerrainDensity::kernel4<6>, &TerrainDensity::kernel4<7>, &TerrainDensity::kernel4<8>,
+    &TerrainDensity::kernel4<9>, &TerrainDensity::kernel4<10>,
+};
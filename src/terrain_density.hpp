@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+#include "terrain_edits.hpp"
+
+// CPU version of the density function in Assets/noise.h. Must stay in sync
+// with it, otherwise CPU-generated blocks won't line up with GPU-generated ones.
+//
+// With edits, their brushes are applied on top, see TerrainEdits. They must
+// outlive the density function and not change while it is evaluated.
+class TerrainDensity {
+public:
+    TerrainDensity(float period, int octaves, float octaves_decay, glm::vec2 warp_params,
+                   const TerrainEdits* edits = nullptr);
+
+    // Same as perlinNoise in noise.h.
+    static float perlinNoise(glm::vec3 coords, float frequency);
+
+    // Same as terrainDensity in noise.h, using at most max_octaves octaves.
+    float terrainDensity(glm::vec3 coords, float block_size, int max_octaves) const
+    {
+        float density = (this->*kernels[std::min(max_octaves, octaves)])(coords, block_size);
+        return edits ? edits->apply(*this, coords, block_size, density) : density;
+    }
+    float terrainDensity(glm::vec3 coords, float block_size) const
+    {
+        float density = (this->*kernels[octaves])(coords, block_size);
+        return edits ? edits->apply(*this, coords, block_size, density) : density;
+    }
+
+    // The density smoothing brushes pull towards, without the edits.
+    float smoothDensity(glm::vec3 coords, float block_size) const
+    {
+        return (this->*kernels[std::min(EDIT_SMOOTH_OCTAVES, octaves)])(coords, block_size);
+    }
+
+    // terrainDensity at four points at once, with the same results. Uses SSE2
+    // where available.
+    void terrainDensity4(const glm::vec3* coords, float block_size, int max_octaves,
+                         float* densities) const
+    {
+        (this->*kernels4[std::min(max_octaves, octaves)])(coords, block_size, densities);
+        if (edits) {
+            for (int i = 0; i < 4; i++) {
+                densities[i] = edits->apply(*this, coords[i], block_size, densities[i]);
+            }
+        }
+    }
+
+    // terrainDensity at count points from start, step apart along x, with the
+    // same results. Neighbouring points share most of their lattice points, so
+    // each noise hashes the gradients around the row once instead of eight
+    // times per point, which makes the low octaves almost free.
+    void terrainDensityRow(glm::vec3 start, float step, int count, float block_size,
+                           float* densities) const;
+
+    // Bounds how fast the density with at most max_octaves octaves changes, per
+    // unit of coords, from how fast perlinNoise does and how much the warp
+    // stretches coordinates.
+    float lipschitzBound(float block_size, int max_octaves) const;
+    // Bounds how much the octaves after the first max_octaves ones add to the
+    // density.
+    float octaveRemainder(int max_octaves) const;
+
+    // 1 / pow(i + 1, octaves_decay) for each octave, also given to the shaders.
+    const float* octaveWeights() const { return octave_weights; }
+
+    int octaves;
+
+private:
+    // The density function with the octave loop unrolled at compile time,
+    // kernels[i] is the one for i octaves.
+    template <int Octaves>
+    float kernel(glm::vec3 coords, float block_size) const;
+
+    typedef float (TerrainDensity::*Kernel)(glm::vec3 coords, float block_size) const;
+    static const Kernel kernels[MAX_OCTAVES + 1];
+
+    template <int Octaves>
+    void kernel4(const glm::vec3* coords, float block_size, float* densities) const;
+
+    typedef void (TerrainDensity::*Kernel4)(const glm::vec3* coords, float block_size,
+                                            float* densities) const;
+    static const Kernel4 kernels4[MAX_OCTAVES + 1];
+
+    // terrainDensityRow for up to DENSITY_ROW_CHUNK points.
+    void densityRow(glm::vec3 start, float step, int count, float block_size,
+                    float* densities) const;
+
+    float period;
+    glm::vec2 warp_params;
+    const TerrainEdits* edits;
+
+    // Computed once instead of for every sample.
+    float octave_weights[MAX_OCTAVES];
+};
@@ -0,0 +1,332 @@
+#include "terrain_edits.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "constants.hpp"
+#include "terrain_density.hpp"
+
+using namespace glm;
+using namespace std;
+
+#define CELL_COORDS float(EDIT_CELL_SIZE * BLOCK_SIZE)
+
+static ivec3 cellOf(vec3 coords)
+{
+    return ivec3(floor(coords / CELL_COORDS));
+}
+
+// Weight of flattening and smoothing at distance / radius, with a gradient of
+// at most FALLOFF_LIPSCHITZ.
+static float falloff(float t)
+{
+    float s = 1.0f - t * t;
+    return s * s;
+}
+#define FALLOFF_LIPSCHITZ 1.54f
+
+// The density the brushes made out of unedited, kept from crossing the floor and
+// ceiling terms of the density function: brushes add no ground above 1.9 blocks
+// and remove none below 0.1 blocks, so the terrain stays within the 2 blocks
+// high the blocks and surface queries cover.
+static float keepInBand(vec3 coords, float block_size, float unedited, float density)
+{
+    float height = coords.y / block_size;
+    if (height < 0.1f) {
+        density = std::max(density, std::min(unedited, (0.1f - height) * 10));
+    }
+    if (height > 1.9f) {
+        density = std::min(density, std::max(unedited, (1.9f - height) * 10));
+    }
+    return density;
+}
+
+TerrainEdits::TerrainEdits()
+: displacement_version(0)
+{
+    clear();
+}
+
+void TerrainEdits::add(const TerrainBrush& brush)
+{
+    Brush scaled;
+    scaled.type = brush.type;
+    scaled.center = brush.center * float(BLOCK_SIZE);
+    scaled.radius = brush.radius * BLOCK_SIZE;
+    scaled.strength = clamp(brush.strength, 0.0f, 1.0f);
+    brushes.push_back(scaled);
+
+    int index = brushes.size() - 1;
+    vec3 brush_low, brush_high;
+    brushBounds(index, brush_low, brush_high);
+    low = min(low, brush_low);
+    high = max(high, brush_high);
+
+    ivec3 first = cellOf(brush_low);
+    ivec3 last = cellOf(brush_high);
+    for (int z = first.z; z <= last.z; z++) {
+        for (int y = first.y; y <= last.y; y++) {
+            for (int x = first.x; x <= last.x; x++) {
+                cells[ivec3(x, y, z)].push_back(index);
+            }
+        }
+    }
+}
+
+void TerrainEdits::clear()
+{
+    brushes.clear();
+    cells.clear();
+    low = vec3(numeric_limits<float>::max());
+    high = vec3(-numeric_limits<float>::max());
+    clearDisplacement();
+}
+
+void TerrainEdits::setDisplacement(vec2 origin, float cell_size, int resolution,
+                                   const vector<float>& heights)
+{
+    displacement = heights;
+    displacement_origin = origin;
+    displacement_cell_size = cell_size;
+    displacement_resolution = resolution;
+    displacement_version++;
+
+    displacement_slope = 0.0f;
+    for (int z = 0; z < resolution; z++) {
+        for (int x = 0; x < resolution; x++) {
+            float height = heights[z * resolution + x];
+            if (x + 1 < resolution) {
+                displacement_slope = std::max(displacement_slope,
+                                              fabs(heights[z * resolution + x + 1] - height));
+            }
+            if (z + 1 < resolution) {
+                displacement_slope = std::max(displacement_slope,
+                                              fabs(heights[(z + 1) * resolution + x] - height));
+            }
+        }
+    }
+    displacement_slope /= cell_size;
+}
+
+void TerrainEdits::clearDisplacement()
+{
+    if (!displacement.empty()) {
+        displacement.clear();
+        displacement_version++;
+    }
+    displacement_slope = 0.0f;
+}
+
+void TerrainEdits::displacementBounds(vec3& low, vec3& high) const
+{
+    float size = displacement_cell_size * (displacement_resolution - 1);
+    low = vec3(displacement_origin.x, -numeric_limits<float>::max(), displacement_origin.y);
+    high = vec3(displacement_origin.x + size, numeric_limits<float>::max(),
+                displacement_origin.y + size);
+}
+
+void TerrainEdits::gpuDisplacement(vector<float>& data) const
+{
+    // Without a layer, only a resolution of 0 and a height to pad the array.
+    data.assign(5, 0.0f);
+    if (!displacement.empty()) {
+        data[0] = displacement_origin.x;
+        data[1] = displacement_origin.y;
+        data[2] = displacement_cell_size;
+        data[3] = float(displacement_resolution);
+        data.resize(4);
+        data.insert(data.end(), displacement.begin(), displacement.end());
+    }
+}
+
+void TerrainEdits::blockBounds(ivec4 index, vec3& low, vec3& high)
+{
+    // Same coordinates as TerrainDensityShader.cs.
+    vec3 origin = vec3(ivec3(index) * BLOCK_SIZE);
+    low = origin - float(BLOCK_PADDING * index.w);
+    high = origin + float((BLOCK_PADDED_RESOLUTION - BLOCK_PADDING - 1) * index.w);
+}
+
+void TerrainEdits::brushBounds(int brush, vec3& low, vec3& high) const
+{
+    const Brush& b = brushes[brush];
+    float reach = b.radius;
+    if (b.type == AddSphere || b.type == SubtractSphere) {
+        reach += EDIT_BAND;
+    }
+    low = b.center - reach;
+    high = b.center + reach;
+}
+
+static bool overlaps(vec3 low_a, vec3 high_a, vec3 low_b, vec3 high_b)
+{
+    return all(lessThanEqual(low_a, high_b)) && all(lessThanEqual(low_b, high_a));
+}
+
+bool TerrainEdits::touches(vec3 low, vec3 high, ivec4 index)
+{
+    vec3 block_low, block_high;
+    blockBounds(index, block_low, block_high);
+    return overlaps(block_low, block_high, low, high);
+}
+
+void TerrainEdits::brushesIn(vec3 query_low, vec3 query_high, vector<int>& found) const
+{
+    found.clear();
+    if (!overlaps(query_low, query_high, low, high)) {
+        return;
+    }
+
+    ivec3 first = cellOf(max(query_low, low));
+    ivec3 last = cellOf(min(query_high, high));
+    for (int z = first.z; z <= last.z; z++) {
+        for (int y = first.y; y <= last.y; y++) {
+            for (int x = first.x; x <= last.x; x++) {
+                auto cell = cells.find(ivec3(x, y, z));
+                if (cell == cells.end()) {
+                    continue;
+                }
+                for (int brush : cell->second) {
+                    vec3 brush_low, brush_high;
+                    brushBounds(brush, brush_low, brush_high);
+                    if (overlaps(query_low, query_high, brush_low, brush_high)) {
+                        found.push_back(brush);
+                    }
+                }
+            }
+        }
+    }
+
+    // Brushes spanning several cells were found once per cell.
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+}
+
+void TerrainEdits::gpuBrushes(ivec4 index, vector<GpuBrush>& found) const
+{
+    found.clear();
+    if (brushes.empty()) {
+        return;
+    }
+
+    vec3 block_low, block_high;
+    blockBounds(index, block_low, block_high);
+    vector<int> nearby;
+    brushesIn(block_low, block_high, nearby);
+    for (int brush : nearby) {
+        const Brush& b = brushes[brush];
+        GpuBrush gpu_brush;
+        gpu_brush.center_radius = vec4(b.center, b.radius);
+        gpu_brush.params = vec4(float(b.type), b.strength, 0.0f, 0.0f);
+        found.push_back(gpu_brush);
+    }
+}
+
+// Same as applyBrush in Assets/terrain_edits.h.
+float TerrainEdits::applyBrush(const TerrainDensity& terrain, const Brush& brush, vec3 coords,
+                               float block_size, float density) const
+{
+    float distance = length(coords - brush.center);
+    switch (brush.type) {
+        case AddSphere:
+            if (distance < brush.radius + EDIT_BAND) {
+                density = std::max(density, (brush.radius - distance) * EDIT_SLOPE);
+            }
+            break;
+        case SubtractSphere:
+            if (distance < brush.radius + EDIT_BAND) {
+                density = std::min(density, (distance - brush.radius) * EDIT_SLOPE);
+            }
+            break;
+        case Flatten:
+            if (distance < brush.radius) {
+                float plane = (brush.center.y - coords.y) * EDIT_SLOPE;
+                float weight = brush.strength * falloff(distance / brush.radius);
+                density = mix(density, plane, weight);
+            }
+            break;
+        case Smooth:
+            if (distance < brush.radius) {
+                float smooth = terrain.smoothDensity(coords, block_size);
+                float weight = brush.strength * falloff(distance / brush.radius);
+                density = mix(density, smooth, weight);
+            }
+            break;
+    }
+    return density;
+}
+
+// Same as displace in Assets/terrain_edits.h.
+float TerrainEdits::displace(vec3 coords, float density) const
+{
+    if (displacement.empty()) {
+        return density;
+    }
+
+    vec2 cell = (vec2(coords.x, coords.z) - displacement_origin) / displacement_cell_size;
+    if (any(lessThan(cell, vec2(0.0f))) ||
+        any(greaterThanEqual(cell, vec2(float(displacement_resolution - 1))))) {
+        return density;
+    }
+
+    ivec2 corner = ivec2(cell);
+    vec2 t = cell - vec2(corner);
+    const float* heights = &displacement[corner.y * displacement_resolution + corner.x];
+    float height = mix(mix(heights[0], heights[1], t.x),
+                       mix(heights[displacement_resolution], heights[displacement_resolution + 1],
+                           t.x),
+                       t.y);
+    return density + height * EROSION_SLOPE;
+}
+
+float TerrainEdits::apply(const TerrainDensity& terrain, const vector<int>& nearby,
+                          vec3 coords, float block_size, float density) const
+{
+    density = displace(coords, density);
+    float unedited = density;
+    for (int brush : nearby) {
+        density = applyBrush(terrain, brushes[brush], coords, block_size, density);
+    }
+    return keepInBand(coords, block_size, unedited, density);
+}
+
+float TerrainEdits::apply(const TerrainDensity& terrain, vec3 coords, float block_size,
+                          float density) const
+{
+    density = displace(coords, density);
+    if (any(lessThan(coords, low)) || any(greaterThan(coords, high))) {
+        return density;
+    }
+
+    auto cell = cells.find(cellOf(coords));
+    if (cell == cells.end()) {
+        return density;
+    }
+    float unedited = density;
+    for (int brush : cell->second) {
+        density = applyBrush(terrain, brushes[brush], coords, block_size, density);
+    }
+    return keepInBand(coords, block_size, unedited, density);
+}
+
+float TerrainEdits::lipschitzBound() const
+{
+    // The layer moves the density by EROSION_SLOPE per unit of height.
+    float layer = displacement_slope * EROSION_SLOPE;
+    if (brushes.empty()) {
+        return layer;
+    }
+
+    // Spheres change the density by EDIT_SLOPE per coordinate. The falloff of
+    // the others scales the difference between the density and what they pull
+    // it towards, taken to be at most a couple of units near the surface.
+    float bound = EDIT_SLOPE;
+    for (const Brush& brush : brushes) {
+        if (brush.type == Flatten || brush.type == Smooth) {
+            float difference = 2.0f + (brush.type == Flatten ? brush.radius * EDIT_SLOPE : 0.0f);
+            bound = std::max(bound, EDIT_SLOPE + FALLOFF_LIPSCHITZ * brush.strength / brush.radius *
+                                                     difference);
+        }
+    }
+    return bound + layer;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "vec_hash.hpp"
+
+class TerrainDensity;
+
+// Must match the brush types of Assets/terrain_edits.h.
+enum BrushType {
+    AddSphere = 0,
+    SubtractSphere = 1,
+    Flatten = 2,
+    Smooth = 3,
+};
+
+// One brush stroke, in the same units as block indices.
+struct TerrainBrush {
+    BrushType type;
+    glm::vec3 center;
+    float radius;
+    // How much flattening and smoothing pull the density, within [0, 1].
+    float strength;
+};
+
+// A brush as the density shader reads it, in density coordinates.
+struct GpuBrush {
+    glm::vec4 center_radius;
+    glm::vec4 params;   // type, strength
+};
+
+// Brushes applied on top of the density function, in the order they were
+// added: spheres of ground added (union) or removed (difference), and ground
+// pulled towards a horizontal plane through the center (flatten) or towards
+// its low octaves (smooth) with a falloff to the radius.
+//
+// The density function applies them wherever they reach, on the GPU with the
+// brushes of each block uploaded with it and on the CPU through
+// TerrainDensity, so generated blocks and surface queries agree. Brushes are
+// indexed in cells of EDIT_CELL_SIZE blocks, evaluating the density only pays
+// for the brushes in the cell of the point. Brushes add no ground above 1.9
+// blocks and remove none below 0.1 blocks, where the density function ramps
+// to air and ground, so the terrain stays 2 blocks high.
+//
+// Under the brushes, a layer of heights (from HydraulicErosion) can raise or
+// lower the ground of a square of columns, by moving the density of the whole
+// column by EROSION_SLOPE per unit of height.
+class TerrainEdits {
+public:
+    TerrainEdits();
+
+    void add(const TerrainBrush& brush);
+    void clear();
+    bool empty() const { return brushes.empty() && displacement.empty(); }
+    int brushCount() const { return brushes.size(); }
+
+    // Replaces the layer with resolution^2 heights, row-major in x, cell_size
+    // apart from origin, all in density coordinates along x and z.
+    void setDisplacement(glm::vec2 origin, float cell_size, int resolution,
+                         const std::vector<float>& heights);
+    void clearDisplacement();
+    bool hasDisplacement() const { return !displacement.empty(); }
+    // What the layer changes, in density coordinates, all the way up and down.
+    void displacementBounds(glm::vec3& low, glm::vec3& high) const;
+    // Changes whenever the layer does.
+    int displacementVersion() const { return displacement_version; }
+    // The layer for the density shader, see Assets/terrain_edits.h.
+    void gpuDisplacement(std::vector<float>& data) const;
+
+    // What the density coordinates of a block span, padding included.
+    static void blockBounds(glm::ivec4 index, glm::vec3& low, glm::vec3& high);
+    // What the brush changes, in density coordinates.
+    void brushBounds(int brush, glm::vec3& low, glm::vec3& high) const;
+    // Whether the density texture of the block has coordinates within
+    // [low, high].
+    static bool touches(glm::vec3 low, glm::vec3 high, glm::ivec4 index);
+
+    // The brushes that change the density within [low, high], in the order
+    // they were added.
+    void brushesIn(glm::vec3 low, glm::vec3 high, std::vector<int>& found) const;
+    // The brushes of a block for the density shader.
+    void gpuBrushes(glm::ivec4 index, std::vector<GpuBrush>& found) const;
+
+    // The density with the layer and the brushes applied, for those brushes or
+    // the ones indexed around coords.
+    float apply(const TerrainDensity& terrain, const std::vector<int>& nearby,
+                glm::vec3 coords, float block_size, float density) const;
+    float apply(const TerrainDensity& terrain, glm::vec3 coords, float block_size,
+                float density) const;
+
+    // How much faster than the density function the brushes can make it
+    // change, per unit of coords.
+    float lipschitzBound() const;
+
+private:
+    struct Brush {
+        BrushType type;
+        glm::vec3 center;
+        float radius;
+        float strength;
+    };
+
+    float applyBrush(const TerrainDensity& terrain, const Brush& brush, glm::vec3 coords,
+                     float block_size, float density) const;
+    float displace(glm::vec3 coords, float density) const;
+
+    // In density coordinates.
+    std::vector<Brush> brushes;
+    // Indices of the brushes reaching each cell, in increasing order.
+    ivec3_map<std::vector<int>> cells;
+
+    // Of all the brushes, to skip the index far from them.
+    glm::vec3 low;
+    glm::vec3 high;
+
+    std::vector<float> displacement;
+    glm::vec2 displacement_origin;
+    float displacement_cell_size;
+    int displacement_resolution;
+    // Largest height difference between neighbouring cells, per coordinate.
+    float displacement_slope;
+    int displacement_version;
+};
@@ -2,11 +2,12 @@
 #include "cs488-framework/GlErrorCheck.hpp"
 
 #include <assert.h>
+#include <sstream>
 #include <vector>
 
 #include <glm/glm.hpp>
 
-#include "timer.hpp"
+#include "trace.hpp"
 
 using namespace glm;
 using namespace std;
@@ -16,6 +17,10 @@ using namespace std;
 #define LOCAL_DIM_Y 16
 #define LOCAL_DIM_Z 4
 
+// The brushes follow the ranges of the slots, aligned to 16 bytes.
+static_assert(GENERATOR_BATCH_SIZE % 2 == 0, "Pad the brush ranges");
+#define EDIT_RANGES_BYTES (sizeof(ivec2) * GENERATOR_BATCH_SIZE)
+
 TerrainGenerator::TerrainGenerator()
 : period(60.0f)
 , octaves(8)
@@ -25,24 +30,32 @@ TerrainGenerator::TerrainGenerator()
 , use_short_range_ambient_occlusion(true)
 , use_long_range_ambient_occlusion(true)
 , ambient_occlusion_param(vec4(0.3f, 0.2f, 1.0f, 9.0f))
+, edits(nullptr)
+, block_texture(0)
+, edits_buffer(0)
+, edits_buffer_size(0)
+, edits_uploaded(false)
+, displacement_buffer(0)
+, displacement_buffer_size(0)
+, displacement_version(0)
+, linked_octaves(-1)
 {
     assert(BLOCK_PADDED_RESOLUTION % LOCAL_DIM_X == 0);
     assert(BLOCK_PADDED_RESOLUTION % LOCAL_DIM_Y == 0);
     assert(BLOCK_PADDED_RESOLUTION % LOCAL_DIM_Z == 0);
 }
 
+TerrainGenerator::~TerrainGenerator()
+{
+    glDeleteTextures(1, &block_texture);
+    glDeleteBuffers(1, &edits_buffer);
+    glDeleteBuffers(1, &displacement_buffer);
+}
+
 void TerrainGenerator::init(string dir)
 {
     density_shader.generateProgramObject();
     density_shader.attachComputeShader((dir + "TerrainDensityShader.cs").c_str());
-    density_shader.link();
-
-    block_padding_uni = density_shader.getUniformLocation("block_padding");
-    period_uni = density_shader.getUniformLocation("period");
-    octaves_uni = density_shader.getUniformLocation("octaves");
-    octaves_decay_uni = density_shader.getUniformLocation("octaves_decay");
-    warp_params_uni = density_shader.getUniformLocation("warp_params");
-    block_index_uni = density_shader.getUniformLocation("block_index");
 
     // Generate texture object in which to store the terrain block.
     glGenTextures(1, &block_texture);
@@ -76,17 +89,175 @@ void TerrainGenerator::init(string dir)
                        GL_READ_WRITE,   // access
                        GL_R32F);
 
+    // Empty ranges until there are brushes.
+    vector<char> no_edits(EDIT_RANGES_BYTES + sizeof(GpuBrush), 0);
+    glGenBuffers(1, &edits_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, edits_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, no_edits.size(), no_edits.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    edits_buffer_size = no_edits.size();
+
+    vector<float> no_displacement;
+    TerrainEdits().gpuDisplacement(no_displacement);
+    glGenBuffers(1, &displacement_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, displacement_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * no_displacement.size(),
+                 no_displacement.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    displacement_buffer_size = sizeof(float) * no_displacement.size();
+
     CHECK_GL_ERRORS;
 }
 
+size_t TerrainGenerator::gpuBytes() const
+{
+    if (block_texture == 0) {
+        return 0;
+    }
+    return sizeof(float) * BLOCK_PADDED_RESOLUTION * BLOCK_PADDED_RESOLUTION *
+           BLOCK_PADDED_RESOLUTION + edits_buffer_size + displacement_buffer_size;
+}
+
+void TerrainGenerator::copyParameters(const TerrainGenerator& other)
+{
+    octaves = other.octaves;
+    octaves_decay = other.octaves_decay;
+    warp_frequency = other.warp_frequency;
+    warp_strength = other.warp_strength;
+    period = other.period;
+    use_short_range_ambient_occlusion = other.use_short_range_ambient_occlusion;
+    use_long_range_ambient_occlusion = other.use_long_range_ambient_occlusion;
+    ambient_occlusion_param = other.ambient_occlusion_param;
+    edits = other.edits;
+}
+
+void TerrainGenerator::generateTerrainBlocks(const vector<Block*>& blocks)
+{
+    for (Block* block : blocks) {
+        generateTerrainBlock(*block);
+    }
+}
+
+void TerrainGenerator::finishInit()
+{
+    findUniforms();
+}
+
+void TerrainGenerator::specializeShaders()
+{
+    if (linkSpecializedShaders()) {
+        findUniforms();
+    }
+}
+
+bool TerrainGenerator::linkSpecializedShaders()
+{
+    octaves = clamp(octaves, 1, MAX_OCTAVES);
+    if (octaves == linked_octaves) {
+        return false;
+    }
+
+    TRACE_ZONE("Specialize shaders");
+    linked_octaves = octaves;
+    linkShaders("#define OCTAVES " + to_string(octaves) + "\n");
+    return true;
+}
+
+void TerrainGenerator::linkShaders(const string& defines)
+{
+    density_shader.setDefines(densityDefines(defines));
+    density_shader.link();
+}
+
+void TerrainGenerator::findUniforms()
+{
+    block_padding_uni = density_shader.getUniformLocation("block_padding");
+    period_uni = density_shader.getUniformLocation("period");
+    octave_weights_uni = density_shader.getUniformLocation("octave_weights");
+    warp_params_uni = density_shader.getUniformLocation("warp_params");
+    block_index_uni = density_shader.getUniformLocation("block_index");
+}
+
+string TerrainGenerator::densityDefines(const string& defines)
+{
+    // The edit constants, at full precision so that the brushes match the CPU.
+    ostringstream edit_defines;
+    edit_defines.precision(9);
+    edit_defines << "#define EDIT_SLOTS " << GENERATOR_BATCH_SIZE << "\n"
+                 << "#define EDIT_BAND " << EDIT_BAND << "\n"
+                 << "#define EDIT_SLOPE " << EDIT_SLOPE << "\n"
+                 << "#define EDIT_SMOOTH_OCTAVES " << EDIT_SMOOTH_OCTAVES << "\n"
+                 << "#define EROSION_SLOPE " << EROSION_SLOPE << "\n";
+
+    if (DENSITY_GRADIENT_CACHE) {
+        return defines + edit_defines.str() + "#define GRADIENT_CACHE\n";
+    }
+    return defines + edit_defines.str();
+}
+
+void TerrainGenerator::uploadEdits(const vector<Block*>& blocks)
+{
+    assert(blocks.size() <= GENERATOR_BATCH_SIZE);
+
+    vector<ivec2> ranges(GENERATOR_BATCH_SIZE, ivec2(0));
+    vector<GpuBrush> brushes;
+    if (edits && !edits->empty()) {
+        vector<GpuBrush> block_brushes;
+        for (size_t slot = 0; slot < blocks.size(); slot++) {
+            edits->gpuBrushes(ivec4(blocks[slot]->index, blocks[slot]->size), block_brushes);
+            ranges[slot] = ivec2(brushes.size(), block_brushes.size());
+            brushes.insert(brushes.end(), block_brushes.begin(), block_brushes.end());
+        }
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, edits_buffer);
+    // Nothing to do while there are no brushes, the ranges are still empty.
+    if (!brushes.empty() || edits_uploaded) {
+        size_t size = EDIT_RANGES_BYTES + sizeof(GpuBrush) * brushes.size();
+        if (size > edits_buffer_size) {
+            glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+            edits_buffer_size = size;
+        }
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, EDIT_RANGES_BYTES, ranges.data());
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, EDIT_RANGES_BYTES,
+                        sizeof(GpuBrush) * brushes.size(), brushes.data());
+        edits_uploaded = !brushes.empty();
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, edits_buffer);
+
+    // The layer only changes when it is eroded again.
+    int version = edits ? edits->displacementVersion() : 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, displacement_buffer);
+    if (version != displacement_version) {
+        vector<float> data;
+        edits->gpuDisplacement(data);
+        displacement_buffer_size = sizeof(float) * data.size();
+        glBufferData(GL_SHADER_STORAGE_BUFFER, displacement_buffer_size, data.data(),
+                     GL_STATIC_DRAW);
+        displacement_version = version;
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, displacement_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    CHECK_GL_ERRORS;
+}
+
+void TerrainGenerator::setOctaveWeights(GLint location)
+{
+    glUniform1fv(location, octaves, densityFunction().octaveWeights());
+}
+
 void TerrainGenerator::generateDensity(Block& block)
 {
+    uploadEdits(vector<Block*>(1, &block));
+
     // Generate the density values for the terrain block.
     density_shader.enable();
     {
+        TRACE_ZONE("Density");
+
         glUniform1i(block_padding_uni, BLOCK_PADDING);
-        glUniform1i(octaves_uni, octaves);
-        glUniform1f(octaves_decay_uni, octaves_decay);
+        setOctaveWeights(octave_weights_uni);
         glUniform2f(warp_params_uni, warp_frequency, warp_strength);
         glUniform1f(period_uni, period);
         glUniform4i(block_index_uni,
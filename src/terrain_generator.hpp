@@ -2,22 +2,50 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "cs488-framework/ShaderProgram.hpp"
 #include "block.hpp"
 #include "constants.hpp"
 #include "grid.hpp"
+#include "terrain_density.hpp"
+#include "terrain_edits.hpp"
 #include "transform_program.hpp"
 
 class TerrainGenerator {
 public:
     TerrainGenerator();
-    virtual ~TerrainGenerator() {}
+    virtual ~TerrainGenerator();
 
-    void init(std::string dir);
+    // Submits the shaders and allocates the buffers and textures, deleted
+    // with the generator. finishInit looks up what the linked shaders need,
+    // the programs of everything else compile in the meantime.
+    virtual void init(std::string dir);
+    virtual void finishInit();
 
     virtual void generateTerrainBlock(Block& block) = 0;
 
+    // Generators that do better with several blocks at once override these,
+    // the others generate them one at a time.
+    virtual void generateTerrainBlocks(const std::vector<Block*>& blocks);
+    // How many blocks generateTerrainBlocks takes to keep the GPU busy.
+    virtual int batchSize() { return 1; }
+
+    // GPU memory taken by the buffers and textures of the generator, not
+    // counting those of the blocks.
+    virtual size_t gpuBytes() const;
+
+    // Takes the terrain and ambient occlusion parameters of that generator,
+    // so that switching generators keeps the terrain.
+    void copyParameters(const TerrainGenerator& other);
+
+    // The density function with the current parameters, evaluated on the CPU.
+    TerrainDensity densityFunction() const
+    {
+        return TerrainDensity(period, octaves, octaves_decay,
+                              glm::vec2(warp_frequency, warp_strength), edits);
+    }
+
     int octaves;
     float octaves_decay;
     float warp_frequency;
@@ -26,20 +54,57 @@ public:
     bool use_short_range_ambient_occlusion;
     bool use_long_range_ambient_occlusion;
     glm::vec4 ambient_occlusion_param;
+    // Applied on top of the density function, owned by the BlockManager.
+    const TerrainEdits* edits;
 
 protected:
     void generateDensity(Block& block);
 
+    // Uploads the brushes of each block, in the order of the slots of a batch,
+    // and the layer of heights if it changed, and binds them for the density
+    // shader.
+    void uploadEdits(const std::vector<Block*>& blocks);
+
+    // Relinks the programs that sample the density function if the octave
+    // count changed since they were linked, see OCTAVES in noise.h, and looks
+    // up their uniforms again. Called before generating each block.
+    void specializeShaders();
+    // Only the relinking, called once they are attached in init. Returns
+    // whether they were linked.
+    bool linkSpecializedShaders();
+
+    // Links those programs with the given defines.
+    virtual void linkShaders(const std::string& defines);
+    // Looks up the uniforms of the programs linked by linkShaders.
+    virtual void findUniforms();
+
+    // The defines of the density compute shaders, see cacheGradients in
+    // noise.h.
+    static std::string densityDefines(const std::string& defines);
+
+    // Sets the octave_weights uniform of a program built by linkShaders.
+    void setOctaveWeights(GLint location);
+
 private:
     ShaderProgram density_shader;
 
     // A 3D cubic block of terrain.
     GLuint block_texture;
 
+    // The brush ranges of the slots then the brushes, see Assets/terrain_edits.h.
+    GLuint edits_buffer;
+    size_t edits_buffer_size;
+    bool edits_uploaded;
+    // The layer of heights of the edits, and the version it was uploaded for.
+    GLuint displacement_buffer;
+    size_t displacement_buffer_size;
+    int displacement_version;
+
     GLint block_padding_uni;
     GLint period_uni;
-    GLint octaves_uni;
-    GLint octaves_decay_uni;
+    GLint octave_weights_uni;
     GLint warp_params_uni;
     GLint block_index_uni;
+
+    int linked_octaves;
 };
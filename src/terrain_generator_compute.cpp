@@ -0,0 +1,320 @@
+#include "terrain_generator_compute.hpp"
+
+#include "cs488-framework/GlErrorCheck.hpp"
+
+#include <algorithm>
+#include <assert.h>
+
+#include <glm/glm.hpp>
+
+#include "indirect_block.hpp"
+#include "trace.hpp"
+
+using namespace glm;
+using namespace std;
+
+// NOTE: if you update these, update them on the GPU side too
+#define DENSITY_DIM_X 16
+#define DENSITY_DIM_Y 16
+#define DENSITY_DIM_Z 4
+#define COMPACT_GROUP_SIZE 64
+
+#define MAX_TRIANGLES (BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE * 5)
+
+// Texture and image unit of the atlas, after those of the renderer.
+#define ATLAS_UNIT 3
+
+// Matches the layout glDispatchComputeIndirect reads.
+struct DispatchIndirectCommand {
+    GLuint num_groups_x;
+    GLuint num_groups_y;
+    GLuint num_groups_z;
+};
+
+TerrainGeneratorCompute::TerrainGeneratorCompute()
+: TerrainGenerator()
+, atlas_texture(0)
+, batch_blocks_buffer(0)
+, triangles_buffer(0)
+, draw_commands_buffer(0)
+, dispatch_buffer(0)
+{
+}
+
+TerrainGeneratorCompute::~TerrainGeneratorCompute()
+{
+    glDeleteTextures(1, &atlas_texture);
+    glDeleteBuffers(1, &batch_blocks_buffer);
+    glDeleteBuffers(1, &triangles_buffer);
+    glDeleteBuffers(1, &draw_commands_buffer);
+    glDeleteBuffers(1, &dispatch_buffer);
+}
+
+void TerrainGeneratorCompute::init(string dir)
+{
+    TerrainGenerator::init(dir);
+
+    string batch_define = "#define BATCH_SIZE " + to_string(GENERATOR_BATCH_SIZE) + "\n";
+
+    compact_shader.generateProgramObject();
+    compact_shader.attachComputeShader((dir + "MarchingCubesCompact.cs").c_str());
+    compact_shader.setDefines(batch_define);
+    compact_shader.link();
+
+    density_shader.generateProgramObject();
+    density_shader.attachComputeShader((dir + "TerrainDensityShader.cs").c_str());
+
+    vertices_shader.generateProgramObject();
+    vertices_shader.attachComputeShader((dir + "MarchingCubesVertices.cs").c_str());
+    linkSpecializedShaders();
+
+    initAtlas();
+
+    glGenBuffers(1, &batch_blocks_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch_blocks_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ivec4) * GENERATOR_BATCH_SIZE,
+                 nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &triangles_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangles_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * MAX_TRIANGLES * GENERATOR_BATCH_SIZE,
+                 nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &draw_commands_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, draw_commands_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawArraysIndirectCommand) * GENERATOR_BATCH_SIZE,
+                 nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &dispatch_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, dispatch_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DispatchIndirectCommand), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    CHECK_GL_ERRORS;
+}
+
+void TerrainGeneratorCompute::finishInit()
+{
+    TerrainGenerator::finishInit();
+
+    block_size_uni_1 = compact_shader.getUniformLocation("block_size");
+    block_padding_uni_1 = compact_shader.getUniformLocation("block_padding");
+    max_triangles_uni_1 = compact_shader.getUniformLocation("max_triangles");
+}
+
+size_t TerrainGeneratorCompute::gpuBytes() const
+{
+    if (atlas_texture == 0) {
+        return TerrainGenerator::gpuBytes();
+    }
+    return TerrainGenerator::gpuBytes() +
+           sizeof(float) * BLOCK_PADDED_RESOLUTION * BLOCK_PADDED_RESOLUTION *
+               BLOCK_PADDED_RESOLUTION * GENERATOR_BATCH_SIZE +
+           sizeof(ivec4) * GENERATOR_BATCH_SIZE +
+           sizeof(GLuint) * MAX_TRIANGLES * GENERATOR_BATCH_SIZE +
+           sizeof(DrawArraysIndirectCommand) * GENERATOR_BATCH_SIZE +
+           sizeof(DispatchIndirectCommand);
+}
+
+void TerrainGeneratorCompute::initAtlas()
+{
+    glGenTextures(1, &atlas_texture);
+    glActiveTexture(GL_TEXTURE0 + ATLAS_UNIT);
+    glBindTexture(GL_TEXTURE_3D, atlas_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    // Same as the texture of TerrainGenerator, once per block of the batch.
+    glTexImage3D(GL_TEXTURE_3D,
+                 0,                         // level of detail
+                 GL_R32F,                   // internal format
+                 BLOCK_PADDED_RESOLUTION, BLOCK_PADDED_RESOLUTION,
+                 BLOCK_PADDED_RESOLUTION * GENERATOR_BATCH_SIZE,
+                 0,                         // 0 is required
+                 GL_RED, GL_FLOAT, NULL     // input format, not applicable
+                );
+
+    glBindImageTexture(ATLAS_UNIT,
+                       atlas_texture,
+                       0,               // level
+                       GL_TRUE,         // layered
+                       0,               // layer
+                       GL_READ_WRITE,   // access
+                       GL_R32F);
+
+    glActiveTexture(GL_TEXTURE0);
+
+    CHECK_GL_ERRORS;
+}
+
+void TerrainGeneratorCompute::linkShaders(const string& defines)
+{
+    TerrainGenerator::linkShaders(defines);
+
+    string batch_defines = defines + "#define BATCH_SIZE " + to_string(GENERATOR_BATCH_SIZE) + "\n";
+
+    density_shader.setDefines(densityDefines(batch_defines));
+    density_shader.link();
+
+#if PACKED_VERTICES
+    vertices_shader.setDefines(batch_defines + "#define PACKED_VERTICES\n");
+#else
+    vertices_shader.setDefines(batch_defines);
+#endif
+    vertices_shader.link();
+}
+
+void TerrainGeneratorCompute::findUniforms()
+{
+    TerrainGenerator::findUniforms();
+
+    block_padding_uni = density_shader.getUniformLocation("block_padding");
+    period_uni = density_shader.getUniformLocation("period");
+    octave_weights_uni = density_shader.getUniformLocation("octave_weights");
+    warp_params_uni = density_shader.getUniformLocation("warp_params");
+
+    block_size_uni_2 = vertices_shader.getUniformLocation("block_size");
+    block_padding_uni_2 = vertices_shader.getUniformLocation("block_padding");
+    max_triangles_uni_2 = vertices_shader.getUniformLocation("max_triangles");
+    period_uni_marching = vertices_shader.getUniformLocation("period");
+    octave_weights_uni_marching = vertices_shader.getUniformLocation("octave_weights");
+    warp_params_uni_marching = vertices_shader.getUniformLocation("warp_params");
+    short_range_ambient_uni = vertices_shader.getUniformLocation("short_range_ambient");
+    long_range_ambient_uni = vertices_shader.getUniformLocation("long_range_ambient");
+    ambient_occlusion_param_uni = vertices_shader.getUniformLocation("ambient_occlusion_param");
+}
+
+void TerrainGeneratorCompute::generateTerrainBlock(Block& block)
+{
+    generateBatch(vector<Block*>(1, &block));
+}
+
+void TerrainGeneratorCompute::generateTerrainBlocks(const vector<Block*>& blocks)
+{
+    for (size_t first = 0; first < blocks.size(); first += GENERATOR_BATCH_SIZE) {
+        size_t last = std::min(blocks.size(), first + GENERATOR_BATCH_SIZE);
+        generateBatch(vector<Block*>(blocks.begin() + first, blocks.begin() + last));
+    }
+}
+
+void TerrainGeneratorCompute::generateBatch(const vector<Block*>& blocks)
+{
+    TRACE_ZONE("Compute - batch");
+
+    int count = blocks.size();
+    assert(count > 0 && count <= GENERATOR_BATCH_SIZE);
+
+    specializeShaders();
+
+    // Where each block is, and counts starting from zero for both passes.
+    vector<ivec4> batch_blocks;
+    vector<DrawArraysIndirectCommand> draw_commands;
+    for (Block* block : blocks) {
+        batch_blocks.push_back(ivec4(block->index, block->size));
+        draw_commands.push_back({ 0, 1, 0, 0 });
+    }
+    DispatchIndirectCommand dispatch_command = { 0, (GLuint)count, 1 };
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch_blocks_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(ivec4) * count, &batch_blocks[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, draw_commands_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(DrawArraysIndirectCommand) * count,
+                    &draw_commands[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, dispatch_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(dispatch_command), &dispatch_command);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Bindings 0 and 5 hold the brushes and the layer of heights for the
+    // density pass, then the triangles and a vertex buffer.
+    uploadEdits(blocks);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, draw_commands_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, dispatch_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, batch_blocks_buffer);
+
+    density_shader.enable();
+    {
+        TRACE_ZONE("Compute - density");
+
+        glUniform1i(block_padding_uni, BLOCK_PADDING);
+        setOctaveWeights(octave_weights_uni);
+        glUniform2f(warp_params_uni, warp_frequency, warp_strength);
+        glUniform1f(period_uni, period);
+
+        glDispatchCompute(BLOCK_PADDED_RESOLUTION / DENSITY_DIM_X,
+                          BLOCK_PADDED_RESOLUTION / DENSITY_DIM_Y,
+                          BLOCK_PADDED_RESOLUTION / DENSITY_DIM_Z * count);
+
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    density_shader.disable();
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, triangles_buffer);
+    for (int i = 0; i < count; i++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4 + i, blocks[i]->out_vbo);
+    }
+
+    compact_shader.enable();
+    {
+        TRACE_ZONE("Compute - compact triangles");
+
+        glUniform1i(block_size_uni_1, BLOCK_SIZE);
+        glUniform1i(block_padding_uni_1, BLOCK_PADDING);
+        glUniform1ui(max_triangles_uni_1, MAX_TRIANGLES);
+
+        int voxels = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE;
+        glDispatchCompute((voxels + COMPACT_GROUP_SIZE - 1) / COMPACT_GROUP_SIZE, count, 1);
+
+        // The second pass reads the triangles and is sized by the dispatch
+        // command the first one wrote.
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    }
+    compact_shader.disable();
+
+    CHECK_GL_ERRORS;
+
+    vertices_shader.enable();
+    {
+        TRACE_ZONE("Compute - vertices");
+
+        glUniform1f(period_uni_marching, period);
+        setOctaveWeights(octave_weights_uni_marching);
+        glUniform2f(warp_params_uni_marching, warp_frequency, warp_strength);
+        glUniform1i(block_size_uni_2, BLOCK_SIZE);
+        glUniform1i(block_padding_uni_2, BLOCK_PADDING);
+        glUniform1ui(max_triangles_uni_2, MAX_TRIANGLES);
+        glUniform1i(short_range_ambient_uni, use_short_range_ambient_occlusion);
+        glUniform1i(long_range_ambient_uni, use_long_range_ambient_occlusion);
+        glUniform4f(ambient_occlusion_param_uni,
+                    ambient_occlusion_param.x, ambient_occlusion_param.y,
+                    ambient_occlusion_param.z, ambient_occlusion_param.w);
+
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dispatch_buffer);
+        glDispatchComputeIndirect(0);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+        // The blocks are drawn from the vertices, and the draw commands are
+        // copied to them below.
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+    vertices_shader.disable();
+
+    for (int i = 0; i < count; i++) {
+        IndirectBlock& block = dynamic_cast<IndirectBlock&>(*blocks[i]);
+        glBindBuffer(GL_COPY_READ_BUFFER, draw_commands_buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, block.draw_buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                            sizeof(DrawArraysIndirectCommand) * i, 0,
+                            sizeof(DrawArraysIndirectCommand));
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    for (int i = 0; i < 4 + count; i++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+    }
+
+    CHECK_GL_ERRORS;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+#include "terrain_generator.hpp"
+
+// Marching cubes in compute shaders only, up to GENERATOR_BATCH_SIZE blocks at
+// a time with one dispatch per pass for all of them. The densities of the
+// blocks are stacked in a 3D texture atlas, and the shaders find the index
+// and size of each block in a storage buffer.
+//
+// The first marching cubes pass classifies the voxels. A prefix sum of their
+// triangle counts runs across each work group, and then the triangles of the
+// whole group are written at once. An atomic add on the vertex count of the
+// block's indirect draw command picks where they go. The second pass is
+// dispatched indirectly over those triangles and computes their vertices into
+// the block's vertex buffer. Blocks must be IndirectBlocks.
+class TerrainGeneratorCompute : public TerrainGenerator {
+public:
+    TerrainGeneratorCompute();
+    virtual ~TerrainGeneratorCompute();
+
+    virtual void init(std::string dir);
+    virtual void finishInit();
+
+    virtual void generateTerrainBlock(Block& block);
+    virtual void generateTerrainBlocks(const std::vector<Block*>& blocks);
+    virtual int batchSize() { return GENERATOR_BATCH_SIZE; }
+    virtual size_t gpuBytes() const;
+
+protected:
+    virtual void linkShaders(const std::string& defines);
+    virtual void findUniforms();
+
+private:
+    void initAtlas();
+    // At most GENERATOR_BATCH_SIZE blocks.
+    void generateBatch(const std::vector<Block*>& blocks);
+
+    ShaderProgram density_shader;
+    ShaderProgram compact_shader;
+    ShaderProgram vertices_shader;
+
+    GLint block_padding_uni;
+    GLint period_uni;
+    GLint octave_weights_uni;
+    GLint warp_params_uni;
+    GLint block_size_uni_1;
+    GLint block_padding_uni_1;
+    GLint max_triangles_uni_1;
+    GLint block_size_uni_2;
+    GLint block_padding_uni_2;
+    GLint max_triangles_uni_2;
+    GLint period_uni_marching;
+    GLint octave_weights_uni_marching;
+    GLint warp_params_uni_marching;
+    GLint short_range_ambient_uni;
+    GLint long_range_ambient_uni;
+    GLint ambient_occlusion_param_uni;
+
+    // The densities of a batch, stacked along z.
+    GLuint atlas_texture;
+
+    // Index and size of each block of the batch.
+    GLuint batch_blocks_buffer;
+    // Packed triangles written by the first pass, as in the Medium generator,
+    // room for every voxel of every block.
+    GLuint triangles_buffer;
+    // The draw command of each block, copied to the block at the end.
+    GLuint draw_commands_buffer;
+    // The work groups of the second pass, written by the first.
+    GLuint dispatch_buffer;
+};
@@ -0,0 +1,111 @@
+#include "terrain_generator_cpu.hpp"
+
+#include "cs488-framework/GlErrorCheck.hpp"
+
+#include <assert.h>
+
+#include <glm/glm.hpp>
+
+#include "indexed_block.hpp"
+#include "trace.hpp"
+#include "vertex_cache.hpp"
+
+using namespace glm;
+using namespace std;
+
+// Same as octahedralEncode in terrain_vertex_common.h.
+static vec2 octahedralEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 encoded = vec2(n.x, n.y);
+    if (n.z < 0.0f) {
+        vec2 signs = vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (1.0f - abs(vec2(n.y, n.x))) * signs;
+    }
+    return encoded;
+}
+
+// Same as packVertex in terrain_vertex_common.h.
+static uvec3 packVertex(const MeshVertex& vertex)
+{
+    return uvec3(packUnorm2x16(vec2(vertex.position.x, vertex.position.y)),
+                 packUnorm2x16(vec2(vertex.position.z, vertex.ambient_occlusion)),
+                 packSnorm2x16(octahedralEncode(vertex.normal)));
+}
+
+TerrainGeneratorCpu::TerrainGeneratorCpu()
+: TerrainGenerator()
+{
+}
+
+void TerrainGeneratorCpu::init(string /*dir*/)
+{
+    // Nothing to compile, the density function runs on the CPU.
+}
+
+void TerrainGeneratorCpu::finishInit()
+{
+}
+
+void TerrainGeneratorCpu::generateTerrainBlock(Block& block)
+{
+    IndexedBlock* indexed_block = dynamic_cast<IndexedBlock*>(&block);
+    assert(indexed_block != NULL);
+
+#if ONE_BLOCK_PROFILE
+    Timer timer;
+    timer.start();
+#endif
+
+    TerrainDensity terrain_density = densityFunction();
+    {
+        TRACE_ZONE("CPU - mesh");
+        mesher.generate(block.index, block.size, terrain_density,
+                        use_short_range_ambient_occlusion,
+                        use_long_range_ambient_occlusion,
+                        ambient_occlusion_param);
+    }
+
+    TRACE_ZONE("CPU - upload");
+
+    mesh.vertex_count = mesher.vertices.size();
+    if (block.vertexFormat() == PackedVertex) {
+        mesh.vertices.resize(mesher.vertices.size() * sizeof(uvec3));
+        uvec3* packed_vertices = (uvec3*)mesh.vertices.data();
+        for (size_t i = 0; i < mesher.vertices.size(); i++) {
+            packed_vertices[i] = packVertex(mesher.vertices[i]);
+        }
+    } else {
+        const char* vertex_data = (const char*)mesher.vertices.data();
+        mesh.vertices.assign(vertex_data, vertex_data + mesher.vertices.size() * sizeof(MeshVertex));
+    }
+
+    // Most blocks have far fewer than 2^16 vertices, halve the index buffer
+    // when we can.
+    mesh.index_count = mesher.indices.size();
+    if (mesher.vertices.size() <= 0xFFFF) {
+        mesh.index_type = GL_UNSIGNED_SHORT;
+        mesh.indices.resize(mesher.indices.size() * sizeof(GLushort));
+        GLushort* short_indices = (GLushort*)mesh.indices.data();
+        for (size_t i = 0; i < mesher.indices.size(); i++) {
+            short_indices[i] = mesher.indices[i];
+        }
+    } else {
+        mesh.index_type = GL_UNSIGNED_INT;
+        const char* index_data = (const char*)mesher.indices.data();
+        mesh.indices.assign(index_data, index_data + mesher.indices.size() * sizeof(GLuint));
+    }
+    mesh.clusters = mesher.clusters;
+
+    indexed_block->uploadMesh(mesh);
+
+#if ONE_BLOCK_PROFILE
+    timer.stop();
+    printf("CPU block - %.3f, %d vertices, %d triangles, %d clusters, ACMR %.3f\n",
+           timer.elapsedSeconds(), (int)mesher.vertices.size(),
+           (int)mesher.indices.size() / 3, (int)mesher.clusters.size(),
+           averageCacheMissRatio(mesher.indices, mesher.vertices.size(), VERTEX_CACHE_SIZE));
+#endif
+
+    CHECK_GL_ERRORS;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+#include "indexed_block.hpp"
+#include "terrain_generator.hpp"
+#include "terrain_mesher.hpp"
+
+// Generates blocks on the CPU with shared vertices, see TerrainMesher.
+// Writes into IndexedBlocks.
+class TerrainGeneratorCpu : public TerrainGenerator {
+public:
+    TerrainGeneratorCpu();
+    virtual ~TerrainGeneratorCpu() {}
+
+    virtual void init(std::string dir);
+    virtual void finishInit();
+
+    virtual void generateTerrainBlock(Block& block);
+
+    // The mesh of the last generated block, as uploaded.
+    const BlockMesh& lastMesh() { return mesh; }
+
+private:
+    TerrainMesher mesher;
+
+    // Staging memory for the upload, kept around to avoid reallocating.
+    BlockMesh mesh;
+};
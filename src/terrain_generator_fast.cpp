@@ -6,7 +6,7 @@
 #include <vector>
 
 #include "indexed_block.hpp"
-#include "timer.hpp"
+#include "trace.hpp"
 
 using namespace glm;
 using namespace std;
@@ -14,18 +14,51 @@ using namespace std;
 static const GLchar* non_empties_varyings[] = { "z6_y6_x6_case8" };
 static const GLchar* unique_edges_varyings[] = { "z6_y6_x6_edge4" };
 static const GLchar* triangle_index_varyings[] = { "index" };
+#if PACKED_VERTICES
+static const GLchar* triangle_vertex_varyings[] = { "packed_vertex" };
+#else
 static const GLchar* triangle_vertex_varyings[] = { "position", "normal", "ambient_occlusion" };
+#endif
+
+// One unsigned int per voxel.
+#define UINT_STORAGE_BYTES (BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE * sizeof(unsigned int))
+// One vertex index per edge of each voxel.
+#define LOOKUP_TEXTURE_BYTES (3 * BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE * sizeof(GLint))
 
 TerrainGeneratorFast::TerrainGeneratorFast()
 : TerrainGenerator()
 , list_non_empties_shader(non_empties_varyings, 1)
+, non_empties_feedback(0)
+, non_empties_query(0)
+, case_vao(0)
+, case_vbo(0)
 , voxel_unique_edges_shader(unique_edges_varyings, 1)
+, edge_count_query(0)
+, unique_edges_feedback(0)
+, unique_edges_vao(0)
+, unique_edges_vbo(0)
+, unique_vertex_shader(triangle_vertex_varyings, sizeof(triangle_vertex_varyings) / sizeof(triangle_vertex_varyings[0]))
 , triangle_shader(triangle_index_varyings, 1)
-, unique_vertex_shader(triangle_vertex_varyings, 3)
+, index_count_query(0)
+, lookup_texture(0)
 , grid(BLOCK_SIZE)
 {
 }
 
+TerrainGeneratorFast::~TerrainGeneratorFast()
+{
+    glDeleteQueries(1, &non_empties_query);
+    glDeleteQueries(1, &edge_count_query);
+    glDeleteQueries(1, &index_count_query);
+    glDeleteTransformFeedbacks(1, &non_empties_feedback);
+    glDeleteTransformFeedbacks(1, &unique_edges_feedback);
+    glDeleteBuffers(1, &case_vbo);
+    glDeleteBuffers(1, &unique_edges_vbo);
+    glDeleteVertexArrays(1, &case_vao);
+    glDeleteVertexArrays(1, &unique_edges_vao);
+    glDeleteTextures(1, &lookup_texture);
+}
+
 void TerrainGeneratorFast::init(string dir)
 {
     TerrainGenerator::init(dir);
@@ -37,58 +70,83 @@ void TerrainGeneratorFast::init(string dir)
 
     glGenQueries(1, &non_empties_query);
 
-    grid.init(list_non_empties_shader);
-
     voxel_unique_edges_shader.generateProgramObject();
     voxel_unique_edges_shader.attachVertexShader((dir + "VoxelUniqueEdges.vs").c_str());
     voxel_unique_edges_shader.attachGeometryShader((dir + "VoxelUniqueEdges.gs").c_str());
     voxel_unique_edges_shader.link();
 
-    case_attrib = voxel_unique_edges_shader.getAttribLocation("z6_y6_x6_case8_in");
     glGenQueries(1, &edge_count_query);
 
     unique_vertex_shader.generateProgramObject();
     unique_vertex_shader.attachVertexShader((dir + "UniqueVertex.vs").c_str());
-    unique_vertex_shader.link();
-
-    edge_attrib = unique_vertex_shader.getAttribLocation("z6_y6_x6_edge4_in");
-
-    block_index_uni = unique_vertex_shader.getUniformLocation("block_index");
-    block_size_uni = unique_vertex_shader.getUniformLocation("block_size");
-    block_padding_uni = unique_vertex_shader.getUniformLocation("block_padding");
-    period_uni_marching = unique_vertex_shader.getUniformLocation("period");
-    octaves_uni_marching = unique_vertex_shader.getUniformLocation("octaves");
-    octaves_decay_uni_marching = unique_vertex_shader.getUniformLocation("octaves_decay");
-    warp_params_uni_marching = unique_vertex_shader.getUniformLocation("warp_params");
-    short_range_ambient_uni = unique_vertex_shader.getUniformLocation("short_range_ambient");
-    long_range_ambient_uni = unique_vertex_shader.getUniformLocation("long_range_ambient");
-    ambient_occlusion_param_uni = unique_vertex_shader.getUniformLocation("ambient_occlusion_param");
-
-    initUIntStorage(case_vao, case_vbo, non_empties_feedback, case_attrib);
-    initUIntStorage(unique_edges_vao, unique_edges_vbo, unique_edges_feedback, edge_attrib);
+    linkSpecializedShaders();
 
     index_shader.generateProgramObject();
     index_shader.attachComputeShader((dir + "ConstructIndexLookup.cs").c_str());
     index_shader.link();
 
-    total_items_uni = index_shader.getUniformLocation("total_items");
-
     triangle_shader.generateProgramObject();
     triangle_shader.attachVertexShader((dir + "VoxelUniqueEdges.vs").c_str());
     triangle_shader.attachGeometryShader((dir + "ConstructTriangles.gs").c_str());
     triangle_shader.link();
 
-    texture_size_uni = triangle_shader.getUniformLocation("texture_size");
     glGenQueries(1, &index_count_query);
 
     initVertexLookup();
 }
 
+void TerrainGeneratorFast::finishInit()
+{
+    TerrainGenerator::finishInit();
+
+    grid.init(list_non_empties_shader);
+
+    case_attrib = voxel_unique_edges_shader.getAttribLocation("z6_y6_x6_case8_in");
+    edge_attrib = unique_vertex_shader.getAttribLocation("z6_y6_x6_edge4_in");
+
+    initUIntStorage(case_vao, case_vbo, non_empties_feedback, case_attrib);
+    initUIntStorage(unique_edges_vao, unique_edges_vbo, unique_edges_feedback, edge_attrib);
+
+    total_items_uni = index_shader.getUniformLocation("total_items");
+    texture_size_uni = triangle_shader.getUniformLocation("texture_size");
+}
+
+void TerrainGeneratorFast::linkShaders(const string& defines)
+{
+    TerrainGenerator::linkShaders(defines);
+
+    unique_vertex_shader.setDefines(defines);
+    unique_vertex_shader.link();
+}
+
+void TerrainGeneratorFast::findUniforms()
+{
+    TerrainGenerator::findUniforms();
+
+    block_index_uni = unique_vertex_shader.getUniformLocation("block_index");
+    block_size_uni = unique_vertex_shader.getUniformLocation("block_size");
+    block_padding_uni = unique_vertex_shader.getUniformLocation("block_padding");
+    period_uni_marching = unique_vertex_shader.getUniformLocation("period");
+    octave_weights_uni_marching = unique_vertex_shader.getUniformLocation("octave_weights");
+    warp_params_uni_marching = unique_vertex_shader.getUniformLocation("warp_params");
+    short_range_ambient_uni = unique_vertex_shader.getUniformLocation("short_range_ambient");
+    long_range_ambient_uni = unique_vertex_shader.getUniformLocation("long_range_ambient");
+    ambient_occlusion_param_uni = unique_vertex_shader.getUniformLocation("ambient_occlusion_param");
+}
+
+size_t TerrainGeneratorFast::gpuBytes() const
+{
+    if (lookup_texture == 0) {
+        return TerrainGenerator::gpuBytes();
+    }
+    return TerrainGenerator::gpuBytes() + grid.bufferBytes() + 2 * UINT_STORAGE_BYTES +
+           LOOKUP_TEXTURE_BYTES;
+}
+
 void TerrainGeneratorFast::initUIntStorage(GLuint& vao, GLuint& vbo, GLuint& feedback, GLint attrib)
 {
     size_t unit_size = sizeof(unsigned int);
-    size_t data_size = BLOCK_SIZE * BLOCK_SIZE *
-                       BLOCK_SIZE * unit_size;
+    size_t data_size = UINT_STORAGE_BYTES;
 
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
@@ -109,8 +167,6 @@ void TerrainGeneratorFast::initUIntStorage(GLuint& vao, GLuint& vbo, GLuint& fee
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    // TODO: If we do this multiple times, make sure we clean up old copies....
-    // Should probably benchmark GPU memory usage.
     glGenTransformFeedbacks(1, &feedback);
     {
         glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
@@ -164,6 +220,7 @@ void TerrainGeneratorFast::generateTerrainBlock(Block& block)
 {
     IndexedBlock* indexed_block = dynamic_cast<IndexedBlock*>(&block);
     assert(indexed_block != NULL);
+    specializeShaders();
     generateDensity(block);
 
     glEnable(GL_RASTERIZER_DISCARD);
@@ -171,6 +228,8 @@ void TerrainGeneratorFast::generateTerrainBlock(Block& block)
     GLint non_empties_count;
     list_non_empties_shader.enable();
     {
+        TRACE_ZONE("Fast - list non-empties");
+
         glBindVertexArray(grid.getVertices());
 
         glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, non_empties_feedback);
@@ -194,6 +253,8 @@ void TerrainGeneratorFast::generateTerrainBlock(Block& block)
     GLint unique_edges_count;
     voxel_unique_edges_shader.enable();
     {
+        TRACE_ZONE("Fast - unique edges");
+
         glBindVertexArray(case_vao);
 
         glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, unique_edges_feedback);
@@ -217,6 +278,8 @@ void TerrainGeneratorFast::generateTerrainBlock(Block& block)
 
     index_shader.enable();
     {
+        TRACE_ZONE("Fast - vertex indices");
+
         glUniform1i(total_items_uni, unique_edges_count);
 
         //glBindBuffer(GL_ARRAY_BUFFER, case_vbo); // needed?
@@ -245,6 +308,8 @@ void TerrainGeneratorFast::generateTerrainBlock(Block& block)
 
     triangle_shader.enable();
     {
+        TRACE_ZONE("Fast - triangles");
+
         glUniform1i(texture_size_uni, BLOCK_SIZE);
 
         glBindVertexArray(case_vao);
@@ -264,6 +329,8 @@ void TerrainGeneratorFast::generateTerrainBlock(Block& block)
 
         glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
         glGetQueryObjectiv(index_count_query, GL_QUERY_RESULT, &indexed_block->index_count);
+        indexed_block->index_type = GL_UNSIGNED_INT;
+        indexed_block->clusters.clear();
 
         //printf("_%d\n" , indexed_block->index_count);
         glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
@@ -284,9 +351,10 @@ void TerrainGeneratorFast::generateTerrainBlock(Block& block)
 
     unique_vertex_shader.enable();
     {
+        TRACE_ZONE("Fast - unique vertices");
+
         glUniform1f(period_uni_marching, period);
-        glUniform1i(octaves_uni_marching, octaves);
-        glUniform1f(octaves_decay_uni_marching, octaves_decay);
+        setOctaveWeights(octave_weights_uni_marching);
         glUniform4i(block_index_uni, block.index.x, block.index.y, block.index.z, block.size);
         glUniform1i(block_size_uni, BLOCK_SIZE);
         glUniform1i(block_padding_uni, BLOCK_PADDING);
@@ -5,11 +5,17 @@
 class TerrainGeneratorFast : public TerrainGenerator {
 public:
     TerrainGeneratorFast();
-    virtual ~TerrainGeneratorFast() {}
+    virtual ~TerrainGeneratorFast();
 
-    void init(std::string dir);
+    virtual void init(std::string dir);
+    virtual void finishInit();
 
     virtual void generateTerrainBlock(Block& block);
+    virtual size_t gpuBytes() const;
+
+protected:
+    virtual void linkShaders(const std::string& defines);
+    virtual void findUniforms();
 
 private:
     void initUIntStorage(GLuint& vao, GLuint& vbo, GLuint& feedback, GLint attrib);
@@ -37,8 +43,7 @@ private:
     GLint block_size_uni;
     GLint block_padding_uni;
     GLint period_uni_marching;
-    GLint octaves_uni_marching;
-    GLint octaves_decay_uni_marching;
+    GLint octave_weights_uni_marching;
     GLint warp_params_uni_marching;
     GLint short_range_ambient_uni;
     GLint long_range_ambient_uni;
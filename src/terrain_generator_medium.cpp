@@ -5,22 +5,39 @@
 #include <glm/glm.hpp>
 #include <vector>
 
-#include "timer.hpp"
+#include "trace.hpp"
 
 using namespace glm;
 using namespace std;
 
 static const GLchar* packed_varyings[] = { "z6_y6_x6_edge1_edge2_edge3" };
+#if PACKED_VERTICES
+static const GLchar* triangle_varyings[] = { "packed_vertex" };
+#else
 static const GLchar* triangle_varyings[] = { "position", "normal", "ambient_occlusion" };
+#endif
+
+// Up to 5 triangles per voxel.
+#define PACKED_TRIANGLES_BYTES (BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE * sizeof(unsigned int) * 5)
 
 TerrainGeneratorMedium::TerrainGeneratorMedium()
 : TerrainGenerator()
 , voxel_edges_shader(packed_varyings, 1)
-, triangle_unpack_shader(triangle_varyings, 3)
+, triangle_unpack_shader(triangle_varyings, sizeof(triangle_varyings) / sizeof(triangle_varyings[0]))
+, voxel_edges_feedback(0)
+, packed_triangles_vao(0)
+, packed_triangles_vbo(0)
 , grid(BLOCK_SIZE)
 {
 }
 
+TerrainGeneratorMedium::~TerrainGeneratorMedium()
+{
+    glDeleteTransformFeedbacks(1, &voxel_edges_feedback);
+    glDeleteBuffers(1, &packed_triangles_vbo);
+    glDeleteVertexArrays(1, &packed_triangles_vao);
+}
+
 void TerrainGeneratorMedium::init(string dir)
 {
     TerrainGenerator::init(dir);
@@ -30,37 +47,59 @@ void TerrainGeneratorMedium::init(string dir)
     voxel_edges_shader.attachGeometryShader((dir + "VoxelEdgesShader.gs").c_str());
     voxel_edges_shader.link();
 
-    block_size_uni_1 = voxel_edges_shader.getUniformLocation("block_size");
-    block_padding_uni_1 = voxel_edges_shader.getUniformLocation("block_padding");
-
     triangle_unpack_shader.generateProgramObject();
     triangle_unpack_shader.attachVertexShader((dir + "TriangleUnpackShader.vs").c_str());
     triangle_unpack_shader.attachGeometryShader((dir + "TriangleUnpackShader.gs").c_str());
+    linkSpecializedShaders();
+}
+
+void TerrainGeneratorMedium::finishInit()
+{
+    TerrainGenerator::finishInit();
+
+    block_size_uni_1 = voxel_edges_shader.getUniformLocation("block_size");
+    block_padding_uni_1 = voxel_edges_shader.getUniformLocation("block_padding");
+
+    packed_attrib = triangle_unpack_shader.getAttribLocation("z6_y6_x6_edge1_edge2_edge3_in");
+
+    initPackedStorage();
+
+    grid.init(voxel_edges_shader);
+}
+
+void TerrainGeneratorMedium::linkShaders(const string& defines)
+{
+    TerrainGenerator::linkShaders(defines);
+
+    triangle_unpack_shader.setDefines(defines);
     triangle_unpack_shader.link();
+}
+
+void TerrainGeneratorMedium::findUniforms()
+{
+    TerrainGenerator::findUniforms();
 
     block_index_uni = triangle_unpack_shader.getUniformLocation("block_index");
     block_size_uni_2 = triangle_unpack_shader.getUniformLocation("block_size");
     block_padding_uni_2 = triangle_unpack_shader.getUniformLocation("block_padding");
     period_uni_marching = triangle_unpack_shader.getUniformLocation("period");
-    octaves_uni_marching = triangle_unpack_shader.getUniformLocation("octaves");
-    octaves_decay_uni_marching = triangle_unpack_shader.getUniformLocation("octaves_decay");
+    octave_weights_uni_marching = triangle_unpack_shader.getUniformLocation("octave_weights");
     warp_params_uni_marching = triangle_unpack_shader.getUniformLocation("warp_params");
     short_range_ambient_uni = triangle_unpack_shader.getUniformLocation("short_range_ambient");
     long_range_ambient_uni = triangle_unpack_shader.getUniformLocation("long_range_ambient");
     ambient_occlusion_param_uni = triangle_unpack_shader.getUniformLocation("ambient_occlusion_param");
+}
 
-    packed_attrib = triangle_unpack_shader.getAttribLocation("z6_y6_x6_edge1_edge2_edge3_in");
-
-    initPackedStorage();
-
-    grid.init(voxel_edges_shader);
+size_t TerrainGeneratorMedium::gpuBytes() const
+{
+    return TerrainGenerator::gpuBytes() + grid.bufferBytes() +
+           (packed_triangles_vbo ? PACKED_TRIANGLES_BYTES : 0);
 }
 
 void TerrainGeneratorMedium::initPackedStorage()
 {
     size_t unit_size = sizeof(unsigned int);
-    size_t data_size = BLOCK_SIZE * BLOCK_SIZE *
-                       BLOCK_SIZE * unit_size * 5;
+    size_t data_size = PACKED_TRIANGLES_BYTES;
 
     glGenVertexArrays(1, &packed_triangles_vao);
     glGenBuffers(1, &packed_triangles_vbo);
@@ -83,8 +122,6 @@ void TerrainGeneratorMedium::initPackedStorage()
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    // TODO: If we do this multiple times, make sure we clean up old copies....
-    // Should probably benchmark GPU memory usage.
     glGenTransformFeedbacks(1, &voxel_edges_feedback);
     {
         glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, voxel_edges_feedback);
@@ -99,12 +136,15 @@ void TerrainGeneratorMedium::initPackedStorage()
 
 void TerrainGeneratorMedium::generateTerrainBlock(Block& block)
 {
+    specializeShaders();
     generateDensity(block);
 
     glEnable(GL_RASTERIZER_DISCARD);
 
     voxel_edges_shader.enable();
     {
+        TRACE_ZONE("Medium - voxel edges");
+
         glUniform1i(block_size_uni_1, BLOCK_SIZE);
         glUniform1i(block_padding_uni_1, BLOCK_PADDING);
 
@@ -141,9 +181,10 @@ void TerrainGeneratorMedium::generateTerrainBlock(Block& block)
 
     triangle_unpack_shader.enable();
     {
+        TRACE_ZONE("Medium - triangle unpack");
+
         glUniform1f(period_uni_marching, period);
-        glUniform1i(octaves_uni_marching, octaves);
-        glUniform1f(octaves_decay_uni_marching, octaves_decay);
+        setOctaveWeights(octave_weights_uni_marching);
         glUniform4i(block_index_uni, block.index.x, block.index.y, block.index.z, block.size);
         glUniform1i(block_size_uni_2, BLOCK_SIZE);
         glUniform1i(block_padding_uni_2, BLOCK_PADDING);
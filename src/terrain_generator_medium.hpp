@@ -5,11 +5,17 @@
 class TerrainGeneratorMedium : public TerrainGenerator {
 public:
     TerrainGeneratorMedium();
-    virtual ~TerrainGeneratorMedium() {}
+    virtual ~TerrainGeneratorMedium();
 
-    void init(std::string dir);
+    virtual void init(std::string dir);
+    virtual void finishInit();
 
     virtual void generateTerrainBlock(Block& block);
+    virtual size_t gpuBytes() const;
+
+protected:
+    virtual void linkShaders(const std::string& defines);
+    virtual void findUniforms();
 
 private:
     void initPackedStorage();
@@ -25,8 +31,7 @@ private:
     GLint block_padding_uni_1;
     GLint block_padding_uni_2;
     GLint period_uni_marching;
-    GLint octaves_uni_marching;
-    GLint octaves_decay_uni_marching;
+    GLint octave_weights_uni_marching;
     GLint warp_params_uni_marching;
     GLint short_range_ambient_uni;
     GLint long_range_ambient_uni;
@@ -4,16 +4,20 @@
 
 #include <glm/glm.hpp>
 
-#include "timer.hpp"
+#include "trace.hpp"
 
 using namespace glm;
 using namespace std;
 
+#if PACKED_VERTICES
+static const GLchar* varyings[] = { "packed_vertex" };
+#else
 static const GLchar* varyings[] = { "position", "normal", "ambient_occlusion" };
+#endif
 
 TerrainGeneratorSlow::TerrainGeneratorSlow()
 : TerrainGenerator()
-, marching_cubes_shader(varyings, 3)
+, marching_cubes_shader(varyings, sizeof(varyings) / sizeof(varyings[0]))
 , grid(BLOCK_SIZE)
 {
 }
@@ -25,30 +29,54 @@ void TerrainGeneratorSlow::init(string dir)
     marching_cubes_shader.generateProgramObject();
     marching_cubes_shader.attachVertexShader((dir + "GridPointShader.vs").c_str());
     marching_cubes_shader.attachGeometryShader((dir + "MarchingCubesShader.gs").c_str());
+    linkSpecializedShaders();
+}
+
+void TerrainGeneratorSlow::finishInit()
+{
+    TerrainGenerator::finishInit();
+
+    grid.init(marching_cubes_shader);
+}
+
+size_t TerrainGeneratorSlow::gpuBytes() const
+{
+    return TerrainGenerator::gpuBytes() + grid.bufferBytes();
+}
+
+void TerrainGeneratorSlow::linkShaders(const string& defines)
+{
+    TerrainGenerator::linkShaders(defines);
+
+    marching_cubes_shader.setDefines(defines);
     marching_cubes_shader.link();
+}
+
+void TerrainGeneratorSlow::findUniforms()
+{
+    TerrainGenerator::findUniforms();
 
     block_size_uni = marching_cubes_shader.getUniformLocation("block_size");
     block_padding_uni_marching = marching_cubes_shader.getUniformLocation("block_padding");
     period_uni_marching = marching_cubes_shader.getUniformLocation("period");
-    octaves_uni_marching = marching_cubes_shader.getUniformLocation("octaves");
-    octaves_decay_uni_marching = marching_cubes_shader.getUniformLocation("octaves_decay");
+    octave_weights_uni_marching = marching_cubes_shader.getUniformLocation("octave_weights");
     warp_params_uni_marching = marching_cubes_shader.getUniformLocation("warp_params");
     short_range_ambient_uni = marching_cubes_shader.getUniformLocation("short_range_ambient");
     long_range_ambient_uni = marching_cubes_shader.getUniformLocation("long_range_ambient");
-
-    grid.init(marching_cubes_shader);
 }
 
 void TerrainGeneratorSlow::generateTerrainBlock(Block& block)
 {
+    specializeShaders();
     generateDensity(block);
 
     // Generate the triangle mesh for the terrain.
     marching_cubes_shader.enable();
     {
+        TRACE_ZONE("Slow - marching cubes");
+
         glUniform1f(period_uni_marching, period);
-        glUniform1i(octaves_uni_marching, octaves);
-        glUniform1f(octaves_decay_uni_marching, octaves_decay);
+        setOctaveWeights(octave_weights_uni_marching);
         glUniform1i(block_size_uni, BLOCK_SIZE);
         glUniform1i(block_padding_uni_marching, BLOCK_PADDING);
         glUniform1f(short_range_ambient_uni, use_short_range_ambient_occlusion);
@@ -7,9 +7,15 @@ public:
     TerrainGeneratorSlow();
     virtual ~TerrainGeneratorSlow() {}
 
-    void init(std::string dir);
+    virtual void init(std::string dir);
+    virtual void finishInit();
 
     virtual void generateTerrainBlock(Block& block);
+    virtual size_t gpuBytes() const;
+
+protected:
+    virtual void linkShaders(const std::string& defines);
+    virtual void findUniforms();
 
 private:
     TransformProgram marching_cubes_shader;
@@ -17,8 +23,7 @@ private:
     GLint block_size_uni;
     GLint block_padding_uni_marching;
     GLint period_uni_marching;
-    GLint octaves_uni_marching;
-    GLint octaves_decay_uni_marching;
+    GLint octave_weights_uni_marching;
     GLint warp_params_uni_marching;
     GLint short_range_ambient_uni;
     GLint long_range_ambient_uni;
@@ -0,0 +1,366 @@
+#include "terrain_mesher.hpp"
+
+#include <assert.h>
+#include <algorithm>
+#include <math.h>
+
+#include "marching_cubes_tables.hpp"
+#include "vertex_cache.hpp"
+
+using namespace glm;
+using namespace std;
+
+// Same table as terrain_vertex_common.h.
+// 32 random rays on sphere with Poisson distribution, table from Ryan Geiss.
+static const vec3 random_rays[32] = {
+    vec3( 0.286582,  0.257763, -0.922729),
+    vec3(-0.171812, -0.888079,  0.426375),
+    vec3( 0.440764, -0.502089, -0.744066),
+    vec3(-0.841007, -0.428818, -0.329882),
+    vec3(-0.380213, -0.588038, -0.713898),
+    vec3(-0.055393, -0.207160, -0.976738),
+    vec3(-0.901510, -0.077811,  0.425706),
+    vec3(-0.974593,  0.123830, -0.186643),
+    vec3( 0.208042, -0.524280,  0.825741),
+    vec3( 0.258429, -0.898570, -0.354663),
+    vec3(-0.262118,  0.574475, -0.775418),
+    vec3( 0.735212,  0.551820,  0.393646),
+    vec3( 0.828700, -0.523923, -0.196877),
+    vec3( 0.788742,  0.005727, -0.614698),
+    vec3(-0.696885,  0.649338, -0.304486),
+    vec3(-0.625313,  0.082413, -0.776010),
+    vec3( 0.358696,  0.928723,  0.093864),
+    vec3( 0.188264,  0.628978,  0.754283),
+    vec3(-0.495193,  0.294596,  0.817311),
+    vec3( 0.818889,  0.508670, -0.265851),
+    vec3( 0.027189,  0.057757,  0.997960),
+    vec3(-0.188421,  0.961802, -0.198582),
+    vec3( 0.995439,  0.019982,  0.093282),
+    vec3(-0.315254, -0.925345, -0.210596),
+    vec3( 0.411992, -0.877706,  0.244733),
+    vec3( 0.625857,  0.080059,  0.775818),
+    vec3(-0.243839,  0.866185,  0.436194),
+    vec3(-0.725464, -0.643645,  0.243768),
+    vec3( 0.766785, -0.430702,  0.475959),
+    vec3(-0.446376, -0.391664,  0.804580),
+    vec3(-0.761557,  0.562508,  0.321895),
+    vec3( 0.344460,  0.753223, -0.560359)
+};
+
+#define BRICKS_PER_SIDE ((BLOCK_SIZE + CLUSTER_BRICK_SIZE - 1) / CLUSTER_BRICK_SIZE)
+
+static int gridIndex(ivec3 texel)
+{
+    return (texel.z * BLOCK_PADDED_RESOLUTION + texel.y) * BLOCK_PADDED_RESOLUTION + texel.x;
+}
+
+TerrainMesher::TerrainMesher()
+: density_grid(BLOCK_PADDED_RESOLUTION * BLOCK_PADDED_RESOLUTION * BLOCK_PADDED_RESOLUTION)
+, density_computed(BLOCK_PADDED_RESOLUTION * BLOCK_PADDED_RESOLUTION, false)
+, edge_vertices(BLOCK_RESOLUTION * BLOCK_RESOLUTION * BLOCK_RESOLUTION * 3, -1)
+, brick_indices(BRICKS_PER_SIDE * BRICKS_PER_SIDE * BRICKS_PER_SIDE)
+{
+}
+
+void TerrainMesher::generate(ivec3 index, int size, const TerrainDensity& density_function,
+                             bool short_range, bool long_range, vec4 ao_param)
+{
+    block_index = index;
+    block_size = size;
+    terrain_density = &density_function;
+    short_range_ambient = short_range;
+    long_range_ambient = long_range;
+    ambient_occlusion_param = ao_param;
+
+    vertices.clear();
+    indices.clear();
+    clusters.clear();
+    for (auto& brick : brick_indices) {
+        brick.clear();
+    }
+    std::fill(density_computed.begin(), density_computed.end(), false);
+    std::fill(edge_vertices.begin(), edge_vertices.end(), -1);
+
+    ivec3 padding = ivec3(BLOCK_PADDING);
+    for (int z = 0; z < BLOCK_SIZE; z++) {
+        for (int y = 0; y < BLOCK_SIZE; y++) {
+            for (int x = 0; x < BLOCK_SIZE; x++) {
+                ivec3 cell = ivec3(x, y, z);
+
+                // Same corner order as VoxelEdgesShader.gs.
+                ivec3 texel = cell + padding;
+                int case_index =
+                    (densityAtTexel(texel + ivec3(0, 0, 0)) > 0 ? 1 << 0 : 0) |
+                    (densityAtTexel(texel + ivec3(0, 1, 0)) > 0 ? 1 << 1 : 0) |
+                    (densityAtTexel(texel + ivec3(1, 1, 0)) > 0 ? 1 << 2 : 0) |
+                    (densityAtTexel(texel + ivec3(1, 0, 0)) > 0 ? 1 << 3 : 0) |
+                    (densityAtTexel(texel + ivec3(0, 0, 1)) > 0 ? 1 << 4 : 0) |
+                    (densityAtTexel(texel + ivec3(0, 1, 1)) > 0 ? 1 << 5 : 0) |
+                    (densityAtTexel(texel + ivec3(1, 1, 1)) > 0 ? 1 << 6 : 0) |
+                    (densityAtTexel(texel + ivec3(1, 0, 1)) > 0 ? 1 << 7 : 0);
+
+                ivec3 brick = cell / CLUSTER_BRICK_SIZE;
+                vector<GLuint>& brick_triangles = brick_indices[
+                    (brick.z * BRICKS_PER_SIDE + brick.y) * BRICKS_PER_SIDE + brick.x];
+
+                int numpolys = case_to_numpolys[case_index];
+                for (int i = 0; i < numpolys; i++) {
+                    for (int j = 0; j < 3; j++) {
+                        int edge = edge_connect_list[case_index][i][j];
+                        brick_triangles.push_back(
+                            edgeVertex(cell + edge_start[edge], edge_axis[edge]));
+                    }
+                }
+            }
+        }
+    }
+
+    // Reorder each brick on its own so that its triangles stay contiguous,
+    // then cut it into clusters.
+    for (auto& brick : brick_indices) {
+        reorderBrick(brick);
+        for (size_t first = 0; first < brick.size(); first += CLUSTER_TRIANGLES * 3) {
+            MeshCluster cluster;
+            cluster.first_index = indices.size() + first;
+            cluster.index_count = std::min(brick.size() - first, (size_t)CLUSTER_TRIANGLES * 3);
+            clusters.push_back(cluster);
+        }
+        indices.insert(indices.end(), brick.begin(), brick.end());
+    }
+
+    reorderVertices();
+
+    for (auto& cluster : clusters) {
+        computeClusterBounds(cluster);
+    }
+}
+
+// Tipsify takes arrays over all the vertices its indices can refer to, so the
+// vertices of the brick are numbered from 0 for it and back after, and each
+// brick costs as much as its own triangles instead of the whole block.
+void TerrainMesher::reorderBrick(vector<GLuint>& brick)
+{
+    if (local_vertices.size() < vertices.size()) {
+        local_vertices.resize(vertices.size(), -1);
+    }
+
+    brick_vertices.clear();
+    for (GLuint& index : brick) {
+        GLint& local = local_vertices[index];
+        if (local < 0) {
+            local = brick_vertices.size();
+            brick_vertices.push_back(index);
+        }
+        index = local;
+    }
+
+    tipsify(brick, brick_vertices.size(), VERTEX_CACHE_SIZE);
+
+    for (GLuint& index : brick) {
+        index = brick_vertices[index];
+    }
+    for (GLuint vertex : brick_vertices) {
+        local_vertices[vertex] = -1;
+    }
+}
+
+float TerrainMesher::densityAtTexel(ivec3 texel)
+{
+    int row = texel.z * BLOCK_PADDED_RESOLUTION + texel.y;
+    if (!density_computed[row]) {
+        // Same as TerrainDensityShader.cs.
+        vec3 world_coords = vec3((ivec3(0, texel.y, texel.z) - ivec3(BLOCK_PADDING)) * block_size) +
+                            vec3(block_index * BLOCK_SIZE);
+        float* densities = &density_grid[row * BLOCK_PADDED_RESOLUTION];
+        terrain_density->terrainDensityRow(world_coords, block_size, BLOCK_PADDED_RESOLUTION,
+                                           BLOCK_RESOLUTION, densities);
+        for (int x = 0; x < BLOCK_PADDED_RESOLUTION; x++) {
+            densities[x] -= (block_size - 1) * 0.02f;
+        }
+        density_computed[row] = true;
+    }
+    return density_grid[gridIndex(texel)];
+}
+
+float TerrainMesher::density(vec3 coord)
+{
+    // Nearest texel lookup like the density function in marching_cubes_common.h,
+    // which samples at (coord + padding) / texture_size.
+    float texture_size = BLOCK_SIZE + 2 * BLOCK_PADDING;
+    ivec3 texel = ivec3(floor((coord + vec3(BLOCK_PADDING)) / texture_size *
+                              float(BLOCK_PADDED_RESOLUTION)));
+    return densityAtTexel(clamp(texel, ivec3(0), ivec3(BLOCK_PADDED_RESOLUTION - 1)));
+}
+
+vec3 TerrainMesher::normalAtVertex(vec3 vertex)
+{
+    float d = 1.0f;
+    vec3 gradient = vec3(
+        density(vertex + vec3(d, 0, 0)) - density(vertex - vec3(d, 0, 0)),
+        density(vertex + vec3(0, d, 0)) - density(vertex - vec3(0, d, 0)),
+        density(vertex + vec3(0, 0, d)) - density(vertex - vec3(0, 0, d)));
+    return -normalize(gradient);
+}
+
+float TerrainMesher::ambientOcclusion(vec3 vertex, vec3 world_position)
+{
+    // Same as ambientOcclusion in terrain_vertex_common.h, returns the visibility.
+    int long_range_octaves = std::min(3, terrain_density->octaves);
+
+    // Long-range samples of the rays pointing up, in the order they are used
+    // below, evaluated four at a time.
+    vec3 long_range_points[32 * 5 + 3];
+    float long_range_densities[32 * 5 + 3];
+    int long_range_count = 0;
+    if (long_range_ambient) {
+        for (int i = 0; i < 32; i++) {
+            vec3 ray = random_rays[i];
+            if (ray.y > 0) {
+                for (int j = 0; j < 5; j++) {
+                    float distance = pow((j + 3) / 5.0f, 1.8f) * 20;
+                    long_range_points[long_range_count++] = world_position + distance * ray;
+                }
+            }
+        }
+        for (int i = long_range_count; i % 4 != 0; i++) {
+            long_range_points[i] = world_position;
+        }
+        for (int i = 0; i < long_range_count; i += 4) {
+            terrain_density->terrainDensity4(&long_range_points[i], BLOCK_SIZE, long_range_octaves,
+                                             &long_range_densities[i]);
+        }
+    }
+    int long_range_sample = 0;
+
+    float occlusion = 0.0f;
+    for (int i = 0; i < 32; i++) {
+        vec3 ray = random_rays[i];
+        float ray_visibility = 1.0f;
+
+        if (short_range_ambient) {
+            vec3 short_ray = vertex + ray;
+            vec3 delta = ray / 4.0f / float(block_size);
+            for (int j = 0; j < 16; j++) {
+                short_ray += delta;
+                float d = density(short_ray);
+                ray_visibility *= (1.0f - clamp(d * ambient_occlusion_param.y, 0.0f, 1.0f) *
+                                          ambient_occlusion_param.x);
+            }
+        }
+
+        if (long_range_ambient && ray.y > 0) {
+            for (int j = 0; j < 5; j++) {
+                float d = long_range_densities[long_range_sample++];
+                ray_visibility *= (1.0f - clamp(d * ambient_occlusion_param.w, 0.0f, 1.0f) *
+                                          ambient_occlusion_param.z);
+            }
+        }
+
+        occlusion += (1.0f - ray_visibility);
+    }
+
+    return (1.0f - occlusion / 32.0f);
+}
+
+GLuint TerrainMesher::edgeVertex(ivec3 corner, int axis)
+{
+    int key = ((corner.z * BLOCK_RESOLUTION + corner.y) * BLOCK_RESOLUTION + corner.x) * 3 + axis;
+    if (edge_vertices[key] >= 0) {
+        return edge_vertices[key];
+    }
+
+    // Place the vertex where the density is approximately zero.
+    // d1 * (1 - t) + d2 * t = 0 => t = d1 / (d1 - d2)
+    ivec3 dir = ivec3(0);
+    dir[axis] = 1;
+    ivec3 texel = corner + ivec3(BLOCK_PADDING);
+    float d1 = densityAtTexel(texel);
+    float d2 = densityAtTexel(texel + dir);
+    float t = d1 / (d1 - d2);
+
+    vec3 vertex_position = vec3(corner) + vec3(dir) * t;
+
+    MeshVertex vertex;
+    vertex.ambient_occlusion = ambientOcclusion(
+        vertex_position,
+        vertex_position * float(block_size) + vec3(block_index * BLOCK_SIZE));
+    vertex.position = vertex_position / float(BLOCK_SIZE);
+    vertex.normal = normalAtVertex(vertex_position);
+
+    edge_vertices[key] = vertices.size();
+    vertices.push_back(vertex);
+    return edge_vertices[key];
+}
+
+void TerrainMesher::reorderVertices()
+{
+    // Store vertices in the order the triangles first use them so that
+    // vertex fetches after the cache reordering walk through memory linearly.
+    vector<GLint> remap(vertices.size(), -1);
+    vector<MeshVertex> reordered;
+    reordered.reserve(vertices.size());
+    for (GLuint& index : indices) {
+        if (remap[index] < 0) {
+            remap[index] = reordered.size();
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    assert(reordered.size() == vertices.size());
+    vertices.swap(reordered);
+}
+
+void TerrainMesher::computeClusterBounds(MeshCluster& cluster)
+{
+    GLuint end = cluster.first_index + cluster.index_count;
+
+    vec3 min_corner = vec3(1.0f);
+    vec3 max_corner = vec3(0.0f);
+    for (GLuint i = cluster.first_index; i < end; i++) {
+        min_corner = min(min_corner, vertices[indices[i]].position);
+        max_corner = max(max_corner, vertices[indices[i]].position);
+    }
+    cluster.center = (min_corner + max_corner) * 0.5f;
+    cluster.radius = 0.0f;
+    for (GLuint i = cluster.first_index; i < end; i++) {
+        cluster.radius = std::max(cluster.radius,
+                                  distance(cluster.center, vertices[indices[i]].position));
+    }
+
+    // Rather than rely on the winding of the marching cubes tables, orient
+    // the face normals with the vertex normals, which point to the air.
+    vector<vec3> face_normals;
+    vec3 normal_sum = vec3(0.0f);
+    for (GLuint i = cluster.first_index; i < end; i += 3) {
+        const MeshVertex& v0 = vertices[indices[i]];
+        const MeshVertex& v1 = vertices[indices[i + 1]];
+        const MeshVertex& v2 = vertices[indices[i + 2]];
+        vec3 normal = cross(v1.position - v0.position, v2.position - v0.position);
+        float area = length(normal);
+        if (area < 1e-12f) {
+            continue;
+        }
+        normal /= area;
+        if (dot(normal, v0.normal + v1.normal + v2.normal) < 0.0f) {
+            normal = -normal;
+        }
+        face_normals.push_back(normal);
+        normal_sum += normal;
+    }
+
+    cluster.cone_axis = vec3(0.0f, 1.0f, 0.0f);
+    cluster.cone_cutoff = 1.0f;
+    if (length(normal_sum) < 1e-6f) {
+        return;
+    }
+
+    vec3 axis = normalize(normal_sum);
+    float min_dot = 1.0f;
+    for (vec3& normal : face_normals) {
+        min_dot = std::min(min_dot, dot(axis, normal));
+    }
+    if (min_dot > 0.0f) {
+        cluster.cone_axis = axis;
+        cluster.cone_cutoff = sqrt(1.0f - min_dot * min_dot);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cs488-framework/OpenGLImport.hpp"
+
+#include "constants.hpp"
+#include "mesh_cluster.hpp"
+#include "terrain_density.hpp"
+
+// Same fields as the transform feedback varyings of the GPU generators,
+// position is already mapped to [0, 1].
+struct MeshVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    float ambient_occlusion;
+};
+
+// Marching cubes on the CPU, producing an indexed mesh.
+//
+// The Slow and Medium generators emit a triangle soup, so a vertex shared by
+// ~6 triangles gets placed, shaded and ambient occluded ~6 times. Here every
+// grid edge is owned by the cell at its start corner (edges 0, 3 and 8 of that
+// cell, like VoxelUniqueEdges.gs), so each vertex is created once and the
+// triangles refer to it by index.
+//
+// Triangles are grouped into clusters of nearby triangles (see MeshCluster),
+// each reordered for the vertex cache.
+class TerrainMesher {
+public:
+    TerrainMesher();
+
+    void generate(glm::ivec3 index, int size, const TerrainDensity& terrain_density,
+                  bool short_range_ambient, bool long_range_ambient,
+                  glm::vec4 ambient_occlusion_param);
+
+    std::vector<MeshVertex> vertices;
+    std::vector<GLuint> indices;
+    std::vector<MeshCluster> clusters;
+
+private:
+    float densityAtTexel(glm::ivec3 texel);
+    float density(glm::vec3 coord);
+    glm::vec3 normalAtVertex(glm::vec3 vertex);
+    float ambientOcclusion(glm::vec3 vertex, glm::vec3 world_position);
+    GLuint edgeVertex(glm::ivec3 corner, int axis);
+    // Reorders the triangles of a brick for the vertex cache.
+    void reorderBrick(std::vector<GLuint>& brick);
+    void reorderVertices();
+    void computeClusterBounds(MeshCluster& cluster);
+
+    // Parameters of the block being generated.
+    glm::ivec3 block_index;
+    int block_size;
+    const TerrainDensity* terrain_density;
+    bool short_range_ambient;
+    bool long_range_ambient;
+    glm::vec4 ambient_occlusion_param;
+
+    // Same layout as the density texture of the GPU generators. Values are
+    // only computed when sampled since ambient occlusion only needs the
+    // padding near the surface, a row along x at a time.
+    std::vector<float> density_grid;
+    std::vector<bool> density_computed;
+
+    // Index of the vertex on each (grid point, axis) edge, or -1.
+    std::vector<GLint> edge_vertices;
+
+    // Triangles of each brick of cells, before they are split into clusters.
+    std::vector<std::vector<GLuint>> brick_indices;
+    // Index of each vertex among those of the brick being reordered, or -1,
+    // and the vertices of that brick.
+    std::vector<GLint> local_vertices;
+    std::vector<GLuint> brick_vertices;
+};
@@ -1,19 +1,54 @@
 #include "terrain_renderer.hpp"
 #include "cs488-framework/GlErrorCheck.hpp"
 
+#include <assert.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+
 #include <glm/glm.hpp>
 
+#include "constants.hpp"
+
 using namespace glm;
 using namespace std;
 
+static const vector<const char*> texture_names = {
+    "Ancient Flooring",
+    "Boards",
+    "CherryBark",
+    "Chimeny",
+    "CliffRock",
+    "CliffRock2",
+    "Dirt",
+    "Grass",
+    "Grass2",
+    "GrassDry",
+    "GrassPurpleFlowers",
+    "GrassSparse",
+    "Gravel",
+    "GroundCover",
+    "Hay",
+    "LeafyGround",
+    "Mud",
+    "OakBark",
+    "PackedDirt",
+    "PineBarkYoung",
+    "PineNeedles",
+    "Roof1",
+    "Siding1",
+    "Siding2",
+    "Stone1",
+};
+
 TerrainRenderer::TerrainRenderer()
-: x_texture("Textures/Stone1.JPG", GL_TEXTURE1)
-, y_texture("Textures/Grass2.JPG", GL_TEXTURE2)
-, z_texture("Textures/Stone1.JPG", GL_TEXTURE3)
-, x_normal_map("Textures/Textures_N/Stone1_N.jpg", GL_TEXTURE4)
-, y_normal_map("Textures/Textures_N/Grass2_N.jpg", GL_TEXTURE5)
-, z_normal_map("Textures/Textures_N/Stone1_N.jpg", GL_TEXTURE6)
+: diffuse_textures(GL_TEXTURE1, Bc1, TEXTURE_LAYER_SIZE)
+, normal_maps(GL_TEXTURE2, Bc5, TEXTURE_LAYER_SIZE)
 {
+    top_texture = textureLayer("Grass2");
+    front_texture = textureLayer("Stone1");
+    side_texture = textureLayer("Stone1");
 }
 
 void TerrainRenderer::init(string dir)
@@ -23,6 +58,32 @@ void TerrainRenderer::init(string dir)
     renderer_shader.attachFragmentShader((dir + "FragmentShader.fs").c_str());
     renderer_shader.link();
 
+    vector<string> texture_paths;
+    vector<string> normal_map_paths;
+    for (const char* name : texture_names) {
+        texture_paths.push_back(string("Textures/") + name + ".JPG");
+        normal_map_paths.push_back(string("Textures/Textures_N/") + name + "_N.jpg");
+    }
+    diffuse_textures.init(texture_loader, texture_paths);
+    normal_maps.init(texture_loader, normal_map_paths);
+
+    // The textures in use first, then all the others so that switching
+    // textures is instant.
+    int initial_layers[] = { side_texture, top_texture, front_texture };
+    for (int layer : initial_layers) {
+        diffuse_textures.load(layer);
+        normal_maps.load(layer);
+    }
+    for (size_t layer = 0; layer < texture_names.size(); layer++) {
+        diffuse_textures.load(layer);
+        normal_maps.load(layer);
+    }
+
+    CHECK_GL_ERRORS;
+}
+
+void TerrainRenderer::finishInit()
+{
     // Set up the uniforms
     P_uni = renderer_shader.getUniformLocation( "P" );
     V_uni = renderer_shader.getUniformLocation( "V" );
@@ -32,6 +93,10 @@ void TerrainRenderer::init(string dir)
     water_clip_uni = renderer_shader.getUniformLocation("water_clip");
     water_reflection_clip_uni = renderer_shader.getUniformLocation("water_reflection_clip");
     clip_height_uni = renderer_shader.getUniformLocation("clip_height");
+    packed_vertices_uni = renderer_shader.getUniformLocation("packed_vertices");
+
+    diffuse_layers_uni = renderer_shader.getUniformLocation("diffuse_layers");
+    normal_layers_uni = renderer_shader.getUniformLocation("normal_layers");
 
     triplanar_colors_uni = renderer_shader.getUniformLocation("triplanar_colors");
     show_ambient_uni = renderer_shader.getUniformLocation("show_ambient_occlusion");
@@ -54,67 +119,58 @@ void TerrainRenderer::init(string dir)
 
     ambient_occlusion_attrib = renderer_shader.getAttribLocation("ambient_occlusion");
 
-    x_texture.init();
-    y_texture.init();
-    z_texture.init();
-    x_normal_map.init();
-    y_normal_map.init();
-    z_normal_map.init();
-
     CHECK_GL_ERRORS;
 }
 
+// Called with renderer_shader enabled.
 void TerrainRenderer::prepareRender()
 {
-    x_texture.rebind();
-    y_texture.rebind();
-    z_texture.rebind();
-    x_normal_map.rebind();
-    y_normal_map.rebind();
-    z_normal_map.rebind();
+    diffuse_textures.update();
+    normal_maps.update();
+
+    // Layers that aren't loaded yet can't be sampled, -1 tells the shader to
+    // use a placeholder instead.
+    ivec3 layers(side_texture, top_texture, front_texture);
+    ivec3 diffuse_layers, normal_layers;
+    for (int i = 0; i < 3; i++) {
+        diffuse_layers[i] = diffuse_textures.isLoaded(layers[i]) ? layers[i] : -1;
+        normal_layers[i] = normal_maps.isLoaded(layers[i]) ? layers[i] : -1;
+    }
+    glUniform3i(diffuse_layers_uni, diffuse_layers.x, diffuse_layers.y, diffuse_layers.z);
+    glUniform3i(normal_layers_uni, normal_layers.x, normal_layers.y, normal_layers.z);
+
+    diffuse_textures.bind();
+    normal_maps.bind();
 }
 
-void TerrainRenderer::changeTopTexture(const char* name)
+int TerrainRenderer::texturesLoading()
 {
-    string path = "Textures/";
-    path += name;
-    path += ".JPG";
-
-    y_texture.reload(path);
-
-    string normal_path = "Textures/Textures_N/";
-    normal_path += name;
-    normal_path += "_N.jpg";
-
-    y_normal_map.reload(normal_path);
+    return diffuse_textures.layersLoading() + normal_maps.layersLoading();
 }
 
-void TerrainRenderer::changeFrontTexture(const char* name)
+void TerrainRenderer::finishLoadingTextures()
 {
-    string path = "Textures/";
-    path += name;
-    path += ".JPG";
-
-    z_texture.reload(path);
-
-    string normal_path = "Textures/Textures_N/";
-    normal_path += name;
-    normal_path += "_N.jpg";
-
-    z_normal_map.reload(normal_path);
+    while (texturesLoading() > 0) {
+        diffuse_textures.update();
+        normal_maps.update();
+        // The upload fences only signal once the commands are submitted.
+        glFlush();
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
 }
 
-void TerrainRenderer::changeSideTexture(const char* name)
+const vector<const char*>& TerrainRenderer::textureNames()
 {
-    string path = "Textures/";
-    path += name;
-    path += ".JPG";
-
-    x_texture.reload(path);
-
-    string normal_path = "Textures/Textures_N/";
-    normal_path += name;
-    normal_path += "_N.jpg";
+    return texture_names;
+}
 
-    x_normal_map.reload(normal_path);
+int TerrainRenderer::textureLayer(const char* name)
+{
+    for (size_t layer = 0; layer < texture_names.size(); layer++) {
+        if (strcmp(texture_names[layer], name) == 0) {
+            return layer;
+        }
+    }
+    assert(false);
+    return 0;
 }
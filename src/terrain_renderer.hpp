@@ -1,20 +1,33 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "cs488-framework/ShaderProgram.hpp"
-#include "texture.hpp"
+#include "texture_array.hpp"
 
 class TerrainRenderer {
 public:
     TerrainRenderer();
 
+    // Submits the shaders, finishInit looks up what they need once linked.
     void init(std::string dir);
+    void finishInit();
     void prepareRender();
 
-    void changeTopTexture(const char* name);
-    void changeFrontTexture(const char* name);
-    void changeSideTexture(const char* name);
+    // Number of textures still being decoded or uploaded.
+    int texturesLoading();
+
+    // Block until every texture is loaded.
+    void finishLoadingTextures();
+
+    // Names of the textures in the arrays, in layer order.
+    const std::vector<const char*>& textureNames();
+
+    // Texture layer used for each direction of triplanar texturing.
+    int top_texture;
+    int front_texture;
+    int side_texture;
 
     ShaderProgram renderer_shader;
 
@@ -26,6 +39,10 @@ public:
     GLint water_clip_uni;
     GLint water_reflection_clip_uni;
     GLint clip_height_uni;
+    GLint packed_vertices_uni;
+
+    GLint diffuse_layers_uni;
+    GLint normal_layers_uni;
 
     GLint triplanar_colors_uni;
     GLint show_ambient_uni;
@@ -48,10 +65,10 @@ public:
     GLint ambient_occlusion_attrib;
 
 private:
-    Texture x_texture;
-    Texture y_texture;
-    Texture z_texture;
-    Texture x_normal_map;
-    Texture y_normal_map;
-    Texture z_normal_map;
+    int textureLayer(const char* name);
+
+    TextureLoader texture_loader;
+
+    TextureArray diffuse_textures;
+    TextureArray normal_maps;
 };
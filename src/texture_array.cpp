@@ -0,0 +1,189 @@
+#include "texture_array.hpp"
+
+#include <iostream>
+#include <string.h>
+
+#include "constants.hpp"
+#include "cs488-framework/GlErrorCheck.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+TextureArray::TextureArray(GLenum binding, TextureContainerFormat format, int layer_size)
+: texture(0)
+, binding(binding)
+, format(format)
+, layer_size(layer_size)
+, level_count(0)
+, loader(nullptr)
+{
+    // Full mip chain, down to 1x1.
+    for (int size = layer_size; size > 0; size /= 2) {
+        level_count++;
+    }
+}
+
+TextureArray::~TextureArray()
+{
+    for (shared_ptr<TextureDecode>& decode : decodes) {
+        if (decode) {
+            decode->cancelled = true;
+        }
+    }
+
+    for (Upload& upload : uploads) {
+        glDeleteSync(upload.fence);
+        glDeleteBuffers(1, &upload.pixel_buffer);
+    }
+
+    glDeleteTextures(1, &texture);
+}
+
+void TextureArray::init(TextureLoader& loader, const vector<string>& paths)
+{
+    this->loader = &loader;
+    this->paths = paths;
+    decodes.resize(paths.size());
+    loaded.resize(paths.size(), false);
+
+    glGenTextures(1, &texture);
+    glActiveTexture(binding);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    {
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, level_count, TextureContainer::internalFormat(format),
+                       layer_size, layer_size, paths.size());
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        // TODO: Compare GL_NEAREST_MIPMAP_LINEAR
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    CHECK_GL_ERRORS;
+}
+
+void TextureArray::load(int layer)
+{
+    if (loaded[layer] || decodes[layer]) {
+        return;
+    }
+    for (const Upload& upload : uploads) {
+        if (upload.layer == layer) {
+            return;
+        }
+    }
+
+    decodes[layer] = loader->decode(paths[layer], format, layer_size);
+}
+
+void TextureArray::update()
+{
+    TRACE_ZONE("TextureArray::update");
+
+    for (size_t i = 0; i < uploads.size(); ) {
+        GLenum status = glClientWaitSync(uploads[i].fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            loaded[uploads[i].layer] = true;
+            glDeleteSync(uploads[i].fence);
+            glDeleteBuffers(1, &uploads[i].pixel_buffer);
+            uploads.erase(uploads.begin() + i);
+        } else {
+            i++;
+        }
+    }
+
+    // Copying a layer to a pixel buffer takes a moment, so only a few are
+    // started per frame.
+    int started = 0;
+    for (size_t layer = 0; layer < decodes.size() && started < TEXTURE_UPLOADS_PER_FRAME; layer++) {
+        if (decodes[layer] && decodes[layer]->done) {
+            startUpload(layer);
+            started++;
+        }
+    }
+}
+
+void TextureArray::startUpload(int layer)
+{
+    TraceZone zone("Upload texture");
+    zone.setDetail("layer %d", layer);
+
+    shared_ptr<TextureDecode> decoded = decodes[layer];
+    decodes[layer].reset();
+
+    if ((int)decoded->levels.size() != level_count) {
+        cerr << "Failed to load texture: " << decoded->path << endl;
+        return;
+    }
+
+    // Every level goes into the same pixel buffer, one after the other.
+    vector<GLsizeiptr> offsets;
+    GLsizeiptr size = 0;
+    for (const TextureContainerLevel& level : decoded->levels) {
+        offsets.push_back(size);
+        size += level.size;
+    }
+
+    Upload upload;
+    upload.layer = layer;
+
+    glGenBuffers(1, &upload.pixel_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.pixel_buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    unsigned char* mapped = (unsigned char*)glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    for (int i = 0; i < level_count; i++) {
+        memcpy(mapped + offsets[i], decoded->levelData(i), decoded->levels[i].size);
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glActiveTexture(binding);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    {
+        // Rows of RGB pixels are only 4-byte aligned for some widths.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int i = 0; i < level_count; i++) {
+            const TextureContainerLevel& level = decoded->levels[i];
+            if (format == Rgb8) {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1,
+                                GL_RGB, GL_UNSIGNED_BYTE, (const void*)offsets[i]);
+            } else {
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer,
+                                          level.width, level.height, 1,
+                                          TextureContainer::internalFormat(format), level.size,
+                                          (const void*)offsets[i]);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    uploads.push_back(upload);
+
+    CHECK_GL_ERRORS;
+}
+
+void TextureArray::bind()
+{
+    glActiveTexture(binding);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+}
+
+bool TextureArray::isLoaded(int layer)
+{
+    return loaded[layer];
+}
+
+int TextureArray::layersLoading()
+{
+    int count = uploads.size();
+    for (const shared_ptr<TextureDecode>& decode : decodes) {
+        if (decode) {
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cs488-framework/OpenGLImport.hpp"
+#include "texture_container.hpp"
+#include "texture_loader.hpp"
+
+// A 2D texture array with one image per layer, all of the same size and
+// format, so that a shader can pick between them with a uniform instead of
+// binding other textures.
+//
+// Layers are loaded in the background. A layer can't be sampled until
+// isLoaded returns true for it, shaders are expected to use a placeholder
+// color until then.
+class TextureArray
+{
+public:
+    TextureArray(GLenum binding, TextureContainerFormat format, int layer_size);
+    ~TextureArray();
+
+    // Allocate a layer for each path. Nothing is loaded yet, see load.
+    void init(TextureLoader& loader, const std::vector<std::string>& paths);
+
+    // Start loading the layer, if it isn't loaded or loading already. Layers
+    // load in the order they are requested.
+    void load(int layer);
+
+    // Upload the layers that finished decoding, without waiting on either the
+    // decoder or the GPU. Called every frame.
+    void update();
+
+    void bind();
+
+    bool isLoaded(int layer);
+    int layersLoading();
+
+private:
+    void startUpload(int layer);
+
+    // Upload of a layer from a pixel buffer, done once fence is signaled.
+    struct Upload {
+        int layer;
+        GLuint pixel_buffer;
+        GLsync fence;
+    };
+
+    GLuint texture;
+    GLenum binding;
+    TextureContainerFormat format;
+    int layer_size;
+    int level_count;
+
+    TextureLoader* loader;
+    std::vector<std::string> paths;
+    std::vector<std::shared_ptr<TextureDecode>> decodes;
+    std::vector<Upload> uploads;
+    std::vector<bool> loaded;
+};
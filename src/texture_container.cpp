@@ -0,0 +1,288 @@
+#include "texture_container.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "bc_encoder.hpp"
+
+using namespace glm;
+using namespace std;
+
+static const char container_magic[4] = { 'C', 'T', 'E', 'X' };
+#define TEXTURE_CONTAINER_VERSION 1
+
+string textureContainerPath(const string& image_path)
+{
+    size_t dot = image_path.find_last_of('.');
+    size_t slash = image_path.find_last_of('/');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        return image_path + TEXTURE_CONTAINER_EXTENSION;
+    }
+    return image_path.substr(0, dot) + TEXTURE_CONTAINER_EXTENSION;
+}
+
+static vec3 readPixel(const vector<unsigned char>& rgb, int width, int height, int x, int y)
+{
+    x = ((x % width) + width) % width;
+    y = ((y % height) + height) % height;
+    const unsigned char* pixel = &rgb[(y * width + x) * 3];
+    return vec3(pixel[0], pixel[1], pixel[2]);
+}
+
+static void writePixel(vector<unsigned char>& rgb, int width, int x, int y, vec3 color,
+                       bool normal_map)
+{
+    if (normal_map) {
+        vec3 normal = color / 127.5f - 1.0f;
+        if (length(normal) > 1e-6f) {
+            color = (normalize(normal) + 1.0f) * 127.5f;
+        }
+    }
+
+    color = clamp(color + 0.5f, vec3(0.0f), vec3(255.0f));
+    unsigned char* out = &rgb[(y * width + x) * 3];
+    out[0] = (unsigned char)color.r;
+    out[1] = (unsigned char)color.g;
+    out[2] = (unsigned char)color.b;
+}
+
+// Bilinear resize, for the few images that aren't already the layer size.
+static vector<unsigned char> resize(const vector<unsigned char>& rgb, int width, int height,
+                                    int new_width, int new_height, bool normal_map)
+{
+    vector<unsigned char> result(new_width * new_height * 3);
+
+    for (int y = 0; y < new_height; y++) {
+        float source_y = (y + 0.5f) * height / new_height - 0.5f;
+        int y0 = (int)floor(source_y);
+        float ty = source_y - y0;
+        for (int x = 0; x < new_width; x++) {
+            float source_x = (x + 0.5f) * width / new_width - 0.5f;
+            int x0 = (int)floor(source_x);
+            float tx = source_x - x0;
+
+            vec3 color = mix(mix(readPixel(rgb, width, height, x0, y0),
+                                 readPixel(rgb, width, height, x0 + 1, y0), tx),
+                             mix(readPixel(rgb, width, height, x0, y0 + 1),
+                                 readPixel(rgb, width, height, x0 + 1, y0 + 1), tx), ty);
+            writePixel(result, new_width, x, y, color, normal_map);
+        }
+    }
+
+    return result;
+}
+
+// Box filter the image down to the next level. Odd sizes are handled by letting
+// every destination pixel average all the source pixels it covers.
+static vector<unsigned char> downsample(const vector<unsigned char>& rgb, int width, int height,
+                                        int new_width, int new_height, bool normal_map)
+{
+    vector<unsigned char> result(new_width * new_height * 3);
+
+    for (int y = 0; y < new_height; y++) {
+        int y0 = y * height / new_height;
+        int y1 = std::max(y0 + 1, (y + 1) * height / new_height);
+        for (int x = 0; x < new_width; x++) {
+            int x0 = x * width / new_width;
+            int x1 = std::max(x0 + 1, (x + 1) * width / new_width);
+
+            vec3 sum(0.0f);
+            for (int source_y = y0; source_y < y1; source_y++) {
+                for (int source_x = x0; source_x < x1; source_x++) {
+                    sum += readPixel(rgb, width, height, source_x, source_y);
+                }
+            }
+            writePixel(result, new_width, x, y, sum / float((x1 - x0) * (y1 - y0)), normal_map);
+        }
+    }
+
+    return result;
+}
+
+void buildTextureLevels(const unsigned char* image, int width, int height, int size,
+                        TextureContainerFormat format,
+                        vector<TextureContainerLevel>& levels,
+                        vector<vector<unsigned char>>& level_data)
+{
+    bool normal_map = format == Bc5;
+
+    vector<unsigned char> rgb(image, image + width * height * 3);
+    if (width != size || height != size) {
+        rgb = resize(rgb, width, height, size, size, normal_map);
+        width = size;
+        height = size;
+    }
+
+    levels.clear();
+    level_data.clear();
+    while (true) {
+        TextureContainerLevel level;
+        level.width = width;
+        level.height = height;
+        level.offset = 0;
+        level.size = 0;
+        levels.push_back(level);
+
+        switch (format) {
+            case Bc1:
+                level_data.push_back(compressBc1(rgb.data(), width, height));
+                break;
+            case Bc5:
+                level_data.push_back(compressBc5(rgb.data(), width, height));
+                break;
+            case Rgb8:
+            default:
+                level_data.push_back(rgb);
+                break;
+        }
+        levels.back().size = level_data.back().size();
+
+        if (width == 1 && height == 1) {
+            break;
+        }
+
+        int new_width = std::max(1, width / 2);
+        int new_height = std::max(1, height / 2);
+        rgb = downsample(rgb, width, height, new_width, new_height, normal_map);
+        width = new_width;
+        height = new_height;
+    }
+}
+
+bool writeTextureContainer(const string& path, TextureContainerFormat format,
+                           const vector<TextureContainerLevel>& levels,
+                           const vector<vector<unsigned char>>& level_data)
+{
+    TextureContainerHeader header;
+    memcpy(header.magic, container_magic, sizeof(header.magic));
+    header.version = TEXTURE_CONTAINER_VERSION;
+    header.format = format;
+    header.level_count = levels.size();
+
+    vector<TextureContainerLevel> placed_levels = levels;
+    uint64_t offset = sizeof(header) + levels.size() * sizeof(TextureContainerLevel);
+    for (size_t i = 0; i < placed_levels.size(); i++) {
+        placed_levels[i].offset = offset;
+        placed_levels[i].size = level_data[i].size();
+        offset += level_data[i].size();
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(placed_levels.data(), sizeof(TextureContainerLevel), placed_levels.size(), file) ==
+            placed_levels.size();
+    for (size_t i = 0; success && i < level_data.size(); i++) {
+        success = fwrite(level_data[i].data(), 1, level_data[i].size(), file) == level_data[i].size();
+    }
+
+    return fclose(file) == 0 && success;
+}
+
+TextureContainer::TextureContainer()
+: format(Rgb8)
+, data(nullptr)
+, size(0)
+{
+}
+
+TextureContainer::~TextureContainer()
+{
+    close();
+}
+
+bool TextureContainer::open(const string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(TextureContainerHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after closing the file.
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    data = (const unsigned char*)mapped;
+    size = file_stat.st_size;
+
+    TextureContainerHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t levels_end = sizeof(header) + header.level_count * sizeof(TextureContainerLevel);
+    if (memcmp(header.magic, container_magic, sizeof(header.magic)) != 0 ||
+        header.version != TEXTURE_CONTAINER_VERSION ||
+        header.format > Bc5 || header.level_count == 0 || levels_end > size) {
+        close();
+        return false;
+    }
+
+    format = (TextureContainerFormat)header.format;
+    levels.resize(header.level_count);
+    memcpy(levels.data(), data + sizeof(header), levels.size() * sizeof(TextureContainerLevel));
+
+    for (const TextureContainerLevel& level : levels) {
+        if (level.offset > size || level.size > size - level.offset) {
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void TextureContainer::close()
+{
+    if (data) {
+        munmap((void*)data, size);
+    }
+    data = nullptr;
+    size = 0;
+    levels.clear();
+}
+
+void TextureContainer::prefetch()
+{
+    volatile unsigned char sum = 0;
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += page_size) {
+        sum += data[i];
+    }
+}
+
+GLenum TextureContainer::internalFormat(TextureContainerFormat format)
+{
+    switch (format) {
+        case Bc1:
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case Bc5:
+            return GL_COMPRESSED_RG_RGTC2;
+        case Rgb8:
+        default:
+            return GL_RGB8;
+    }
+}
+
+const unsigned char* TextureContainer::levelData(int level) const
+{
+    return data + levels[level].offset;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "cs488-framework/OpenGLImport.hpp"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+// Texture file with its whole mip chain already built (and compressed), so
+// that loading it is only a matter of mapping the file and handing each level
+// to OpenGL. Written offline by texture_converter, next to the image it was
+// made from, with the extension replaced by TEXTURE_CONTAINER_EXTENSION.
+//
+// Layout: a TextureContainerHeader, level_count TextureContainerLevel, then
+// the data of every level, in that order. Pixels are stored top row first,
+// like SOIL loads them.
+
+#define TEXTURE_CONTAINER_EXTENSION ".ctex"
+
+enum TextureContainerFormat {
+    Rgb8 = 0,   // Uncompressed
+    Bc1 = 1,    // DXT1, for diffuse textures
+    Bc5 = 2,    // RGTC2, for normal maps, only x and y are stored
+};
+
+struct TextureContainerHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t level_count;
+};
+
+struct TextureContainerLevel {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Returns where the container made from the image at image_path goes.
+std::string textureContainerPath(const std::string& image_path);
+
+// Resize an RGB image to size x size, then build its mip chain with every level
+// in the given format. Sampling wraps around since textures are tiled. Normal
+// maps (Bc5) are renormalized after filtering.
+void buildTextureLevels(const unsigned char* rgb, int width, int height, int size,
+                        TextureContainerFormat format,
+                        std::vector<TextureContainerLevel>& levels,
+                        std::vector<std::vector<unsigned char>>& level_data);
+
+bool writeTextureContainer(const std::string& path, TextureContainerFormat format,
+                           const std::vector<TextureContainerLevel>& levels,
+                           const std::vector<std::vector<unsigned char>>& level_data);
+
+// A texture container mapped in memory.
+class TextureContainer {
+public:
+    TextureContainer();
+    ~TextureContainer();
+
+    // Returns false if the file doesn't exist or isn't a valid container.
+    bool open(const std::string& path);
+
+    // Touch every page so that reading the levels later doesn't block on disk.
+    void prefetch();
+
+    static GLenum internalFormat(TextureContainerFormat format);
+
+    const unsigned char* levelData(int level) const;
+
+    TextureContainerFormat format;
+    std::vector<TextureContainerLevel> levels;
+
+private:
+    void close();
+
+    const unsigned char* data;
+    size_t size;
+};
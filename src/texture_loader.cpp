@@ -0,0 +1,110 @@
+#include "texture_loader.hpp"
+
+#include <algorithm>
+
+#include "soil/soil.h"
+#include "trace.hpp"
+
+using namespace std;
+
+// Decoding and compressing an image is entirely CPU-bound, a few workers are
+// enough to load all the terrain textures at once.
+#define MAX_TEXTURE_WORKERS 4
+
+TextureDecode::TextureDecode(string path, TextureContainerFormat format, int size)
+: path(path)
+, format(format)
+, size(size)
+, done(false)
+, cancelled(false)
+{
+}
+
+const unsigned char* TextureDecode::levelData(int level) const
+{
+    return container ? container->levelData(level) : level_data[level].data();
+}
+
+TextureLoader::TextureLoader()
+: stopping(false)
+{
+    int thread_count = std::max(1, std::min((int)thread::hardware_concurrency(),
+                                            MAX_TEXTURE_WORKERS));
+    for (int i = 0; i < thread_count; i++) {
+        workers.push_back(thread(&TextureLoader::workerLoop, this, i));
+    }
+}
+
+TextureLoader::~TextureLoader()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (thread& worker : workers) {
+        worker.join();
+    }
+}
+
+shared_ptr<TextureDecode> TextureLoader::decode(string path, TextureContainerFormat format,
+                                                int size)
+{
+    shared_ptr<TextureDecode> job = make_shared<TextureDecode>(path, format, size);
+    {
+        lock_guard<std::mutex> lock(mutex);
+        queue.push_back(job);
+    }
+    condition.notify_one();
+
+    return job;
+}
+
+void TextureLoader::workerLoop(int index)
+{
+    traceThreadName("Texture worker " + to_string(index));
+
+    while (true) {
+        shared_ptr<TextureDecode> job;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            job = queue.front();
+            queue.pop_front();
+        }
+
+        if (job->cancelled) {
+            job->done = true;
+            continue;
+        }
+
+        TraceZone zone("Load texture");
+        zone.setDetail("%s", job->path.substr(job->path.find_last_of('/') + 1).c_str());
+
+        unique_ptr<TextureContainer> container(new TextureContainer());
+        if (container->open(textureContainerPath(job->path)) &&
+            container->format == job->format &&
+            container->levels[0].width == (uint32_t)job->size &&
+            container->levels[0].height == (uint32_t)job->size) {
+            container->prefetch();
+            job->levels = container->levels;
+            job->container = std::move(container);
+        } else {
+            // Note: first pixel is loaded as top-left corner whereas OpenGL expects lower-left
+            // corner. This is not handled here so the shader code will need to be aware.
+            int width, height;
+            unsigned char* image = SOIL_load_image(job->path.c_str(), &width, &height,
+                                                   0, SOIL_LOAD_RGB);
+            if (image) {
+                buildTextureLevels(image, width, height, job->size, job->format,
+                                   job->levels, job->level_data);
+                SOIL_free_image_data(image);
+            }
+        }
+        job->done = true;
+    }
+}
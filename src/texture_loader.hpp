@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "texture_container.hpp"
+
+// An image being loaded by a TextureLoader, as a mip chain of size x size
+// levels in the requested format. Once done is set, the worker doesn't touch it
+// anymore and the result can be read without locking.
+//
+// If a matching texture container was made from the image, it is mapped in
+// container and there is nothing to decode. Otherwise the image is decoded,
+// resized and compressed into level_data. levels is empty if the image
+// couldn't be loaded.
+struct TextureDecode {
+    TextureDecode(std::string path, TextureContainerFormat format, int size);
+
+    const unsigned char* levelData(int level) const;
+
+    std::string path;
+    TextureContainerFormat format;
+    int size;
+
+    std::unique_ptr<TextureContainer> container;
+    std::vector<TextureContainerLevel> levels;
+    std::vector<std::vector<unsigned char>> level_data;
+
+    std::atomic<bool> done;
+
+    // Set when the result isn't needed anymore, so that a decode that hasn't
+    // started yet is skipped.
+    std::atomic<bool> cancelled;
+};
+
+// Decodes image files on a pool of worker threads, so that loading textures
+// doesn't stall the frame. Uploading to OpenGL is left to the caller since
+// it has to happen on the thread that owns the context, see TextureArray.
+class TextureLoader {
+public:
+    TextureLoader();
+    ~TextureLoader();
+
+    std::shared_ptr<TextureDecode> decode(std::string path, TextureContainerFormat format,
+                                          int size);
+
+private:
+    void workerLoop(int index);
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::shared_ptr<TextureDecode>> queue;
+    bool stopping;
+};
@@ -0,0 +1,130 @@
+// Offline converter from the JPG/PNG textures to texture containers with a
+// precomputed (and compressed) mip chain, see texture_container.hpp.
+//
+// Usage:
+//   texture_converter <image> [bc1|bc5|rgb8]
+//   texture_converter -all <Textures directory>
+//
+// The container is written next to the image. Images are resized to
+// TEXTURE_LAYER_SIZE, the size of the terrain's texture array layers. With
+// -all, every image in the directory is converted to BC1 and every image in
+// its Textures_N subdirectory (normal maps) to BC5.
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "constants.hpp"
+#include "soil/soil.h"
+#include "texture_container.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+static bool convert(const string& image_path, TextureContainerFormat format)
+{
+    Timer timer;
+    timer.start();
+
+    int width, height;
+    unsigned char* image = SOIL_load_image(image_path.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
+    if (!image) {
+        fprintf(stderr, "Could not load %s: %s\n", image_path.c_str(), SOIL_last_result());
+        return false;
+    }
+
+    vector<TextureContainerLevel> levels;
+    vector<vector<unsigned char>> level_data;
+    buildTextureLevels(image, width, height, TEXTURE_LAYER_SIZE, format, levels, level_data);
+    SOIL_free_image_data(image);
+
+    string container_path = textureContainerPath(image_path);
+    if (!writeTextureContainer(container_path, format, levels, level_data)) {
+        fprintf(stderr, "Could not write %s\n", container_path.c_str());
+        return false;
+    }
+
+    size_t total_size = 0;
+    for (const vector<unsigned char>& data : level_data) {
+        total_size += data.size();
+    }
+
+    timer.stop();
+    printf("%s: %dx%d, %d levels, %.1f KB, %.2f seconds\n", container_path.c_str(),
+           levels[0].width, levels[0].height, (int)levels.size(), total_size / 1024.0,
+           timer.elapsedSeconds());
+
+    return true;
+}
+
+static bool isImage(const string& name)
+{
+    size_t dot = name.find_last_of('.');
+    if (dot == string::npos) {
+        return false;
+    }
+
+    string extension = name.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == "jpg" || extension == "png";
+}
+
+static bool convertDirectory(const string& directory, TextureContainerFormat format)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        fprintf(stderr, "Could not open directory %s\n", directory.c_str());
+        return false;
+    }
+
+    vector<string> names;
+    while (dirent* entry = readdir(dir)) {
+        if (isImage(entry->d_name)) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    std::sort(names.begin(), names.end());
+
+    bool success = true;
+    for (const string& name : names) {
+        success = convert(directory + "/" + name, format) && success;
+    }
+    return success;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 3 && strcmp(argv[1], "-all") == 0) {
+        string directory = argv[2];
+        bool success = convertDirectory(directory, Bc1);
+        success = convertDirectory(directory + "/Textures_N", Bc5) && success;
+        return success ? 0 : 1;
+    }
+
+    if (argc == 2 || argc == 3) {
+        TextureContainerFormat format = Bc1;
+        if (argc == 3) {
+            if (strcmp(argv[2], "bc1") == 0) {
+                format = Bc1;
+            } else if (strcmp(argv[2], "bc5") == 0) {
+                format = Bc5;
+            } else if (strcmp(argv[2], "rgb8") == 0) {
+                format = Rgb8;
+            } else {
+                fprintf(stderr, "Unknown format %s\n", argv[2]);
+                return 1;
+            }
+        }
+        return convert(argv[1], format) ? 0 : 1;
+    }
+
+    fprintf(stderr, "Usage: %s <image> [bc1|bc5|rgb8]\n"
+                    "       %s -all <Textures directory>\n", argv[0], argv[0]);
+    return 1;
+}
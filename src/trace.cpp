@@ -0,0 +1,196 @@
+#include "trace.hpp"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "constants.hpp"
+
+using namespace std;
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    char detail[TRACE_DETAIL_LENGTH];
+};
+
+// Written only by its thread. write_index counts every event ever recorded,
+// the last TRACE_BUFFER_EVENTS of them are kept.
+struct TraceBuffer {
+    TraceBuffer(int thread_id)
+    : thread_id(thread_id)
+    , events(TRACE_BUFFER_EVENTS)
+    , write_index(0)
+    {
+    }
+
+    int thread_id;
+    string thread_name;
+    vector<TraceEvent> events;
+    atomic<uint64_t> write_index;
+};
+
+// Buffers are kept after their thread exits so that its events can still be
+// written. Locked only when a thread records its first event, when naming a
+// thread and when writing the trace.
+static mutex buffers_mutex;
+static vector<unique_ptr<TraceBuffer>> buffers;
+
+static TraceBuffer* threadBuffer()
+{
+    static thread_local TraceBuffer* buffer = nullptr;
+    if (!buffer) {
+        lock_guard<mutex> lock(buffers_mutex);
+        buffers.emplace_back(new TraceBuffer(buffers.size() + 1));
+        buffer = buffers.back().get();
+    }
+    return buffer;
+}
+
+uint64_t traceClock()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Timer::start()
+{
+    start_time = traceClock();
+}
+
+void Timer::stop()
+{
+    end_time = traceClock();
+}
+
+double Timer::elapsedSeconds()
+{
+    return (end_time - start_time) / 1e9;
+}
+
+TraceZone::TraceZone(const char* name)
+: name(name)
+, start(traceClock())
+{
+    detail[0] = '\0';
+}
+
+TraceZone::~TraceZone()
+{
+    TraceBuffer* buffer = threadBuffer();
+    uint64_t index = buffer->write_index.load(memory_order_relaxed);
+
+    TraceEvent& event = buffer->events[index % TRACE_BUFFER_EVENTS];
+    event.name = name;
+    event.start = start;
+    event.end = traceClock();
+    memcpy(event.detail, detail, sizeof(detail));
+
+    buffer->write_index.store(index + 1, memory_order_release);
+}
+
+void TraceZone::setDetail(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(detail, sizeof(detail), format, args);
+    va_end(args);
+}
+
+void traceThreadName(const string& name)
+{
+    TraceBuffer* buffer = threadBuffer();
+    lock_guard<mutex> lock(buffers_mutex);
+    buffer->thread_name = name;
+}
+
+// Copy the events of a buffer while its thread may still be recording.
+static vector<TraceEvent> copyEvents(TraceBuffer& buffer)
+{
+    uint64_t end = buffer.write_index.load(memory_order_acquire);
+    uint64_t begin = end > TRACE_BUFFER_EVENTS ? end - TRACE_BUFFER_EVENTS : 0;
+
+    vector<TraceEvent> events;
+    for (uint64_t i = begin; i < end; i++) {
+        events.push_back(buffer.events[i % TRACE_BUFFER_EVENTS]);
+    }
+
+    // The thread may have wrapped around and overwritten the oldest events
+    // while they were copied. It writes event `later` before publishing it,
+    // which overwrites event later - TRACE_BUFFER_EVENTS, so drop all of those.
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t later = buffer.write_index.load(memory_order_relaxed);
+    if (later >= begin + TRACE_BUFFER_EVENTS) {
+        uint64_t overwritten = later - begin - TRACE_BUFFER_EVENTS + 1;
+        events.erase(events.begin(),
+                     events.begin() + std::min((uint64_t)events.size(), overwritten));
+    }
+
+    return events;
+}
+
+static void writeJsonString(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+bool writeTrace(const string& path, double seconds)
+{
+    uint64_t cutoff = traceClock() - (uint64_t)(seconds * 1e9);
+
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    lock_guard<mutex> lock(buffers_mutex);
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (auto& buffer : buffers) {
+        string thread_name = buffer->thread_name.empty() ?
+            "Thread " + to_string(buffer->thread_id) : buffer->thread_name;
+        fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,"
+                      "\"args\":{\"name\":", first ? "" : ",\n", buffer->thread_id);
+        writeJsonString(file, thread_name.c_str());
+        fprintf(file, "}}");
+        first = false;
+
+        for (const TraceEvent& event : copyEvents(*buffer)) {
+            if (event.end < cutoff) {
+                continue;
+            }
+            // Complete events, timestamps in microseconds.
+            fprintf(file, ",\n{\"ph\":\"X\",\"name\":");
+            writeJsonString(file, event.name);
+            fprintf(file, ",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    buffer->thread_id, event.start / 1000.0, (event.end - event.start) / 1000.0);
+            if (event.detail[0] != '\0') {
+                fprintf(file, ",\"args\":{\"detail\":");
+                writeJsonString(file, event.detail);
+                fprintf(file, "}");
+            }
+            fprintf(file, "}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+// Lightweight frame-time tracing. A TraceZone records how long the scope it is
+// declared in took, into a ring buffer owned by the current thread, so that
+// recording never takes a lock. writeTrace dumps the last few seconds of every
+// thread as Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open.
+//
+// Zones measure CPU time only. OpenGL calls return before the GPU executes
+// them, so a zone around them shows how long submitting the work took.
+//
+//     void BlockManager::update(...)
+//     {
+//         TRACE_ZONE("BlockManager::update");
+//         ...
+//     }
+
+// Monotonic time in nanoseconds, the clock of all the zones.
+uint64_t traceClock();
+
+// Measures a single duration on the trace clock, for results that are printed
+// rather than traced.
+class Timer {
+public:
+    void start();
+    void stop();
+    double elapsedSeconds();
+
+private:
+    uint64_t start_time;
+    uint64_t end_time;
+};
+
+#define TRACE_DETAIL_LENGTH 40
+
+class TraceZone {
+public:
+    // name must outlive the trace, use a string literal.
+    explicit TraceZone(const char* name);
+    ~TraceZone();
+
+    // Extra information shown with the zone, such as which block it generated.
+    // Truncated to TRACE_DETAIL_LENGTH - 1 characters.
+    void setDetail(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+    const char* name;
+    uint64_t start;
+    char detail[TRACE_DETAIL_LENGTH];
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+
+// Name the current thread in the trace.
+void traceThreadName(const std::string& name);
+
+// Write the zones that ended in the last seconds seconds to path. Returns false
+// if the file couldn't be written.
+bool writeTrace(const std::string& path, double seconds);
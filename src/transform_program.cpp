@@ -13,16 +13,15 @@ using namespace std;
 TransformProgram::TransformProgram(const GLchar** varyings, int count)
 : varyings(varyings), count(count)
 {
+    // The varyings are baked into the linked program, so a cached binary
+    // is only valid for the same ones.
+    for (int i = 0; i < count; i++) {
+        linkOptions += varyings[i];
+        linkOptions += '\n';
+    }
 }
 
-void TransformProgram::link()
+void TransformProgram::prepareLink()
 {
-    attachShaders();
-
     glTransformFeedbackVaryings(programObject, count, varyings, GL_INTERLEAVED_ATTRIBS);
-
-    glLinkProgram(programObject);
-    checkLinkStatus();
-
-    CHECK_GL_ERRORS;
 }
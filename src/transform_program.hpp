@@ -11,7 +11,8 @@ public:
     TransformProgram(const GLchar** varyings, int count);
     virtual ~TransformProgram() {}
 
-    virtual void link();
+protected:
+    virtual void prepareLink();
 
 private:
     const GLchar** varyings;
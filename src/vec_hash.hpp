@@ -11,6 +11,12 @@ struct KeyHash {
         long y = v.y;
         return std::hash<long>()(x + (y << 8));
     }
+    std::size_t operator()(const glm::ivec3& v) const {
+        long x = v.x;
+        long y = v.y;
+        long z = v.z;
+        return std::hash<long>()(x + (y << 8) + (z << 16));
+    }
     std::size_t operator()(const glm::ivec4& v) const {
         long x = v.x;
         long y = v.y;
@@ -25,6 +31,10 @@ struct KeyEqual {
     {
         return lhs == rhs;
     }
+    bool operator()(const glm::ivec3& lhs, const glm::ivec3& rhs) const
+    {
+        return lhs == rhs;
+    }
     bool operator()(const glm::ivec4& lhs, const glm::ivec4& rhs) const
     {
         return lhs == rhs;
@@ -36,4 +46,6 @@ using ivec4_set = std::unordered_set<glm::ivec4, KeyHash, KeyEqual>;
 template <typename V>
 using ivec2_map = std::unordered_map<glm::ivec2, V, KeyHash, KeyEqual>;
 template <typename V>
+using ivec3_map = std::unordered_map<glm::ivec3, V, KeyHash, KeyEqual>;
+template <typename V>
 using ivec4_map = std::unordered_map<glm::ivec4, V, KeyHash, KeyEqual>;
@@ -0,0 +1,138 @@
+#include "vertex_cache.hpp"
+
+#include <assert.h>
+
+using namespace std;
+
+// Vertex adjacent to the last fan that will still be in the cache once its
+// remaining triangles are emitted, or -1 if there is none.
+static int nextVertex(const vector<int>& candidates, const vector<int>& live_triangles,
+                      const vector<int>& cache_time, int time, int cache_size)
+{
+    int best_vertex = -1;
+    int best_priority = -1;
+    for (int v : candidates) {
+        if (live_triangles[v] > 0) {
+            // Prefer the oldest vertex that will still be in the cache after
+            // fanning around it.
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live_triangles[v] <= cache_size) {
+                priority = time - cache_time[v];
+            }
+            if (priority > best_priority) {
+                best_priority = priority;
+                best_vertex = v;
+            }
+        }
+    }
+    return best_vertex;
+}
+
+// Called when the last fan has no usable neighbour, pick the most recently
+// used vertex that still has triangles, otherwise the next one in input order.
+static int skipDeadEnd(vector<int>& dead_end, const vector<int>& live_triangles,
+                       int& cursor, int vertex_count)
+{
+    while (!dead_end.empty()) {
+        int v = dead_end.back();
+        dead_end.pop_back();
+        if (live_triangles[v] > 0) {
+            return v;
+        }
+    }
+    while (cursor < vertex_count) {
+        if (live_triangles[cursor] > 0) {
+            return cursor;
+        }
+        cursor++;
+    }
+    return -1;
+}
+
+void tipsify(vector<GLuint>& indices, size_t vertex_count, int cache_size)
+{
+    assert(indices.size() % 3 == 0);
+    int triangle_count = indices.size() / 3;
+    if (triangle_count == 0) {
+        return;
+    }
+
+    // Vertex -> adjacent triangles, stored as one array with offsets.
+    vector<int> live_triangles(vertex_count, 0);
+    for (GLuint index : indices) {
+        live_triangles[index]++;
+    }
+    vector<int> offsets(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; v++) {
+        offsets[v + 1] = offsets[v] + live_triangles[v];
+    }
+    vector<int> adjacency(indices.size());
+    vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int t = 0; t < triangle_count; t++) {
+        for (int k = 0; k < 3; k++) {
+            adjacency[fill[indices[t * 3 + k]]++] = t;
+        }
+    }
+
+    vector<int> cache_time(vertex_count, 0);
+    vector<bool> emitted(triangle_count, false);
+    vector<int> dead_end;
+    vector<int> candidates;
+    vector<GLuint> output;
+    output.reserve(indices.size());
+
+    // Start with every vertex out of the cache.
+    int time = cache_size + 1;
+    int cursor = 0;
+    int fan_vertex = 0;
+    while (fan_vertex >= 0) {
+        candidates.clear();
+        for (int i = offsets[fan_vertex]; i < offsets[fan_vertex + 1]; i++) {
+            int t = adjacency[i];
+            if (emitted[t]) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                int v = indices[t * 3 + k];
+                output.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live_triangles[v]--;
+                if (time - cache_time[v] > cache_size) {
+                    cache_time[v] = time;
+                    time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        fan_vertex = nextVertex(candidates, live_triangles, cache_time, time, cache_size);
+        if (fan_vertex < 0) {
+            fan_vertex = skipDeadEnd(dead_end, live_triangles, cursor, vertex_count);
+        }
+    }
+
+    assert(output.size() == indices.size());
+    indices.swap(output);
+}
+
+float averageCacheMissRatio(const vector<GLuint>& indices, size_t vertex_count,
+                            int cache_size)
+{
+    if (indices.empty()) {
+        return 0.0f;
+    }
+
+    // Same timestamp trick as above to simulate a FIFO cache.
+    vector<int> cache_time(vertex_count, 0);
+    int time = cache_size + 1;
+    int misses = 0;
+    for (GLuint v : indices) {
+        if (time - cache_time[v] > cache_size) {
+            cache_time[v] = time;
+            time++;
+            misses++;
+        }
+    }
+    return float(misses) / (indices.size() / 3);
+}
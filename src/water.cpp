@@ -19,7 +19,10 @@ void Water::init(string dir)
     water_shader.attachVertexShader((dir + "ColorShader.vs").c_str());
     water_shader.attachFragmentShader((dir + "ColorShader.fs").c_str());
     water_shader.link();
+}
 
+void Water::finishInit()
+{
     P_uni = water_shader.getUniformLocation("P");
     V_uni = water_shader.getUniformLocation("V");
     M_uni = water_shader.getUniformLocation("M");
@@ -12,6 +12,7 @@ public:
     Water();
 
     void init(std::string dir);
+    void finishInit();
     void draw(glm::mat4 P, glm::mat4 V, glm::mat4 M, glm::vec3 eye_position, float alpha);
     void start();
     void end();